@@ -465,6 +465,53 @@ print_comparison() {
     done
 }
 
+# --------------------------------------------------------------------------
+# Startup: process cold start, as `prism transpile` of an empty file. Too short
+# for the millisecond table, so it is timed over a batch of runs.
+# --------------------------------------------------------------------------
+bench_startup() {
+    local runs=$((ITERATIONS * 10))
+    local label binary start end
+    echo ""
+    echo -e "${BOLD}=== STARTUP: empty.c transpile, ${runs} runs ===${RESET}"
+    : > "$BENCH_DIR/empty.c"
+    for label in "1.0" "Current"; do
+        binary="$BENCH_DIR/prism_v10"
+        [ "$label" = "Current" ] && binary="$BENCH_DIR/prism_current"
+        "$binary" transpile "$BENCH_DIR/empty.c" -o /dev/null > /dev/null 2>&1 || true
+        start=$(date +%s%N)
+        for ((i = 0; i < runs; i++)); do
+            "$binary" transpile "$BENCH_DIR/empty.c" -o /dev/null > /dev/null 2>&1
+        done
+        end=$(date +%s%N)
+        printf "  %-35s  %6d us/run\n" "$label" $(( (end - start) / runs / 1000 ))
+    done
+}
+
+# --------------------------------------------------------------------------
+# Attribute-dense headers: stacked __attribute__, __declspec, [[...]] and
+# __asm__ labels in the style of glibc and MSVC declarations, the input where
+# Pass 1 walks back over the most noise per token.
+# --------------------------------------------------------------------------
+bench_attr_headers() {
+    local label binary i
+    echo ""
+    echo -e "${BOLD}=== ATTRIBUTE-DENSE HEADERS ===${RESET}"
+    for i in $(seq 1 4000); do
+        cat << CEOF
+extern int __g$i (const char *__restrict __s, int __n, ...) __attribute__ ((__nothrow__ , __leaf__)) __attribute__ ((__nonnull__ (1))) __attribute__ ((__format__ (__printf__, 1, 3)));
+extern char *__h$i (char *__restrict __d, const char *__restrict __s) __asm__ ("" "__h${i}_chk") __attribute__ ((__nothrow__ , __leaf__)) __attribute__ ((__access__ (__write_only__, 1)));
+__declspec(dllimport) __declspec(noalias) int __cdecl _m$i(__declspec(guard(ignore)) void *_P, unsigned int _N) __attribute__((__deprecated__("use _m${i}_s")));
+[[__nodiscard__]] [[__gnu__::__always_inline__]] static __inline __attribute__ ((__artificial__)) int __i$i (int __a) { return (__extension__ ({ int __r = __a; __r; })); }
+CEOF
+    done > "$BENCH_DIR/attr_headers.c"
+    for label in "1.0" "Current"; do
+        binary="$BENCH_DIR/prism_v10"
+        [ "$label" = "Current" ] && binary="$BENCH_DIR/prism_current"
+        bench_command "$label attr_headers.c (emit)" "$binary" transpile "$BENCH_DIR/attr_headers.c" -o /dev/null
+    done
+}
+
 # --------------------------------------------------------------------------
 # Profile: measure where time goes in the transpile pipeline
 # --------------------------------------------------------------------------
@@ -536,6 +583,111 @@ measure_memory() {
     fi
 }
 
+# --------------------------------------------------------------------------
+# Cache hash throughput: pp-cache keys and payload checksums
+# --------------------------------------------------------------------------
+bench_cache_hash() {
+    echo ""
+    echo -e "${BOLD}=== CACHE HASH THROUGHPUT ===${RESET}"
+    cat > "$BENCH_DIR/hash_bench.c" << 'CEOF'
+#define PRISM_LIB_MODE
+#include "prism.c"
+
+/* The byte-at-a-time hash the cache used before the four-lane one. */
+static void legacy_feed(PPKey *k, const void *p, size_t n) {
+    const unsigned char *s = (const unsigned char *)p;
+    for (size_t i = 0; i < n; i++) {
+        k->a = (k->a ^ s[i]) * 0x100000001b3ULL;
+        k->b = (k->b + s[i] + 1) * 0x9e3779b97f4a7c15ULL;
+        k->b ^= k->b >> 29;
+    }
+    k->a ^= n * 0xff51afd7ed558ccdULL;
+}
+
+static double bench(void (*feed)(PPKey *, const void *, size_t), const char *buf, size_t len, int reps) {
+    PPKey k = {0};
+    double t0 = prism_now_ms();
+    for (int r = 0; r < reps; r++) feed(&k, buf, len);
+    double ms = prism_now_ms() - t0;
+    if (k.a == 42) puts("");
+    return (double)len * reps / (ms / 1000.0) / 1e9;
+}
+
+int main(void) {
+    size_t len = (size_t)2 << 20; /* a flattened TU */
+    char *buf = malloc(len);
+    if (!buf) return 1;
+    for (size_t i = 0; i < len; i++) buf[i] = (char)(' ' + (i * 7919 % 95));
+    printf("  %-35s  %6.2f GB/s\n", "byte-at-a-time (before)", bench(legacy_feed, buf, len, 20));
+    printf("  %-35s  %6.2f GB/s\n", "four-lane ppk_feed (current)", bench(ppk_feed, buf, len, 200));
+    free(buf);
+    return 0;
+}
+CEOF
+    if cc -O2 -w -I"$PRISM_DIR" -o "$BENCH_DIR/hash_bench" "$BENCH_DIR/hash_bench.c" 2>/dev/null; then
+        "$BENCH_DIR/hash_bench"
+    else
+        echo "  could not build the hash benchmark — skipping"
+    fi
+}
+
+# --------------------------------------------------------------------------
+# Cache compression: codec throughput, then warm-hit latency and the pp-cache
+# footprint for prism.c with and without compressed payloads
+# --------------------------------------------------------------------------
+bench_cache_lz() {
+    local binary="$1"
+    local input="$2"
+    echo ""
+    echo -e "${BOLD}=== CACHE COMPRESSION: $input ===${RESET}"
+    cat > "$BENCH_DIR/lz_bench.c" << 'CEOF'
+#define PRISM_LIB_MODE
+#include "prism.c"
+
+int main(int argc, char **argv) {
+    FileBytes in = read_file_bytes(argc > 1 ? argv[1] : "");
+    if (!in.data) return 1;
+    char *z = malloc(pp_lz_bound(in.size) + PP_LZ_SLACK), *out = malloc(in.size + PP_LZ_SLACK);
+    if (!z || !out) return 1;
+    size_t packed = 0;
+    double t0 = prism_now_ms();
+    for (int r = 0; r < 10; r++) packed = pp_lz_pack(in.data, in.size, z);
+    double t1 = prism_now_ms();
+    bool ok = true;
+    for (int r = 0; r < 100; r++) ok &= pp_lz_unpack(z, packed, out, in.size);
+    double t2 = prism_now_ms();
+    if (!ok || memcmp(out, in.data, in.size) != 0) return 1;
+    printf("  %-35s  %6.2fx  (%zu -> %zu bytes)\n", "ratio", (double)in.size / packed, in.size, packed);
+    printf("  %-35s  %6.2f GB/s\n", "compress", in.size * 10.0 / ((t1 - t0) / 1000.0) / 1e9);
+    printf("  %-35s  %6.2f GB/s\n", "decompress", in.size * 100.0 / ((t2 - t1) / 1000.0) / 1e9);
+    return 0;
+}
+CEOF
+    if cc -E "$input" -o "$BENCH_DIR/lz_input.i" 2>/dev/null &&
+       cc -O2 -w -I"$PRISM_DIR" -o "$BENCH_DIR/lz_bench" "$BENCH_DIR/lz_bench.c" 2>/dev/null; then
+        "$BENCH_DIR/lz_bench" "$BENCH_DIR/lz_input.i"
+    else
+        echo "  could not build the codec benchmark — skipping"
+    fi
+
+    local mode dir best ms bytes
+    for mode in 0 1; do
+        dir="$BENCH_DIR/lz_cache_$mode"
+        rm -rf "$dir"
+        PRISM_PP_CACHE_DIR="$dir" PRISM_PP_CACHE_COMPRESS=$mode "$binary" transpile "$input" -o /dev/null 2>/dev/null
+        best=""
+        for _ in $(seq 1 "$ITERATIONS"); do
+            ms=$(PRISM_PP_CACHE_DIR="$dir" PRISM_PP_CACHE_COMPRESS=$mode "$binary" --prism-prof transpile "$input" \
+                 -o /dev/null 2>&1 | sed -n 's/.*preprocess=\([0-9.]*\)ms.*/\1/p')
+            if [ -n "$ms" ] && { [ -z "$best" ] || awk "BEGIN{exit !($ms < $best)}"; }; then best=$ms; fi
+        done
+        bytes=$(cat "$dir"/??/*.pp "$dir"/??/*.ppk 2>/dev/null | wc -c)
+        printf "  %-35s  warm hit %8s ms   pp entries %6d KB\n" \
+            "PRISM_PP_CACHE_COMPRESS=$mode" "${best:-n/a}" $((bytes / 1024))
+        rm -rf "$dir"
+    done
+}
+
 # ============================================================================
 # MAIN
 # ============================================================================
@@ -557,6 +709,12 @@ run_suite "Current" "$BENCH_DIR/prism_current"
 
 print_comparison
 
+# Process cold start
+bench_startup
+
+# Pass 1 on attribute-dense declarations
+bench_attr_headers
+
 # Additional profiling for current version
 profile_transpile "$BENCH_DIR/prism_current" "$BENCH_DIR/stress_mixed.c"
 
@@ -564,6 +722,12 @@ profile_transpile "$BENCH_DIR/prism_current" "$BENCH_DIR/stress_mixed.c"
 measure_memory "1.0 stress_mixed.c"     "$BENCH_DIR/prism_v10"     transpile "$BENCH_DIR/stress_mixed.c"
 measure_memory "Current stress_mixed.c" "$BENCH_DIR/prism_current" transpile "$BENCH_DIR/stress_mixed.c"
 
+# pp-cache hashing on a warm build
+bench_cache_hash
+
+# pp-cache payload compression
+bench_cache_lz "$BENCH_DIR/prism_current" "$PRISM_DIR/prism.c"
+
 # Perf stat if available
 perf_stat_run "Current transpile test.c" "$BENCH_DIR/prism_current" transpile .github/test.c
 
@@ -0,0 +1,307 @@
+/* keywords.c — generates the lexer's keyword table in parse.c.
+ *
+ * Every identifier the lexer reads is classified by one probe into a static
+ * table: a keyword owns its slot, so a spelling is a keyword exactly when the
+ * slot it hashes to holds that spelling. This file is the keyword list. It
+ * finds a hash seed and per-bucket displacements that give each keyword a slot
+ * of its own, and rewrites the block between the "keyword table" markers:
+ *
+ *   cc -O2 -o /tmp/kw .github/keywords.c && /tmp/kw parse.c
+ *
+ * `--check parse.c` exits nonzero instead of writing when the block is not
+ * what this list generates; the suite runs it. keyword_hash() must match
+ * pparse_keyword_slot() in parse.c, which the suite also checks.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOTS 256
+#define BUCKETS 64
+
+typedef struct {
+	const char *name, *tag, *flags;
+	int is_kw;
+} Keyword;
+
+/* K: a keyword, with its token tag and extra token flags. F: a function name
+ * the analysis treats specially; it stays an identifier. */
+#define K(name, tag, flags) {name, #tag, #flags, 1}
+#define F(name, tag) {name, #tag, "0", 0}
+
+static const Keyword keywords[] = {
+    K("return", PPARSE_TT_SKIP_DECL | PPARSE_TT_RETURN, 0),
+    K("if", PPARSE_TT_SKIP_DECL | PPARSE_TT_IF, 0),
+    K("else", PPARSE_TT_SKIP_DECL | PPARSE_TT_IF, 0),
+    K("for", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, 0),
+    K("while", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, 0),
+    K("do", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, 0),
+    K("switch", PPARSE_TT_SKIP_DECL | PPARSE_TT_SWITCH, 0),
+    K("case", PPARSE_TT_SKIP_DECL | PPARSE_TT_CASE, 0),
+    K("default", PPARSE_TT_SKIP_DECL | PPARSE_TT_DEFAULT, 0),
+    K("break", PPARSE_TT_SKIP_DECL | PPARSE_TT_BREAK, 0),
+    K("continue", PPARSE_TT_SKIP_DECL | PPARSE_TT_CONTINUE, 0),
+    K("goto", PPARSE_TT_SKIP_DECL | PPARSE_TT_GOTO, 0),
+    K("sizeof", PPARSE_TT_SKIP_DECL, PPARSE_TF_SIZEOF),
+    K("alignof", PPARSE_TT_SKIP_DECL, PPARSE_TF_SIZEOF | PPARSE_TF_ALIGNOF | PPARSE_TF_SOFT_KW),
+    K("_Alignof", PPARSE_TT_SKIP_DECL, PPARSE_TF_SIZEOF | PPARSE_TF_ALIGNOF),
+    K("_Generic", PPARSE_TT_SKIP_DECL | PPARSE_TT_GENERIC, 0),
+    K("_Static_assert", PPARSE_TT_SKIP_DECL, PPARSE_TF_STATIC_ASSERT),
+    K("static_assert", PPARSE_TT_SKIP_DECL, PPARSE_TF_SOFT_KW | PPARSE_TF_STATIC_ASSERT),
+    K("struct", PPARSE_TT_TYPE | PPARSE_TT_SUE, 0),
+    K("union", PPARSE_TT_TYPE | PPARSE_TT_SUE, 0),
+    K("enum", PPARSE_TT_TYPE | PPARSE_TT_SUE, 0),
+    K("typedef", PPARSE_TT_SKIP_DECL | PPARSE_TT_TYPEDEF, 0),
+    K("static", PPARSE_TT_QUALIFIER | PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, 0),
+    K("extern", PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, 0),
+    K("inline", PPARSE_TT_INLINE, 0),
+    K("const", PPARSE_TT_QUALIFIER | PPARSE_TT_CONST, 0),
+    K("volatile", PPARSE_TT_QUALIFIER | PPARSE_TT_VOLATILE, 0),
+    K("restrict", PPARSE_TT_QUALIFIER, 0),
+    K("_Atomic", PPARSE_TT_QUALIFIER | PPARSE_TT_TYPE, 0),
+    K("_Nonnull", PPARSE_TT_QUALIFIER, 0),
+    K("_Nullable", PPARSE_TT_QUALIFIER, 0),
+    K("_Null_unspecified", PPARSE_TT_QUALIFIER, 0),
+    K("_Noreturn", PPARSE_TT_SKIP_DECL | PPARSE_TT_INLINE, 0),
+    K("noreturn", PPARSE_TT_SKIP_DECL | PPARSE_TT_INLINE, PPARSE_TF_SOFT_KW),
+    K("__inline", PPARSE_TT_INLINE, 0),
+    K("__inline__", PPARSE_TT_INLINE, 0),
+    K("_Thread_local", PPARSE_TT_STORAGE, 0),
+    K("__thread", PPARSE_TT_STORAGE, 0),
+    K("constexpr", PPARSE_TT_QUALIFIER, PPARSE_TF_SOFT_KW),
+    K("thread_local", PPARSE_TT_QUALIFIER | PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, PPARSE_TF_SOFT_KW),
+    K("void", PPARSE_TT_TYPE, 0),
+    K("char", PPARSE_TT_TYPE, 0),
+    K("short", PPARSE_TT_TYPE, 0),
+    K("int", PPARSE_TT_TYPE, 0),
+    K("long", PPARSE_TT_TYPE, 0),
+    K("float", PPARSE_TT_TYPE, 0),
+    K("double", PPARSE_TT_TYPE, 0),
+    K("signed", PPARSE_TT_TYPE, 0),
+    K("unsigned", PPARSE_TT_TYPE, 0),
+    K("_Bool", PPARSE_TT_TYPE, 0),
+    K("bool", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Complex", PPARSE_TT_TYPE, 0),
+    K("_Imaginary", PPARSE_TT_TYPE, 0),
+    /* Extension type spellings are soft: after an established type they
+     * are ordinary declarator names (`int _Float32;`, `int __int64;`) on
+     * clang/gcc, matching `bool`. As a lone type specifier they keep
+     * PPARSE_TT_TYPE so `_Float32 x;` / `__int64 y;` still zero-init. */
+    K("__int128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__int128_t", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__uint128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__uint128_t", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__int8", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__int16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__int32", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__int64", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__float128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__float80", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__fp16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("__bf16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float32", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float64", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float32x", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float64x", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Float128x", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Decimal32", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Decimal64", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("_Decimal128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    K("typeof_unqual", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, PPARSE_TF_SOFT_KW),
+    K("__typeof_unqual__", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    K("__typeof_unqual", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    K("auto", PPARSE_TT_QUALIFIER | PPARSE_TT_TYPE, 0),
+    K("register", PPARSE_TT_QUALIFIER | PPARSE_TT_REGISTER, 0),
+    K("_Alignas", PPARSE_TT_QUALIFIER | PPARSE_TT_ALIGNAS, 0),
+    K("alignas", PPARSE_TT_QUALIFIER | PPARSE_TT_ALIGNAS, PPARSE_TF_SOFT_KW),
+    K("typeof", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, PPARSE_TF_SOFT_KW),
+    K("__typeof__", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    K("__typeof", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    K("__auto_type", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    K("_BitInt", PPARSE_TT_TYPE | PPARSE_TT_BITINT, 0),
+    K("asm", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, PPARSE_TF_SOFT_KW),
+    K("__asm__", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, 0),
+    K("__asm", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, 0),
+    K("__attribute__", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, 0),
+    K("__attribute", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, 0),
+    K("__declspec", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, 0),
+    K("__cdecl", 0, PPARSE_TF_MS_CC),
+    K("__stdcall", 0, PPARSE_TF_MS_CC),
+    K("__fastcall", 0, PPARSE_TF_MS_CC),
+    K("__thiscall", 0, PPARSE_TF_MS_CC),
+    K("__vectorcall", 0, PPARSE_TF_MS_CC),
+    K("_cdecl", 0, PPARSE_TF_MS_CC),
+    K("_stdcall", 0, PPARSE_TF_MS_CC),
+    K("_fastcall", 0, PPARSE_TF_MS_CC),
+    K("cdecl", 0, PPARSE_TF_MS_CC | PPARSE_TF_SOFT_KW),
+    K("stdcall", 0, PPARSE_TF_MS_CC | PPARSE_TF_SOFT_KW),
+    K("_Pragma", PPARSE_TT_ATTR, 0),
+    K("__pragma", PPARSE_TT_ATTR, 0),
+    K("__extension__", PPARSE_TT_INLINE, 0),
+    K("__builtin_va_list", 0, 0),
+    K("__builtin_va_arg", 0, 0),
+    K("__builtin_offsetof", 0, PPARSE_TF_SIZEOF | PPARSE_TF_OFFSETOF),
+    K("offsetof", 0, PPARSE_TF_SIZEOF | PPARSE_TF_OFFSETOF | PPARSE_TF_SOFT_KW),
+    K("__restrict", PPARSE_TT_QUALIFIER, 0),
+    K("__restrict__", PPARSE_TT_QUALIFIER, 0),
+    K("__builtin_types_compatible_p", 0, 0),
+    K("defer", PPARSE_TT_DEFER, 0),
+    K("orelse", PPARSE_TT_ORELSE, 0),
+    K("raw", 0, PPARSE_TF_RAW),
+    F("exit", PPARSE_TT_NORETURN_FN),
+    F("_Exit", PPARSE_TT_NORETURN_FN),
+    F("_exit", PPARSE_TT_NORETURN_FN),
+    F("abort", PPARSE_TT_NORETURN_FN),
+    F("quick_exit", PPARSE_TT_NORETURN_FN),
+    F("__builtin_trap", PPARSE_TT_NORETURN_FN),
+    F("__builtin_unreachable", PPARSE_TT_NORETURN_FN),
+    F("thrd_exit", PPARSE_TT_NORETURN_FN),
+    F("setjmp", PPARSE_TT_SPECIAL_FN),
+    F("longjmp", PPARSE_TT_SPECIAL_FN),
+    F("_setjmp", PPARSE_TT_SPECIAL_FN),
+    F("_longjmp", PPARSE_TT_SPECIAL_FN),
+    F("sigsetjmp", PPARSE_TT_SPECIAL_FN),
+    F("siglongjmp", PPARSE_TT_SPECIAL_FN),
+    F("__sigsetjmp", PPARSE_TT_SPECIAL_FN),
+    F("__siglongjmp", PPARSE_TT_SPECIAL_FN),
+    F("__setjmp", PPARSE_TT_SPECIAL_FN),
+    F("__longjmp", PPARSE_TT_SPECIAL_FN),
+    F("__longjmp_chk", PPARSE_TT_SPECIAL_FN),
+    F("pthread_exit", PPARSE_TT_SPECIAL_FN),
+    F("__builtin_setjmp", PPARSE_TT_SPECIAL_FN),
+    F("__builtin_longjmp", PPARSE_TT_SPECIAL_FN),
+    F("__builtin_setjmp_receive", PPARSE_TT_SPECIAL_FN),
+    F("savectx", PPARSE_TT_SPECIAL_FN),
+    F("vfork", PPARSE_TT_SPECIAL_FN),
+};
+
+#define N (sizeof keywords / sizeof *keywords)
+#define BEGIN_MARK "/* BEGIN keyword table"
+#define END_MARK "/* END keyword table */"
+
+/* Lengths of two or more only: the lexer does not look shorter ones up. */
+static uint32_t keyword_hash(const char *key, uint32_t len, uint32_t seed) {
+	const unsigned char *k = (const unsigned char *)key;
+	uint32_t h = (len | (uint32_t)k[0] << 8 | (uint32_t)k[1] << 16 | (uint32_t)k[len - 1] << 24) ^
+		     k[len - 2] * 0x9e3779b9u ^ k[len / 2] * 0x85ebca6bu;
+	return h * seed;
+}
+
+/* Slot i of the table, or -1; displacement d of bucket b. */
+static int slot_of[SLOTS];
+static uint8_t disp[BUCKETS];
+
+/* Buckets take a displacement largest first; a seed fails when two keywords
+ * of one bucket share a base, or a bucket finds no displacement. */
+static int try_seed(uint32_t seed) {
+	int order[BUCKETS], size[BUCKETS] = {0};
+	uint32_t base[N];
+	for (size_t i = 0; i < N; i++) {
+		uint32_t h = keyword_hash(keywords[i].name, (uint32_t)strlen(keywords[i].name), seed);
+		base[i] = (h >> 8) & (SLOTS - 1);
+		size[h >> 26]++;
+		for (size_t j = 0; j < i; j++)
+			if (base[j] == base[i] &&
+			    keyword_hash(keywords[j].name, (uint32_t)strlen(keywords[j].name), seed) >> 26 == h >> 26)
+				return 0;
+	}
+	for (int b = 0; b < BUCKETS; b++) order[b] = b;
+	for (int a = 1; a < BUCKETS; a++)
+		for (int b = a; b > 0 && size[order[b]] > size[order[b - 1]]; b--) {
+			int t = order[b];
+			order[b] = order[b - 1];
+			order[b - 1] = t;
+		}
+	memset(slot_of, -1, sizeof slot_of);
+	memset(disp, 0, sizeof disp);
+	for (int o = 0; o < BUCKETS && size[order[o]]; o++) {
+		int b = order[o], d;
+		for (d = 0; d < SLOTS; d++) {
+			int fits = 1;
+			for (size_t i = 0; fits && i < N; i++)
+				if (keyword_hash(keywords[i].name, (uint32_t)strlen(keywords[i].name), seed) >> 26 ==
+				    (uint32_t)b)
+					fits = slot_of[base[i] ^ d] < 0;
+			if (fits) break;
+		}
+		if (d == SLOTS) return 0;
+		disp[b] = (uint8_t)d;
+		for (size_t i = 0; i < N; i++)
+			if (keyword_hash(keywords[i].name, (uint32_t)strlen(keywords[i].name), seed) >> 26 == (uint32_t)b)
+				slot_of[base[i] ^ d] = (int)i;
+	}
+	return 1;
+}
+
+static size_t emit(char *out, uint32_t seed) {
+	size_t n = 0;
+	n += sprintf(out + n, "%s: generated by .github/keywords.c, edit the list there. */\n", BEGIN_MARK);
+	n += sprintf(out + n, "#define PPARSE_KW_SEED 0x%08xu\n", seed);
+	n += sprintf(out + n, "static const uint8_t pparse_keyword_disp[PPARSE_KW_BUCKETS] = {");
+	for (int b = 0; b < BUCKETS; b++)
+		n += sprintf(out + n, "%s%u,", b % 16 ? " " : "\n    ", disp[b]);
+	n += sprintf(out + n, "\n};\nstatic const PParseKeywordEntry pparse_keyword_table[PPARSE_KW_SLOTS] = {\n");
+	for (int s = 0; s < SLOTS; s++) {
+		if (slot_of[s] < 0) continue;
+		const Keyword *k = &keywords[slot_of[s]];
+		if (k->is_kw)
+			n += sprintf(out + n, "    [%d] = PPARSE_KW(\"%s\", %s, %s),\n", s, k->name, k->tag, k->flags);
+		else
+			n += sprintf(out + n, "    [%d] = PPARSE_KW_FN(\"%s\", %s),\n", s, k->name, k->tag);
+	}
+	n += sprintf(out + n, "};\n");
+	return n;
+}
+
+int main(int argc, char **argv) {
+	int check = argc == 3 && !strcmp(argv[1], "--check");
+	if (argc != 2 && !check) {
+		fprintf(stderr, "usage: %s [--check] parse.c\n", argv[0]);
+		return 2;
+	}
+	const char *path = argv[argc - 1];
+	uint32_t seed = 0x9e3779b1u;
+	while (!try_seed(seed))
+		if ((seed += 2) == 0x9e3779b1u + (2u << 20)) {
+			fprintf(stderr, "no seed separates the keywords; hash more of each spelling\n");
+			return 1;
+		}
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return 2;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *src = malloc((size_t)size + 1), *block = malloc(64 * 1024);
+	if (!src || !block || fread(src, 1, (size_t)size, f) != (size_t)size) {
+		fprintf(stderr, "%s: read failed\n", path);
+		return 2;
+	}
+	fclose(f);
+	src[size] = '\0';
+	char *begin = strstr(src, BEGIN_MARK), *end = begin ? strstr(begin, END_MARK) : NULL;
+	if (!end) {
+		fprintf(stderr, "%s: no keyword table markers\n", path);
+		return 2;
+	}
+	size_t len = emit(block, seed);
+	if (check) {
+		if ((size_t)(end - begin) == len && !memcmp(begin, block, len)) return 0;
+		fprintf(stderr, "%s: keyword table is stale; run .github/keywords.c on it\n", path);
+		return 1;
+	}
+	f = fopen(path, "wb");
+	if (!f || fwrite(src, 1, (size_t)(begin - src), f) != (size_t)(begin - src) ||
+	    fwrite(block, 1, len, f) != len || fputs(end, f) == EOF || fclose(f) != 0) {
+		perror(path);
+		return 2;
+	}
+	printf("%zu keywords in %d slots, seed 0x%08x\n", N, SLOTS, seed);
+	return 0;
+}
@@ -894,6 +894,286 @@ static int write_text_file(const char *path, const char *text) {
 	return ok;
 }
 
+#ifndef _WIN32
+static char recipe_cli_path[64];
+
+static void recipe_cli_remove(void) { unlink(recipe_cli_path); }
+
+/* The prism CLI, built once per run from the prism.c beside this suite, for
+ * what only the CLI does: its worker pool, its -c units, its signal handling.
+ * NULL when it cannot be built here. */
+static const char *recipe_cli_binary(void) {
+	static int state; // 0 untried, 1 built, -1 failed
+	if (!state) {
+		const char *src = access("prism.c", R_OK) == 0 ? "prism.c" : "../prism.c";
+		char cmd[PATH_MAX];
+		snprintf(recipe_cli_path, sizeof recipe_cli_path, "/tmp/prism_recipe_cli_%ld", (long)getpid());
+		snprintf(cmd, sizeof cmd, "%s -O0 -w -o %s %s", backend_cc(), recipe_cli_path, src);
+		state = run_shell_command(cmd) == 0 ? 1 : -1;
+		if (state > 0) atexit(recipe_cli_remove);
+	}
+	return state > 0 ? recipe_cli_path : NULL;
+}
+
+/* Names in `dir` that start with a dot: the CLI's source-adjacent temps. */
+static int recipe_dot_files(const char *dir) {
+	DIR *d = opendir(dir);
+	int n = 0;
+	if (!d) return -1;
+	for (struct dirent *e; (e = readdir(d));)
+		n += e->d_name[0] == '.' && strcmp(e->d_name, ".") && strcmp(e->d_name, "..");
+	closedir(d);
+	return n;
+}
+
+/* Polls for `path` to exist and be non-empty, for up to `ms` milliseconds. */
+static int recipe_wait_file(const char *path, int ms) {
+	struct stat sb;
+	for (; ms > 0; ms -= 10) {
+		if (stat(path, &sb) == 0 && sb.st_size > 0) return 1;
+		usleep(10000);
+	}
+	return 0;
+}
+#endif
+
+/* Preprocessed text with spaces and tabs removed: GCC's indentation and
+ * spacing between tokens are cosmetic. Line breaks and linemarkers stay, so
+ * the line each token lands on and the system flags over it are compared. */
+static char *squeeze_pp(const char *s) {
+	char *out = malloc(strlen(s) + 1), *w = out;
+	if (!out) return NULL;
+	for (; *s; s++)
+		if (*s != ' ' && *s != '\t' && *s != '\r') *w++ = *s;
+	*w = '\0';
+	return out;
+}
+
+static void count_chunks_cb(const char *dir, const char *name, void *ud) {
+	(void)dir;
+	if (strstr(name, ".ppk")) ++*(int *)ud;
+}
+
+/* What tokenizing `text` with scan kernel set `kernel` produced: the tokens,
+ * the text as the tokenizer rewrote it, or the diagnostic that stopped it. */
+typedef struct {
+	PParseToken *tokens;
+	uint32_t count;
+	char *text, *views;
+	char diag[300];
+} ScanRun;
+
+/* The file views and tag summary a tokenizer run left, as text. */
+static char *scan_views(void) {
+	PPARSE_CTX();
+	size_t cap = 32, n = 0;
+	for (int i = 0; i < _pc->input_file_count; i++) cap += strlen(_pc->input_files[i]->name) + 40;
+	char *out = malloc(cap);
+	if (!out) return NULL;
+	n += (size_t)snprintf(out + n, cap - n, "tags %x\n", (unsigned)pparse_token_tag_summary);
+	for (int i = 0; i < _pc->input_file_count; i++) {
+		const PParseFile *f = _pc->input_files[i];
+		n += (size_t)snprintf(out + n, cap - n, "%s %d %u%u%u%u\n", f->name, f->line_delta, (unsigned)f->file_no,
+				      (unsigned)f->is_system, (unsigned)f->is_direct_system_include,
+				      (unsigned)f->skip_emit);
+	}
+	return out;
+}
+
+static void scan_run(ScanRun *run, const char *kernel, const char *text, size_t len) {
+	*run = (ScanRun){0};
+	pparse_ctx_init();
+	PPARSE_CTX();
+	pparse_scan_select(kernel);
+	char *buf = calloc(1, len + 64);
+	if (!buf) return;
+	memcpy(buf, text, len);
+	uint32_t first = pparse_token_count;
+	_pc->token_source = buf;
+	error_recovery_init();
+	if (setjmp(_pc->error_jmp) == 0) {
+		PParseToken *tok = pparse_tokenize_buffer("scan.c", buf);
+		run->count = pparse_token_count - first;
+		run->tokens = malloc(run->count * sizeof *run->tokens);
+		if (run->tokens) memcpy(run->tokens, tok, run->count * sizeof *run->tokens);
+		run->text = strdup(_pc->token_source);
+		run->views = scan_views();
+	} else
+		snprintf(run->diag, sizeof run->diag, "%d:%s", _pc->error_line, _pc->error_msg);
+	_pc->error_jmp_set = false;
+	prism_reset();
+}
+
+static bool scan_runs_equal(const ScanRun *a, const ScanRun *b) {
+	return a->count == b->count && !strcmp(a->diag, b->diag) && (!a->count || (a->tokens && b->tokens)) &&
+	       (!a->count || !memcmp(a->tokens, b->tokens, a->count * sizeof *a->tokens)) &&
+	       !a->text == !b->text && (!a->text || !strcmp(a->text, b->text)) && !a->views == !b->views &&
+	       (!a->views || !strcmp(a->views, b->views));
+}
+
+static void scan_run_free(ScanRun *run) {
+	free(run->tokens);
+	free(run->text);
+	free(run->views);
+}
+
+/* Generated text for the scan kernels: every kind of run they stop, long and
+ * short, starting and ending at every alignment, and sometimes left
+ * unterminated at the end of the buffer. */
+static size_t scan_corpus_text(char *out, size_t cap, uint32_t seed) {
+	static const char ident[] = "abcxyzABCXYZ_$0189\xc3\xa9";
+	static const char space[] = " \t\n\v\f\r";
+	static const char body[] = "ab */*\n\\\"'$\t\xc3\xa9 ;{}";
+	size_t n = 0;
+	uint32_t x = seed * 2654435761u + 1;
+#define SCAN_RAND(m) ((x = x * 1103515245u + 12345u), (x >> 8) % (m))
+#define SCAN_PUT(c) (n + 1 < cap ? (void)(out[n++] = (char)(c)) : (void)0)
+	for (uint32_t pad = SCAN_RAND(64); pad--;) SCAN_PUT(' ');
+	for (int frag = 0; frag < 200 && n + 200 < cap; frag++) {
+		uint32_t len = SCAN_RAND(4) ? SCAN_RAND(12) : SCAN_RAND(90);
+		switch (SCAN_RAND(8)) {
+		case 0:
+			SCAN_PUT('v');
+			while (len--) SCAN_PUT(ident[SCAN_RAND(sizeof ident - 1)]);
+			break;
+		case 1:
+			SCAN_PUT(' ');
+			while (len--) SCAN_PUT(space[SCAN_RAND(sizeof space - 1)]);
+			break;
+		case 2:
+			SCAN_PUT('"');
+			while (len--) {
+				char c = body[SCAN_RAND(sizeof body - 1)];
+				if (c == '\n' || c == '"') c = '\\';
+				if (c == '\\') SCAN_PUT(c);
+				SCAN_PUT(c);
+			}
+			SCAN_PUT('"');
+			break;
+		case 3:
+			SCAN_PUT('/');
+			SCAN_PUT('/');
+			while (len--) {
+				char c = body[SCAN_RAND(sizeof body - 1)];
+				SCAN_PUT(c == '\n' ? ' ' : c);
+				if (c == '\\' && SCAN_RAND(3) == 0) SCAN_PUT('\n');
+			}
+			SCAN_PUT('\n');
+			break;
+		case 4:
+			SCAN_PUT('/');
+			SCAN_PUT('*');
+			while (len--) {
+				char c = body[SCAN_RAND(sizeof body - 1)];
+				if (c == '/' && n && out[n - 1] == '*') c = '-';
+				SCAN_PUT(c);
+			}
+			SCAN_PUT('*');
+			SCAN_PUT('/');
+			break;
+		case 5:
+			n += (size_t)snprintf(out + n, cap - n, "\n# %u \"f%u.h\"%s\n", SCAN_RAND(900) + 1, SCAN_RAND(3),
+					      SCAN_RAND(2) ? " 1 3 4" : "");
+			break;
+		case 6:
+			n += (size_t)snprintf(out + n, cap - n, "\n#pragma scan");
+			while (len--) SCAN_PUT(body[SCAN_RAND(sizeof body - 1)] == '\n' ? ' ' : 'p');
+			SCAN_PUT('\n');
+			break;
+		default:
+			n += (size_t)snprintf(out + n, cap - n, " %u.5e+1 <%%: %%> ; ", SCAN_RAND(100000));
+			break;
+		}
+	}
+	switch (SCAN_RAND(6)) {
+	case 0: SCAN_PUT('"'); break;
+	case 1: SCAN_PUT('/'); SCAN_PUT('*'); break;
+	case 2: SCAN_PUT('"'); SCAN_PUT('\\'); break;
+	}
+#undef SCAN_RAND
+#undef SCAN_PUT
+	out[n] = '\0';
+	return n;
+}
+
+/* Generated preprocessed text for the split tokenizer: user code and system
+ * headers between linemarkers, with delimiters, `[[`, attribute arguments,
+ * statement expressions and comments open across the markers a part may
+ * start at. */
+static size_t split_corpus_text(char *out, size_t cap, uint32_t seed) {
+	static const char *const code[] = {
+	    "int f(int a) { return ({ int b = a; b; }); }\n",
+	    "[[noreturn]] void g(void);\n",
+	    "__attribute__((noreturn)) void h(void);\n",
+	    "int d<:4:> = <% 1, 2 %>;\n",
+	    "void exit(int c) { }\n",
+	    "void k(void) { defer exit(1); if (setjmp(b)) abort(); }\n",
+	    "char *s = \"}{)(\", c = '}';\n",
+	    "typedef struct { int x; } T; T t = { .x = 1 };\n",
+	    "void w(void) { vfork(); asm(\"nop\"); }\n",
+	    "void m(void) { e(); g(); h(); }\n",
+	};
+	static const char *const open[] = {"void o(void) {\n", "int p = (\n", "int q[] = {\n", "int r = ({\n"};
+	static const char *const close[] = {"}\n", "1);\n", "1 };\n", "1; });\n"};
+	/* Text before and after a marker, and the name of a function the text
+	 * declares noreturn, which a call after it should see. */
+	static const char *const across[][3] = {
+	    {"[", "[noreturn]] void", "q"}, {"__attribute__", "((noreturn)) void", "u"},
+	    {"__attribute__((", "noreturn)) void", "v"}, {"int y = (", "{ 1; });\n", ""},
+	    {"/* c", " */ int n;\n", ""}, {"int z = ({ 1; }", ");\n", ""}, {"_Noreturn void e(void) [[", "]];\n", ""},
+	    {"char *t = \"", "\";\n", ""}, {"%:", "pragma x\n", ""},
+	};
+	size_t n = 0;
+	int depth = 0, stack[16];
+	uint32_t x = seed * 2654435761u + 1, line = 1;
+#define SPLIT_RAND(m) ((x = x * 1103515245u + 12345u), (x >> 8) % (m))
+#define SPLIT_PUT(...) (n += (size_t)snprintf(out + n, cap - n, __VA_ARGS__))
+	SPLIT_PUT("# 0 \"scan.c\"\n# 0 \"<built-in>\"\n# 1 \"scan.c\"\n");
+	while (n + 512 < cap) {
+		uint32_t k = SPLIT_RAND(4);
+		line += SPLIT_RAND(40);
+		switch (SPLIT_RAND(10)) {
+		case 4:
+			if (depth < 16) SPLIT_PUT("%s", open[stack[depth++] = (int)k]);
+			break;
+		case 5:
+			if (depth) SPLIT_PUT("%s", close[stack[--depth]]);
+			break;
+		case 6:
+			k = SPLIT_RAND(N(across));
+			SPLIT_PUT("%s\n# %u \"scan.c\"\n%s", across[k][0], line, across[k][1]);
+			if (*across[k][2])
+				SPLIT_PUT(" %s%zu(void);\nvoid m(void) { %s%zu(); }\n", across[k][2], n, across[k][2], n);
+			break;
+		case 7:
+			SPLIT_PUT("# 1 \"f%u.h\" 1\n%s# %u \"scan.c\" 2\n", k, code[SPLIT_RAND(N(code))], line);
+			break;
+		case 8:
+			SPLIT_PUT("# 1 \"/usr/include/f%u.h\" 1 3 4\n%s", k, code[SPLIT_RAND(N(code))]);
+			if (k & 1)
+				SPLIT_PUT("# 1 \"/usr/include/bits/f%u.h\" 1 3 4\n%s# 9 \"/usr/include/f%u.h\" 2 3 4\n", k,
+					  code[SPLIT_RAND(N(code))], k);
+			/* A marker without flags while the header is open, which
+			 * sends a part that starts there back to one run. */
+			if (k == 2 && !SPLIT_RAND(8))
+				SPLIT_PUT("# %u \"g%u.h\"\n%s", line, k, code[SPLIT_RAND(N(code))]);
+			SPLIT_PUT("# %u \"/usr/include/f%u.h\" 3 4\n%s# %u \"scan.c\" 2\n", line, k,
+				  code[SPLIT_RAND(N(code))], line);
+			break;
+		case 9:
+			SPLIT_PUT("\n# %u \"scan.c\"\n", line);
+			break;
+		default:
+			SPLIT_PUT("%s", code[SPLIT_RAND(N(code))]);
+			break;
+		}
+	}
+	while (depth) SPLIT_PUT("%s", close[stack[--depth]]);
+#undef SPLIT_RAND
+#undef SPLIT_PUT
+	return n;
+}
+
 /* The internal actions drive prism through environment variables, and several
  * set one without putting it back: a full run leaves PRISM_PP_CACHE_DIR
  * pointing at a directory these actions have already deleted, and
@@ -905,7 +1185,7 @@ static int write_text_file(const char *path, const char *text) {
 static const char *const INTERNAL_ENV_VARS[] = {
 	"PRISM_PP_CACHE_DIR", "PRISM_PP_CACHE_MAX_MB", "PRISM_PP_CACHE_MAX_DAYS",
 	"PRISM_NO_PP_CACHE", "CPATH", "DEPENDENCIES_OUTPUT", "SUNPRO_DEPENDENCIES",
-	"SOURCE_DATE_EPOCH",
+	"SOURCE_DATE_EPOCH", "PRISM_LEX_SPLIT_KB",
 };
 
 static int run_internal(const Recipe *r, char *failed_action) {
@@ -925,16 +1205,27 @@ static int run_internal(const Recipe *r, char *failed_action) {
 			     setenv("PRISM_PP_CACHE_MAX_MB", "1", 1) == 0;
 			const char *dir = pp_cache_dir();
 			ok = ok && dir && !strcmp(dir, cache);
+			/* Two 700 KB entries overflow the 1 MB cap. seed1 is stored last but
+			 * seed0 is used after it, so seed1 is the one evicted. */
+			PPKey seed[2] = {{0x5eed000000000000ULL, 0}, {0x5eed000000000000ULL, 1}};
 			for (int i = 0; ok && i < 2; i++) {
-				snprintf(entry, sizeof entry, "%s/seed%d.pp", dir, i);
-				FILE *fp = fopen(entry, "wb");
+				ok = pp_cache_path(&seed[i], entry, sizeof entry);
+				FILE *fp = ok ? fopen(entry, "wb") : NULL;
 				if (!fp) { ok = 0; break; }
 				char block[4096];
 				memset(block, 'A' + i, sizeof block);
 				for (int n = 0; n < 175; n++)
 					if (fwrite(block, 1, sizeof block, fp) != sizeof block) ok = 0;
 				if (fclose(fp) != 0) ok = 0;
+				pp_index_note(&seed[i], ".pp", 175 * 4096);
 			}
+			pp_index_note(&seed[0], ".pp", PP_NOTE_HIT);
+			/* Compiler-profile records share the directory and its maintenance. */
+			PPKey rk = {0x5eed, 0xcc};
+			cc_record_store(&rk, "kind gcc\nversion recipe\n");
+			char *rec = cc_record_load(&rk);
+			ok = ok && rec && !strcmp(rec, "kind gcc\nversion recipe\n");
+			free(rec);
 			/* Exercise the user-facing cache reports without adding noise to the
 			 * recipe protocol's single summary line. */
 			int saved = dup(STDOUT_FILENO);
@@ -944,7 +1235,43 @@ static int run_internal(const Recipe *r, char *failed_action) {
 			else {
 				ok = ok && pp_cache_info() == 0;
 				pp_cache_prune();
+				ok = ok && pp_cache_path(&seed[0], entry, sizeof entry) && access(entry, F_OK) == 0;
+				ok = ok && pp_cache_path(&seed[1], entry, sizeof entry) && access(entry, F_OK) != 0;
+				/* The compacted index still accounts for what survived. */
+				PPIndex x;
+				long consumed = 0;
+				ok = ok && pp_index_load(&x, &consumed) && x.n == 2;
+				if (ok) free(x.v);
+				/* A store made while a compaction holds the log lands in the
+				 * log that replaces it, not in the one being replaced. */
+				char log[PATH_MAX], next[PATH_MAX];
+				FileBytes snap = {0};
+				int held = -1;
+				ok = ok && pp_index_path(log, sizeof log) &&
+				     snprintf(next, sizeof next, "%s.next", log) < (int)sizeof next &&
+				     (held = open(log, O_RDONLY)) >= 0 && flock(held, LOCK_EX) == 0 &&
+				     (snap = read_file_bytes(log)).data;
+				FILE *nf = ok ? fopen(next, "wb") : NULL;
+				ok = ok && nf && fwrite(snap.data, 1, snap.size, nf) == snap.size;
+				if (nf && fclose(nf) != 0) ok = 0;
+				pid_t kid = ok ? fork() : -1;
+				if (kid == 0) {
+					/* flock belongs to the open file, which fork shares. */
+					close(held);
+					PPKey late = {0x5eed000000000000ULL, 2};
+					pp_index_note(&late, ".pp", 4096);
+					_exit(0);
+				}
+				int status = 0;
+				ok = ok && kid > 0 && usleep(100 * 1000) == 0 && rename(next, log) == 0;
+				if (held >= 0) close(held);
+				ok = ok && waitpid(kid, &status, 0) == kid && pp_index_load(&x, &consumed) && x.n == 3;
+				if (ok) free(x.v);
+				free(snap.data);
 				ok = ok && pp_cache_clear() == 0;
+				rec = cc_record_load(&rk);
+				ok = ok && !rec;
+				free(rec);
 				fflush(stdout);
 				if (dup2(saved, STDOUT_FILENO) < 0) ok = 0;
 			}
@@ -975,8 +1302,8 @@ static int run_internal(const Recipe *r, char *failed_action) {
 			char *warm = preprocess_with_cc(src);
 			prism_reset();
 			ok = ok && cold && warm && !strcmp(cold, warm) && strstr(warm, "17");
-			free(cold);
-			free(warm);
+			pp_buf_free(cold);
+			pp_buf_free(warm);
 
 			fp = fopen(hdr, "wb");
 			if (!fp) ok = 0;
@@ -987,11 +1314,102 @@ static int run_internal(const Recipe *r, char *failed_action) {
 				apply_features(prism_defaults());
 				char *changed = preprocess_with_cc(src);
 				ok = ok && changed && strstr(changed, "2301") && !strstr(changed, "=17;");
-				free(changed);
+				pp_buf_free(changed);
 				prism_reset();
 			}
 			unlink(src);
 			unlink(hdr);
+		} else if (*p == 'd') {
+			/* Two units including the same header share its expansion as one
+			 * chunk, reassemble exactly, and a damaged chunk is a miss. */
+			char src[2][256], hdr[256], chunk[PATH_MAX];
+			char *cold[2] = {NULL, NULL};
+			int before = 0, after = 0;
+			snprintf(hdr, sizeof hdr, "/tmp/prism_recipe_dedup_hdr_%ld.h", (long)getpid());
+			FILE *fp = fopen(hdr, "wb");
+			if (!fp) { ok = 0; continue; }
+			/* Large enough to be stored compressed as well. */
+			for (int i = 0; i < 1000; i++) fprintf(fp, "extern int recipe_dedup_%d;\n", i);
+			fclose(fp);
+			pp_each_entry(count_chunks_cb, &before);
+			for (int i = 0; i < 2; i++) {
+				snprintf(src[i], sizeof src[i], "/tmp/prism_recipe_dedup_%d_%ld.c", i, (long)getpid());
+				fp = fopen(src[i], "wb");
+				if (!fp) { ok = 0; continue; }
+				fprintf(fp, "#include \"%s\"\nint recipe_dedup_main_%d;\n", hdr, i);
+				fclose(fp);
+				pparse_ctx_init();
+				apply_features(prism_defaults());
+				cold[i] = preprocess_with_cc(src[i]);
+				prism_reset();
+			}
+			pp_each_entry(count_chunks_cb, &after);
+			ok = ok && cold[0] && cold[1] && after == before + 1;
+			for (int i = 0; ok && i < 2; i++) {
+				pparse_ctx_init();
+				apply_features(prism_defaults());
+				char *warm = preprocess_with_cc(src[i]);
+				prism_reset();
+				ok = ok && warm && !strcmp(warm, cold[i]);
+				pp_buf_free(warm);
+			}
+			/* Damage the header's chunk without changing its size: the next
+			 * run must miss rather than serve it, and store it again intact. */
+			size_t cut[64], off = 0, len = 0;
+			int n = cold[0] ? pp_chunk_split(cold[0], strlen(cold[0]), cut, 64) : 0;
+			chunk[0] = '\0';
+			for (int i = 0; i < n; i++)
+				if (cut[i + 1] - cut[i] >= PP_CHUNK_MIN && pp_marker_flag(cold[0] + cut[i], cold[0] + cut[i + 1]) == 1) {
+					PPKey ck = pp_chunk_key(cold[0] + cut[i], cut[i + 1] - cut[i]);
+					off = cut[i];
+					len = cut[i + 1] - cut[i];
+					if (!pp_entry_path(&ck, ".ppk", chunk, sizeof chunk)) chunk[0] = '\0';
+				}
+			fp = chunk[0] ? fopen(chunk, "r+b") : NULL;
+			ok = ok && fp && fseek(fp, -3, SEEK_END) == 0 && fputc('#', fp) != EOF;
+			if (fp) fclose(fp);
+			if (ok) {
+				pparse_ctx_init();
+				apply_features(prism_defaults());
+				char *warm = preprocess_with_cc(src[0]);
+				prism_reset();
+				ok = warm && !strcmp(warm, cold[0]);
+				pp_buf_free(warm);
+				char *stored = malloc(len + PP_LZ_SLACK);
+				PPKey ck = pp_chunk_key(cold[0] + off, len);
+				ok = ok && stored && pp_chunk_get(&ck, stored, len) && !memcmp(stored, cold[0] + off, len);
+				free(stored);
+			}
+			for (int i = 0; i < 2; i++) {
+				pp_buf_free(cold[i]);
+				unlink(src[i]);
+			}
+			unlink(hdr);
+		} else if (*p == 'l') {
+			/* The payload codec round-trips, and rejects truncated or damaged
+			 * input instead of reading or writing out of bounds. */
+			size_t n = 200000, packed = 0;
+			char *text = malloc(n), *z = NULL, *back = malloc(n + PP_LZ_SLACK);
+			for (size_t i = 0; text && i < n; i++)
+				text[i] = i % 97 < 60 ? "static int recipe_lz(void) { return 0; }\n"[i % 41] : (char)('a' + i * 7919 % 26);
+			z = text ? pp_lz_maybe_pack(text, n, &packed) : NULL;
+			char *slack = z ? realloc(z, packed + PP_LZ_SLACK) : NULL;
+			if (slack) z = slack;
+			ok = ok && back && slack && packed < n / 2 && pp_lz_unpack(z, packed, back, n) && !memcmp(back, text, n);
+			ok = ok && !pp_lz_unpack(z, packed - 1, back, n) && !pp_lz_unpack(z, packed, back, n - 1);
+			/* A flipped literal still decodes (the payload checksum catches
+			 * it); anything else must stay in bounds, which a sanitizer
+			 * build of this suite checks. */
+			for (size_t i = 0; ok && i < packed; i += packed / 64 + 1) {
+				z[i] ^= 0x5a;
+				(void)pp_lz_unpack(z, packed, back, n);
+				z[i] ^= 0x5a;
+			}
+			/* Below the threshold, or when it would not pay, nothing is packed. */
+			ok = ok && !pp_lz_maybe_pack(text, PP_LZ_MIN - 1, &packed);
+			free(text);
+			free(z);
+			free(back);
 		} else if (*p == 'w') {
 			/* Five Phase-1 walks scan for a terminator. Each now stops on a
 			 * stray `}` as well, because without it the walk leaves the block
@@ -1354,6 +1772,628 @@ static int run_internal(const Recipe *r, char *failed_action) {
 			rmdir(inc_a);
 			rmdir(inc_b);
 			rmdir(root);
+		} else if (*p == 'i') {
+			/* -fintegrated-cpp must hand the parser what `cc -E` would, and
+			 * decline rather than guess. Only GCC's behaviour is modelled. */
+			char src[256], hdr[256];
+			snprintf(src, sizeof src, "/tmp/prism_recipe_ipp_src_%ld.c", (long)getpid());
+			snprintf(hdr, sizeof hdr, "/tmp/prism_recipe_ipp_hdr_%ld.h", (long)getpid());
+			char text[1024];
+			snprintf(text, sizeof text,
+				 "#include \"%s\"\n#include \"%s\"\n#include <stddef.h>\n"
+				 "#if defined(SQ) && __has_include(<stdio.h>) && SQ(3) == 9 && !defined X\n"
+				 "int CAT(ok_, __LINE__) = SQ(2 + 1); const char *s = STR(a  +  \"b\\n\");\n"
+				 "#elif 1\n#error unreachable\n#endif\n"
+				 "size_t n = offsetof(struct { int a; }, a); V(g) V(g, 1, 2) __COUNTER__ __COUNTER__\n"
+				 "void *p = NULL, *q = STR(NULL); int l = __LINE__ + SQ(NULL != 0);\n",
+				 hdr, hdr);
+			ok = ok && write_text_file(hdr, "#pragma once\n#define SQ(x) ((x) * (x))\n"
+						    "#define CAT(a, b) a##b\n#define STR(x) #x\n"
+						    "#define V(f, ...) f(0, ##__VA_ARGS__)\n") &&
+			     write_text_file(src, text) && setenv("PRISM_NO_PP_CACHE", "1", 1) == 0;
+			pparse_ctx_init();
+			apply_features(prism_defaults());
+			char *ext = ok ? preprocess_with_cc(src) : NULL;
+			prism_reset();
+			prism_integrated_cpp = true;
+			pparse_ctx_init();
+			apply_features(prism_defaults());
+			char *in = ok ? preprocess_with_cc(src) : NULL;
+			prism_reset();
+			prism_integrated_cpp = false;
+			char *argv[] = {PRISM_DEFAULT_CC, "-E", src, NULL};
+			const char *why = NULL;
+			char *direct = ipp_preprocess(argv, 3, &why);
+			char *a = ext ? squeeze_pp(ext) : NULL, *b = in ? squeeze_pp(in) : NULL;
+			char *c = direct ? squeeze_pp(direct) : NULL;
+			ok = ok && a && b && !strcmp(a, b) && strstr(a, "intok___LINE__=((2+1)*(2+1));");
+			/* Other compilers are declined by name, never half-modelled. GCC
+			 * wraps a system header's macro used here in marker pairs. */
+			if (direct)
+				ok = ok && c && !strcmp(a, c) && strstr(direct, "# 1 \"/tmp/prism_recipe_ipp_hdr_") &&
+				     strstr(c, "\"34\n((void*)0)\n#10\"/tmp/prism_recipe_ipp_src_");
+			else
+				ok = ok && why && !strcmp(why, "not GCC");
+			free(a);
+			free(b);
+			free(c);
+			pp_buf_free(ext);
+			pp_buf_free(in);
+			free(direct);
+			unlink(src);
+			unlink(hdr);
+		} else if (*p == 'o') {
+			/* The output cache replays an emission only for the same
+			 * preprocessed text and settings. Planting a marker under the key
+			 * proves a second run replays instead of re-emitting; a feature
+			 * change must miss it. */
+			char src[256], out[256];
+			PPKey key;
+			snprintf(src, sizeof src, "/tmp/prism_recipe_outc_%ld.c", (long)getpid());
+			snprintf(out, sizeof out, "/tmp/prism_recipe_outc_%ld.out.c", (long)getpid());
+			ok = ok && write_text_file(src, "#define RECIPE_OUTC 3\n"
+							"void f(void){ int *p = 0; defer (void)p; }\n") &&
+			     unsetenv("PRISM_NO_PP_CACHE") == 0;
+			pparse_ctx_init();
+			apply_features(prism_defaults());
+			char *pp = ok ? preprocess_with_cc(src) : NULL;
+			bool keyed = pp && out_cache_key(&key, src, pp, strlen(pp));
+			pp_buf_free(pp);
+			prism_reset();
+			char *first = NULL, *replayed = NULL, *other = NULL;
+			if (keyed) {
+				pparse_ctx_init();
+				apply_features(prism_defaults());
+				ok = ok && transpile(src, out);
+				first = read_file_padded(out);
+				out_cache_store(&key, "int recipe_replayed;\n", 21);
+				pparse_ctx_init();
+				apply_features(prism_defaults());
+				ok = ok && transpile(src, out);
+				replayed = read_file_padded(out);
+				PrismFeatures f = prism_defaults();
+				f.defer = false;
+				pparse_ctx_init();
+				apply_features(f);
+				ok = ok && transpile(src, out);
+				other = read_file_padded(out);
+			}
+			/* Without a resolvable prism binary nothing is recorded; that is
+			 * the designed fallback, not a failure. */
+			ok = ok && (!keyed || (first && replayed && other && strstr(first, "defer") == NULL &&
+						!strcmp(replayed, "int recipe_replayed;\n") &&
+						strstr(other, "defer") && !strstr(other, "recipe_replayed")));
+			free(first);
+			free(replayed);
+			free(other);
+			unlink(src);
+			unlink(out);
+		} else if (*p == 'u') {
+			/* A run that warned is not recorded, so the same input warns
+			 * again rather than replaying silently. The warning here comes
+			 * from Pass 2, not Pass 1. */
+			char src[256], out[256];
+			snprintf(src, sizeof src, "/tmp/prism_recipe_outw_%ld.c", (long)getpid());
+			snprintf(out, sizeof out, "/tmp/prism_recipe_outw_%ld.out.c", (long)getpid());
+			ok = ok && write_text_file(src, "void exit(int);\n"
+							"void f(void){ defer (void)0; exit(1); }\n") &&
+			     unsetenv("PRISM_NO_PP_CACHE") == 0;
+			int saved_err = dup(STDERR_FILENO), warned = 0;
+			FILE *err_sink = tmpfile();
+			if (saved_err < 0 || !err_sink || fflush(stderr) != 0 ||
+			    dup2(fileno(err_sink), STDERR_FILENO) < 0)
+				ok = 0;
+			for (int i = 0; ok && i < 2; i++) {
+				pparse_ctx_init();
+				apply_features(prism_defaults());
+				ok = transpile(src, out);
+				prism_reset();
+			}
+			fflush(stderr);
+			if (saved_err >= 0 && dup2(saved_err, STDERR_FILENO) < 0) ok = 0;
+			if (saved_err >= 0) close(saved_err);
+			if (err_sink) {
+				char line[512];
+				rewind(err_sink);
+				while (fgets(line, sizeof line, err_sink))
+					warned += strstr(line, "'exit' referenced with active defers") != NULL;
+				fclose(err_sink);
+			}
+			ok = ok && warned == 2;
+			if (!ok) fprintf(stderr, "output cache: warned %d times in two runs\n", warned);
+			unlink(src);
+			unlink(out);
+		} else if (*p == 'j') {
+			/* -fobject-cache hands back the object recorded for the same
+			 * emission and backend argv. Any other argv must miss, and a flag
+			 * that writes a side file must not be cached at all. */
+			char obj[256];
+			PPKey key, other;
+			snprintf(obj, sizeof obj, "/tmp/prism_recipe_objc_%ld.o", (long)getpid());
+			char *argv[] = {"cc", "-c", "-x", "c", "-", "-o", obj, NULL};
+			char *argv_o2[] = {"cc", "-O2", "-c", "-x", "c", "-", "-o", obj, NULL};
+			char *argv_split[] = {"cc", "-gsplit-dwarf", "-c", "-x", "c", "-", "-o", obj, NULL};
+			static const char text[] = "int recipe_objc;\n";
+			ok = ok && unsetenv("PRISM_NO_PP_CACHE") == 0 && obj_cache_argv_ok(argv) &&
+			     !obj_cache_argv_ok(argv_split);
+			bool keyed = ok && obj_cache_key(&key, argv, text, sizeof text - 1) &&
+				     obj_cache_key(&other, argv_o2, text, sizeof text - 1);
+			if (keyed) {
+				unlink(obj);
+				out_cache_store_entry(&key, OBJ_CACHE_MAGIC, ".obj", "recipe object", 13);
+				ok = ok && (key.a != other.a || key.b != other.b) && !obj_cache_fetch(&other, obj) &&
+				     access(obj, F_OK) != 0 && obj_cache_fetch(&key, obj);
+				char *got = read_file_padded(obj);
+				ok = ok && got && !strcmp(got, "recipe object");
+				free(got);
+			}
+			unlink(obj);
+		} else if (*p == 't') {
+			/* A token-stream snapshot puts back exactly what tokenizing
+			 * left: the pool slice, the linemarker file views and the text
+			 * the digraphs were rewritten in. It must not restore onto a
+			 * context in another state. */
+			char src[256], hdr[256], text[512], *pp = NULL, *snap = NULL, *source = NULL;
+			PParseToken *tokens = NULL;
+			uint32_t first = 0, count = 0, summary = 0;
+			int nfiles = 0;
+			size_t snap_len = 0, off = 0;
+			PPKey key, sum;
+			snprintf(src, sizeof src, "/tmp/prism_recipe_tokc_%ld.c", (long)getpid());
+			snprintf(hdr, sizeof hdr, "/tmp/prism_recipe_tokc_%ld.h", (long)getpid());
+			snprintf(text, sizeof text, "#include \"%s\"\n"
+						    "int recipe_tokc(void) <%% int a<:2:> = <%%1, 2%%>; return a<:1:>; %%>\n",
+				 hdr);
+			ok = ok && write_text_file(hdr, "static int recipe_tokc_h(int x) { return x * 3; }\n") &&
+			     write_text_file(src, text) && unsetenv("PRISM_NO_PP_CACHE") == 0 &&
+			     setenv("PRISM_PP_CACHE_TOKENS", "1", 1) == 0;
+			pparse_ctx_init();
+			PPARSE_CTX();
+			apply_features(prism_defaults());
+			pp = ok ? preprocess_with_cc(src) : NULL;
+			ok = ok && pp;
+			sum = pp ? pp_payload_checksum(pp, strlen(pp)) : (PPKey){0};
+			bool keyed = pp && tok_cache_key(&key, src, &sum);
+			if (pp) {
+				_pc->token_source = pp;
+				_pc->input_preprocessed = true;
+				first = pparse_token_count;
+				PParseToken *tok = tokenize_cached(src, pp);
+				count = pparse_token_count - first;
+				tokens = malloc(count * sizeof *tokens);
+				source = strdup(_pc->token_source);
+				ok = ok && tokens && source && tok == &pparse_token_pool[first];
+				if (tokens) memcpy(tokens, tok, count * sizeof *tokens);
+				summary = pparse_token_tag_summary;
+				nfiles = _pc->input_file_count;
+			}
+			prism_reset();
+			if (keyed) snap = out_cache_read_entry(&key, TOK_CACHE_MAGIC, ".tok", &snap_len, &off);
+			ok = ok && (!keyed || snap);
+			if (snap && ok) {
+				pparse_ctx_init();
+				pp = preprocess_with_cc(src);
+				ok = pp && pparse_token_count == first;
+				/* One token too many in the pool: the snapshot's pair
+				 * indexes would be off by one, so it must decline. */
+				if (ok) pparse_token_count++;
+				ok = ok && !pparse_token_restore(snap + off, snap_len, pp, strlen(pp)) &&
+				     _pc->input_file_count == 0;
+				if (ok) pparse_token_count--;
+				PParseToken *tok = ok ? pparse_token_restore(snap + off, snap_len, pp, strlen(pp)) : NULL;
+				if (tok) _pc->token_source = pp;
+				else pp_buf_free(pp);
+				ok = ok && tok && pparse_token_count - first == count &&
+				     !memcmp(tok, tokens, count * sizeof *tokens) && !strcmp(_pc->token_source, source) &&
+				     strstr(source, "<%") == NULL && pparse_token_tag_summary == summary &&
+				     _pc->input_file_count == nfiles && nfiles > 1 &&
+				     _pc->current_file == pparse_tok_file(&tok[count - 1]);
+				for (int i = 0; ok && i < nfiles; i++)
+					ok = _pc->input_files[i]->file_no == (uint32_t)i &&
+					     _pc->input_files[i]->name != NULL;
+				ok = ok && strstr(_pc->input_files[0]->name, "prism_recipe_tokc_");
+				prism_reset();
+			}
+			free(snap);
+			free(tokens);
+			free(source);
+			unsetenv("PRISM_PP_CACHE_TOKENS");
+			unlink(src);
+			unlink(hdr);
+		} else if (*p == 'v') {
+			/* Every scan kernel set this CPU runs must tokenize exactly as
+			 * the byte-at-a-time reference does: the same tokens and lines,
+			 * the same rewritten text, the same diagnostic. The corpus is
+			 * Prism's own sources, when the run starts where they are, and
+			 * generated text. */
+			static const char *const sources[] = {"prism.c", "parse.c", ".github/test.c",
+							      "../prism.c", "../parse.c", "test.c"};
+			char gen[16384];
+			int compared = 0;
+			for (size_t k = 0; ok && k < N(pparse_scan_kernels); k++) {
+				const PParseScanKernel *kernel = &pparse_scan_kernels[k];
+				if (!strcmp(kernel->name, "scalar") || !pparse_scan_supported(kernel)) continue;
+				for (size_t i = 0; ok && i < N(sources) + 400; i++) {
+					FileBytes fb = {0};
+					const char *text = gen;
+					size_t len;
+					if (i < N(sources)) {
+						fb = read_file_bytes(sources[i]);
+						if (!fb.data) continue;
+						text = fb.data;
+						len = fb.size;
+					} else
+						len = scan_corpus_text(gen, sizeof gen, (uint32_t)i);
+					ScanRun want, got;
+					scan_run(&want, "scalar", text, len);
+					scan_run(&got, kernel->name, text, len);
+					ok = scan_runs_equal(&want, &got) && (want.count || want.diag[0]);
+					if (!ok)
+						fprintf(stderr, "scan kernel %s differs from scalar on %s\n", kernel->name,
+							i < N(sources) ? sources[i] : "generated text");
+					compared++;
+					scan_run_free(&want);
+					scan_run_free(&got);
+					free(fb.data);
+				}
+			}
+			ok = ok && compared >= 400;
+			pparse_scan = NULL;
+		} else if (*p == 'x') {
+			/* A buffer lexed in parts by worker processes must come out as
+			 * one run over it does: the same tokens, text, file views and
+			 * skip spans, or the same diagnostic. The corpus is generated
+			 * text with something open across each kind of linemarker a part
+			 * may start at, as it is and as runs that must go back to one
+			 * run: a keyword #defined before a cut, a closer with no opener,
+			 * an opener never closed. Prism's own sources, with markers
+			 * added, need only agree. */
+			static const char *const sources[] = {"prism.c", ".github/test.c", "../prism.c", "test.c"};
+			static const char *const wrap[][2] = {
+			    {"", ""}, {"#define defer 1\n", ""}, {"", "}\n"}, {"(\n", ""}};
+			char gen[24576], *text = NULL;
+			int split = 0;
+			setenv("PRISM_LEX_SPLIT_KB", "1", 1);
+			for (size_t i = 0; ok && i < N(sources) + 160; i++) {
+				size_t len = 0, w = i % 8 < 5 ? 0 : i % 8 - 4;
+				if (i < N(sources)) {
+					FileBytes fb = read_file_bytes(sources[i]);
+					if (!fb.data) continue;
+					text = malloc(fb.size * 2 + 64);
+					if (text) {
+						for (size_t b = 0, last = 0; b < fb.size; b++) {
+							text[len++] = fb.data[b];
+							if (fb.data[b] == '\n' && b - last > 4096) {
+								len += (size_t)sprintf(text + len, "# %zu \"scan.c\"\n", b);
+								last = b;
+							}
+						}
+						text[len] = '\0';
+					}
+					free(fb.data);
+					w = 0;
+				} else {
+					text = malloc(sizeof gen + 64);
+					if (text) {
+						size_t g = split_corpus_text(gen, sizeof gen, (uint32_t)i);
+						len = (size_t)sprintf(text, "%s%.*s%s", wrap[w][0], (int)g, gen, wrap[w][1]);
+					}
+				}
+				if (!text) {
+					ok = 0;
+					break;
+				}
+				ScanRun want, got;
+				lex_split_jobs = 1;
+				scan_run(&want, NULL, text, len);
+				lex_split_jobs = 4;
+				lex_split_parts = 0;
+				scan_run(&got, NULL, text, len);
+				ok = scan_runs_equal(&want, &got) && (want.count || want.diag[0]) &&
+				     (i < N(sources) || (w > 1) == !!want.diag[0]) &&
+				     (w == 0 || lex_split_parts == 0);
+				if (!ok)
+					fprintf(stderr, "split tokenize differs on %s (%d parts) %s\n",
+						i < N(sources) ? sources[i] : "generated text", lex_split_parts, want.diag);
+				split += lex_split_parts > 1;
+				scan_run_free(&want);
+				scan_run_free(&got);
+				free(text);
+			}
+			ok = ok && split >= 80;
+			lex_split_jobs = 1;
+		} else if (*p == 'n') {
+			/* Identifiers are interned as they are lexed: one id per
+			 * spelling, numbered in the order names first appear, each
+			 * with its keyword class. After Pass 1 has reused parse_data
+			 * on defer and goto, their ids still come out by spelling, and
+			 * every token that owns a binding says so. */
+			static const char src[] =
+			    "typedef int T;\nstruct T { T T; };\n"
+			    "static int f(T a) { defer (void)a; if (a) goto out; a = f(a - 1); out: return a; }\n"
+			    "int while_, defer_, T2 = sizeof(struct T);\n";
+			pparse_ctx_init();
+			PPARSE_CTX();
+			char *buf = strdup(src);
+			uint32_t first = pparse_token_count, next = 0, jumps = 0;
+			_pc->token_source = buf;
+			error_recovery_init();
+			if (buf && setjmp(_pc->error_jmp) == 0) {
+				PParseToken *tok = pparse_tokenize_buffer("names.c", buf);
+				for (uint32_t i = first; ok && i < pparse_token_count; i++) {
+					PParseToken *t = &pparse_token_pool[i];
+					if (t->kind > PPARSE_TK_KEYWORD) continue;
+					char *name = pparse_loc(_pc, t);
+					uint32_t id = t->parse_data;
+					ok = id <= next && id < _pc->name_count && _pc->names[id].len == t->len &&
+					     !memcmp(_pc->names[id].name, name, t->len) &&
+					     _pc->names[id].kw == pparse_keyword_lookup(name, (int)t->len);
+					next += id == next;
+					for (uint32_t j = first; ok && j < i; j++) {
+						PParseToken *u = &pparse_token_pool[j];
+						if (u->kind <= PPARSE_TK_KEYWORD)
+							ok = (u->parse_data == id) ==
+							     (u->len == t->len && !memcmp(pparse_loc(_pc, u), name, t->len));
+					}
+				}
+				ok = ok && next == _pc->name_count && next > 10;
+				uint32_t *ids = malloc((pparse_token_count - first) * sizeof *ids);
+				for (uint32_t i = first; ok && ids && i < pparse_token_count; i++)
+					ids[i - first] = pparse_token_pool[i].parse_data;
+				pparse_analyze(tok);
+				for (uint32_t i = first; ok && ids && i < pparse_token_count; i++) {
+					PParseToken *t = &pparse_token_pool[i];
+					if (t->kind > PPARSE_TK_KEYWORD) continue;
+					ok = pparse_token_name_id(_pc, t) == ids[i - first];
+					jumps += (t->tag & (PPARSE_TT_DEFER | PPARSE_TT_GOTO)) != 0;
+				}
+				ok = ok && ids && jumps == 2 && pparse_typedef_table.count > 3;
+				/* A token not marked bound is taken to own no entry. */
+				for (int i = 0; ok && i < pparse_typedef_table.count; i++)
+					ok = pparse_td_is_bound(
+					    _pc, &pparse_token_pool[pparse_typedef_table.entries[i].token_index]);
+				free(ids);
+			} else
+				ok = 0;
+			_pc->error_jmp_set = false;
+			prism_reset();
+		} else if (*p == 'g') {
+			/* K&R parameters spelled `defer` and `raw` are bound like any
+			 * other name, and `raw` also carries a recipe whose target is
+			 * in pair_idx. Binding it must leave that index in the pool. */
+			static const char src[] = "int f(defer, raw) int defer; int raw; { return defer + raw; }\n"
+						  "int g(raw) int raw; { return raw; }\n";
+			pparse_ctx_init();
+			PPARSE_CTX();
+			char *buf = strdup(src);
+			uint32_t first = pparse_token_count;
+			_pc->token_source = buf;
+			error_recovery_init();
+			if (buf && setjmp(_pc->error_jmp) == 0) {
+				pparse_analyze(pparse_tokenize_buffer("kr.c", buf));
+				for (uint32_t i = first; ok && i < pparse_token_count; i++)
+					ok = pparse_token_pool[i].pair_idx < pparse_token_count;
+				ok = ok && pparse_typedef_table.count >= 3;
+				if (!ok) fprintf(stderr, "K&R soft-keyword parameters left a pair_idx outside the pool\n");
+				/* The bound mark is exact both ways: a marked token owns an
+				 * entry, and an entry's token is marked. */
+				for (uint32_t i = first; ok && i < pparse_token_count; i++) {
+					bool owns = false;
+					for (int e = 0; !owns && e < pparse_typedef_table.count; e++)
+						owns = pparse_typedef_table.entries[e].token_index == i;
+					ok = owns == pparse_td_is_bound(_pc, &pparse_token_pool[i]);
+					if (!ok) fprintf(stderr, "token %u bound mark disagrees with the typedef table\n", i);
+				}
+			} else
+				ok = 0;
+			_pc->error_jmp_set = false;
+			prism_reset();
+		} else if (*p == 'e') {
+			/* Pass 2 emits a file-scope function body as is when Pass 1
+			 * found nothing in it to lower. Each body below after the
+			 * first carries one kind of lowering, nested or not; the last
+			 * has only braces and statements Pass 2 passes through. */
+			static const char src[] =
+			    "void exit(int);\n"
+			    "int a(int x) { int y = x + 1; for (int i = 0; i < x; i++) y += i; return y; }\n"
+			    "int b(void) { int y; return y; }\n"
+			    "void c(void) { if (1) { defer (void)0; } }\n"
+			    "int d(int i) { int arr[4] = {0}; return arr[i]; }\n"
+			    "void e(int x) { if (x) exit(1); }\n"
+			    "int f(void) { struct S { int a; } s = {1}; return s.a; }\n"
+			    "int g(int x) { raw int y; y = x; return y; }\n"
+			    "int h(int x) { if (x) int y = 1; return x; }\n"
+			    "int k(int x) { while (x) { if (x & 1) { x--; continue; } x >>= 1; } return x; }\n";
+			pparse_ctx_init();
+			PPARSE_CTX();
+			char *buf = strdup(src), got[16] = {0};
+			uint32_t first = pparse_token_count, feat = _pc->features;
+			int bodies = 0;
+			_pc->token_source = buf;
+			_pc->features |= PPARSE_F_BOUNDS_CHECK | PPARSE_F_AUTO_UNREACHABLE;
+			error_recovery_init();
+			if (buf && setjmp(_pc->error_jmp) == 0) {
+				pparse_analyze(pparse_tokenize_buffer("plain.c", buf));
+				for (uint32_t i = first; i < pparse_token_count && bodies < 15; i++) {
+					PParseToken *t = &pparse_token_pool[i];
+					if (!(t->flags & PPARSE_TF_OPEN) || t->ch0 != '{') continue;
+					PParseScopeInfo *si = &pparse_scope_tree[(uint16_t)t->parse_data];
+					if (si->is_func_body && !si->parent_id) got[bodies++] = si->is_plain ? 'P' : '-';
+				}
+				ok = !strcmp(got, "P-------P");
+				if (!ok) fprintf(stderr, "plain bodies: got %s\n", got);
+			} else
+				ok = 0;
+			_pc->error_jmp_set = false;
+			_pc->features = feat;
+			prism_reset();
+		} else if (*p == 'f') {
+			/* A plain body copies runs of tokens straight from the source,
+			 * and must still space them as emit_tok would: apart where they
+			 * would paste, one space for a tab or several, and a newline
+			 * before a declaration that follows a statement. */
+			PrismFeatures f = prism_defaults();
+			f.bounds_check = false;
+			f.line_directives = false;
+			PrismResult r = prism_transpile_source(
+			    "int f(int x, int y) { int z = x+++y; z = z&&&y; while (x-->0) z += x/ *&y; z = z\t+  1; return z; }\n"
+			    "int g(int a) { int b = a; int c = b; return a+b+c; }\n",
+			    "runs.c", f);
+			ok = r.status == PRISM_OK && r.output &&
+			     strstr(r.output, "int f(int x, int y) { int z = x++ +y; z = z&& &y; "
+					      "while (x-- >0) z += x/ *&y; z = z + 1; return z; }\n") &&
+			     strstr(r.output, "int g(int a) { int b = a;\nint c = b; return a+b+c; }\n");
+			if (!ok) fprintf(stderr, "plain runs: got %s\n", r.output ? r.output : "(none)");
+			prism_free(&r);
+		} else if (*p == 'c') {
+			/* pparse_analyze reports each phase's time and what it swept:
+			 * every token for the scope sweep, the prescan and finalize,
+			 * and the Pass 1 entries for the CFG check. */
+			pparse_ctx_init();
+			PPARSE_CTX();
+			char *buf = strdup("int f(int x) { defer (void)0; if (x) goto out; out: return x; }\n");
+			uint32_t first = pparse_token_count;
+			error_recovery_init();
+			if (buf && setjmp(_pc->error_jmp) == 0) {
+				pparse_analyze(pparse_tokenize_buffer("phases.c", buf));
+				uint64_t swept = (uint64_t)(pparse_token_count - first) * sizeof(PParseToken);
+				ok = first == 1 && _pc->phase_bytes[PPARSE_PHASE_SCOPES] == swept &&
+				     _pc->phase_bytes[PPARSE_PHASE_PRESCAN] == swept &&
+				     _pc->phase_bytes[PPARSE_PHASE_FINALIZE] == swept &&
+				     _pc->phase_bytes[PPARSE_PHASE_CFG] == (uint64_t)p1_entry_count * sizeof(P1FuncEntry) &&
+				     p1_entry_count >= 3;
+				for (int i = 0; i < PPARSE_PHASE_COUNT; i++) ok &= _pc->phase_ms[i] >= 0.0;
+			} else
+				ok = 0;
+			_pc->error_jmp_set = false;
+			prism_reset();
+		} else if (*p == 'y') {
+			/* The keyword table is a perfect hash: each keyword sits in the
+			 * slot its spelling hashes to, and a spelling one edit away
+			 * from a keyword is found only when it is a keyword itself.
+			 * The table must also be what .github/keywords.c generates. */
+			int keywords = 0;
+			for (int s = 0; ok && s < PPARSE_KW_SLOTS; s++) {
+				const PParseKeywordEntry *e = &pparse_keyword_table[s];
+				if (!e->name) continue;
+				int len = (int)strlen(e->name);
+				char near[64];
+				ok = len < 60 && (int)pparse_keyword_slot(e->name, (uint32_t)len) == s &&
+				     (uint8_t)(e->value >> PPARSE_KW_LEN_SHIFT) == len &&
+				     pparse_keyword_lookup(e->name, len) == e->value;
+				for (int v = 0; ok && v < 3; v++) {
+					int n = v == 0 ? len - 1 : v == 1 ? len + 1 : len;
+					memcpy(near, e->name, (size_t)len);
+					near[len] = 'x';
+					if (v == 2) near[len - 1] ^= 0x20;
+					bool is_kw = false;
+					for (int t = 0; t < PPARSE_KW_SLOTS; t++)
+						is_kw |= pparse_keyword_table[t].name &&
+							 (int)strlen(pparse_keyword_table[t].name) == n &&
+							 !memcmp(pparse_keyword_table[t].name, near, (size_t)n);
+					ok = !pparse_keyword_lookup(near, n) == !is_kw;
+				}
+				keywords++;
+			}
+			ok = ok && keywords > 100 && pparse_keyword_lookup("defer", 5) &&
+			     !pparse_keyword_lookup("deferx", 6) &&
+			     ((pparse_keyword_lookup("raw", 3) >> PPARSE_KW_SHADOW_SHIFT) & PPARSE_KWSHADOW_RAW);
+			const char *gen = access(".github/keywords.c", R_OK) == 0 ? ".github/keywords.c" : "keywords.c";
+			const char *parse = gen[0] == '.' ? "parse.c" : "../parse.c";
+			if (ok && access(gen, R_OK) == 0) {
+				char cmd[PATH_MAX * 2];
+				snprintf(cmd, sizeof cmd, "cc -O2 -o /tmp/prism_recipe_kw_%ld %s && /tmp/prism_recipe_kw_%ld --check %s",
+					 (long)getpid(), gen, (long)getpid(), parse);
+				ok = run_shell_command(cmd) == 0;
+				snprintf(cmd, sizeof cmd, "/tmp/prism_recipe_kw_%ld", (long)getpid());
+				unlink(cmd);
+			}
+		} else if (*p == 'k') {
+			/* A Pass 1 prefix snapshot resumes the prescan where scanning
+			 * the system headers would have left it. Three analyses: the
+			 * first, of another file in another directory that includes the
+			 * same headers, stores a snapshot; the second, of this file,
+			 * restores it; the third scans this file in full, and the last
+			 * two must agree on every token and table. */
+			char src[256], dir[256], other[300];
+			PParseToken *tokens[3] = {0};
+			PParseTypedefEntry *typedefs[3] = {0};
+			uint32_t counts[3] = {0}, records[3] = {0}, heads[3] = {0};
+			int ntd[3] = {0}, nfs[3] = {0}, nfuncs[3] = {0}, kept = 0;
+			snprintf(src, sizeof src, "/tmp/prism_recipe_p1s_%ld.c", (long)getpid());
+			ok = ok && write_text_file(src, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n"
+							"typedef struct { int a[4]; } recipe_p1s_t;\n"
+							"int recipe_p1s(recipe_p1s_t *v) {\n"
+							"\tFILE *f = fopen(\"x\", \"r\");\n"
+							"\tdefer if (f) fclose(f);\n"
+							"\tsize_t n = strlen(\"ab\");\n"
+							"\treturn v->a[n];\n}\n");
+			snprintf(dir, sizeof dir, "/tmp/prism_recipe_p1s_dir_%ld", (long)getpid());
+			snprintf(other, sizeof other, "%s/other_unit.c", dir);
+			ok = ok && mkdir(dir, 0700) == 0 &&
+			     write_text_file(other, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n"
+						    "static int recipe_p1s_other(void) { return (int)strlen(\"x\"); }\n");
+			p1_prefix_forget();
+			for (int run = 0; ok && run < 3; run++) {
+				ok = run < 2 ? setenv("PRISM_PP_CACHE_PASS1", "1", 1) == 0
+					     : unsetenv("PRISM_PP_CACHE_PASS1") == 0;
+				pparse_ctx_init();
+				PPARSE_CTX();
+				apply_features(prism_defaults());
+				char *unit = run ? src : other;
+				char *pp = ok ? preprocess_with_cc(unit) : NULL;
+				ok = ok && pp;
+				if (pp) {
+					_pc->token_source = pp;
+					_pc->input_preprocessed = true;
+					pparse_analyze(pparse_tokenize_buffer(unit, pp));
+					counts[run] = pparse_token_count;
+					tokens[run] = malloc(counts[run] * sizeof(PParseToken));
+					ntd[run] = pparse_typedef_table.count;
+					typedefs[run] = malloc((size_t)ntd[run] * sizeof(PParseTypedefEntry) + 1);
+					ok = tokens[run] && typedefs[run];
+					if (ok) {
+						memcpy(tokens[run], pparse_token_pool, counts[run] * sizeof(PParseToken));
+						memcpy(typedefs[run], pparse_typedef_table.entries,
+						       (size_t)ntd[run] * sizeof(PParseTypedefEntry));
+					}
+					for (uint32_t i = 0; i < _pc->function_symbol_cap; i++)
+						nfs[run] += pparse_function_symbols[i] != 0;
+					nfuncs[run] = func_meta_count;
+					records[run] = _pc->analysis_count;
+					for (uint32_t i = 0; _pc->analysis_index && i < counts[run]; i++)
+						heads[run] += _pc->analysis_index[i] != 0;
+				}
+				prism_reset();
+				if (run == 1)
+					for (int i = 0; i < P1_PREFIX_SLOTS; i++) kept += p1_prefix_slots[i].snap != NULL;
+			}
+			/* One slot: the second run found the first run's snapshot rather
+			 * than storing its own. */
+			ok = ok && kept == 1 && counts[1] == counts[2] && ntd[1] == ntd[2] && ntd[1] > 100 &&
+			     !memcmp(tokens[1], tokens[2], counts[1] * sizeof(PParseToken)) &&
+			     !memcmp(typedefs[1], typedefs[2], (size_t)ntd[1] * sizeof(PParseTypedefEntry)) &&
+			     nfs[1] == nfs[2] && nfuncs[1] == nfuncs[2] && records[1] == records[2] &&
+			     heads[1] == heads[2] && records[1] > 0;
+			for (int i = 0; i < 3; i++) {
+				free(tokens[i]);
+				free(typedefs[i]);
+			}
+			if (ok) {
+				setenv("PRISM_PP_CACHE_PASS1", "1", 1);
+				PrismResult with = prism_transpile_file(src, prism_defaults());
+				unsetenv("PRISM_PP_CACHE_PASS1");
+				PrismResult without = prism_transpile_file(src, prism_defaults());
+				ok = with.status == PRISM_OK && without.status == PRISM_OK && with.output &&
+				     without.output && !strcmp(with.output, without.output);
+				prism_free(&with);
+				prism_free(&without);
+			}
+			p1_prefix_forget();
+			unsetenv("PRISM_PP_CACHE_PASS1");
+			unlink(src);
+			unlink(other);
+			rmdir(dir);
 		} else if (*p == 'X') {
 			/* pp_cache_dir() resolves PRISM_PP_CACHE_DIR once per thread and
 			 * caches it, so this action cannot redirect itself at a private
@@ -1374,6 +2414,12 @@ static int run_internal(const Recipe *r, char *failed_action) {
 				pp_each_entry(pp_clear_cb, &removed);
 				snprintf(marker, sizeof marker, "%s/%s", dir, PP_PRUNE_MARKER);
 				unlink(marker);
+				snprintf(marker, sizeof marker, "%s/%s", dir, PP_INDEX_NAME);
+				unlink(marker);
+				for (int i = 0; i < 256; i++) {
+					snprintf(marker, sizeof marker, "%s/%02x", dir, i);
+					rmdir(marker);
+				}
 				ok = ok && rmdir(dir) == 0;
 			}
 			unsetenv("PRISM_PP_CACHE_DIR");
@@ -1401,6 +2447,160 @@ static int run_internal(const Recipe *r, char *failed_action) {
 			char *quiet[] = {"sh", "-c", "echo hidden >&2", NULL};
 			ok = ok && run_command(yes) == 0 && run_command(no) == 7 &&
 			     run_command(sig) == 143 && run_command_quiet(quiet) == 0;
+		} else if (*p == 'z') {
+			/* `-c` with several units compiles them concurrently, Prism
+			 * sources first and passthrough inputs after, whatever their
+			 * order on the command line. The status is the first failing
+			 * unit's in that order, not the first to fail in time: b.c's
+			 * compile fails slowly with 5 while y.s fails at once with 7.
+			 * Serially, nothing after b.c is compiled. */
+			const char *cli = recipe_cli_binary();
+			char dir[64], path[128], cmd[512];
+			ok = cli != NULL;
+			snprintf(dir, sizeof dir, "/tmp/prism_recipe_units_%ld", (long)getpid());
+			ok = ok && pp_mkdir_p(dir);
+			static const char *const files[][2] = {
+			    {"a.c", "int a(void) { return 1; }\n"},
+			    {"b.c", "int b(void) { return 2; }\n"},
+			    {"c.c", "int c(void) { return 3; }\n"},
+			    {"y.s", "\t.text\n"},
+			    {"z.s", "\t.text\n"},
+			    {"cc.sh", "#!/bin/sh\n"
+				      "case \" $* \" in *\" -c \"*)\n"
+				      "  case \" $* \" in\n"
+				      "  *\" .b.c.\"*) sleep 1; exit 5;;\n"
+				      "  *\" y.s \"*) exit 7;;\n"
+				      "  esac;;\n"
+				      "esac\n"
+				      "exec cc \"$@\"\n"},
+			};
+			static const char *const objects[] = {"a.o", "b.o", "c.o", "y.o", "z.o"};
+			for (size_t i = 0; ok && i < N(files); i++) {
+				snprintf(path, sizeof path, "%s/%s", dir, files[i][0]);
+				ok = write_text_file(path, files[i][1]);
+			}
+			snprintf(path, sizeof path, "%s/cc.sh", dir);
+			ok = ok && chmod(path, 0700) == 0;
+			/* Which objects each run leaves: -j4 starts a.c through y.s at
+			 * once and z.s when a.c is done; -j1 stops at b.c. */
+			static const char *const runs[][2] = {{"-j4 -c y.s a.c b.c c.c z.s", "10101"},
+							      {"-j1 -c a.c b.c c.c y.s z.s", "10000"}};
+			for (size_t run = 0; ok && run < N(runs); run++) {
+				for (size_t i = 0; i < N(objects); i++) {
+					snprintf(path, sizeof path, "%s/%s", dir, objects[i]);
+					unlink(path);
+				}
+				snprintf(cmd, sizeof cmd, "cd %s && PRISM_NO_PP_CACHE=1 %s --prism-cc=%s/cc.sh %s 2>/dev/null",
+					 dir, cli, dir, runs[run][0]);
+				int rc = run_shell_command(cmd);
+				ok = WIFEXITED(rc) && WEXITSTATUS(rc) == 5 && recipe_dot_files(dir) == 0;
+				for (size_t i = 0; ok && i < N(objects); i++) {
+					snprintf(path, sizeof path, "%s/%s", dir, objects[i]);
+					ok = (access(path, F_OK) == 0) == (runs[run][1][i] == '1');
+				}
+				if (!ok) fprintf(stderr, "prism %s: rc %d or wrong objects\n", runs[run][0], rc);
+			}
+			for (size_t i = 0; i < N(files); i++) {
+				snprintf(path, sizeof path, "%s/%s", dir, files[i][0]);
+				unlink(path);
+			}
+			for (size_t i = 0; i < N(objects); i++) {
+				snprintf(path, sizeof path, "%s/%s", dir, objects[i]);
+				unlink(path);
+			}
+			rmdir(dir);
+		} else if (*p == 'a') {
+			/* The CLI transpiles several sources on a pool of worker
+			 * processes. Their diagnostics are replayed in source order and
+			 * the first failing source ends the build: b.c's error is
+			 * reported, c.c's never is, and nothing is left beside them. A
+			 * worker killed mid-build, or the CLI itself, takes the `cc -E`
+			 * it is waiting on and its temporaries with it. */
+			const char *cli = recipe_cli_binary();
+			char dir[64], path[128], cmd[512];
+			ok = cli != NULL;
+			snprintf(dir, sizeof dir, "/tmp/prism_recipe_pool_%ld", (long)getpid());
+			ok = ok && pp_mkdir_p(dir);
+			static const char *const files[][2] = {
+			    {"a.c", "int a(void) { return 1; }\n"},
+			    {"b.c", "void b(void) { goto out; int x = 1; out: (void)x; }\n"},
+			    {"c.c", "void c(void) { defer { return; } }\n"},
+			    {"m.c", "int main(void) { return 0; }\n"},
+			    {"slow.c", "int slow(void) { return 2; }\n"},
+			    /* Stands in for cc: `-E` of slow.c waits until signalled
+			     * and notes that it was. */
+			    {"cc.sh", "#!/bin/sh\n"
+				      "d=$(dirname \"$0\")\n"
+				      "case \" $* \" in *\" -E \"*slow.c*)\n"
+				      "  trap 'echo killed > \"$d/killed\"; exit 1' TERM\n"
+				      "  echo $PPID > \"$d/worker\"\n"
+				      "  sleep 60 & wait; exit 1;;\n"
+				      "esac\n"
+				      "exec cc \"$@\"\n"},
+			};
+			for (size_t i = 0; ok && i < N(files); i++) {
+				snprintf(path, sizeof path, "%s/%s", dir, files[i][0]);
+				ok = write_text_file(path, files[i][1]);
+			}
+			snprintf(path, sizeof path, "%s/cc.sh", dir);
+			ok = ok && chmod(path, 0700) == 0;
+			for (int run = 0; ok && run < 3; run++) {
+				snprintf(cmd, sizeof cmd,
+					 "cd %s && PRISM_NO_PP_CACHE=1 %s --prism-verbose -j4 a.c b.c c.c m.c -o out 2>err",
+					 dir, cli);
+				int rc = run_shell_command(cmd);
+				snprintf(path, sizeof path, "%s/err", dir);
+				char *err = read_file_padded(path);
+				const char *ta = err ? strstr(err, "Transpiling a.c") : NULL;
+				const char *tb = err ? strstr(err, "Transpiling b.c") : NULL;
+				const char *eb = err ? strstr(err, "b.c:1: pparse_error") : NULL;
+				ok = WIFEXITED(rc) && WEXITSTATUS(rc) != 0 && ta && tb && eb && ta < tb && tb < eb &&
+				     !strstr(err, "c.c:") && !strstr(err, "Transpiling c.c") &&
+				     !strstr(err, "Transpiling m.c") && recipe_dot_files(dir) == 0;
+				snprintf(path, sizeof path, "%s/out", dir);
+				ok = ok && access(path, F_OK) != 0;
+				if (!ok) fprintf(stderr, "worker pool run %d: rc %d, stderr:\n%s\n", run, rc, err ? err : "");
+				free(err);
+			}
+			/* SIGTERM to the worker running slow.c, then to the CLI. */
+			for (int who = 0; ok && who < 2; who++) {
+				char worker[128], killed[128];
+				snprintf(worker, sizeof worker, "%s/worker", dir);
+				snprintf(killed, sizeof killed, "%s/killed", dir);
+				unlink(worker);
+				unlink(killed);
+				snprintf(path, sizeof path, "--prism-cc=%s/cc.sh", dir);
+				char *argv[] = {(char *)cli, path, "-j4", "a.c", "slow.c", "m.c", "-o", "out", NULL};
+				pid_t pid = fork();
+				if (pid == 0) {
+					int devnull = open("/dev/null", O_WRONLY);
+					if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+					setenv("PRISM_NO_PP_CACHE", "1", 1);
+					if (chdir(dir) == 0) execv(cli, argv);
+					_exit(127);
+				}
+				ok = pid > 0 && recipe_wait_file(worker, 20000);
+				char *w = ok ? read_file_padded(worker) : NULL;
+				long wpid = w ? strtol(w, NULL, 10) : 0;
+				free(w);
+				ok = ok && wpid > 1 && kill(who ? pid : (pid_t)wpid, SIGTERM) == 0;
+				int st = pid > 0 ? wait_pid_deadline(pid, 30) : -1;
+				ok = ok && st != -1 && !(WIFEXITED(st) && WEXITSTATUS(st) == 0) &&
+				     recipe_wait_file(killed, 5000) && recipe_dot_files(dir) == 0;
+				if (!ok)
+					fprintf(stderr, "SIGTERM to the %s left its cc -E or temps behind\n",
+						who ? "CLI" : "worker");
+			}
+			for (size_t i = 0; i < N(files); i++) {
+				snprintf(path, sizeof path, "%s/%s", dir, files[i][0]);
+				unlink(path);
+			}
+			static const char *const made[] = {"err", "out", "worker", "killed"};
+			for (size_t i = 0; i < N(made); i++) {
+				snprintf(path, sizeof path, "%s/%s", dir, made[i]);
+				unlink(path);
+			}
+			rmdir(dir);
 		} else if (*p == 'O') {
 			out_fp = tmpfile();
 			if (!out_fp) { ok = 0; continue; }
@@ -1592,7 +2792,7 @@ static int run_internal(const Recipe *r, char *failed_action) {
 				apply_features(prism_defaults());
 				char *bad = preprocess_with_cc(in);
 				ok = ok && !bad;
-				free(bad);
+				pp_buf_free(bad);
 				prism_reset();
 			}
 			const unsigned char bom[] = {0xff, 0xfe};
@@ -1605,7 +2805,7 @@ static int run_internal(const Recipe *r, char *failed_action) {
 				apply_features(prism_defaults());
 				char *bad = preprocess_with_cc(in);
 				ok = ok && !bad;
-				free(bad);
+				pp_buf_free(bad);
 				prism_reset();
 			}
 			fflush(stderr);
@@ -1867,28 +3067,30 @@ static int run_internal(const Recipe *r, char *failed_action) {
 					ok = 0;
 				} else {
 					int wrote = fputs(PP_CACHE_MAGIC, fp) >= 0 &&
-						    fputs("deps 0\ndirs 0\npayload 9223372036854775807\n", fp) >= 0;
+						    fputs("deps 0\ndirs 0\npayload 9223372036854775807 0 0 65536\n", fp) >= 0;
 					if (fclose(fp) != 0) wrote = 0;
 					ok = ok && wrote;
 				}
 				char *payload = pp_cache_load(&corrupt);
 				ok = ok && payload == NULL;
-				free(payload);
+				pp_buf_free(payload);
 				fp = fopen(corrupt_path, "wb");
 				if (!fp) {
 					ok = 0;
 				} else {
-					int wrote = fputs(PP_CACHE_MAGIC, fp) >= 0 && fputs("deps 1\ninvalid dependency\ninvalid dependency\ndirs 0\npayload 0\n", fp) >= 0;
+					int wrote = fputs(PP_CACHE_MAGIC, fp) >= 0 && fputs("deps 1\ninvalid dependency\ninvalid dependency\ndirs 0\npayload 0 0 0 65536\n", fp) >= 0;
 					if (fclose(fp) != 0) wrote = 0;
 					ok = ok && wrote;
 				}
 					payload = pp_cache_load(&corrupt);
 					ok = ok && payload == NULL;
-					free(payload);
+					pp_buf_free(payload);
 					unlink(corrupt_path);
 				}
 				/* A same-length flip must not turn into silently altered generated C.
-				 * Exercise the payload checksum and the exact-EOF validation together. */
+				 * Exercise the payload checksum and the exact-EOF validation together.
+				 * The payload sits at 64 KiB, a multiple of every page size, so the
+				 * hit is the mapped path. */
 				PPKey checked = {0x0badf00d12345678ULL, 0x87654321deadbeefULL};
 				char checked_path[PATH_MAX] = {0};
 				const char checked_payload[] = "int cache_checksum_value;\n";
@@ -1898,19 +3100,21 @@ static int run_internal(const Recipe *r, char *failed_action) {
 				} else {
 					FILE *fp = fopen(checked_path, "wb");
 					int wrote = fp && fputs(PP_CACHE_MAGIC, fp) >= 0 && fputs("deps 0\ndirs 0\n", fp) >= 0 &&
-						fprintf(fp, "payload %zu %016llx %016llx\n", sizeof checked_payload - 1,
+						fprintf(fp, "payload %zu %016llx %016llx 65536\n", sizeof checked_payload - 1,
 							(unsigned long long)checked_sum.a, (unsigned long long)checked_sum.b) > 0 &&
-						fwrite(checked_payload, 1, sizeof checked_payload - 1, fp) == sizeof checked_payload - 1;
+						fseek(fp, 65536, SEEK_SET) == 0 &&
+						fwrite(checked_payload, 1, sizeof checked_payload, fp) == sizeof checked_payload &&
+						fwrite("\0\0\0\0\0\0\0", 1, 7, fp) == 7;
 					if (fp && fclose(fp) != 0) wrote = 0;
 					char *payload = pp_cache_load(&checked);
 					ok = ok && wrote && payload && !strcmp(payload, checked_payload);
-					free(payload);
+					pp_buf_free(payload);
 					fp = fopen(checked_path, "r+b");
-					int flipped = fp && fseek(fp, -1, SEEK_END) == 0 && fputc('X', fp) != EOF;
+					int flipped = fp && fseek(fp, -9, SEEK_END) == 0 && fputc('X', fp) != EOF;
 					if (fp && fclose(fp) != 0) flipped = 0;
 					payload = pp_cache_load(&checked);
 					ok = ok && flipped && payload == NULL;
-					free(payload);
+					pp_buf_free(payload);
 					unlink(checked_path);
 				}
 				/* mkstemp-style cache publishing gives concurrent same-process stores
@@ -2522,6 +3726,35 @@ static int run_internal(const Recipe *r, char *failed_action) {
 			rmdir(clang_dir);
 			rmdir(lib);
 			rmdir(root);
+		} else if (*p == 'm') {
+			/* Functions in runs the tokenizer marks skipped (here the
+			 * compiler-injected stdc-predef.h, which is not re-included) must
+			 * not shift the function metadata of the user code after them. */
+			char src[PATH_MAX], text[PATH_MAX * 3 + 512];
+			ok = snprintf(src, sizeof src, "/tmp/prism_recipe_skip_span_%ld.c", (long)getpid()) > 0 &&
+			     snprintf(text, sizeof text,
+				      "# 1 \"%s\"\n"
+				      "# 1 \"/usr/include/stdc-predef.h\" 1 3 4\n"
+				      "static inline int skip_span_a(void) { int z; return z; }\n"
+				      "# 2 \"%s\" 2\n"
+				      "int skip_span_user(int x) { defer x = 1; return x; }\n"
+				      "# 1 \"/usr/include/stdc-predef.h\" 1 3 4\n"
+				      "static inline int skip_span_b(void) { int z; { int w; } return z; }\n"
+				      "# 3 \"%s\" 2\n"
+				      "int skip_span_tail(int y) { defer y = 2; return y; }\n",
+				      src, src, src) > 0 &&
+			     write_text_file(src, text);
+			if (ok) {
+				PrismFeatures f = prism_defaults();
+				f.flatten_headers = false;
+				PrismResult result = prism_transpile_file(src, f);
+				ok = result.status == PRISM_OK && result.output && !strstr(result.output, "skip_span_a") &&
+				     !strstr(result.output, "skip_span_b") && !strstr(result.output, "defer") &&
+				     strstr(result.output, "int __prism_ret_0 = ( x);  x = 1; return __prism_ret_0;") &&
+				     strstr(result.output, "int __prism_ret_1 = ( y);  y = 2; return __prism_ret_1;");
+				prism_free(&result);
+			}
+			unlink(src);
 		}
 		if (before && !ok && failed_action && !*failed_action) *failed_action = *p;
 		if (getenv("PRISM_INTERNAL_TRACE"))
@@ -5082,12 +6315,22 @@ static const char *const av_x_cpp[] = {"prism", "-xcpp-output", "source"};
 static const char *const av_x_none[] = {"prism", "-x", "none", "source"};
 static const char *const av_arg_flags[] = {"prism", "-I", ".", "-include", "/dev/null", "x.c"};
 static const char *const av_run_sep[] = {"prism", "run", "x.c", "--", "--flag"};
+static const char *const av_jobs[] = {"prism", "-j", "3", "a.c", "b.c"};
+static const char *const av_jobs_joined[] = {"prism", "-j8", "-c", "a.c", "b.c"};
+static const char *const av_integrated_cpp[] = {"prism", "-fintegrated-cpp", "-c", "x.c"};
+static const char *const av_object_cache[] = {"prism", "-fobject-cache", "-c", "x.c"};
 
 static const Recipe recipes[] = {
 	{"internal/platform", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
-	 NULL, NULL, NULL, 0, "KCSPODAFJTRMNYZWGILBH"},
+	 NULL, NULL, NULL, 0, "KCdSPODAFJTRMNYZWGILBH"},
+	{"internal/worker-pool", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "a"},
+	{"internal/compile-units", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "z"},
 	{"internal/system-header-ordering", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
 	 NULL, NULL, NULL, 0, "b"},
+	{"internal/system-skip-spans", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "m"},
 	{"internal/api-reset", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0, NULL, NULL, NULL, 0, "Q"},
 	{"internal/api-validation", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX, NULL, NULL, NULL, 0, "V"},
 	{"internal/api-first-oom", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0, NULL, NULL, NULL, 0, "E"},
@@ -5868,6 +7111,10 @@ static const Recipe recipes[] = {
 	{.id="cli/x-none", .oracle=O_CLI, .argv=av_x_none, .argc=N(av_x_none), .cli_mode=CLI_DEFAULT, .cli_action=CLI_ACT_NONE, .cli_sources=0, .cli_cc_args=-1},
 	{.id="cli/arg-flags", .oracle=O_CLI, .argv=av_arg_flags, .argc=N(av_arg_flags), .cli_mode=CLI_DEFAULT, .cli_action=CLI_ACT_NONE, .cli_sources=1, .cli_cc_args=-1},
 	{.id="cli/run-separator", .oracle=O_CLI, .argv=av_run_sep, .argc=N(av_run_sep), .cli_mode=CLI_RUN, .cli_action=CLI_ACT_NONE, .cli_sources=1, .cli_cc_args=-1},
+	{.id="cli/jobs", .oracle=O_CLI, .argv=av_jobs, .argc=N(av_jobs), .cli_mode=CLI_DEFAULT, .cli_action=CLI_ACT_NONE, .cli_sources=2, .cli_cc_args=0},
+	{.id="cli/jobs-joined", .oracle=O_CLI, .argv=av_jobs_joined, .argc=N(av_jobs_joined), .cli_mode=CLI_DEFAULT, .cli_action=CLI_ACT_NONE, .cli_sources=2, .cli_cc_args=1},
+	{.id="cli/integrated-cpp", .oracle=O_CLI, .argv=av_integrated_cpp, .argc=N(av_integrated_cpp), .cli_mode=CLI_DEFAULT, .cli_action=CLI_ACT_NONE, .cli_sources=1, .cli_cc_args=1},
+	{.id="cli/object-cache", .oracle=O_CLI, .argv=av_object_cache, .argc=N(av_object_cache), .cli_mode=CLI_DEFAULT, .cli_action=CLI_ACT_NONE, .cli_sources=1, .cli_cc_args=1},
 	{.id="cli/rsp-basic", .source="-fbounds-check x.c\n", .oracle=O_CLI,
 	 .requires=CAP_POSIX, .argv=av_rsp, .argc=2, .cli_mode=CLI_DEFAULT,
 	 .cli_action=CLI_ACT_NONE, .cli_sources=1, .cli_cc_args=0, .set_features=FB_BOUNDS},
@@ -6182,6 +7429,36 @@ static const Recipe recipes[] = {
 	 NULL, NULL, NULL, 0, "r"},
 	{"internal/spawn-classification", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
 	 NULL, NULL, NULL, 0, "q"},
+	{"internal/integrated-cpp", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "i"},
+	{"internal/output-cache", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "o"},
+	{"internal/output-cache-warnings", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "u"},
+	{"internal/object-cache", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "j"},
+	{"internal/cache-compression", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0,
+	 NULL, NULL, NULL, 0, "l"},
+	{"internal/token-cache", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "t"},
+	{"internal/prefix-snapshot", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "k"},
+	{"internal/scan-kernels", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "v"},
+	{"internal/split-tokenize", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "x"},
+	{"internal/name-interning", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0,
+	 NULL, NULL, NULL, 0, "n"},
+	{"internal/kr-soft-keyword-params", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0,
+	 NULL, NULL, NULL, 0, "g"},
+	{"internal/keyword-table", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
+	 NULL, NULL, NULL, 0, "y"},
+	{"internal/plain-bodies", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0,
+	 NULL, NULL, NULL, 0, "e"},
+	{"internal/phase-sweeps", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0,
+	 NULL, NULL, NULL, 0, "c"},
+	{"internal/plain-runs", NULL, NULL, {0}, O_INTERNAL, 0, 0, 0,
+	 NULL, NULL, NULL, 0, "f"},
 	{"internal/cache-cleanup", NULL, NULL, {0}, O_INTERNAL, 0, 0, CAP_POSIX,
 	 NULL, NULL, NULL, 0, "X"},
 };
@@ -32,6 +32,63 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* The tokenizer's scan kernels (see pparse_scan_select) use the vector unit
+ * every CPU of the target has, and AVX2 where the CPU reports it at runtime.
+ * PPARSE_NO_SIMD keeps them to plain C. */
+#ifndef PPARSE_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PPARSE_SCAN_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define PPARSE_SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define PPARSE_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/* A host whose source buffers are not all malloc'd (prism maps cache entries)
+ * names its release function here before including this file. */
+#ifndef PPARSE_FREE_SOURCE
+#define PPARSE_FREE_SOURCE free
+#endif
+
+/* A host that keeps Pass 1 prefix snapshots (see pparse_prefix_bounds) names
+ * its lookup and its store here. Without one, no snapshot is ever taken. */
+#ifndef PPARSE_PREFIX_LOAD
+#define PPARSE_PREFIX_LOAD(bounds, n, hit, want, len) ((void)(bounds), (void)(len), (const char *)NULL)
+#define PPARSE_PREFIX_STORE(snap, len) free(snap)
+#endif
+
+/* A host that lets its user pick the tokenizer's scan kernels (see
+ * pparse_scan_select) names the choice here; NULL is the fastest the CPU runs. */
+#ifndef PPARSE_SCAN_DEFAULT
+#define PPARSE_SCAN_DEFAULT NULL
+#endif
+
+/* A host that can lex a large buffer in parts at once (see pparse_lex_split)
+ * says here how many parts a buffer of `len` bytes is worth, and runs
+ * `job(arg, i, out, cap)` for each part in a worker of its own, each with
+ * `cap` bytes at `out` that the worker's `done(arg, outs)` then reads. It
+ * returns false, having called nothing, when it cannot, and `done`'s result
+ * otherwise. Without one, every buffer is lexed in one run. */
+#ifndef PPARSE_LEX_JOBS
+#define PPARSE_LEX_JOBS(len) ((void)(len), 1)
+#define PPARSE_LEX_PARALLEL(n, cap, job, done, arg) ((void)(n), (void)(cap), (void)(job), (void)(done), false)
+#endif
+
+/* A host that profiles names a millisecond clock here; pparse_analyze reads
+ * it between phases. Without one, every phase takes no time. */
+#ifndef PPARSE_CLOCK_MS
+#define PPARSE_CLOCK_MS() 0.0
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
@@ -80,9 +137,8 @@
 #define PPARSE_KW_MARKER 0x80000000ULL // Internal marker bit for keyword map: values are (tag | PPARSE_KW_MARKER)
 #define PPARSE_KW_FLAGS_SHIFT 32	// Extra token flags encoded in bits 32-47 of keyword value
 #define PPARSE_KW_LEN_SHIFT 48	// Identifier length encoded in bits 48-55
-/* Linear-probe bound shared by keyword-map insertion and lookup; they must
- * agree or a displaced keyword becomes unfindable. See pparse_init_keyword_map. */
-#define PPARSE_KW_MAX_PROBE 32
+#define PPARSE_KW_SLOTS 256	// Keyword table: a perfect hash, see pparse_keyword_slot
+#define PPARSE_KW_BUCKETS 64
 #define PPARSE_KW_SHADOW_SHIFT 56 // Dialect macro-shadow bit encoded in bits 56-58
 
 static inline bool pparse_is_hspace(char c) {
@@ -243,13 +299,6 @@ static const char PPARSE_ERR_ORELSE_DEFN_DIM[] =
  * the length compile-time and lets the optimizer fold short memcmp calls. */
 #define pparse_equal(tok, s) pparse_equal_n(_pc, tok, s, (uint32_t)(sizeof(s) - 1))
 
-#define pparse_KEYWORD_HASH(key, len)                                                                               \
-	((len) == 0 ? 0                                                                                      \
-		    : (((unsigned)(len) * 2 + (unsigned char)(key)[0] * 99 +                                 \
-			(unsigned char)((len) > 1 ? (key)[1] : (key)[0]) * 125 +                             \
-			(unsigned char)((len) > 6 ? (key)[6] : (key)[(len) - 1]) * 69) &                     \
-		       255))
-
 /* Shared capacity growth: double until >= need (or init_cap when empty). */
 static inline size_t pparse_vec_grow_cap(size_t cap, size_t need, size_t init_cap) {
 	size_t new_cap = cap == 0 ? (init_cap > 0 ? init_cap : 1) : cap * 2;
@@ -299,6 +348,7 @@ enum {
 #define PPARSE_WB_ATTR_NOISE (PPARSE_WB_FROM_PRED | PPARSE_WB_SKIP_PREP | PPARSE_WB_SKIP_ATTR | PPARSE_WB_JUMP_C23_ATTR)
 #define PPARSE_WB_SKIP_NOISE (PPARSE_WB_SKIP_PREP | PPARSE_WB_SKIP_ATTR | PPARSE_WB_JUMP_C23_ATTR | PPARSE_WB_JUMP_ATTR_PARENS)
 #define PPARSE_WB_SKIP_ATTRS (PPARSE_WB_SKIP_PREP | PPARSE_WB_SKIP_ATTR | PPARSE_WB_JUMP_C23_ATTR | PPARSE_WB_JUMP_ALL_PARENS)
+#define PPARSE_WB_STMT_EXPR (PPARSE_WB_ATTR_NOISE | PPARSE_WB_JUMP_ATTR_PARENS)
 static PParseToken *pparse_walk_back(uint32_t start_idx, unsigned flags);
 static bool pparse_is_raw_declaration_context(PParseToken *raw_kw, PParseToken *after_raw);
 
@@ -393,7 +443,7 @@ struct PParseToken {
 	uint32_t len;	    // PParseToken length in bytes (must handle >65535 for large literals)
 	union {
 		uint32_t pair_idx; // Delimiter token: paired index (0 = none)
-		uint32_t td_entry; // Identifier token: binding scratch
+		uint32_t td_entry; // Identifier token: binding scope depth
 	};
 	int32_t line_no : 18;
 	uint32_t file_idx : 14;
@@ -466,8 +516,11 @@ typedef struct {
 	PParseTypedefEntry *entries;
 	int count;
 	int capacity;
-	PParseHashMap name_map; // Maps name → (entry_index + 1) as void*, 0 = absent. Chain via prev_index.
+	int *heads;	   // By identifier id: newest entry index + 1, 0 = absent. Chain via prev_index.
+	uint32_t head_cap; // ids covered by heads
 	uint64_t bloom;	  // Bloom filter: bit (ch0 ^ len) & 63. Fast negative lookup.
+	uint64_t *bound;  // By pool index: the token owns an entry
+	uint32_t bound_cap; // tokens covered by bound
 	PParseTimelineState tl;
 } PParseTypedefTable;
 /* Long same-name chains use sorted timelines with prev_cover skip links;
@@ -497,7 +550,8 @@ typedef struct {
 	PParseBoundsArrayEntry *entries;
 	int count;
 	int capacity;
-	PParseHashMap name_map;
+	int *heads; // As PParseTypedefTable's
+	uint32_t head_cap;
 	uint64_t bloom;
 } PParseBoundsArrayTable;
 /* One TLS lookup for the complete bounds registry. */
@@ -507,10 +561,21 @@ typedef struct {
 } PParseBoundsState;
 
 typedef struct {
-	char *name;
+	const char *name;
 	uint64_t value;
 } PParseKeywordEntry;
 
+/* A distinct identifier spelling of the TU. The tokenizer numbers them densely
+ * in order of first appearance and stores the number in each identifier's
+ * parse_data, so symbol tables index arrays by it instead of hashing and
+ * comparing the spelling at every lookup. */
+typedef struct {
+	char *name; // arena copy; the text it came from may go before the tokens do
+	uint32_t len;
+	uint32_t hash; // pparse_fast_hash of the spelling
+	uint64_t kw;   // pparse_keyword_lookup of the spelling
+} PParseName;
+
 enum // Feature flags
 {
 	PPARSE_F_DEFER = 1,
@@ -560,6 +625,9 @@ typedef struct {
 	int if_depth, trail_n, snap_start;
 } PParseSosDoFrame;
 
+// The analysis phases pparse_analyze runs, in order.
+enum { PPARSE_PHASE_SCOPES, PPARSE_PHASE_PRESCAN, PPARSE_PHASE_FINALIZE, PPARSE_PHASE_CFG, PPARSE_PHASE_COUNT };
+
 typedef struct PParseContext {
 	PParseArena main_arena;
 	PParseFile *current_file;
@@ -583,10 +651,15 @@ typedef struct PParseContext {
 	 * translation a second time, changing string and character literals the
 	 * real preprocessor deliberately left alone. */
 	bool input_preprocessed;
+	uint32_t warnings; // pparse_warn_tok diagnostics printed so far
 	uint32_t tp_count;  // Next free index. 0 reserved as NULL sentinel.
 	uint32_t tp_cap;
 	uint32_t pparse_token_tag_summary; // OR of PPARSE_TT_* tags in the current token stream
-	PParseKeywordEntry kw_cache[256];
+	/* Identifier interning: names[id], found by spelling through open
+	 * addressing over slots of (hash << 32 | id + 1). */
+	PParseName *names;
+	uint64_t *name_slots;
+	uint32_t name_count, name_cap, name_slot_mask;
 
 	void *p1_scope_tree; // PParseScopeInfo[] — flat array indexed by scope_id
 	uint16_t p1_scope_count;
@@ -607,12 +680,18 @@ typedef struct PParseContext {
 	 * _Thread_local slots: it is reached through the threaded `_pc`, so it costs
 	 * a constant offset instead of a _tlv_get_addr per access. */
 	PParseTypedefTable typedef_table;
-	PParseHashMap function_symbols;
+	uint8_t *function_symbols; // PParseFunctionSymbolKind by identifier id
+	uint32_t function_symbol_cap;
 	PParseBoundsState ba;
 	PParseSosDoFrame *sos_do_frames;
 	int *sos_do_snap_buf, *sos_if_trail_snap;
 	int sos_do_cap, sos_snap_cap, sos_if_cap;
 	uint32_t td_scope_close;
+	uint32_t p1_restored; // Tokens the last prescan took from a prefix snapshot
+	/* The last analysis by PPARSE_PHASE_*: time by PPARSE_CLOCK_MS, and the
+	 * bytes of tokens, or of Pass 1 entries for CFG, each phase swept. */
+	double phase_ms[PPARSE_PHASE_COUNT];
+	uint64_t phase_bytes[PPARSE_PHASE_COUNT];
 	bool p1_has_raw_block;
 	bool parses_frozen;
 } PParseContext;
@@ -632,8 +711,8 @@ enum {
 	PPARSE_WALK_TYPEDEF_DECLARATORS = 1u << 0, /* pparse_typedef_declaration */
 	PPARSE_WALK_DECL_INITIALIZER = 1u << 1,	   /* p1d_scan_init_orelse */
 	PPARSE_WALK_BITFIELD_WIDTH = 1u << 2,	   /* p1d_probe_declaration */
-	PPARSE_WALK_TYPEDEF_PRESCAN = 1u << 3,	   /* p1_full_depth_prescan, typedef/enum */
-	PPARSE_WALK_LABEL_LIST = 1u << 4,	   /* p1_full_depth_prescan, __label__ */
+	PPARSE_WALK_TYPEDEF_PRESCAN = 1u << 3,	   /* p1_prescan_run, typedef/enum */
+	PPARSE_WALK_LABEL_LIST = 1u << 4,	   /* p1_prescan_run, __label__ */
 };
 static PRISM_THREAD_LOCAL uint32_t pparse_walk_stops;
 
@@ -658,7 +737,6 @@ static PRISM_THREAD_LOCAL uint32_t pparse_walk_stops;
 #define pparse_token_count (_pc->tp_count)
 #define pparse_token_cap (_pc->tp_cap)
 #define pparse_token_tag_summary (_pc->pparse_token_tag_summary)
-#define pparse_keyword_cache (_pc->kw_cache)
 static PRISM_COLD noreturn void pparse_error(char *fmt, ...);
 static void pparse_hashmap_put(PParseHashMap *map, char *key, int keylen, void *val);
 static void pparse_hashmap_remove(PParseHashMap *map, char *key, int keylen);
@@ -949,17 +1027,11 @@ static void pparse_hashmap_put(PParseHashMap *map, char *key, int keylen, void *
 	pparse_hashmap_put_hashed(map, key, keylen, val, pparse_fast_hash(key, keylen));
 }
 
-/* Tokenizer-only map access: parse_data still contains the lexer hash here.
- * Later parse passes use pparse_token_name_hash() because finalization may repurpose it. */
-static inline PRISM_PURE void *pparse_lex_token_map_get(PParseHashMap *map, PParseToken *tok) {
-	PPARSE_CTX();
-	if (!map->buckets) return NULL;
-	return pparse_hashmap_get_hashed(map, pparse_loc(_pc, tok), tok->len, tok->parse_data);
-}
-
-static inline void pparse_lex_token_map_put(PParseHashMap *map, PParseToken *tok, void *value) {
-	PPARSE_CTX();
-	pparse_hashmap_put_hashed(map, pparse_loc(_pc, tok), tok->len, value, tok->parse_data);
+/* A zeroed array with an element per identifier id, for tokenizer-only maps:
+ * parse_data still holds every identifier's id there. Later passes use
+ * pparse_token_name_id() because Pass 1 repurposes it on a few tokens. */
+static void *pparse_lex_name_array(PParseContext *_pc, size_t elem_size) {
+	return pparse_arena_alloc(&_pc->main_arena, (size_t)_pc->name_count * elem_size);
 }
 
 
@@ -1092,6 +1164,7 @@ static PRISM_COLD void pparse_warn_tok(PParseToken *tok, const char *fmt, ...) {
 	va_list ap;
 	va_start(ap, fmt);
 	PParseFile *f = pparse_tok_file(tok);
+	_pc->warnings++;
 	pparse_verror_at(f->name, _pc->token_source, pparse_tok_line_no(tok), pparse_loc(_pc, tok), "warning", fmt, ap);
 	va_end(ap);
 #endif
@@ -1148,200 +1221,6 @@ static inline PRISM_PURE bool pparse_is_gnu_label_decl_head(PParseToken *tok) {
 	return tok->len == 9 && tok->ch0 == '_' && prism_memeq_static(pparse_loc(_pc, tok), "__label__", 9);
 }
 
-static void pparse_init_keyword_map(void) {
-	PPARSE_CTX();
-#if defined(_MSC_VER)
-#pragma warning(push)
-#else
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
-#endif
-	static struct {
-		char *name;
-		uint32_t tag;
-		bool is_kw;
-		uint16_t extra_flags;
-	} entries[] = {
-	    {"return", PPARSE_TT_SKIP_DECL | PPARSE_TT_RETURN, true},
-	    {"if", PPARSE_TT_SKIP_DECL | PPARSE_TT_IF, true},
-	    {"else", PPARSE_TT_SKIP_DECL | PPARSE_TT_IF, true},
-	    {"for", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, true},
-	    {"while", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, true},
-	    {"do", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, true},
-	    {"switch", PPARSE_TT_SKIP_DECL | PPARSE_TT_SWITCH, true},
-	    {"case", PPARSE_TT_SKIP_DECL | PPARSE_TT_CASE, true},
-	    {"default", PPARSE_TT_SKIP_DECL | PPARSE_TT_DEFAULT, true},
-	    {"break", PPARSE_TT_SKIP_DECL | PPARSE_TT_BREAK, true},
-	    {"continue", PPARSE_TT_SKIP_DECL | PPARSE_TT_CONTINUE, true},
-	    {"goto", PPARSE_TT_SKIP_DECL | PPARSE_TT_GOTO, true},
-	    {"sizeof", PPARSE_TT_SKIP_DECL, true, PPARSE_TF_SIZEOF},
-	    {"alignof", PPARSE_TT_SKIP_DECL, true, PPARSE_TF_SIZEOF | PPARSE_TF_ALIGNOF | PPARSE_TF_SOFT_KW},
-	    {"_Alignof", PPARSE_TT_SKIP_DECL, true, PPARSE_TF_SIZEOF | PPARSE_TF_ALIGNOF},
-	    {"_Generic", PPARSE_TT_SKIP_DECL | PPARSE_TT_GENERIC, true},
-	    {"_Static_assert", PPARSE_TT_SKIP_DECL, true, PPARSE_TF_STATIC_ASSERT},
-	    {"static_assert", PPARSE_TT_SKIP_DECL, true, PPARSE_TF_SOFT_KW | PPARSE_TF_STATIC_ASSERT},
-	    {"struct", PPARSE_TT_TYPE | PPARSE_TT_SUE, true},
-	    {"union", PPARSE_TT_TYPE | PPARSE_TT_SUE, true},
-	    {"enum", PPARSE_TT_TYPE | PPARSE_TT_SUE, true},
-	    {"typedef", PPARSE_TT_SKIP_DECL | PPARSE_TT_TYPEDEF, true},
-	    {"static", PPARSE_TT_QUALIFIER | PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, true},
-	    {"extern", PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, true},
-	    {"inline", PPARSE_TT_INLINE, true},
-	    {"const", PPARSE_TT_QUALIFIER | PPARSE_TT_CONST, true},
-	    {"volatile", PPARSE_TT_QUALIFIER | PPARSE_TT_VOLATILE, true},
-	    {"restrict", PPARSE_TT_QUALIFIER, true},
-	    {"_Atomic", PPARSE_TT_QUALIFIER | PPARSE_TT_TYPE, true},
-	    {"_Nonnull", PPARSE_TT_QUALIFIER, true},
-	    {"_Nullable", PPARSE_TT_QUALIFIER, true},
-	    {"_Null_unspecified", PPARSE_TT_QUALIFIER, true},
-	    {"_Noreturn", PPARSE_TT_SKIP_DECL | PPARSE_TT_INLINE, true},
-	    {"noreturn", PPARSE_TT_SKIP_DECL | PPARSE_TT_INLINE, true, PPARSE_TF_SOFT_KW},
-	    {"__inline", PPARSE_TT_INLINE, true},
-	    {"__inline__", PPARSE_TT_INLINE, true},
-	    {"_Thread_local", PPARSE_TT_STORAGE, true},
-	    {"__thread", PPARSE_TT_STORAGE, true},
-	    {"constexpr", PPARSE_TT_QUALIFIER, true, PPARSE_TF_SOFT_KW},
-	    {"thread_local", PPARSE_TT_QUALIFIER | PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, true, PPARSE_TF_SOFT_KW},
-	    {"void", PPARSE_TT_TYPE, true},
-	    {"char", PPARSE_TT_TYPE, true},
-	    {"short", PPARSE_TT_TYPE, true},
-	    {"int", PPARSE_TT_TYPE, true},
-	    {"long", PPARSE_TT_TYPE, true},
-	    {"float", PPARSE_TT_TYPE, true},
-	    {"double", PPARSE_TT_TYPE, true},
-	    {"signed", PPARSE_TT_TYPE, true},
-	    {"unsigned", PPARSE_TT_TYPE, true},
-	    {"_Bool", PPARSE_TT_TYPE, true},
-	    {"bool", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Complex", PPARSE_TT_TYPE, true},
-	    {"_Imaginary", PPARSE_TT_TYPE, true},
-	    /* Extension type spellings are soft: after an established type they
-	     * are ordinary declarator names (`int _Float32;`, `int __int64;`) on
-	     * clang/gcc, matching `bool`. As a lone type specifier they keep
-	     * PPARSE_TT_TYPE so `_Float32 x;` / `__int64 y;` still zero-init. */
-	    {"__int128", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__int128_t", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__uint128", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__uint128_t", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__int8", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__int16", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__int32", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__int64", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__float128", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__float80", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__fp16", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"__bf16", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float16", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float32", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float64", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float128", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float32x", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float64x", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Float128x", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Decimal32", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Decimal64", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"_Decimal128", PPARSE_TT_TYPE, true, PPARSE_TF_SOFT_KW},
-	    {"typeof_unqual", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true, PPARSE_TF_SOFT_KW},
-	    {"__typeof_unqual__", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true},
-	    {"__typeof_unqual", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true},
-	    {"auto", PPARSE_TT_QUALIFIER | PPARSE_TT_TYPE, true},
-	    {"register", PPARSE_TT_QUALIFIER | PPARSE_TT_REGISTER, true},
-	    {"_Alignas", PPARSE_TT_QUALIFIER | PPARSE_TT_ALIGNAS, true},
-	    {"alignas", PPARSE_TT_QUALIFIER | PPARSE_TT_ALIGNAS, true, PPARSE_TF_SOFT_KW},
-	    {"typeof", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true, PPARSE_TF_SOFT_KW},
-	    {"__typeof__", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true},
-	    {"__typeof", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true},
-	    {"__auto_type", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, true},
-	    {"_BitInt", PPARSE_TT_TYPE | PPARSE_TT_BITINT, true},
-	    {"asm", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, true, PPARSE_TF_SOFT_KW},
-	    {"__asm__", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, true},
-	    {"__asm", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, true},
-	    {"__attribute__", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, true},
-	    {"__attribute", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, true},
-	    {"__declspec", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, true},
-	    {"__cdecl", 0, true, PPARSE_TF_MS_CC},
-	    {"__stdcall", 0, true, PPARSE_TF_MS_CC},
-	    {"__fastcall", 0, true, PPARSE_TF_MS_CC},
-	    {"__thiscall", 0, true, PPARSE_TF_MS_CC},
-	    {"__vectorcall", 0, true, PPARSE_TF_MS_CC},
-	    {"_cdecl", 0, true, PPARSE_TF_MS_CC},
-	    {"_stdcall", 0, true, PPARSE_TF_MS_CC},
-	    {"_fastcall", 0, true, PPARSE_TF_MS_CC},
-	    {"cdecl", 0, true, PPARSE_TF_MS_CC | PPARSE_TF_SOFT_KW},
-	    {"stdcall", 0, true, PPARSE_TF_MS_CC | PPARSE_TF_SOFT_KW},
-	    {"_Pragma", PPARSE_TT_ATTR, true},
-	    {"__pragma", PPARSE_TT_ATTR, true},
-	    {"__extension__", PPARSE_TT_INLINE, true},
-	    {"__builtin_va_list", 0, true},
-	    {"__builtin_va_arg", 0, true},
-	    {"__builtin_offsetof", 0, true, PPARSE_TF_SIZEOF | PPARSE_TF_OFFSETOF},
-	    {"offsetof", 0, true, PPARSE_TF_SIZEOF | PPARSE_TF_OFFSETOF | PPARSE_TF_SOFT_KW},
-	    {"__restrict", PPARSE_TT_QUALIFIER, true},
-	    {"__restrict__", PPARSE_TT_QUALIFIER, true},
-	    {"__builtin_types_compatible_p", 0, true},
-	    {"defer", PPARSE_TT_DEFER, true},
-	    {"orelse", PPARSE_TT_ORELSE, true},
-	    {"raw", 0, true, PPARSE_TF_RAW},
-	    {"exit", PPARSE_TT_NORETURN_FN, false},
-	    {"_Exit", PPARSE_TT_NORETURN_FN, false},
-	    {"_exit", PPARSE_TT_NORETURN_FN, false},
-	    {"abort", PPARSE_TT_NORETURN_FN, false},
-	    {"quick_exit", PPARSE_TT_NORETURN_FN, false},
-	    {"__builtin_trap", PPARSE_TT_NORETURN_FN, false},
-	    {"__builtin_unreachable", PPARSE_TT_NORETURN_FN, false},
-	    {"thrd_exit", PPARSE_TT_NORETURN_FN, false},
-	    {"setjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"longjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"_setjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"_longjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"sigsetjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"siglongjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__sigsetjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__siglongjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__setjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__longjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__longjmp_chk", PPARSE_TT_SPECIAL_FN, false},
-	    {"pthread_exit", PPARSE_TT_SPECIAL_FN, false},
-	    {"__builtin_setjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__builtin_longjmp", PPARSE_TT_SPECIAL_FN, false},
-	    {"__builtin_setjmp_receive", PPARSE_TT_SPECIAL_FN, false},
-	    {"savectx", PPARSE_TT_SPECIAL_FN, false},
-	    {"vfork", PPARSE_TT_SPECIAL_FN, false},
-	};
-#if defined(_MSC_VER)
-#pragma warning(pop)
-#else
-#pragma GCC diagnostic pop
-#endif
-
-	memset(pparse_keyword_cache, 0, sizeof(pparse_keyword_cache));
-	for (size_t i = 0; i < sizeof(entries) / sizeof(*entries); i++) {
-		int len = strlen(entries[i].name);
-		uint64_t val = entries[i].is_kw ? (entries[i].tag | PPARSE_KW_MARKER) : entries[i].tag;
-		val |= (uint64_t)entries[i].extra_flags << PPARSE_KW_FLAGS_SHIFT;
-		val |= (uint64_t)(uint8_t)len << PPARSE_KW_LEN_SHIFT;
-		unsigned shadow = entries[i].tag & PPARSE_TT_DEFER ? PPARSE_KWSHADOW_DEFER
-				  : entries[i].tag & PPARSE_TT_ORELSE ? PPARSE_KWSHADOW_ORELSE
-				  : entries[i].extra_flags & PPARSE_TF_RAW ? PPARSE_KWSHADOW_RAW : 0;
-		val |= (uint64_t)shadow << PPARSE_KW_SHADOW_SHIFT;
-		unsigned slot = pparse_KEYWORD_HASH(entries[i].name, len);
-		unsigned probe = 0;
-		while (pparse_keyword_cache[slot & 255].name) {
-			slot++;
-			probe++;
-		}
-		/* Insertion probes without a bound, lookup gives up after
-		 * PPARSE_KW_MAX_PROBE. A keyword displaced further than that would be
-		 * stored and then never found again -- silently not a keyword. At 141
-		 * entries in 256 slots the worst displacement is 10, so the two agree
-		 * with room to spare; this fires if a future keyword closes the gap. */
-		if (probe >= PPARSE_KW_MAX_PROBE)
-			pparse_error("internal: keyword '%s' displaced %u slots, past the lookup probe limit",
-				     entries[i].name, probe);
-		pparse_keyword_cache[slot & 255] = (PParseKeywordEntry){.name = entries[i].name, .value = val};
-	}
-}
-
 /* C11 6.4.3: \uXXXX (4 hex) or \UXXXXXXXX (8 hex). Returns length or 0. */
 static int pparse_read_ucn(char *p) {
 	if (*p != '\\') return 0;
@@ -1361,6 +1240,328 @@ static int pparse_read_ucn(char *p) {
 #define pparse_SWAR_HAS_ZERO(v) (((v) - 0x0101010101010101ULL) & ~(v) & 0x8080808080808080ULL)
 #define pparse_SWAR_BROADCAST(c) (0x0101010101010101ULL * (uint8_t)(c))
 
+/* ---- Scan kernels ----------------------------------------------------------
+ * The tokenizer's long scans -- whitespace runs, identifier tails, comment and
+ * string bodies, the rest of a directive line -- each ask one question of a
+ * run of bytes: where does it stop, and how many newlines did it cross. A
+ * kernel set answers the three shapes of that question for one instruction
+ * set. `until` stops at the first of three bytes or NUL, `space` at the first
+ * byte that is not C whitespace, `ident` at the first byte that cannot
+ * continue an identifier (pparse_ident_char); the first two add the newlines
+ * they passed to `*newlines`.
+ *
+ * The vector kernels load whole aligned blocks, starting with the one that
+ * holds `p` and masking off the bytes before it. An aligned block never
+ * crosses a page, so reading the end of the block past the terminating NUL
+ * (or the head before `p`) cannot fault; the address sanitizer is told so.
+ * The "scalar" set is the byte-at-a-time reference every other set must agree
+ * with token for token (see pparse_scan_select). */
+typedef struct {
+	const char *name;
+	char *(*until)(char *p, int a, int b, int c, int *newlines);
+	char *(*space)(char *p, int *newlines);
+	char *(*ident)(char *p);
+} PParseScanKernel;
+
+#if defined(__SANITIZE_ADDRESS__)
+#define PPARSE_SCAN_NO_ASAN __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define PPARSE_SCAN_NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef PPARSE_SCAN_NO_ASAN
+#define PPARSE_SCAN_NO_ASAN
+#endif
+
+static inline unsigned pparse_ctz64(uint64_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long i;
+	_BitScanForward64(&i, v);
+	return (unsigned)i;
+#else
+	return (unsigned)__builtin_ctzll(v);
+#endif
+}
+
+static inline int pparse_popcount64(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(v);
+#else
+	v -= (v >> 1) & 0x5555555555555555ULL;
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static char *pparse_scan_until_scalar(char *p, int a, int b, int c, int *newlines) {
+	int nl = 0;
+	for (;; p++) {
+		char x = *p;
+		if (x == (char)a || x == (char)b || x == (char)c || x == '\0') break;
+		nl += x == '\n';
+	}
+	*newlines += nl;
+	return p;
+}
+
+static char *pparse_scan_space_scalar(char *p, int *newlines) {
+	int nl = 0;
+	for (;; p++) {
+		unsigned char x = (unsigned char)*p;
+		if (x != ' ' && (unsigned)(x - '\t') > '\r' - '\t') break;
+		nl += x == '\n';
+	}
+	*newlines += nl;
+	return p;
+}
+
+static char *pparse_scan_ident_scalar(char *p) {
+	while (pparse_ident_char[(unsigned char)*p]) p++;
+	return p;
+}
+
+/* Eight bytes at a time in a general register: no instruction set needed,
+ * and what the comment scanners always used. */
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_until_swar(char *p, int a, int b, int c, int *newlines) {
+	while ((uintptr_t)p & 7) {
+		char x = *p;
+		if (x == (char)a || x == (char)b || x == (char)c || x == '\0') return p;
+		*newlines += x == '\n';
+		p++;
+	}
+	uint64_t ma = pparse_SWAR_BROADCAST(a), mb = pparse_SWAR_BROADCAST(b), mc = pparse_SWAR_BROADCAST(c);
+	uint64_t mn = pparse_SWAR_BROADCAST('\n');
+	for (;; p += 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		if (pparse_SWAR_HAS_ZERO(v) || pparse_SWAR_HAS_ZERO(v ^ ma) || pparse_SWAR_HAS_ZERO(v ^ mb) ||
+		    pparse_SWAR_HAS_ZERO(v ^ mc))
+			return pparse_scan_until_scalar(p, a, b, c, newlines);
+		/* The zero test is exact only for the lowest match; a byte-wise
+		 * compare-and-count keeps the newline total exact. */
+		if (pparse_SWAR_HAS_ZERO(v ^ mn))
+			for (int i = 0; i < 8; i++) *newlines += p[i] == '\n';
+	}
+}
+
+#if PPARSE_SCAN_SSE2 || PPARSE_SCAN_NEON
+/* Stop bits of a block at or after `at`, and the newlines before the first
+ * of them. `bits` is the number of mask bits per byte. */
+#define PPARSE_SCAN_BLOCK_END(stop, lf, bits, base, newlines)                                        \
+	do {                                                                                         \
+		if (stop) {                                                                          \
+			unsigned at_ = pparse_ctz64(stop);                                           \
+			*(newlines) += pparse_popcount64((lf) & ((1ULL << at_) - 1)) / (bits);       \
+			return (char *)(base) + at_ / (bits);                                        \
+		}                                                                                    \
+		*(newlines) += pparse_popcount64(lf) / (bits);                                       \
+	} while (0)
+#endif
+
+#if PPARSE_SCAN_SSE2
+#define PPARSE_SSE2_IN_RANGE(v, lo, span)                                                            \
+	_mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8((v), _mm_set1_epi8((char)(lo))), _mm_set1_epi8((char)(span))), \
+		       _mm_sub_epi8((v), _mm_set1_epi8((char)(lo))))
+
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_until_sse2(char *p, int a, int b, int c, int *newlines) {
+	const __m128i va = _mm_set1_epi8((char)a), vb = _mm_set1_epi8((char)b), vc = _mm_set1_epi8((char)c);
+	const __m128i vz = _mm_setzero_si128(), vn = _mm_set1_epi8('\n');
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+	uint64_t keep = (0xFFFFULL << (p - q)) & 0xFFFF;
+	for (;; q += 16, keep = 0xFFFF) {
+		__m128i v = _mm_load_si128((const __m128i *)q);
+		__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+					   _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vz)));
+		uint64_t stop = (uint64_t)(unsigned)_mm_movemask_epi8(hit) & keep;
+		uint64_t lf = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vn)) & keep;
+		PPARSE_SCAN_BLOCK_END(stop, lf, 1, q, newlines);
+	}
+}
+
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_space_sse2(char *p, int *newlines) {
+	const __m128i vs = _mm_set1_epi8(' '), vn = _mm_set1_epi8('\n');
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+	uint64_t keep = (0xFFFFULL << (p - q)) & 0xFFFF;
+	for (;; q += 16, keep = 0xFFFF) {
+		__m128i v = _mm_load_si128((const __m128i *)q);
+		__m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, vs), PPARSE_SSE2_IN_RANGE(v, '\t', '\r' - '\t'));
+		uint64_t stop = ~(uint64_t)(unsigned)_mm_movemask_epi8(ws) & keep;
+		uint64_t lf = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vn)) & keep;
+		PPARSE_SCAN_BLOCK_END(stop, lf, 1, q, newlines);
+	}
+}
+
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_ident_sse2(char *p) {
+	const __m128i vu = _mm_set1_epi8('_'), vd = _mm_set1_epi8('$'), v20 = _mm_set1_epi8(0x20);
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+	uint64_t keep = (0xFFFFULL << (p - q)) & 0xFFFF;
+	for (;; q += 16, keep = 0xFFFF) {
+		__m128i v = _mm_load_si128((const __m128i *)q);
+		/* Bytes >= 0x80 are identifier bytes too: their sign bit is the mask. */
+		__m128i id = _mm_or_si128(_mm_or_si128(PPARSE_SSE2_IN_RANGE(v, '0', 9),
+						       PPARSE_SSE2_IN_RANGE(_mm_or_si128(v, v20), 'a', 25)),
+					  _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, vu), _mm_cmpeq_epi8(v, vd)), v));
+		uint64_t stop = ~(uint64_t)(unsigned)_mm_movemask_epi8(id) & keep;
+		if (stop) return (char *)q + pparse_ctz64(stop);
+	}
+}
+#endif
+
+#if PPARSE_SCAN_AVX2
+#define PPARSE_AVX2_IN_RANGE(v, lo, span)                                                            \
+	_mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8((v), _mm256_set1_epi8((char)(lo))),          \
+					  _mm256_set1_epi8((char)(span))),                             \
+			  _mm256_sub_epi8((v), _mm256_set1_epi8((char)(lo))))
+
+static __attribute__((target("avx2"))) PPARSE_SCAN_NO_ASAN char *
+pparse_scan_until_avx2(char *p, int a, int b, int c, int *newlines) {
+	const __m256i va = _mm256_set1_epi8((char)a), vb = _mm256_set1_epi8((char)b);
+	const __m256i vc = _mm256_set1_epi8((char)c), vz = _mm256_setzero_si256(), vn = _mm256_set1_epi8('\n');
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)31);
+	uint64_t keep = (0xFFFFFFFFULL << (p - q)) & 0xFFFFFFFF;
+	for (;; q += 32, keep = 0xFFFFFFFF) {
+		__m256i v = _mm256_load_si256((const __m256i *)q);
+		__m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+					      _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), _mm256_cmpeq_epi8(v, vz)));
+		uint64_t stop = (uint64_t)(unsigned)_mm256_movemask_epi8(hit) & keep;
+		uint64_t lf = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vn)) & keep;
+		PPARSE_SCAN_BLOCK_END(stop, lf, 1, q, newlines);
+	}
+}
+
+static __attribute__((target("avx2"))) PPARSE_SCAN_NO_ASAN char *pparse_scan_space_avx2(char *p, int *newlines) {
+	const __m256i vs = _mm256_set1_epi8(' '), vn = _mm256_set1_epi8('\n');
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)31);
+	uint64_t keep = (0xFFFFFFFFULL << (p - q)) & 0xFFFFFFFF;
+	for (;; q += 32, keep = 0xFFFFFFFF) {
+		__m256i v = _mm256_load_si256((const __m256i *)q);
+		__m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, vs), PPARSE_AVX2_IN_RANGE(v, '\t', '\r' - '\t'));
+		uint64_t stop = ~(uint64_t)(unsigned)_mm256_movemask_epi8(ws) & keep;
+		uint64_t lf = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vn)) & keep;
+		PPARSE_SCAN_BLOCK_END(stop, lf, 1, q, newlines);
+	}
+}
+
+static __attribute__((target("avx2"))) PPARSE_SCAN_NO_ASAN char *pparse_scan_ident_avx2(char *p) {
+	const __m256i vu = _mm256_set1_epi8('_'), vd = _mm256_set1_epi8('$'), v20 = _mm256_set1_epi8(0x20);
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)31);
+	uint64_t keep = (0xFFFFFFFFULL << (p - q)) & 0xFFFFFFFF;
+	for (;; q += 32, keep = 0xFFFFFFFF) {
+		__m256i v = _mm256_load_si256((const __m256i *)q);
+		__m256i id = _mm256_or_si256(
+		    _mm256_or_si256(PPARSE_AVX2_IN_RANGE(v, '0', 9), PPARSE_AVX2_IN_RANGE(_mm256_or_si256(v, v20), 'a', 25)),
+		    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, vu), _mm256_cmpeq_epi8(v, vd)), v));
+		uint64_t stop = ~(uint64_t)(unsigned)_mm256_movemask_epi8(id) & keep;
+		if (stop) return (char *)q + pparse_ctz64(stop);
+	}
+}
+#endif
+
+#if PPARSE_SCAN_NEON
+/* NEON has no byte movemask. Narrowing each 16-bit lane by four keeps four
+ * bits per byte in one 64-bit word, so a match at byte i is bit 4i. */
+static inline uint64_t pparse_neon_mask(uint8x16_t m) {
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+#define PPARSE_NEON_IN_RANGE(v, lo, span) vcleq_u8(vsubq_u8((v), vdupq_n_u8(lo)), vdupq_n_u8(span))
+
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_until_neon(char *p, int a, int b, int c, int *newlines) {
+	const uint8x16_t va = vdupq_n_u8((uint8_t)a), vb = vdupq_n_u8((uint8_t)b), vc = vdupq_n_u8((uint8_t)c);
+	const uint8x16_t vz = vdupq_n_u8(0), vn = vdupq_n_u8('\n');
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+	uint64_t keep = ~0ULL << ((p - q) * 4);
+	for (;; q += 16, keep = ~0ULL) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)q);
+		uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+					  vorrq_u8(vceqq_u8(v, vc), vceqq_u8(v, vz)));
+		uint64_t stop = pparse_neon_mask(hit) & keep;
+		uint64_t lf = pparse_neon_mask(vceqq_u8(v, vn)) & keep;
+		PPARSE_SCAN_BLOCK_END(stop, lf, 4, q, newlines);
+	}
+}
+
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_space_neon(char *p, int *newlines) {
+	const uint8x16_t vs = vdupq_n_u8(' '), vn = vdupq_n_u8('\n');
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+	uint64_t keep = ~0ULL << ((p - q) * 4);
+	for (;; q += 16, keep = ~0ULL) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)q);
+		uint8x16_t ws = vorrq_u8(vceqq_u8(v, vs), PPARSE_NEON_IN_RANGE(v, '\t', '\r' - '\t'));
+		uint64_t stop = ~pparse_neon_mask(ws) & keep;
+		uint64_t lf = pparse_neon_mask(vceqq_u8(v, vn)) & keep;
+		PPARSE_SCAN_BLOCK_END(stop, lf, 4, q, newlines);
+	}
+}
+
+static PPARSE_SCAN_NO_ASAN char *pparse_scan_ident_neon(char *p) {
+	const uint8x16_t vu = vdupq_n_u8('_'), vd = vdupq_n_u8('$'), v20 = vdupq_n_u8(0x20);
+	const uint8x16_t vhi = vdupq_n_u8(0x80);
+	const char *q = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+	uint64_t keep = ~0ULL << ((p - q) * 4);
+	for (;; q += 16, keep = ~0ULL) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)q);
+		uint8x16_t id = vorrq_u8(vorrq_u8(PPARSE_NEON_IN_RANGE(v, '0', 9),
+						  PPARSE_NEON_IN_RANGE(vorrq_u8(v, v20), 'a', 25)),
+					 vorrq_u8(vorrq_u8(vceqq_u8(v, vu), vceqq_u8(v, vd)), vcgeq_u8(v, vhi)));
+		uint64_t stop = ~pparse_neon_mask(id) & keep;
+		if (stop) return (char *)q + pparse_ctz64(stop) / 4;
+	}
+}
+#endif
+
+static const PParseScanKernel pparse_scan_kernels[] = {
+#if PPARSE_SCAN_AVX2
+    {"avx2", pparse_scan_until_avx2, pparse_scan_space_avx2, pparse_scan_ident_avx2},
+#endif
+#if PPARSE_SCAN_SSE2
+    {"sse2", pparse_scan_until_sse2, pparse_scan_space_sse2, pparse_scan_ident_sse2},
+#endif
+#if PPARSE_SCAN_NEON
+    {"neon", pparse_scan_until_neon, pparse_scan_space_neon, pparse_scan_ident_neon},
+#endif
+    {"swar", pparse_scan_until_swar, pparse_scan_space_scalar, pparse_scan_ident_scalar},
+    {"scalar", pparse_scan_until_scalar, pparse_scan_space_scalar, pparse_scan_ident_scalar},
+};
+
+static PRISM_THREAD_LOCAL const PParseScanKernel *pparse_scan;
+
+static bool pparse_scan_supported(const PParseScanKernel *k) {
+#if PPARSE_SCAN_AVX2
+	if (k->until == pparse_scan_until_avx2) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	(void)k;
+	return true;
+}
+
+/* Selects the kernel set named `name` for this thread, or the fastest one the
+ * CPU runs when `name` is NULL or not one this build has. Returns the name of
+ * the set in use. */
+static const char *pparse_scan_select(const char *name) {
+	const PParseScanKernel *best = NULL;
+	for (size_t i = 0; i < sizeof pparse_scan_kernels / sizeof *pparse_scan_kernels; i++) {
+		const PParseScanKernel *k = &pparse_scan_kernels[i];
+		if (!pparse_scan_supported(k)) continue;
+		if (!best) best = k;
+		if (name && !strcmp(name, k->name)) {
+			best = k;
+			break;
+		}
+	}
+	pparse_scan = best;
+	return best->name;
+}
+
+static inline PRISM_ALWAYS_INLINE const PParseScanKernel *pparse_scan_kernel(void) {
+	if (__builtin_expect(!pparse_scan, 0)) pparse_scan_select(PPARSE_SCAN_DEFAULT);
+	return pparse_scan;
+}
+
 static inline __attribute__((always_inline)) PParseToken *
 pparse_new_token(PParseTokenKind kind, char *start, char *end, PParseTokState *ts) {
 	PPARSE_CTX();
@@ -1395,14 +1596,13 @@ pparse_new_token(PParseTokenKind kind, char *start, char *end, PParseTokState *t
 }
 
 static char *pparse_string_literal_end(char *p) {
-	for (; *p != '"'; p++) {
-		if (*p == '\0') pparse_error_at(p, "unclosed string literal");
-		if (*p == '\\') {
-			if (p[1] == '\0') pparse_error_at(p, "unclosed string literal");
-			p++;
-		}
+	const PParseScanKernel *sk = pparse_scan_kernel();
+	int newlines = 0;
+	for (;; p += 2) {
+		p = sk->until(p, '"', '\\', '\\', &newlines);
+		if (*p == '"') return p;
+		if (*p == '\0' || p[1] == '\0') pparse_error_at(p, "unclosed string literal");
 	}
-	return p;
 }
 static PParseToken *pparse_read_string_literal(char *start, char *quote, PParseTokState *ts) {
 	char *end = pparse_string_literal_end(quote + 1);
@@ -1488,11 +1688,6 @@ static PParseFile *pparse_add_input_file(PParseFile file) {
 	return stored;
 }
 
-static void pparse_ensure_keyword_cache(void) {
-	PPARSE_CTX();
-	if (!pparse_keyword_cache[0].name && !pparse_keyword_cache[1].name) pparse_init_keyword_map();
-}
-
 /* Track the three dialect spellings in the directive pass the tokenizer must
  * make anyway. This preserves macro point-of-definition and #undef semantics. */
 static inline unsigned pparse_update_kw_shadow(char *p, unsigned mask) {
@@ -1515,19 +1710,243 @@ static inline unsigned pparse_update_kw_shadow(char *p, unsigned mask) {
 	return define ? mask | bit : mask & ~bit;
 }
 
-static inline PRISM_ALWAYS_INLINE PRISM_PURE uint64_t
-pparse_keyword_lookup(PParseContext *_pc, char *key, int keylen) {
+/* A keyword's table value: its tag (with PPARSE_KW_MARKER unless it is one of
+ * the special function names), extra token flags, length and shadow bit. */
+#define PPARSE_KW_VALUE(name, tag, flags, marker)                                                        \
+	((uint64_t)(tag) | (marker) | (uint64_t)(flags) << PPARSE_KW_FLAGS_SHIFT |                        \
+	 (uint64_t)(sizeof(name) - 1) << PPARSE_KW_LEN_SHIFT |                                           \
+	 (uint64_t)((tag) & PPARSE_TT_DEFER	  ? PPARSE_KWSHADOW_DEFER                              \
+		    : (tag) & PPARSE_TT_ORELSE ? PPARSE_KWSHADOW_ORELSE                             \
+		    : (flags) & PPARSE_TF_RAW  ? PPARSE_KWSHADOW_RAW                                \
+					       : 0)                                                 \
+	     << PPARSE_KW_SHADOW_SHIFT)
+#define PPARSE_KW(name, tag, flags) {name, PPARSE_KW_VALUE(name, tag, flags, PPARSE_KW_MARKER)}
+#define PPARSE_KW_FN(name, tag) {name, PPARSE_KW_VALUE(name, tag, 0, 0)}
+
+/* BEGIN keyword table: generated by .github/keywords.c, edit the list there. */
+#define PPARSE_KW_SEED 0x9e3779b3u
+static const uint8_t pparse_keyword_disp[PPARSE_KW_BUCKETS] = {
+    0, 4, 0, 0, 8, 1, 0, 0, 3, 2, 4, 1, 1, 0, 6, 0,
+    0, 0, 4, 2, 0, 1, 1, 1, 1, 0, 1, 0, 2, 7, 2, 8,
+    3, 0, 0, 0, 1, 4, 0, 0, 0, 1, 2, 4, 0, 0, 5, 2,
+    1, 11, 2, 0, 2, 0, 0, 0, 3, 22, 11, 0, 0, 0, 1, 0,
+};
+static const PParseKeywordEntry pparse_keyword_table[PPARSE_KW_SLOTS] = {
+    [0] = PPARSE_KW("__int64", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [1] = PPARSE_KW("break", PPARSE_TT_SKIP_DECL | PPARSE_TT_BREAK, 0),
+    [2] = PPARSE_KW("__restrict__", PPARSE_TT_QUALIFIER, 0),
+    [3] = PPARSE_KW("__bf16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [4] = PPARSE_KW("__typeof", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    [7] = PPARSE_KW("void", PPARSE_TT_TYPE, 0),
+    [10] = PPARSE_KW("typeof_unqual", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, PPARSE_TF_SOFT_KW),
+    [11] = PPARSE_KW("__int32", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [12] = PPARSE_KW("extern", PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, 0),
+    [14] = PPARSE_KW_FN("sigsetjmp", PPARSE_TT_SPECIAL_FN),
+    [15] = PPARSE_KW("_Pragma", PPARSE_TT_ATTR, 0),
+    [17] = PPARSE_KW_FN("__longjmp_chk", PPARSE_TT_SPECIAL_FN),
+    [23] = PPARSE_KW("__inline__", PPARSE_TT_INLINE, 0),
+    [25] = PPARSE_KW("struct", PPARSE_TT_TYPE | PPARSE_TT_SUE, 0),
+    [31] = PPARSE_KW_FN("__siglongjmp", PPARSE_TT_SPECIAL_FN),
+    [32] = PPARSE_KW("_Generic", PPARSE_TT_SKIP_DECL | PPARSE_TT_GENERIC, 0),
+    [33] = PPARSE_KW("_Float32x", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [34] = PPARSE_KW("for", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, 0),
+    [35] = PPARSE_KW("_Float128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [36] = PPARSE_KW("__attribute", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, 0),
+    [37] = PPARSE_KW_FN("__builtin_unreachable", PPARSE_TT_NORETURN_FN),
+    [38] = PPARSE_KW_FN("__builtin_setjmp", PPARSE_TT_SPECIAL_FN),
+    [39] = PPARSE_KW("__fastcall", 0, PPARSE_TF_MS_CC),
+    [40] = PPARSE_KW("_Decimal128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [41] = PPARSE_KW("_stdcall", 0, PPARSE_TF_MS_CC),
+    [42] = PPARSE_KW("_Null_unspecified", PPARSE_TT_QUALIFIER, 0),
+    [43] = PPARSE_KW("case", PPARSE_TT_SKIP_DECL | PPARSE_TT_CASE, 0),
+    [44] = PPARSE_KW("goto", PPARSE_TT_SKIP_DECL | PPARSE_TT_GOTO, 0),
+    [45] = PPARSE_KW_FN("_longjmp", PPARSE_TT_SPECIAL_FN),
+    [47] = PPARSE_KW_FN("quick_exit", PPARSE_TT_NORETURN_FN),
+    [48] = PPARSE_KW("_Float64x", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [51] = PPARSE_KW("__inline", PPARSE_TT_INLINE, 0),
+    [52] = PPARSE_KW_FN("thrd_exit", PPARSE_TT_NORETURN_FN),
+    [53] = PPARSE_KW("while", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, 0),
+    [54] = PPARSE_KW("__int8", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [55] = PPARSE_KW("__thread", PPARSE_TT_STORAGE, 0),
+    [60] = PPARSE_KW("enum", PPARSE_TT_TYPE | PPARSE_TT_SUE, 0),
+    [61] = PPARSE_KW_FN("__builtin_trap", PPARSE_TT_NORETURN_FN),
+    [62] = PPARSE_KW("_BitInt", PPARSE_TT_TYPE | PPARSE_TT_BITINT, 0),
+    [63] = PPARSE_KW("__auto_type", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    [64] = PPARSE_KW("__thiscall", 0, PPARSE_TF_MS_CC),
+    [71] = PPARSE_KW_FN("pthread_exit", PPARSE_TT_SPECIAL_FN),
+    [76] = PPARSE_KW("_Float128x", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [78] = PPARSE_KW("switch", PPARSE_TT_SKIP_DECL | PPARSE_TT_SWITCH, 0),
+    [79] = PPARSE_KW("stdcall", 0, PPARSE_TF_MS_CC | PPARSE_TF_SOFT_KW),
+    [80] = PPARSE_KW("__declspec", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, 0),
+    [81] = PPARSE_KW("union", PPARSE_TT_TYPE | PPARSE_TT_SUE, 0),
+    [82] = PPARSE_KW("_Thread_local", PPARSE_TT_STORAGE, 0),
+    [84] = PPARSE_KW_FN("abort", PPARSE_TT_NORETURN_FN),
+    [85] = PPARSE_KW("alignof", PPARSE_TT_SKIP_DECL, PPARSE_TF_SIZEOF | PPARSE_TF_ALIGNOF | PPARSE_TF_SOFT_KW),
+    [86] = PPARSE_KW("return", PPARSE_TT_SKIP_DECL | PPARSE_TT_RETURN, 0),
+    [87] = PPARSE_KW_FN("setjmp", PPARSE_TT_SPECIAL_FN),
+    [88] = PPARSE_KW("char", PPARSE_TT_TYPE, 0),
+    [90] = PPARSE_KW("asm", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, PPARSE_TF_SOFT_KW),
+    [92] = PPARSE_KW("register", PPARSE_TT_QUALIFIER | PPARSE_TT_REGISTER, 0),
+    [93] = PPARSE_KW_FN("__builtin_setjmp_receive", PPARSE_TT_SPECIAL_FN),
+    [94] = PPARSE_KW("if", PPARSE_TT_SKIP_DECL | PPARSE_TT_IF, 0),
+    [95] = PPARSE_KW("auto", PPARSE_TT_QUALIFIER | PPARSE_TT_TYPE, 0),
+    [97] = PPARSE_KW("do", PPARSE_TT_SKIP_DECL | PPARSE_TT_LOOP, 0),
+    [99] = PPARSE_KW("__typeof_unqual", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    [105] = PPARSE_KW("typedef", PPARSE_TT_SKIP_DECL | PPARSE_TT_TYPEDEF, 0),
+    [110] = PPARSE_KW_FN("siglongjmp", PPARSE_TT_SPECIAL_FN),
+    [111] = PPARSE_KW("restrict", PPARSE_TT_QUALIFIER, 0),
+    [113] = PPARSE_KW_FN("longjmp", PPARSE_TT_SPECIAL_FN),
+    [114] = PPARSE_KW("__builtin_offsetof", 0, PPARSE_TF_SIZEOF | PPARSE_TF_OFFSETOF),
+    [118] = PPARSE_KW("signed", PPARSE_TT_TYPE, 0),
+    [119] = PPARSE_KW("typeof", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, PPARSE_TF_SOFT_KW),
+    [120] = PPARSE_KW("noreturn", PPARSE_TT_SKIP_DECL | PPARSE_TT_INLINE, PPARSE_TF_SOFT_KW),
+    [121] = PPARSE_KW("_Atomic", PPARSE_TT_QUALIFIER | PPARSE_TT_TYPE, 0),
+    [122] = PPARSE_KW_FN("savectx", PPARSE_TT_SPECIAL_FN),
+    [123] = PPARSE_KW("__uint128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [126] = PPARSE_KW("__builtin_types_compatible_p", 0, 0),
+    [127] = PPARSE_KW_FN("__longjmp", PPARSE_TT_SPECIAL_FN),
+    [128] = PPARSE_KW_FN("__setjmp", PPARSE_TT_SPECIAL_FN),
+    [132] = PPARSE_KW("else", PPARSE_TT_SKIP_DECL | PPARSE_TT_IF, 0),
+    [133] = PPARSE_KW("__uint128_t", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [134] = PPARSE_KW("volatile", PPARSE_TT_QUALIFIER | PPARSE_TT_VOLATILE, 0),
+    [135] = PPARSE_KW("alignas", PPARSE_TT_QUALIFIER | PPARSE_TT_ALIGNAS, PPARSE_TF_SOFT_KW),
+    [136] = PPARSE_KW_FN("__sigsetjmp", PPARSE_TT_SPECIAL_FN),
+    [139] = PPARSE_KW("__stdcall", 0, PPARSE_TF_MS_CC),
+    [140] = PPARSE_KW("short", PPARSE_TT_TYPE, 0),
+    [141] = PPARSE_KW("__float128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [144] = PPARSE_KW("static_assert", PPARSE_TT_SKIP_DECL, PPARSE_TF_SOFT_KW | PPARSE_TF_STATIC_ASSERT),
+    [145] = PPARSE_KW("__fp16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [146] = PPARSE_KW("_Alignas", PPARSE_TT_QUALIFIER | PPARSE_TT_ALIGNAS, 0),
+    [147] = PPARSE_KW("sizeof", PPARSE_TT_SKIP_DECL, PPARSE_TF_SIZEOF),
+    [148] = PPARSE_KW("__restrict", PPARSE_TT_QUALIFIER, 0),
+    [149] = PPARSE_KW("thread_local", PPARSE_TT_QUALIFIER | PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, PPARSE_TF_SOFT_KW),
+    [152] = PPARSE_KW("constexpr", PPARSE_TT_QUALIFIER, PPARSE_TF_SOFT_KW),
+    [153] = PPARSE_KW("unsigned", PPARSE_TT_TYPE, 0),
+    [156] = PPARSE_KW_FN("_Exit", PPARSE_TT_NORETURN_FN),
+    [157] = PPARSE_KW_FN("_exit", PPARSE_TT_NORETURN_FN),
+    [158] = PPARSE_KW("__extension__", PPARSE_TT_INLINE, 0),
+    [163] = PPARSE_KW("_Float32", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [165] = PPARSE_KW_FN("vfork", PPARSE_TT_SPECIAL_FN),
+    [166] = PPARSE_KW("continue", PPARSE_TT_SKIP_DECL | PPARSE_TT_CONTINUE, 0),
+    [167] = PPARSE_KW("_Alignof", PPARSE_TT_SKIP_DECL, PPARSE_TF_SIZEOF | PPARSE_TF_ALIGNOF),
+    [168] = PPARSE_KW("float", PPARSE_TT_TYPE, 0),
+    [169] = PPARSE_KW("__asm", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, 0),
+    [170] = PPARSE_KW("_Static_assert", PPARSE_TT_SKIP_DECL, PPARSE_TF_STATIC_ASSERT),
+    [171] = PPARSE_KW("__builtin_va_list", 0, 0),
+    [172] = PPARSE_KW("_fastcall", 0, PPARSE_TF_MS_CC),
+    [173] = PPARSE_KW("__typeof__", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    [174] = PPARSE_KW_FN("_setjmp", PPARSE_TT_SPECIAL_FN),
+    [175] = PPARSE_KW_FN("__builtin_longjmp", PPARSE_TT_SPECIAL_FN),
+    [177] = PPARSE_KW("_Noreturn", PPARSE_TT_SKIP_DECL | PPARSE_TT_INLINE, 0),
+    [180] = PPARSE_KW("bool", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [181] = PPARSE_KW("int", PPARSE_TT_TYPE, 0),
+    [182] = PPARSE_KW("__pragma", PPARSE_TT_ATTR, 0),
+    [185] = PPARSE_KW("_Bool", PPARSE_TT_TYPE, 0),
+    [187] = PPARSE_KW("const", PPARSE_TT_QUALIFIER | PPARSE_TT_CONST, 0),
+    [188] = PPARSE_KW("__attribute__", PPARSE_TT_ATTR | PPARSE_TT_QUALIFIER, 0),
+    [189] = PPARSE_KW("__builtin_va_arg", 0, 0),
+    [190] = PPARSE_KW_FN("exit", PPARSE_TT_NORETURN_FN),
+    [191] = PPARSE_KW("default", PPARSE_TT_SKIP_DECL | PPARSE_TT_DEFAULT, 0),
+    [192] = PPARSE_KW("__cdecl", 0, PPARSE_TF_MS_CC),
+    [194] = PPARSE_KW("inline", PPARSE_TT_INLINE, 0),
+    [195] = PPARSE_KW("__float80", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [196] = PPARSE_KW("orelse", PPARSE_TT_ORELSE, 0),
+    [204] = PPARSE_KW("_Decimal64", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [206] = PPARSE_KW("_cdecl", 0, PPARSE_TF_MS_CC),
+    [208] = PPARSE_KW("_Nullable", PPARSE_TT_QUALIFIER, 0),
+    [209] = PPARSE_KW("__asm__", PPARSE_TT_SKIP_DECL | PPARSE_TT_ASM, 0),
+    [210] = PPARSE_KW("_Float16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [211] = PPARSE_KW("_Complex", PPARSE_TT_TYPE, 0),
+    [216] = PPARSE_KW("__typeof_unqual__", PPARSE_TT_TYPE | PPARSE_TT_TYPEOF, 0),
+    [217] = PPARSE_KW("raw", 0, PPARSE_TF_RAW),
+    [224] = PPARSE_KW("long", PPARSE_TT_TYPE, 0),
+    [232] = PPARSE_KW("_Decimal32", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [233] = PPARSE_KW("offsetof", 0, PPARSE_TF_SIZEOF | PPARSE_TF_OFFSETOF | PPARSE_TF_SOFT_KW),
+    [237] = PPARSE_KW("defer", PPARSE_TT_DEFER, 0),
+    [238] = PPARSE_KW("cdecl", 0, PPARSE_TF_MS_CC | PPARSE_TF_SOFT_KW),
+    [242] = PPARSE_KW("_Nonnull", PPARSE_TT_QUALIFIER, 0),
+    [243] = PPARSE_KW("double", PPARSE_TT_TYPE, 0),
+    [244] = PPARSE_KW("__vectorcall", 0, PPARSE_TF_MS_CC),
+    [245] = PPARSE_KW("static", PPARSE_TT_QUALIFIER | PPARSE_TT_SKIP_DECL | PPARSE_TT_STORAGE, 0),
+    [247] = PPARSE_KW("__int128", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [248] = PPARSE_KW("__int16", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [249] = PPARSE_KW("_Float64", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+    [250] = PPARSE_KW("_Imaginary", PPARSE_TT_TYPE, 0),
+    [251] = PPARSE_KW("__int128_t", PPARSE_TT_TYPE, PPARSE_TF_SOFT_KW),
+};
+/* END keyword table */
+
+/* Every keyword owns the slot its spelling hashes to: the seed spreads
+ * keywords over buckets and each bucket's displacement moves its keywords
+ * onto free slots. Any other spelling lands on a slot it does not match. */
+static inline PRISM_ALWAYS_INLINE PRISM_PURE uint32_t pparse_keyword_slot(const char *key, uint32_t len) {
+	const unsigned char *k = (const unsigned char *)key;
+	uint32_t h = (len | (uint32_t)k[0] << 8 | (uint32_t)k[1] << 16 | (uint32_t)k[len - 1] << 24) ^
+		     k[len - 2] * 0x9e3779b9u ^ k[len / 2] * 0x85ebca6bu;
+	h *= PPARSE_KW_SEED;
+	return ((h >> 8) ^ pparse_keyword_disp[h >> 26]) & (PPARSE_KW_SLOTS - 1);
+}
+
+static inline PRISM_ALWAYS_INLINE PRISM_PURE uint64_t pparse_keyword_lookup(const char *key, int keylen) {
 	if (keylen < 2) return 0;
-	unsigned slot = pparse_KEYWORD_HASH(key, keylen);
-	for (int i = 0; i < PPARSE_KW_MAX_PROBE; i++) {
-		PParseKeywordEntry *ent = &pparse_keyword_cache[(slot + i) & 255];
-		if (!ent->name) return 0;
-		if ((uint8_t)(ent->value >> PPARSE_KW_LEN_SHIFT) == keylen &&
-		    prism_memeq_runtime_sized(ent->name, key, (uint32_t)keylen))
-			return ent->value;
-	}
+	const PParseKeywordEntry *ent = &pparse_keyword_table[pparse_keyword_slot(key, (uint32_t)keylen)];
+	if ((uint8_t)(ent->value >> PPARSE_KW_LEN_SHIFT) == keylen &&
+	    prism_memeq_runtime_sized(ent->name, key, (uint32_t)keylen))
+		return ent->value;
 	return 0;
 }
+
+/* ---- identifier interning ---- */
+
+static void pparse_name_rehash(PParseContext *_pc) {
+	uint32_t cap = _pc->name_slots ? (_pc->name_slot_mask + 1) * 2 : 4096;
+	uint64_t *slots = pparse_arena_alloc(&_pc->main_arena, (size_t)cap * sizeof(*slots));
+	for (uint32_t id = 0; id < _pc->name_count; id++) {
+		uint32_t s = _pc->names[id].hash & (cap - 1);
+		while (slots[s]) s = (s + 1) & (cap - 1);
+		slots[s] = (uint64_t)_pc->names[id].hash << 32 | (id + 1);
+	}
+	_pc->name_slots = slots;
+	_pc->name_slot_mask = cap - 1;
+}
+
+/* The id of spelling [p, p + len), or UINT32_MAX if the TU has none such. */
+static inline PRISM_ALWAYS_INLINE PRISM_PURE uint32_t pparse_name_lookup(PParseContext *_pc, char *p, uint32_t len,
+									  uint32_t hash) {
+	const uint64_t *slots = _pc->name_slots;
+	uint32_t mask = _pc->name_slot_mask;
+	if (!slots) return UINT32_MAX;
+	for (uint32_t s = hash & mask;; s = (s + 1) & mask) {
+		uint64_t v = slots[s];
+		if (!v) return UINT32_MAX;
+		if ((uint32_t)(v >> 32) != hash) continue;
+		PParseName *n = &_pc->names[(uint32_t)v - 1];
+		if (n->len == len && prism_memeq_runtime_sized(n->name, p, len)) return (uint32_t)v - 1;
+	}
+}
+
+static uint32_t __attribute__((noinline)) pparse_name_add(PParseContext *_pc, char *p, uint32_t len, uint32_t hash) {
+	if ((uint64_t)(_pc->name_count + 1) * 2 > (uint64_t)_pc->name_slot_mask + 1 || !_pc->name_slots)
+		pparse_name_rehash(_pc);
+	PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, _pc->names, _pc->name_count + 1, _pc->name_cap, 1024, PParseName);
+	uint32_t id = _pc->name_count++;
+	char *copy = pparse_arena_alloc_uninit(&_pc->main_arena, len);
+	_pc->names[id] = (PParseName){.name = memcpy(copy, p, len),
+				      .len = len,
+				      .hash = hash,
+				      .kw = pparse_keyword_lookup(p, (int)len)};
+	uint32_t s = hash & _pc->name_slot_mask;
+	while (_pc->name_slots[s]) s = (s + 1) & _pc->name_slot_mask;
+	_pc->name_slots[s] = (uint64_t)hash << 32 | (id + 1);
+	return id;
+}
+
+/* The id of spelling [p, p + len), numbering it if it is new. */
+static inline PRISM_ALWAYS_INLINE uint32_t pparse_name_intern(PParseContext *_pc, char *p, uint32_t len) {
+	uint32_t hash = pparse_fast_hash(p, len), id = pparse_name_lookup(_pc, p, len, hash);
+	return id != UINT32_MAX ? id : pparse_name_add(_pc, p, len, hash);
+}
+
 static int pparse_read_punct(char *p) {
 	switch (*p) {
 	case '<':
@@ -1567,79 +1986,32 @@ static int pparse_read_punct(char *p) {
 /* Phase 2: `\`+newline (and `\r\n`) inside // comments is spliced, so the
  * comment continues on the next physical line. Line numbers still advance. */
 static char *pparse_skip_line_comment(char *p, PParseTokState *ts) {
+	const PParseScanKernel *sk = pparse_scan_kernel();
+	int newlines = 0;
 	for (;;) {
-		while ((uintptr_t)p & 7) {
-			if (*p == '\0') return p;
-			if (*p == '\\') {
-				if (p[1] == '\n') {
-					p += 2;
-					ts->line_no++;
-					continue;
-				}
-				if (p[1] == '\r' && p[2] == '\n') {
-					p += 3;
-					ts->line_no++;
-					continue;
-				}
-			}
-			if (*p == '\n') return p;
+		p = sk->until(p, '\n', '\\', '\\', &newlines);
+		if (*p != '\\') return p;
+		if (p[1] == '\n') {
+			p += 2;
+			ts->line_no++;
+		} else if (p[1] == '\r' && p[2] == '\n') {
+			p += 3;
+			ts->line_no++;
+		} else
 			p++;
-		}
-		uint64_t nl_mask = pparse_SWAR_BROADCAST('\n');
-		uint64_t bs_mask = pparse_SWAR_BROADCAST('\\');
-		for (;;) {
-			uint64_t v;
-			memcpy(&v, p, 8);
-			if (pparse_SWAR_HAS_ZERO(v) || pparse_SWAR_HAS_ZERO(v ^ nl_mask) || pparse_SWAR_HAS_ZERO(v ^ bs_mask)) {
-				for (int i = 0; i < 8; i++) {
-					if (p[i] == '\0') return p + i;
-					if (p[i] == '\\') {
-						if (p[i + 1] == '\n') {
-							p += i + 2;
-							ts->line_no++;
-							goto realign;
-						}
-						if (p[i + 1] == '\r' && p[i + 2] == '\n') {
-							p += i + 3;
-							ts->line_no++;
-							goto realign;
-						}
-					}
-					if (p[i] == '\n') return p + i;
-				}
-			}
-			p += 8;
-		}
-	realign:;
 	}
 }
 static char *pparse_skip_block_comment(char *p, PParseTokState *ts) {
-	while ((uintptr_t)p & 7) {
+	const PParseScanKernel *sk = pparse_scan_kernel();
+	int newlines = 0;
+	for (;; p++) {
+		p = sk->until(p, '*', '*', '*', &newlines);
 		if (*p == '\0') pparse_error_at(p, "unclosed block comment");
-		if (*p == '\n') {
-			ts->line_no++;
-			ts->at_bol = true;
-		}
-		if (p[0] == '*' && p[1] == '/') return p + 2;
-		p++;
-	}
-	uint64_t nl_mask = pparse_SWAR_BROADCAST('\n');
-	uint64_t star_mask = pparse_SWAR_BROADCAST('*');
-	for (;;) {
-		uint64_t v;
-		memcpy(&v, p, 8);
-		if (pparse_SWAR_HAS_ZERO(v) || pparse_SWAR_HAS_ZERO(v ^ nl_mask) || pparse_SWAR_HAS_ZERO(v ^ star_mask)) {
-			for (int i = 0; i < 8; i++) {
-				if (p[i] == '\0') pparse_error_at(p + i, "unclosed block comment");
-				if (p[i] == '\n') {
-					ts->line_no++;
-					ts->at_bol = true;
-				}
-				if (p[i] == '*' && p[i + 1] == '/') return p + i + 2;
-			}
-		}
-		p += 8;
+		if (p[1] == '/') break;
 	}
+	ts->line_no += newlines;
+	ts->at_bol |= newlines != 0;
+	return p + 2;
 }
 // Scan C++11/C23 raw string literal: R"delim(content)delim"
 static char *pparse_raw_string_literal_end(char *p, PParseTokState *ts) {
@@ -1866,7 +2238,8 @@ static char *pparse_scan_line_directive(char *p, int *line_no, bool *in_system_i
 				 .is_direct_system_include = direct_system,
 				 .skip_emit = is_system && *in_system_include});
 	_pc->current_file = view;
-	while (*p && *p != '\n') p++;
+	int newlines = 0;
+	p = pparse_scan_kernel()->until(p, '\n', '\n', '\n', &newlines);
 	if (*p == '\n') {
 		p++;
 		(*line_no)++;
@@ -2024,57 +2397,64 @@ static uint32_t *pparse_splice_logical_lines(char *contents, size_t *contents_le
 	return offsets;
 }
 
-static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t contents_len) {
-	PPARSE_CTX();
-	_pc->current_file = file;
-	if (contents_len > UINT32_MAX)
-		pparse_error_at(contents, "source file exceeds 4 GiB; cannot record token locations");
-	uint32_t splice_count = 0;
-	uint32_t *splice_offsets = pparse_splice_logical_lines(contents, &contents_len, &splice_count);
-	_pc->token_source = contents;
-	char *p = contents;
-	/* Skip leading UTF-8 BOM (EF BB BF). UTF-16 BOMs are rejected earlier. */
-	if ((unsigned char)p[0] == 0xEF && (unsigned char)p[1] == 0xBB && (unsigned char)p[2] == 0xBF)
-		p += 3;
-	pparse_token_pool_ensure(pparse_token_count + contents_len / 2 + 4096);
-	uint32_t first_idx = pparse_token_count;
-	uint32_t tag_summary = 0;
-	PParseTokState ts = {.at_bol = true,
-				     .has_space = false,
-				     .line_no = 1,
-				     .splice_offsets = splice_offsets,
-				     .splice_count = splice_count};
-	unsigned kw_shadow_mask = 0;
-	bool in_system_include = false;
-	int delimiter_cap = 64, delimiter_n = 0, builtin_n = 0, builtin_cap = 0;
-	int noreturn_n = 0, noreturn_cap = 0;
-	uint32_t *delimiter_stack =
-	    pparse_arena_alloc_uninit(&_pc->main_arena, delimiter_cap * sizeof(*delimiter_stack));
-	uint32_t *builtin_candidates = NULL;
-	uint32_t *noreturn_candidates = NULL;
-	uint32_t last_prism_idx = 0;
+/* Everything the tokenizer carries from one token to the next. A buffer is
+ * lexed by one pparse_lex_run over all of it, or by one run per part when
+ * pparse_lex_split cuts it up. */
+typedef struct {
+	PParseTokState ts;
+	unsigned kw_shadow_mask;
+	bool in_system_include;
+	/* Lexing one part of a split buffer: a closer whose opener is in an
+	 * earlier part goes in `spill`, followed by the last defer/orelse before
+	 * it, and a `{` whose statement-expression walk leaves the part goes in
+	 * `braces`. The stitch settles both. */
+	bool part;
+	uint32_t first_idx, tag_summary, last_prism_idx;
+	uint32_t *delimiters, *builtins, *noreturns, *spill, *braces;
+	int delimiter_n, delimiter_cap, builtin_n, builtin_cap, noreturn_n, noreturn_cap;
+	int spill_n, spill_cap, brace_n, brace_cap;
+} PParseLex;
+
+/* Whether the statement-expression walk from a `{` in a part, which stopped
+ * at `prev`, looked at tokens of that part only. */
+static bool pparse_lex_walk_in_part(PParseContext *_pc, uint32_t first_idx, PParseToken *prev) {
+	if (!prev || pparse_idx(_pc, prev) < first_idx) return false;
+	if (!(prev->flags & PPARSE_TF_CLOSE)) return true;
+	/* A `]` it stopped at had its opener's flags read; a `)`, the token
+	 * before its opener and any directives in between. */
+	uint32_t open = prev->pair_idx;
+	if (open <= first_idx) return false;
+	if (prev->ch0 != ')') return true;
+	while (open > first_idx && pparse_token_pool[open - 1].kind == PPARSE_TK_PREP_DIR) open--;
+	return open > first_idx;
+}
+
+static inline PRISM_ALWAYS_INLINE char *pparse_lex_run(PParseContext *_pc, PParseLex *lx, char *p) {
+	PParseTokState *ts = &lx->ts;
+	const PParseScanKernel *sk = pparse_scan_kernel();
 	while (*p) {
 		int ident_len;
 		char *ident_end;
-		if (ts.at_bol &&
+		if (ts->at_bol &&
 		    (*p == '#' || (p[0] == '%' && p[1] == ':') ||
 		     (p[0] == '?' && p[1] == '?' && p[2] == '='))) {
 			char *directive_start = p;
-			kw_shadow_mask = pparse_update_kw_shadow(p, kw_shadow_mask);
-			char *after = pparse_scan_line_directive(p, &ts.line_no, &in_system_include);
+			lx->kw_shadow_mask = pparse_update_kw_shadow(p, lx->kw_shadow_mask);
+			char *after = pparse_scan_line_directive(p, &ts->line_no, &lx->in_system_include);
 			if (after) {
 				p = after;
-				ts.at_bol = true;
-				ts.has_space = false;
+				ts->at_bol = true;
+				ts->has_space = false;
 				continue;
 			}
-			while (*p && *p != '\n') p++;
-			pparse_new_token(PPARSE_TK_PREP_DIR, directive_start, p, &ts)->flags |= PPARSE_TF_AT_BOL;
+			int newlines = 0;
+			p = sk->until(p, '\n', '\n', '\n', &newlines);
+			pparse_new_token(PPARSE_TK_PREP_DIR, directive_start, p, ts)->flags |= PPARSE_TF_AT_BOL;
 			if (*p == '\n') {
 				p++;
-				ts.line_no++;
-				ts.at_bol = true;
-				ts.has_space = false;
+				ts->line_no++;
+				ts->at_bol = true;
+				ts->has_space = false;
 			}
 			continue;
 		}
@@ -2089,13 +2469,13 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 		switch (cc0) {
 		case PCC_SLASH:
 			if (p[1] == '/') {
-				p = pparse_skip_line_comment(p + 2, &ts);
-				ts.has_space = true;
+				p = pparse_skip_line_comment(p + 2, ts);
+				ts->has_space = true;
 				continue;
 			}
 			if (p[1] == '*') {
-				p = pparse_skip_block_comment(p + 2, &ts);
-				ts.has_space = true;
+				p = pparse_skip_block_comment(p + 2, ts);
+				ts->has_space = true;
 				continue;
 			}
 			goto do_punct;
@@ -2111,14 +2491,11 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 		 * interleaved pairs. */
 		case PCC_SPACE:
 		case PCC_NEWLINE: {
-			int newlines = 0;
-			do {
-				newlines += (*p == '\n');
-				p++;
-			} while (pparse_char_class[(unsigned char)*p] & (PCC_SPACE | PCC_NEWLINE));
-			ts.line_no += newlines;
-			ts.at_bol |= newlines != 0;
-			ts.has_space = (p[-1] != '\n');
+			int newlines = *p++ == '\n';
+			if (pparse_char_class[(unsigned char)*p] & (PCC_SPACE | PCC_NEWLINE)) p = sk->space(p, &newlines);
+			ts->line_no += newlines;
+			ts->at_bol |= newlines != 0;
+			ts->has_space = (p[-1] != '\n');
 			continue;
 		}
 		/* Fast path: the vast majority of tokens are identifiers/keywords that
@@ -2137,7 +2514,7 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 	do_number: {
 			char *start = p;
 			p = pparse_scan_pp_number(p);
-			pparse_new_token(PPARSE_TK_NUM, start, p, &ts);
+			pparse_new_token(PPARSE_TK_NUM, start, p, ts);
 			continue;
 		}
 		/* String, character and raw-string literals differ only in the
@@ -2149,13 +2526,13 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 				  ((*p == 'u') & (p[1] == '8'));
 			char q = p[pfx];
 			if (q == 'R' && p[pfx + 1] == '"') {
-				PParseToken *nt = pparse_read_raw_string_literal(p, p + pfx + 1, &ts);
+				PParseToken *nt = pparse_read_raw_string_literal(p, p + pfx + 1, ts);
 				p += nt->len;
 				continue;
 			}
 			if (q == '"' || q == '\'') {
-				PParseToken *nt = q == '"' ? pparse_read_string_literal(p, p + pfx, &ts)
-							   : pparse_read_char_literal(p, p + pfx, &ts);
+				PParseToken *nt = q == '"' ? pparse_read_string_literal(p, p + pfx, ts)
+							   : pparse_read_char_literal(p, p + pfx, ts);
 				p += nt->len;
 				continue;
 			}
@@ -2170,33 +2547,40 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 		ident_end = p + 1;
 	scan_ident_tail:
 		for (;;) {
-			while (pparse_ident_char[(unsigned char)*ident_end]) ident_end++;
+			if (pparse_ident_char[(unsigned char)*ident_end]) ident_end = sk->ident(ident_end);
 			int ucn = pparse_read_ucn(ident_end);
 			if (!ucn) break;
 			ident_end += ucn;
 		}
 		ident_len = (int)(ident_end - p);
 		{
-			PParseToken *t = pparse_new_token(PPARSE_TK_IDENT, p, p + ident_len, &ts);
-			t->parse_data = pparse_fast_hash(p, (uint32_t)ident_len);
-			uint64_t kw = pparse_keyword_lookup(_pc, p, ident_len);
-			kw *= (kw_shadow_mask & (unsigned)(kw >> PPARSE_KW_SHADOW_SHIFT)) == 0;
+			PParseToken *t = pparse_new_token(PPARSE_TK_IDENT, p, p + ident_len, ts);
+			/* A spelling's keyword entry is looked up once, when it is
+			 * numbered. lex_only text is not kept past the call. */
+			uint64_t kw;
+			if (__builtin_expect(_pc->lex_only, 0)) {
+				kw = pparse_keyword_lookup(p, ident_len);
+			} else {
+				t->parse_data = pparse_name_intern(_pc, p, (uint32_t)ident_len);
+				kw = _pc->names[t->parse_data].kw;
+			}
+			kw *= (lx->kw_shadow_mask & (unsigned)(kw >> PPARSE_KW_SHADOW_SHIFT)) == 0;
 			if (kw) {
 				bool marked_keyword = (kw & PPARSE_KW_MARKER) != 0;
 				t->kind = (PParseTokenKind)(marked_keyword * PPARSE_TK_KEYWORD);
 				t->tag = (uint32_t)(kw & ~PPARSE_KW_MARKER);
 				t->flags |= (uint16_t)(kw >> PPARSE_KW_FLAGS_SHIFT);
-				tag_summary |= t->tag;
+				lx->tag_summary |= t->tag;
 				uint32_t ti = pparse_token_count - 1;
-				if (t->tag & (PPARSE_TT_DEFER | PPARSE_TT_ORELSE)) last_prism_idx = ti;
-				if (delimiter_n == 0 && (t->tag & (PPARSE_TT_NORETURN_FN | PPARSE_TT_SPECIAL_FN))) {
-					pparse_push_u32(_pc, &builtin_candidates, &builtin_n, &builtin_cap, ti);
+				if (t->tag & (PPARSE_TT_DEFER | PPARSE_TT_ORELSE)) lx->last_prism_idx = ti;
+				if (lx->delimiter_n == 0 && (t->tag & (PPARSE_TT_NORETURN_FN | PPARSE_TT_SPECIAL_FN))) {
+					pparse_push_u32(_pc, &lx->builtins, &lx->builtin_n, &lx->builtin_cap, ti);
 				}
 				bool nr_spec = ((t->tag & (PPARSE_TT_INLINE | PPARSE_TT_SKIP_DECL)) ==
 					       (PPARSE_TT_INLINE | PPARSE_TT_SKIP_DECL) &&
 					       (pparse_equal(t, "_Noreturn") || pparse_equal(t, "noreturn")));
 				if ((t->tag & PPARSE_TT_ATTR) || nr_spec) {
-					pparse_push_u32(_pc, &noreturn_candidates, &noreturn_n, &noreturn_cap, ti);
+					pparse_push_u32(_pc, &lx->noreturns, &lx->noreturn_n, &lx->noreturn_cap, ti);
 				}
 			}
 			p += ident_len;
@@ -2206,7 +2590,7 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 		int punct_len = pparse_read_punct(p);
 		if (punct_len) {
 			int abs_len = abs(punct_len);
-			PParseToken *t = pparse_new_token(PPARSE_TK_PUNCT, p, p + abs_len, &ts);
+			PParseToken *t = pparse_new_token(PPARSE_TK_PUNCT, p, p + abs_len, ts);
 			if (punct_len < 0) {
 				char norm;
 				switch (abs_len == 4 ? '%' : p[0]) {
@@ -2229,23 +2613,29 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 			uint16_t delimiter_flags = t->flags & (PPARSE_TF_OPEN | PPARSE_TF_CLOSE);
 			if (delimiter_flags) {
 				if (delimiter_flags & PPARSE_TF_OPEN) {
-					pparse_push_u32(_pc, &delimiter_stack, &delimiter_n, &delimiter_cap, ti);
+					pparse_push_u32(_pc, &lx->delimiters, &lx->delimiter_n, &lx->delimiter_cap, ti);
 					if (t->ch0 == '{') {
-						PParseToken *prev =
-						    pparse_walk_back(ti, PPARSE_WB_ATTR_NOISE | PPARSE_WB_JUMP_ATTR_PARENS);
-						if (prev && pparse_match_ch(prev, '(')) prev->flags |= PPARSE_TF_STMT_EXPR;
+						PParseToken *prev = pparse_walk_back(ti, PPARSE_WB_STMT_EXPR);
+						if (lx->part && !pparse_lex_walk_in_part(_pc, lx->first_idx, prev))
+							pparse_push_u32(_pc, &lx->braces, &lx->brace_n, &lx->brace_cap, ti);
+						else if (prev && pparse_match_ch(prev, '('))
+							prev->flags |= PPARSE_TF_STMT_EXPR;
 					}
-					if (t->ch0 == '[' && ti > first_idx) {
+					if (t->ch0 == '[' && ti > lx->first_idx) {
 						PParseToken *prev = &pparse_token_pool[ti - 1];
 						if (prev->ch0 == '[' && (prev->flags & PPARSE_TF_OPEN)) {
 							prev->flags |= PPARSE_TF_C23_ATTR;
-							pparse_push_u32(_pc, &noreturn_candidates, &noreturn_n,
-									 &noreturn_cap, ti - 1);
+							pparse_push_u32(_pc, &lx->noreturns, &lx->noreturn_n,
+									 &lx->noreturn_cap, ti - 1);
 						}
 					}
+				} else if (lx->delimiter_n == 0 && lx->part) {
+					/* Opened in an earlier part: the stitch pairs it. */
+					pparse_push_u32(_pc, &lx->spill, &lx->spill_n, &lx->spill_cap, ti);
+					pparse_push_u32(_pc, &lx->spill, &lx->spill_n, &lx->spill_cap, lx->last_prism_idx);
 				} else {
-					if (delimiter_n == 0) pparse_error_tok(t, "unmatched closing delimiter");
-					uint32_t open_idx = delimiter_stack[--delimiter_n];
+					if (lx->delimiter_n == 0) pparse_error_tok(t, "unmatched closing delimiter");
+					uint32_t open_idx = lx->delimiters[--lx->delimiter_n];
 					PParseToken *open = &pparse_token_pool[open_idx];
 					unsigned expected_close = open->ch0 + 2 - (open->ch0 == '(');
 					if (t->ch0 != expected_close)
@@ -2255,9 +2645,9 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 								  open->ch0);
 					open->pair_idx = ti;
 					t->pair_idx = open_idx;
-					if (open > pparse_token_pool + first_idx && ((open - 1)->tag & PPARSE_TT_ATTR))
+					if (open > pparse_token_pool + lx->first_idx && ((open - 1)->tag & PPARSE_TT_ATTR))
 						for (PParseToken *u = open; u <= t; u++) u->ann |= P1_IN_ATTR_ARGS;
-					if (last_prism_idx > t->pair_idx) open->flags |= PPARSE_TF_HAS_PRISM;
+					if (lx->last_prism_idx > t->pair_idx) open->flags |= PPARSE_TF_HAS_PRISM;
 				}
 			}
 			p += abs_len;
@@ -2266,24 +2656,370 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 		pparse_error_at(p, "invalid token");
 	}
 
+	return p;
+}
+
+/* ---- split tokenization ----
+ *
+ * A large preprocessed buffer can be lexed in parts at once. It is cut at
+ * linemarkers, where the lexer is in the state it starts a buffer in: at the
+ * start of a line, about to name the file it is in. Each part is lexed by a
+ * worker of the host's, into its own copy of this context, as if it were a
+ * buffer of its own. pparse_lex_stitch then appends the parts' tokens to the
+ * pool in order and finishes what a part could not see from inside: the
+ * closers whose openers an earlier part left, the depth its builtin candidates
+ * were really at, a `[[` or an attribute's arguments across the cut, and the
+ * `{` whose statement-expression walk leaves the part. A part lexed from state
+ * an earlier one did not leave it in (a #define shadowing a keyword, a system
+ * header still open), delimiters that do not pair, or any worker failing sends
+ * the buffer back to one run, which also gives any diagnostic exactly as it
+ * would have been. */
+enum {
+	PPARSE_LEX_MAX_PARTS = 64,
+	PPARSE_LEX_HEAD = 64, // offset of a part's tokens in its worker's output
+};
+
+typedef struct {
+	PParseLex *lx;
+	PParseFile *entry; // the view the buffer starts in
+	uint32_t file_base; // input_file_count when the parts began
+	uint32_t name_base; // name_count when the parts began
+	int n;
+	char *cut[PPARSE_LEX_MAX_PARTS + 1];
+	uint8_t kind[PPARSE_LEX_MAX_PARTS + 1]; // pparse_lex_cut_ok of each cut
+} PParseLexSplit;
+
+/* The head of a worker's output. The tokens follow at PPARSE_LEX_HEAD, then
+ * the open delimiters, the spill pairs, the builtin and noreturn candidates
+ * and the braces, as pool indexes, then one record per file view. */
+typedef struct {
+	uint32_t count, files, newlines, names;
+	uint32_t opens, spills, builtins, noreturns, braces;
+	uint32_t tag_summary, last_prism_idx, kw_shadow_mask;
+	bool in_system_include, at_bol, has_space;
+} PParseLexPart;
+
+typedef char pparse_assert_lex_head[(sizeof(PParseLexPart) <= PPARSE_LEX_HEAD) ? 1 : -1];
+
+static void pparse_lex_stmt_expr(uint32_t brace) {
+	PParseToken *prev = pparse_walk_back(brace, PPARSE_WB_STMT_EXPR);
+	if (prev && pparse_match_ch(prev, '(')) prev->flags |= PPARSE_TF_STMT_EXPR;
+}
+
+/* Whether a part can start at the line at `q`: 0 if not, else a `# N "file"`
+ * linemarker with neither flag 1 nor 3, so it enters no file; 2 if it has flag
+ * 2, which closes any system header open before it, and 1 if it needs none to
+ * have been. */
+static int pparse_lex_cut_ok(const char *q) {
+	int digits = 0, kind = 1;
+	if (*q++ != '#') return 0;
+	while (pparse_is_hspace(*q)) q++;
+	for (; PPARSE_IS_DIGIT(*q); q++) digits++;
+	if (!digits || digits > 9 || !pparse_is_hspace(*q)) return 0;
+	while (pparse_is_hspace(*q)) q++;
+	if (*q++ != '"') return 0;
+	for (; *q != '"'; q++) {
+		if (*q == '\\' && q[1] && q[1] != '\n') q++;
+		if (*q == '\n' || !*q) return 0;
+	}
+	for (q++;; q++) {
+		while (pparse_is_hspace(*q)) q++;
+		if (*q == '\n') return kind;
+		if (!PPARSE_IS_DIGIT(*q) || PPARSE_IS_DIGIT(q[1]) || *q == '1' || *q == '3') return 0;
+		if (*q == '2') kind = 2;
+	}
+}
+
+/* Cuts [p, end) into at most `want` parts near equal in size, at lines
+ * pparse_lex_cut_ok accepts, noting in `kind` what each accepted. Returns the
+ * number of parts. */
+static int pparse_lex_cuts(char *p, char *end, int want, char **cut, uint8_t *kind) {
+	int n = 1;
+	cut[0] = p;
+	for (int i = 1; i < want; i++) {
+		char *q = p + (size_t)(end - p) / want * i;
+		if (q <= cut[n - 1]) q = cut[n - 1] + 1;
+		for (q--; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; q++)
+			if ((kind[n] = (uint8_t)pparse_lex_cut_ok(q + 1))) break;
+		if (!q) break;
+		cut[n++] = q + 1;
+	}
+	cut[n] = end;
+	return n;
+}
+
+static char *pparse_lex_put(char *w, const void *words, uint32_t n) {
+	if (n) memcpy(w, words, (size_t)n * 4);
+	return w + (size_t)n * 4;
+}
+
+/* A worker's part `i`, lexed into this process's copy of the context and
+ * written to `out`. */
+static bool pparse_lex_part(void *arg, int i, char *out, size_t cap) {
+	PParseLexSplit *sp = arg;
+	PPARSE_CTX();
+	PParseLex lx = {.ts = {.at_bol = true, .line_no = 1}, .part = true, .first_idx = pparse_token_count};
+#ifdef PRISM_LIB_MODE
+	/* The caller's recovery point belongs to the process that forked this one. */
+	_pc->error_jmp_set = true;
+	if (setjmp(_pc->error_jmp)) return false;
+#endif
+	*sp->cut[i + 1] = '\0';
+	if (pparse_lex_run(_pc, &lx, sp->cut[i]) != sp->cut[i + 1]) return false;
+	PParseLexPart head = {.count = pparse_token_count - lx.first_idx,
+			      .files = (uint32_t)_pc->input_file_count - sp->file_base,
+			      .newlines = (uint32_t)lx.ts.line_no - 1,
+			      .names = _pc->name_count - sp->name_base,
+			      .opens = (uint32_t)lx.delimiter_n,
+			      .spills = (uint32_t)lx.spill_n / 2,
+			      .builtins = (uint32_t)lx.builtin_n,
+			      .noreturns = (uint32_t)lx.noreturn_n,
+			      .braces = (uint32_t)lx.brace_n,
+			      .tag_summary = lx.tag_summary,
+			      .last_prism_idx = lx.last_prism_idx,
+			      .kw_shadow_mask = lx.kw_shadow_mask,
+			      .in_system_include = lx.in_system_include,
+			      .at_bol = lx.ts.at_bol,
+			      .has_space = lx.ts.has_space};
+	/* Below one wrap of the 14-bit file_idx, a token's view is the first
+	 * one on from the last token's with its number. */
+	if (head.files >= 0x3FFF) return false;
+	size_t need = PPARSE_LEX_HEAD + (size_t)head.count * sizeof(PParseToken) +
+		      4 * ((size_t)head.opens + lx.spill_n + head.builtins + head.noreturns + head.braces);
+	for (uint32_t j = 0; j < head.files; j++) need += 13 + strlen(_pc->input_files[sp->file_base + j]->name);
+	if (need > cap) return false;
+	memcpy(out, &head, sizeof head);
+	char *w = out + PPARSE_LEX_HEAD;
+	memcpy(w, &pparse_token_pool[lx.first_idx], (size_t)head.count * sizeof(PParseToken));
+	w += (size_t)head.count * sizeof(PParseToken);
+	w = pparse_lex_put(w, lx.delimiters, head.opens);
+	w = pparse_lex_put(w, lx.spill, (uint32_t)lx.spill_n);
+	w = pparse_lex_put(w, lx.builtins, head.builtins);
+	w = pparse_lex_put(w, lx.noreturns, head.noreturns);
+	w = pparse_lex_put(w, lx.braces, head.braces);
+	uint32_t t = 0, no = sp->entry->file_no;
+	for (uint32_t j = 0; j <= head.files; j++) {
+		PParseFile *f = j < head.files ? _pc->input_files[sp->file_base + j] : NULL;
+		while (t < head.count && pparse_token_pool[lx.first_idx + t].file_idx == no) t++;
+		/* Only the first part has tokens before its first linemarker. */
+		if (!j && t && i) return false;
+		if (!f) break;
+		int32_t delta = f->line_delta;
+		uint32_t name_len = (uint32_t)strlen(f->name);
+		*w++ = (char)(f->is_system | f->is_direct_system_include << 1 | f->skip_emit << 2);
+		memcpy(w, &delta, 4);
+		memcpy(w + 4, &t, 4);
+		memcpy(w + 8, &name_len, 4);
+		memcpy(w + 12, f->name, name_len);
+		w += 12 + name_len;
+		no = f->file_no;
+	}
+	return t == head.count;
+}
+
+/* Appends the parts the workers left in `outs` to the pool, as one run over
+ * the buffer would have. Returns false, having changed nothing, when they
+ * cannot stand for that run. */
+static bool pparse_lex_stitch(void *arg, char **outs) {
+	PParseLexSplit *sp = arg;
+	PParseLex *lx = sp->lx;
+	PPARSE_CTX();
+	PParseLexPart head[PPARSE_LEX_MAX_PARTS];
+	uint32_t total = 0, opens = 0;
+	for (int k = 0; k < sp->n; k++) {
+		memcpy(&head[k], outs[k], sizeof head[k]);
+		opens += head[k].opens;
+	}
+	uint8_t *stack = pparse_arena_alloc_uninit(&_pc->main_arena, opens + 1);
+	uint32_t depth = 0;
+	for (int k = 0; k < sp->n; k++) {
+		const PParseLexPart *h = &head[k];
+		const PParseToken *toks = (const PParseToken *)(outs[k] + PPARSE_LEX_HEAD);
+		const uint32_t *open = (const uint32_t *)(toks + h->count), *spill = open + h->opens;
+		if (k && (head[k - 1].kw_shadow_mask || (head[k - 1].in_system_include && sp->kind[k] < 2)))
+			return false;
+		for (uint32_t s = 0; s < h->spills; s++) {
+			unsigned c = toks[spill[2 * s] - lx->first_idx].ch0, o;
+			if (!depth) return false;
+			o = stack[--depth];
+			if (c != o + 2 - (o == '(')) return false;
+		}
+		for (uint32_t o = 0; o < h->opens; o++) stack[depth++] = toks[open[o] - lx->first_idx].ch0;
+		total += h->count;
+	}
+	if (depth) return false;
+
+	pparse_token_pool_ensure((size_t)lx->first_idx + total + 1);
+	PParseToken *pool = pparse_token_pool;
+	PParseFile *cur = _pc->current_file;
+	uint32_t last_prism = 0;
+	int lines = 0;
+	for (int k = 0; k < sp->n; k++) {
+		const PParseLexPart *h = &head[k];
+		const PParseToken *toks = (const PParseToken *)(outs[k] + PPARSE_LEX_HEAD);
+		const uint32_t *open = (const uint32_t *)(toks + h->count), *spill = open + h->opens,
+			       *builtin = spill + 2 * h->spills, *nr = builtin + h->builtins,
+			       *brace = nr + h->noreturns;
+		const char *rec = (const char *)(brace + h->braces);
+		uint32_t start = pparse_token_count, off = start - lx->first_idx, depth_at = (uint32_t)lx->delimiter_n;
+		/* A part numbered the names it met first after the ones all parts
+		 * started from; in order, they are the ones one run would have. */
+		uint32_t *renumber = pparse_arena_alloc(&_pc->main_arena, (size_t)h->names * sizeof(uint32_t) + 1);
+		memcpy(&pool[start], toks, (size_t)h->count * sizeof(PParseToken));
+		for (uint32_t j = 0, t = 0;; j++) {
+			PParseFile *next = NULL;
+			uint32_t until = h->count;
+			if (j < h->files) {
+				int32_t delta;
+				uint32_t name_len;
+				memcpy(&delta, rec + 1, 4);
+				memcpy(&until, rec + 5, 4);
+				memcpy(&name_len, rec + 9, 4);
+				char *name = pparse_arena_alloc_uninit(&_pc->main_arena, (size_t)name_len + 1);
+				memcpy(name, rec + 13, name_len);
+				name[name_len] = '\0';
+				next = pparse_add_input_file((PParseFile){.name = name,
+							  .line_delta = delta - lines,
+							  .is_system = rec[0] & 1,
+							  .is_direct_system_include = (rec[0] >> 1) & 1,
+							  .skip_emit = (rec[0] >> 2) & 1});
+				rec += 13 + name_len;
+			}
+			for (; t < until; t++) {
+				PParseToken *d = &pool[start + t];
+				d->file_idx = cur->file_no;
+				if ((d->flags & (PPARSE_TF_OPEN | PPARSE_TF_CLOSE)) && d->pair_idx) d->pair_idx += off;
+				if (d->kind <= PPARSE_TK_KEYWORD && d->parse_data >= sp->name_base) {
+					uint32_t *to = &renumber[d->parse_data - sp->name_base];
+					if (!*to) *to = pparse_name_intern(_pc, _pc->token_source + d->match_idx, d->len) + 1;
+					d->parse_data = *to - 1;
+				}
+				/* Digraphs were respelled in the worker's copy of the text. */
+				char *s = _pc->token_source + d->match_idx;
+				if (d->kind == PPARSE_TK_PUNCT && (uint8_t)*s != d->ch0) {
+					s[0] = (char)d->ch0;
+					if (d->len == 2) s[1] = '#';
+				}
+			}
+			if (!next) break;
+			cur = next;
+		}
+		pparse_token_count = start + h->count;
+		if (h->count && start > lx->first_idx) {
+			PParseToken *f = &pool[start], *prev = f - 1;
+			if (f->ch0 == '[' && (f->flags & PPARSE_TF_OPEN) && prev->ch0 == '[' && (prev->flags & PPARSE_TF_OPEN)) {
+				prev->flags |= PPARSE_TF_C23_ATTR;
+				pparse_push_u32(_pc, &lx->noreturns, &lx->noreturn_n, &lx->noreturn_cap, start - 1);
+			}
+			if ((f->flags & PPARSE_TF_OPEN) && f->pair_idx && (prev->tag & PPARSE_TT_ATTR))
+				for (PParseToken *u = f; u <= &pool[f->pair_idx]; u++) u->ann |= P1_IN_ATTR_ARGS;
+		}
+		for (uint32_t s = 0; s < h->spills; s++) {
+			uint32_t ti = spill[2 * s] + off, prism = spill[2 * s + 1];
+			uint32_t open_idx = lx->delimiters[--lx->delimiter_n];
+			PParseToken *o = &pool[open_idx], *t = &pool[ti];
+			o->pair_idx = ti;
+			t->pair_idx = open_idx;
+			if (o > pool + lx->first_idx && ((o - 1)->tag & PPARSE_TT_ATTR))
+				for (PParseToken *u = o; u <= t; u++) u->ann |= P1_IN_ATTR_ARGS;
+			if ((prism ? prism + off : last_prism) > open_idx) o->flags |= PPARSE_TF_HAS_PRISM;
+		}
+		/* A part saw its builtin candidates at its own depth 0; they were at
+		 * the buffer's only once its closers had taken every opener before. */
+		for (uint32_t b = 0, s = 0; b < h->builtins; b++) {
+			while (s < h->spills && spill[2 * s] < builtin[b]) s++;
+			if (s == depth_at) pparse_push_u32(_pc, &lx->builtins, &lx->builtin_n, &lx->builtin_cap, builtin[b] + off);
+		}
+		for (uint32_t r = 0; r < h->noreturns; r++)
+			pparse_push_u32(_pc, &lx->noreturns, &lx->noreturn_n, &lx->noreturn_cap, nr[r] + off);
+		for (uint32_t b = 0; b < h->braces; b++) pparse_lex_stmt_expr(brace[b] + off);
+		for (uint32_t o = 0; o < h->opens; o++)
+			pparse_push_u32(_pc, &lx->delimiters, &lx->delimiter_n, &lx->delimiter_cap, open[o] + off);
+		if (h->last_prism_idx) last_prism = h->last_prism_idx + off;
+		lx->tag_summary |= h->tag_summary;
+		lines += (int)h->newlines;
+	}
+	const PParseLexPart *last = &head[sp->n - 1];
+	lx->ts.line_no = 1 + lines;
+	lx->ts.at_bol = last->at_bol;
+	lx->ts.has_space = last->has_space;
+	lx->kw_shadow_mask = last->kw_shadow_mask;
+	lx->in_system_include = last->in_system_include;
+	lx->last_prism_idx = last_prism;
+	_pc->current_file = cur;
+	return true;
+}
+
+/* Lexes [p, end) in parts when the host finds the buffer worth it, leaving
+ * `lx` as one run over it would have. Returns where lexing goes on from:
+ * `end`, or `p` when the buffer is to be lexed in one run after all. Kept out
+ * of line: inlined into pparse_tokenize, it slows the one run by about 5%. */
+static char *__attribute__((noinline)) pparse_lex_split(PParseLex *lx, char *p, char *end) {
+	PPARSE_CTX();
+	int want = PPARSE_LEX_JOBS((size_t)(end - p));
+	/* The first part's file view must be the newest, so no view it adds can
+	 * share its 14-bit number. */
+	if (want < 2 || !_pc->input_file_count || _pc->input_files[_pc->input_file_count - 1] != _pc->current_file)
+		return p;
+	PParseLexSplit sp = {.lx = lx,
+			     .entry = _pc->current_file,
+			     .file_base = (uint32_t)_pc->input_file_count,
+			     .name_base = _pc->name_count};
+	sp.n = pparse_lex_cuts(p, end, want < PPARSE_LEX_MAX_PARTS ? want : PPARSE_LEX_MAX_PARTS, sp.cut, sp.kind);
+	if (sp.n < 2) return p;
+	size_t widest = 0;
+	for (int i = 0; i < sp.n; i++)
+		if ((size_t)(sp.cut[i + 1] - sp.cut[i]) > widest) widest = (size_t)(sp.cut[i + 1] - sp.cut[i]);
+	/* Room for a token every 1.3 bytes, which real C text stays well under. */
+	size_t cap = PPARSE_LEX_HEAD + widest * 24 + ((size_t)1 << 20);
+	return PPARSE_LEX_PARALLEL(sp.n, cap, pparse_lex_part, pparse_lex_stitch, &sp) ? end : p;
+}
+
+static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t contents_len) {
+	PPARSE_CTX();
+	_pc->current_file = file;
+	if (contents_len > UINT32_MAX)
+		pparse_error_at(contents, "source file exceeds 4 GiB; cannot record token locations");
+	uint32_t splice_count = 0;
+	uint32_t *splice_offsets = pparse_splice_logical_lines(contents, &contents_len, &splice_count);
+	_pc->token_source = contents;
+	char *p = contents;
+	/* Skip leading UTF-8 BOM (EF BB BF). UTF-16 BOMs are rejected earlier. */
+	if ((unsigned char)p[0] == 0xEF && (unsigned char)p[1] == 0xBB && (unsigned char)p[2] == 0xBF)
+		p += 3;
+	pparse_token_pool_ensure(pparse_token_count + contents_len / 2 + 4096);
+	PParseLex lx = {.ts = {.at_bol = true,
+			       .has_space = false,
+			       .line_no = 1,
+			       .splice_offsets = splice_offsets,
+			       .splice_count = splice_count},
+			.first_idx = pparse_token_count,
+			.delimiter_cap = 64};
+	lx.delimiters = pparse_arena_alloc_uninit(&_pc->main_arena, lx.delimiter_cap * sizeof(*lx.delimiters));
+	uint32_t first_idx = lx.first_idx;
+	/* Splices shift line numbers across a cut, and lex_only text need not
+	 * pair its delimiters; neither is split. */
+	if (!splice_count && !_pc->lex_only) p = pparse_lex_split(&lx, p, contents + contents_len);
+	p = pparse_lex_run(_pc, &lx, p);
+
 	/* `lex_only` callers want the token *spellings* out of text that has not
 	 * been through cc -E yet, where a macro body may legitimately open a
 	 * delimiter it never closes. Pairing is meaningless for them, so an
 	 * unclosed delimiter is not an error; every consumer of pair_idx runs
 	 * only on preprocessed input. */
-	if (delimiter_n > 0 && !_pc->lex_only) {
-		PParseToken *open = &pparse_token_pool[delimiter_stack[delimiter_n - 1]];
+	if (lx.delimiter_n > 0 && !_pc->lex_only) {
+		PParseToken *open = &pparse_token_pool[lx.delimiters[lx.delimiter_n - 1]];
 		pparse_error_tok(open, "unclosed delimiter '%c'", open->ch0);
 	}
-	pparse_new_token(PPARSE_TK_EOF, p, p, &ts);
+	pparse_new_token(PPARSE_TK_EOF, p, p, &lx.ts);
 
 	PParseToken *first = &pparse_token_pool[first_idx];
-	pparse_token_tag_summary = tag_summary;
+	pparse_token_tag_summary = lx.tag_summary;
 	if (_pc->lex_only) return first;
 	{
-		PParseHashMap user_builtin = {0};
-		for (int i = 0; i < builtin_n; i++) {
-			PParseToken *name = &pparse_token_pool[builtin_candidates[i]];
+		uint8_t *user_builtin = NULL;
+		for (int i = 0; i < lx.builtin_n; i++) {
+			PParseToken *name = &pparse_token_pool[lx.builtins[i]];
 			PParseToken *open = pparse_p0_next(name);
 			if (!pparse_match_ch(open, '(')) continue;
 			PParseToken *after = pparse_p0_next(pparse_pair_known(open));
@@ -2299,23 +3035,25 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 				}
 				break;
 			}
-			if (pparse_match_ch(after, '{'))
-				pparse_lex_token_map_put(&user_builtin, name, (void *)1);
+			if (pparse_match_ch(after, '{')) {
+				if (!user_builtin) user_builtin = pparse_lex_name_array(_pc, 1);
+				user_builtin[name->parse_data] = 1;
+			}
 		}
 		/* User definitions of libc noreturn/special names are ordinary unless
 		 * explicitly annotated (_Noreturn / attr). Clear keyword-cache tags so
 		 * taint + auto-unreachable do not treat `int exit(void){…}` as builtin. */
-		if (user_builtin.used > 0) {
+		if (user_builtin) {
 			for (PParseToken *s = first; s->kind != PPARSE_TK_EOF; s = pparse_p0_next(s)) {
-				if ((s->tag & (PPARSE_TT_NORETURN_FN | PPARSE_TT_SPECIAL_FN)) &&
-				    pparse_lex_token_map_get(&user_builtin, s))
+				if ((s->tag & (PPARSE_TT_NORETURN_FN | PPARSE_TT_SPECIAL_FN)) && s->kind <= PPARSE_TK_KEYWORD &&
+				    user_builtin[s->parse_data])
 					s->tag &= ~(PPARSE_TT_NORETURN_FN | PPARSE_TT_SPECIAL_FN);
 			}
 		}
 
 		// Pre-scan function bodies: tag '{' with PPARSE_TT_SPECIAL_FN / PPARSE_TT_ASM / PPARSE_TT_NORETURN_FN(=vfork).
 		// Propagate special-function taint transitively through wrapper chains.
-		if (tag_summary &
+		if (lx.tag_summary &
 		    (PPARSE_TT_SPECIAL_FN | PPARSE_TT_NORETURN_FN | PPARSE_TT_ASM)) {
 			typedef struct {
 				PParseToken *name;
@@ -2413,16 +3151,14 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 
 			uint32_t *wrapper_taint = NULL;
 			int *callee_idx = NULL;
-			PParseHashMap func_map = {0};
+			int *func_map = NULL; // function index + 1 by name id
 			if (function_count > 0) {
 				wrapper_taint = pparse_arena_alloc(&_pc->main_arena,
 							    (size_t)function_count * sizeof(*wrapper_taint));
 				callee_idx = pparse_arena_alloc(&_pc->main_arena,
 							 (size_t)function_count * sizeof(*callee_idx));
-				for (int i = 0; i < function_count; i++) {
-					pparse_lex_token_map_put(
-					    &func_map, functions[i].name, (void *)(intptr_t)(i + 1));
-				}
+				func_map = pparse_lex_name_array(_pc, sizeof(*func_map));
+				for (int i = 0; i < function_count; i++) func_map[functions[i].name->parse_data] = i + 1;
 				for (int i = 0; i < function_count; i++) {
 					callee_idx[i] = -1;
 					PParseToken *callee = pparse_find_wrapper_callee(functions[i].body);
@@ -2436,8 +3172,7 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 							: PPARSE_TT_SPECIAL_FN; // setjmp/longjmp/pthread_exit wrapper
 						continue;
 					}
-					void *v = pparse_lex_token_map_get(&func_map, callee);
-					if (v) callee_idx[i] = (int)(intptr_t)v - 1;
+					callee_idx[i] = func_map[callee->parse_data] - 1;
 				}
 
 				/* Taint flows callee → caller along the wrapper chain. */
@@ -2525,9 +3260,8 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 									continue;
 							}
 						}
-						void *v = pparse_lex_token_map_get(&func_map, b);
-						if (!v) continue;
-						int j = (int)(intptr_t)v - 1;
+						int j = func_map[b->parse_data] - 1;
+						if (j < 0) continue;
 						PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, edges, edge_count + 1,
 									 edge_cap, 64, PParseTaintEdge);
 						edges[edge_count++] = (PParseTaintEdge){i, j};
@@ -2610,8 +3344,9 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 	}
 
 	// When a noreturn specifier is found before a function declaration,
-		if (noreturn_n) {
-			PParseHashMap nr_map = {0};
+		if (lx.noreturn_n) {
+			uint8_t *nr_map = pparse_lex_name_array(_pc, 1);
+			bool any_nr = false;
 #define pparse_SKIP_ATTR_ARGS(a)                                                                                    \
 	do {                                                                                                 \
 		if ((a)->kind <= PPARSE_TK_KEYWORD && pparse_p0_next(a)->ch0 == '(')                              \
@@ -2630,8 +3365,8 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 			pparse_SKIP_ATTR_ARGS(_a);                                                                  \
 		}                                                                                            \
 	} while (0)
-			for (int ni = 0; ni < noreturn_n; ni++) {
-				PParseToken *t = &pparse_token_pool[noreturn_candidates[ni]];
+			for (int ni = 0; ni < lx.noreturn_n; ni++) {
+				PParseToken *t = &pparse_token_pool[lx.noreturns[ni]];
 			bool is_noreturn = false;
 			bool attribute_form = false;
 			PParseToken *scan_start = t;
@@ -2720,7 +3455,8 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 						}
 						/* Prefix _Noreturn / [[noreturn]] / leading attr:
 						 * tag every declarator in the list. */
-						pparse_lex_token_map_put(&nr_map, s, (void *)1);
+						nr_map[s->parse_data] = 1;
+						any_nr = true;
 						fn_name = s;
 					}
 				}
@@ -2729,25 +3465,14 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 				fn_name = pparse_p0_attr_owner_backward(_pc, attr_origin);
 			}
 			if (!fn_name) continue;
-			if (post_decl_attr)
-				pparse_lex_token_map_put(&nr_map, fn_name, (void *)1);
-			else if (!pparse_lex_token_map_get(&nr_map, fn_name))
-				pparse_lex_token_map_put(&nr_map, fn_name, (void *)1);
+			nr_map[fn_name->parse_data] = 1;
+			any_nr = true;
 		}
 
-		if (nr_map.used > 0) {
-			uint64_t nr_bloom = 0;
-			for (int i = 0; i < nr_map.capacity; i++) {
-				PParseHashEntry *ent = &nr_map.buckets[i];
-				if (ent->key && ent->key != PPARSE_TOMBSTONE)
-					nr_bloom |= 1ULL
-						    << (((unsigned char)ent->key[0] ^ ent->key_len) & 63);
-			}
+		if (any_nr) {
 			for (PParseToken *s = first; s->kind != PPARSE_TK_EOF; s = pparse_p0_next(s)) {
-				if (pparse_p0_token_can_name_function(s) &&
-				    (nr_bloom & (1ULL << (((unsigned)s->ch0 ^ s->len) & 63))) &&
-				    !(pparse_token_pool[pparse_idx(_pc, s) - 1].tag & PPARSE_TT_MEMBER) &&
-				    pparse_lex_token_map_get(&nr_map, s))
+				if (pparse_p0_token_can_name_function(s) && nr_map[s->parse_data] &&
+				    !(pparse_token_pool[pparse_idx(_pc, s) - 1].tag & PPARSE_TT_MEMBER))
 					s->tag |= PPARSE_TT_NORETURN_FN;
 			}
 		}
@@ -2759,7 +3484,6 @@ static PParseToken *pparse_tokenize(PParseFile *file, char *contents, size_t con
 	return first;
 }
 static PParseToken *pparse_tokenize_buffer(char *name, char *buf) {
-	pparse_ensure_keyword_cache();
 	size_t contents_len = strlen(buf);
 	PParseFile *file = pparse_add_input_file((PParseFile){.name = pparse_intern_filename(name)});
 	return pparse_tokenize(file, buf, contents_len);
@@ -2804,6 +3528,138 @@ static void pparse_count_dialect_keywords(char *name, char *buf, long *n_defer,
 	}
 }
 
+/* ---- token-stream snapshots ----
+ *
+ * Everything pparse_tokenize leaves behind for analysis: the pool slice from
+ * `first` up to the EOF token, the file views it registered (the buffer's own
+ * and one per linemarker), the file it ended in, the tag summary, and the
+ * source text as splicing and digraph rewriting left it. Pool and file indexes
+ * are stored as they are, so a snapshot only restores onto a context in the
+ * same state it was taken from; the bytes are this build's struct layout, and
+ * whoever persists them keys on that. */
+enum {
+	PPARSE_SNAP_FIRST,
+	PPARSE_SNAP_COUNT,
+	PPARSE_SNAP_FILE_BASE,
+	PPARSE_SNAP_FILE_COUNT,
+	PPARSE_SNAP_CURRENT_FILE,
+	PPARSE_SNAP_TAG_SUMMARY,
+	PPARSE_SNAP_SOURCE_LEN,
+	PPARSE_SNAP_SOURCE_KEPT, // 1: the text is the input buffer's, unchanged
+	PPARSE_SNAP_NAME_BASE,	 // name_count before the tokens were lexed
+	PPARSE_SNAP_WORDS,
+};
+
+/* A malloc'd snapshot of the tokens from pool index `first`, the files from
+ * `file_base` on and the names from `name_base` on, or NULL when out of memory.
+ * With `source_kept`, tokenization did not rewrite the buffer and its text is
+ * left out. The names are not stored: the tokens spell them, in order. */
+static char *pparse_token_snapshot(uint32_t first, uint32_t file_base, uint32_t name_base, bool source_kept,
+				   size_t *len) {
+	PPARSE_CTX();
+	uint32_t head[PPARSE_SNAP_WORDS] = {0};
+	size_t source_len = strlen(_pc->token_source), size = sizeof head;
+	head[PPARSE_SNAP_FIRST] = first;
+	head[PPARSE_SNAP_COUNT] = pparse_token_count - first;
+	head[PPARSE_SNAP_FILE_BASE] = file_base;
+	head[PPARSE_SNAP_FILE_COUNT] = (uint32_t)_pc->input_file_count - file_base;
+	head[PPARSE_SNAP_CURRENT_FILE] = _pc->current_file->file_no;
+	head[PPARSE_SNAP_TAG_SUMMARY] = pparse_token_tag_summary;
+	head[PPARSE_SNAP_SOURCE_LEN] = (uint32_t)source_len;
+	head[PPARSE_SNAP_SOURCE_KEPT] = source_kept;
+	head[PPARSE_SNAP_NAME_BASE] = name_base;
+	for (int i = (int)file_base; i < _pc->input_file_count; i++) size += 9 + strlen(_pc->input_files[i]->name);
+	if (!source_kept) size += source_len;
+	size += (size_t)head[PPARSE_SNAP_COUNT] * sizeof(PParseToken);
+	char *out = malloc(size), *w = out;
+	if (!out) return NULL;
+	memcpy(w, head, sizeof head);
+	w += sizeof head;
+	for (int i = (int)file_base; i < _pc->input_file_count; i++) {
+		PParseFile *f = _pc->input_files[i];
+		int32_t delta = f->line_delta;
+		uint32_t name_len = (uint32_t)strlen(f->name);
+		*w++ = (char)(f->is_system | f->is_direct_system_include << 1 | f->skip_emit << 2);
+		memcpy(w, &delta, 4);
+		memcpy(w + 4, &name_len, 4);
+		memcpy(w + 8, f->name, name_len);
+		w += 8 + name_len;
+	}
+	if (!source_kept) {
+		memcpy(w, _pc->token_source, source_len);
+		w += source_len;
+	}
+	memcpy(w, &pparse_token_pool[first], (size_t)head[PPARSE_SNAP_COUNT] * sizeof(PParseToken));
+	*len = size;
+	return out;
+}
+
+/* Puts a snapshot back in place of tokenizing `buf` (`buf_len` bytes, which
+ * the context then owns as pparse_tokenize would). Returns the first token, or
+ * NULL, having changed nothing, when the snapshot does not fit this context. */
+static PParseToken *pparse_token_restore(const char *snap, size_t len, char *buf, size_t buf_len) {
+	PPARSE_CTX();
+	uint32_t head[PPARSE_SNAP_WORDS];
+	const char *r = snap + sizeof head, *end = snap + len, *files;
+	if (len < sizeof head) return NULL;
+	memcpy(head, snap, sizeof head);
+	uint32_t first = head[PPARSE_SNAP_FIRST], count = head[PPARSE_SNAP_COUNT];
+	uint32_t nfiles = head[PPARSE_SNAP_FILE_COUNT], source_len = head[PPARSE_SNAP_SOURCE_LEN];
+	bool kept = head[PPARSE_SNAP_SOURCE_KEPT];
+	if (first != pparse_token_count || head[PPARSE_SNAP_FILE_BASE] != (uint32_t)_pc->input_file_count ||
+	    head[PPARSE_SNAP_NAME_BASE] != _pc->name_count || !nfiles || head[PPARSE_SNAP_CURRENT_FILE] - head[PPARSE_SNAP_FILE_BASE] >= nfiles || !count ||
+	    source_len > buf_len || (kept && source_len != buf_len))
+		return NULL;
+	files = r;
+	for (uint32_t i = 0; i < nfiles; i++) {
+		uint32_t name_len;
+		if ((size_t)(end - r) < 9) return NULL;
+		memcpy(&name_len, r + 5, 4);
+		if ((size_t)(end - r - 9) < name_len) return NULL;
+		r += 9 + name_len;
+	}
+	if ((size_t)(end - r) != (kept ? 0 : source_len) + (size_t)count * sizeof(PParseToken)) return NULL;
+	pparse_token_pool_ensure((size_t)first + count);
+	PParseToken *toks = &pparse_token_pool[first];
+	memcpy(toks, r + (kept ? 0 : source_len), (size_t)count * sizeof(PParseToken));
+	/* Names are numbered in order of first appearance. */
+	for (uint32_t i = 0, next = _pc->name_count; i < count; i++)
+		if (toks[i].kind <= PPARSE_TK_KEYWORD && toks[i].parse_data >= next) {
+			if (toks[i].parse_data > next) return NULL;
+			next++;
+		}
+
+	for (uint32_t i = 0; i < nfiles; i++) {
+		int32_t delta;
+		uint32_t name_len;
+		memcpy(&delta, files + 1, 4);
+		memcpy(&name_len, files + 5, 4);
+		char *name = pparse_arena_alloc_uninit(&_pc->main_arena, (size_t)name_len + 1);
+		memcpy(name, files + 9, name_len);
+		name[name_len] = '\0';
+		(void)pparse_add_input_file((PParseFile){.name = name,
+					 .line_delta = delta,
+					 .is_system = files[0] & 1,
+					 .is_direct_system_include = (files[0] >> 1) & 1,
+					 .skip_emit = (files[0] >> 2) & 1});
+		files += 9 + name_len;
+	}
+	_pc->current_file = _pc->input_files[head[PPARSE_SNAP_CURRENT_FILE]];
+	if (!kept) {
+		memcpy(buf, r, source_len);
+		buf[source_len] = '\0';
+	}
+	_pc->token_source = buf;
+	for (uint32_t i = 0; i < count; i++)
+		if (toks[i].kind <= PPARSE_TK_KEYWORD && toks[i].parse_data == _pc->name_count) {
+			char *name = buf + toks[i].match_idx;
+			(void)pparse_name_add(_pc, name, toks[i].len, pparse_fast_hash(name, toks[i].len));
+		}
+	pparse_token_count = first + count;
+	pparse_token_tag_summary = head[PPARSE_SNAP_TAG_SUMMARY];
+	return &pparse_token_pool[first];
+}
+
 // Used by both Pass 1 (analysis) and Pass 2 (emission) in prism.c.
 
 typedef struct {
@@ -3133,21 +3989,38 @@ typedef enum {
 #define pparse_is_c23_attr(t) ((t) && ((t)->flags & PPARSE_TF_C23_ATTR))
 #define pparse_is_sizeof_like(t) ((t)->flags & PPARSE_TF_SIZEOF)
 
-static inline PRISM_PURE uint32_t pparse_token_name_hash(PParseToken *tok) {
+/* An identifier token's name id. Pass 1 reuses parse_data on a stream-splice
+ * token and on defer/goto keywords; those find theirs by spelling. */
+static PRISM_PURE uint32_t pparse_token_name_id_slow(PParseContext *_pc, PParseToken *tok) {
+	return pparse_name_lookup(_pc, pparse_loc(_pc, tok), tok->len, pparse_fast_hash(pparse_loc(_pc, tok), tok->len));
+}
+
+static inline PRISM_ALWAYS_INLINE PRISM_PURE uint32_t pparse_token_name_id(PParseContext *_pc, PParseToken *tok) {
+	if (__builtin_expect((tok->flags & PPARSE_TF_LINK_JUMP) || (tok->tag & (PPARSE_TT_DEFER | PPARSE_TT_GOTO)), 0))
+		return pparse_token_name_id_slow(_pc, tok);
 	return tok->parse_data;
 }
 
+/* `*arr` grown, zero-filled, to cover `id` and every id the TU has numbered. */
+#define PPARSE_NAME_ARRAY_COVER(arr, cap, id)                                                            \
+	PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, arr, (size_t)(id) + 1, cap, _pc->name_count, *(arr))
+
+static inline PRISM_PURE int pparse_name_head(const int *heads, uint32_t cap, uint32_t id) {
+	return id < cap ? heads[id] - 1 : -1;
+}
+
 static inline PRISM_PURE PParseFunctionSymbolKind pparse_function_symbol(PParseToken *tok) {
 	PPARSE_CTX();
-	if (!pparse_function_symbols.buckets) return PPARSE_FS_NONE;
-	return (PParseFunctionSymbolKind)(intptr_t)pparse_hashmap_get_hashed(
-	    &pparse_function_symbols, pparse_loc(_pc, tok), tok->len, pparse_token_name_hash(tok));
+	if (tok->kind > PPARSE_TK_KEYWORD) return PPARSE_FS_NONE;
+	uint32_t id = pparse_token_name_id(_pc, tok);
+	return id < _pc->function_symbol_cap ? (PParseFunctionSymbolKind)pparse_function_symbols[id] : PPARSE_FS_NONE;
 }
 
 static inline void pparse_function_symbol_put(PParseToken *tok, PParseFunctionSymbolKind kind) {
 	PPARSE_CTX();
-	pparse_hashmap_put_hashed(
-	    &pparse_function_symbols, pparse_loc(_pc, tok), tok->len, (void *)(intptr_t)kind, pparse_token_name_hash(tok));
+	uint32_t id = pparse_token_name_id(_pc, tok);
+	PPARSE_NAME_ARRAY_COVER(pparse_function_symbols, _pc->function_symbol_cap, id);
+	pparse_function_symbols[id] = (uint8_t)kind;
 }
 
 #define pparse_is_enum_kw(t) ((t)->tag & PPARSE_TT_SUE && (t)->ch0 == 'e')
@@ -3312,7 +4185,8 @@ static void pparse_reset(void) {
 	PPARSE_CTX();
 	pparse_typedef_table = (PParseTypedefTable){0};
 	pparse_ba = (PParseBoundsState){0};
-	pparse_function_symbols = (PParseHashMap){0};
+	pparse_function_symbols = NULL;
+	_pc->function_symbol_cap = 0;
 	_pc->parses_frozen = false;
 	_pc->p1_func_meta = NULL;
 	_pc->p1_func_meta_count = _pc->p1_func_meta_cap = 0;
@@ -3335,17 +4209,15 @@ static void pparse_reset(void) {
 	static void PFX##_build_timelines(void) {                                                  \
 		PPARSE_CTX();                                                                      \
 		(STATE).tl_count_at_build = (TABLE).count;                                         \
-		if ((STATE).max_chain_seen < 8 || !(TABLE).name_map.buckets) return;               \
+		if ((STATE).max_chain_seen < 8 || !(TABLE).heads) return;                          \
 		PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, (STATE).tl_descs, (TABLE).count,         \
 					(STATE).tl_desc_cap, 64, uint64_t);                        \
 		memset((STATE).tl_descs, 0, (size_t)(TABLE).count * sizeof(*(STATE).tl_descs));    \
-		/* Walk name_map heads only (one probe per unique name). */                        \
-		int cap = (TABLE).name_map.capacity;                                               \
+		/* Walk the chain heads only (one per name). */                                    \
 		int pos = 0;                                                                       \
-		for (int b = 0; b < cap; b++) {                                                    \
-			PParseHashEntry *ent = &(TABLE).name_map.buckets[b];                       \
-			if (!ent->key || ent->key == PPARSE_TOMBSTONE) continue;                    \
-			int head = (int)(intptr_t)ent->val - 1;                                    \
+		for (uint32_t id = 0; id < (TABLE).head_cap; id++) {                               \
+			int head = (TABLE).heads[id] - 1;                                          \
+			if (head < 0) continue;                                                    \
 			int run = 0;                                                               \
 			for (int j = head; j >= 0; j = (TABLE).entries[j].prev_index) run++;        \
 			if (run < 8) continue;                                                     \
@@ -3419,12 +4291,10 @@ static PRISM_PURE PParseBoundsArrayEntry *pparse_bounds_array_lookup(PParseConte
 	PParseBoundsState *ba = &pparse_ba;
 	unsigned c0 = tok->ch0, tl = tok->len;
 	if (!(ba->table.bloom & (1ULL << ((c0 ^ tl) & 63)))) return NULL;
-	char *name = pparse_loc(_pc, tok);
 	uint32_t cur = pparse_idx(_pc, tok);
 	PParseBoundsArrayEntry *ents = ba->table.entries;
+	int idx = pparse_name_head(ba->table.heads, ba->table.head_cap, pparse_token_name_id(_pc, tok));
 	if (ba->tl.timeline) {
-		uint32_t hash = pparse_token_name_hash(tok);
-		int idx = pparse_hashmap_index_hashed(&ba->table.name_map, name, (int)tok->len, hash);
 		PPARSE_CHAIN_WALK(PParseBoundsArrayEntry, ents, idx, ba->tl.tl_count_at_build,
 				  if (PPARSE_ENTRY_COVERS(e, cur)) return e;)
 		uint64_t desc = idx >= 0 ? ba->tl.tl_descs[idx] : 0;
@@ -3433,20 +4303,39 @@ static PRISM_PURE PParseBoundsArrayEntry *pparse_bounds_array_lookup(PParseConte
 				  if (PPARSE_ENTRY_COVERS(e, cur)) return e;)
 		return NULL;
 	}
-	int idx = pparse_hashmap_index_hashed(&ba->table.name_map, name, (int)tok->len,
-					      pparse_token_name_hash(tok));
 	PPARSE_CHAIN_WALK(PParseBoundsArrayEntry, ents, idx, 0,
 			  if (PPARSE_ENTRY_COVERS(e, cur)) return e;)
 	return NULL;
 }
 
+/* Which tokens own a typedef-table entry, so a token without one need not
+ * walk its name's chain to learn it has none. A side bitmap rather than a bit
+ * of td_entry: that word is pair_idx for a `raw` or other soft keyword that
+ * carries a recipe, and such a token can be bound too. */
+static void pparse_td_mark_bound(PParseContext *_pc, uint32_t idx) {
+	if (idx >= pparse_typedef_table.bound_cap) {
+		uint32_t cap = pparse_token_count > idx ? pparse_token_count : idx + 1;
+		size_t words = ((size_t)cap + 63) / 64;
+		uint64_t *bits = pparse_arena_alloc(&_pc->main_arena, words * sizeof(uint64_t));
+		if (pparse_typedef_table.bound)
+			memcpy(bits, pparse_typedef_table.bound,
+			       ((size_t)pparse_typedef_table.bound_cap + 63) / 64 * sizeof(uint64_t));
+		pparse_typedef_table.bound = bits;
+		pparse_typedef_table.bound_cap = (uint32_t)(words * 64);
+	}
+	pparse_typedef_table.bound[idx >> 6] |= 1ULL << (idx & 63);
+}
+
+static inline bool pparse_td_is_bound(PParseContext *_pc, PParseToken *tok) {
+	uint32_t idx = pparse_idx(_pc, tok);
+	return idx < pparse_typedef_table.bound_cap && (pparse_typedef_table.bound[idx >> 6] >> (idx & 63) & 1);
+}
+
 static PParseTypedefEntry *
 pparse_typedef_add_entry(PParseToken *tok, int scope_depth, PParseTypedefKind kind, bool is_vla, bool is_void) {
 	PPARSE_CTX();
-	char *name = pparse_loc(_pc, tok);
-	int len = (int)tok->len;
-	uint32_t hash = pparse_fast_hash(name, len);
-	int existing = pparse_hashmap_index_hashed(&pparse_typedef_table.name_map, name, len, hash);
+	uint32_t id = pparse_token_name_id(_pc, tok);
+	int existing = pparse_name_head(pparse_typedef_table.heads, pparse_typedef_table.head_cap, id);
 	// Skip duplicate re-definitions at the same scope (valid C11 §6.7/3).
 	if (existing >= 0) {
 		PParseTypedefEntry *prev = &pparse_typedef_table.entries[existing];
@@ -3473,6 +4362,7 @@ pparse_typedef_add_entry(PParseToken *tok, int scope_depth, PParseTypedefKind ki
 	int new_index = pparse_typedef_table.count++;
 	PParseTypedefEntry *e = &pparse_typedef_table.entries[new_index];
 	tok->td_entry = (uint32_t)(uint16_t)scope_depth;
+	pparse_td_mark_bound(_pc, pparse_idx(_pc, tok));
 	*e = (PParseTypedefEntry){
 	    .prev_index = existing,
 	    .token_index = pparse_idx(_pc, tok),
@@ -3486,8 +4376,9 @@ pparse_typedef_add_entry(PParseToken *tok, int scope_depth, PParseTypedefKind ki
 	    .is_struct_tag = kind == PPARSE_TDK_STRUCT_TAG,
 	    .array_dim_complete = true,
 	};
-	pparse_hashmap_put_hashed(&pparse_typedef_table.name_map, name, len, (void *)(intptr_t)(new_index + 1), hash);
-	pparse_typedef_table.bloom |= 1ULL << (((unsigned char)name[0] ^ len) & 63);
+	PPARSE_NAME_ARRAY_COVER(pparse_typedef_table.heads, pparse_typedef_table.head_cap, id);
+	pparse_typedef_table.heads[id] = new_index + 1;
+	pparse_typedef_table.bloom |= 1ULL << ((tok->ch0 ^ tok->len) & 63);
 	int cl = 1;
 	for (int p = e->prev_index; (p >= 0) & (cl < 8); p = pparse_typedef_table.entries[p].prev_index) cl++;
 	if (cl > pparse_typedef_table.tl.max_chain_seen) pparse_typedef_table.tl.max_chain_seen = cl;
@@ -3501,13 +4392,15 @@ pparse_typedef_add_entry(PParseToken *tok, int scope_depth, PParseTypedefKind ki
 	return e;
 }
 
-static PRISM_PURE int pparse_typedef_get_index(char *name, int len) {
-	PPARSE_CTX();
-	return pparse_hashmap_index_hashed(&pparse_typedef_table.name_map, name, len, pparse_fast_hash(name, len));
-}
 static PParseTypedefEntry *pparse_binding_entry(PParseToken *tok, bool shadow_only) {
 	PPARSE_CTX();
-	for (int ix = pparse_typedef_get_index(pparse_loc(_pc, tok), tok->len); ix >= 0;
+	/* Most asks are about a declarator before it is registered; a common
+	 * name's chain holds every scope's binding of it, so walking it to find
+	 * nothing made each function pay for the whole TU. */
+	if (tok->kind <= PPARSE_TK_KEYWORD && !pparse_td_is_bound(_pc, tok)) return NULL;
+	for (int ix = pparse_name_head(pparse_typedef_table.heads, pparse_typedef_table.head_cap,
+				       pparse_token_name_id(_pc, tok));
+	     ix >= 0;
 	     ix = pparse_typedef_table.entries[ix].prev_index) {
 		PParseTypedefEntry *e = &pparse_typedef_table.entries[ix];
 		if ((e->token_index == pparse_idx(_pc, tok)) & (!shadow_only | e->is_shadow)) return e;
@@ -3580,12 +4473,10 @@ static PRISM_PURE PParseTypedefEntry *pparse_typedef_lookup(PParseContext *_pc,
 		return NULL;
 	unsigned c0 = tok->ch0, tl = tok->len;
 	if (!(tbl->bloom & (1ULL << ((c0 ^ tl) & 63)))) return NULL;
-	char *name = pparse_loc(_pc, tok);
 	uint32_t cur = pparse_idx(_pc, tok);
+	int idx = pparse_name_head(tbl->heads, tbl->head_cap, pparse_token_name_id(_pc, tok));
 	if (td->timeline) {
-		uint32_t hash = pparse_token_name_hash(tok);
 		PParseTypedefEntry *tag_fallback = NULL;
-		int idx = pparse_hashmap_index_hashed(&tbl->name_map, name, (int)tok->len, hash);
 		/* Entries added since the last build are absent from the sorted
 		 * timeline. Walk only that bounded newest prefix. */
 		PPARSE_CHAIN_WALK(PParseTypedefEntry, tbl->entries, idx, td->tl_count_at_build,
@@ -3600,7 +4491,6 @@ static PRISM_PURE PParseTypedefEntry *pparse_typedef_lookup(PParseContext *_pc,
 				  PPARSE_ACCEPT_NONTAG_ELSE_REMEMBER)
 		return tag_fallback;
 	}
-	int idx = pparse_hashmap_index_hashed(&tbl->name_map, name, tok->len, pparse_token_name_hash(tok));
 	// ISO C11 §6.2.3: tag namespace is separate from ordinary identifiers.
 	PParseTypedefEntry *tag_fallback = NULL;
 	PPARSE_CHAIN_WALK(PParseTypedefEntry, tbl->entries, idx, 0,
@@ -3632,11 +4522,10 @@ static PRISM_PURE PParseTypedefEntry *pparse_tag_lookup(PParseToken *tok) {
 	if (!pparse_is_identifier_like(tok)) return NULL;
 	unsigned c0 = tok->ch0, tl = tok->len;
 	if (!(pparse_typedef_table.bloom & (1ULL << ((c0 ^ tl) & 63)))) return NULL;
-	char *name = pparse_loc(_pc, tok);
 	uint32_t cur = pparse_idx(_pc, tok);
+	int idx = pparse_name_head(pparse_typedef_table.heads, pparse_typedef_table.head_cap,
+				   pparse_token_name_id(_pc, tok));
 	if (pparse_typedef_table.tl.timeline) {
-		uint32_t hash = pparse_token_name_hash(tok);
-		int idx = pparse_hashmap_index_hashed(&pparse_typedef_table.name_map, name, (int)tok->len, hash);
 		PPARSE_CHAIN_WALK(PParseTypedefEntry, pparse_typedef_table.entries, idx,
 				  pparse_typedef_table.tl.tl_count_at_build,
 				  if (e->is_struct_tag && PPARSE_ENTRY_COVERS(e, cur)) return e;)
@@ -3646,7 +4535,6 @@ static PRISM_PURE PParseTypedefEntry *pparse_tag_lookup(PParseToken *tok) {
 				  if (e->is_struct_tag && PPARSE_ENTRY_COVERS(e, cur)) return e;)
 		return NULL;
 	}
-	int idx = pparse_hashmap_index_hashed(&pparse_typedef_table.name_map, name, tok->len, pparse_token_name_hash(tok));
 	PPARSE_CHAIN_WALK(PParseTypedefEntry, pparse_typedef_table.entries, idx, 0,
 			  if (e->is_struct_tag && PPARSE_ENTRY_COVERS(e, cur)) return e;)
 	return NULL;
@@ -3834,12 +4722,12 @@ static PRISM_PURE PParseArrayBindingInfo pparse_array_binding_info(PParseToken *
 	return info;
 }
 
-static void pparse_bounds_array_add(char *name, int len, uint32_t token_index, uint8_t array_rank,
+static void pparse_bounds_array_add(PParseToken *tok, uint8_t array_rank,
 				     bool dim_complete, bool is_vla_var, bool blocks_outer,
 				     uint8_t ptr_hops, uint8_t pre_ptr_array, uint32_t static_extent_tok) {
 	PPARSE_CTX();
-	uint32_t hash = pparse_fast_hash(name, len);
-	int existing = pparse_hashmap_index_hashed(&pparse_ba.table.name_map, name, len, hash);
+	uint32_t id = pparse_token_name_id(_pc, tok), token_index = pparse_idx(_pc, tok);
+	int existing = pparse_name_head(pparse_ba.table.heads, pparse_ba.table.head_cap, id);
 	if (existing >= 0) {
 		PParseBoundsArrayEntry *prev = &pparse_ba.table.entries[existing];
 		if (prev->token_index == token_index) {
@@ -3872,9 +4760,9 @@ static void pparse_bounds_array_add(char *name, int len, uint32_t token_index, u
 					 .ptr_hops = ptr_hops,
 					 .pre_ptr_array = pre_ptr_array,
 					 .static_extent_tok = static_extent_tok};
-	pparse_hashmap_put_hashed(
-	    &pparse_ba.table.name_map, name, len, (void *)(intptr_t)(new_index + 1), hash);
-	pparse_ba.table.bloom |= 1ULL << (((unsigned char)name[0] ^ len) & 63);
+	PPARSE_NAME_ARRAY_COVER(pparse_ba.table.heads, pparse_ba.table.head_cap, id);
+	pparse_ba.table.heads[id] = new_index + 1;
+	pparse_ba.table.bloom |= 1ULL << ((tok->ch0 ^ tok->len) & 63);
 	int cl = 1;
 	for (int p = e->prev_index; p >= 0 && cl < 8; p = pparse_ba.table.entries[p].prev_index) cl++;
 	if (cl > pparse_ba.tl.max_chain_seen) pparse_ba.tl.max_chain_seen = cl;
@@ -3889,8 +4777,7 @@ static void pparse_register_array_binding_hops(PParseToken *tok,
 				     bool is_vla,
 				     bool blocks_outer,
 				     uint8_t ptr_hops) {
-	PPARSE_CTX();
-	pparse_bounds_array_add(pparse_loc(_pc, tok), tok->len, pparse_idx(_pc, tok), rank, dim_complete,
+	pparse_bounds_array_add(tok, rank, dim_complete,
 				is_vla, blocks_outer, ptr_hops, 0, 0);
 }
 
@@ -3901,14 +4788,12 @@ static void pparse_register_array_binding_hops_pre(PParseToken *tok,
 						  bool blocks_outer,
 						  uint8_t ptr_hops,
 						  uint8_t pre_ptr_array) {
-	PPARSE_CTX();
-	pparse_bounds_array_add(pparse_loc(_pc, tok), tok->len, pparse_idx(_pc, tok), rank, dim_complete,
+	pparse_bounds_array_add(tok, rank, dim_complete,
 				is_vla, blocks_outer, ptr_hops, pre_ptr_array, 0);
 }
 
 static void pparse_register_static_extent_param(PParseToken *tok, uint8_t rank, uint32_t bracket) {
-	PPARSE_CTX();
-	pparse_bounds_array_add(pparse_loc(_pc, tok), tok->len, pparse_idx(_pc, tok), rank, true, false,
+	pparse_bounds_array_add(tok, rank, true, false,
 				false, 0, 0, bracket);
 }
 
@@ -4117,8 +5002,7 @@ static bool pparse_register_type_array_extent(PParseToken *bind_name, PParseType
 
 static PRISM_PURE PParseBoundsArrayEntry *pparse_bounds_array_entry_for_token(PParseToken *t) {
 	PPARSE_CTX();
-	for (int ix = pparse_hashmap_index_hashed(
-		 &pparse_ba.table.name_map, pparse_loc(_pc, t), t->len, pparse_token_name_hash(t));
+	for (int ix = pparse_name_head(pparse_ba.table.heads, pparse_ba.table.head_cap, pparse_token_name_id(_pc, t));
 	     ix >= 0;
 	     ix = pparse_ba.table.entries[ix].prev_index) {
 		PParseBoundsArrayEntry *e = &pparse_ba.table.entries[ix];
@@ -7589,6 +8473,7 @@ typedef struct {
 	bool is_stmt_expr : 1;
 	bool is_conditional : 1;
 	bool is_init : 1; // initializer brace: = { ... } — not a compound statement
+	bool is_plain : 1; // file-scope function body with nothing for Pass 2 to lower
 } PParseScopeInfo;
 
 #define pparse_scope_tree ((PParseScopeInfo *)_pc->p1_scope_tree)
@@ -8657,7 +9542,7 @@ static void pparse_plan_raw_strip(PParseToken *tok) {
 				     PPARSE_TT_INLINE | PPARSE_TT_TYPEDEF)) ||
 		      (after->flags & PPARSE_TF_RAW)))
 			return;
-	} else if (tok->td_entry) {
+	} else if ((uint16_t)tok->td_entry) {
 		return;
 	}
 	if (!pparse_is_raw_strip_context(tok, after)) return;
@@ -8679,6 +9564,37 @@ static PRISM_PURE bool pparse_needs_space(PParseToken *prev, PParseToken *tok) {
 	       ((a == '*') & (b == '/'));
 }
 
+/* A token of a function body that Pass 2 has to route through the statement
+ * machinery: a raw strip, a directive, a _Generic fold, a noreturn call, or a
+ * declaration that gains an initializer, a `static`, or a split. A declaration
+ * that is the braceless body of a control statement is brace-wrapped, and a
+ * struct body's line breaks depend on whether a declaration emits it. */
+static inline bool pparse_body_token_lowers(PParseToken *t, PParseToken *open) {
+	uint32_t ann = pparse_ann(t);
+	if ((t->flags & PPARSE_TF_RAW) | (t->kind == PPARSE_TK_PREP_DIR) |
+	    (((t->flags ^ open->flags) & PPARSE_TF_SYS_SKIP) != 0) |
+	    ((t->tag & PPARSE_TT_GENERIC) != 0))
+		return true;
+	if (t->kind == PPARSE_TK_PUNCT) {
+		PPARSE_CTX();
+		if (t->ch0 == '{' && (t->flags & PPARSE_TF_OPEN))
+			return pparse_scope_tree[(uint16_t)t->parse_data].is_struct;
+		return t->ch0 == ',' && (ann & P1_DECL_SPLIT);
+	}
+	if ((t->tag & PPARSE_TT_NORETURN_FN) && (ann & P1_NORETURN_CALL_RECIPE)) return true;
+	if ((ann & P1_DECL_RECIPE) &&
+	    (ann & ((3u << P1_DECL_ZERO_SHIFT) | P1_DECL_AUTO_STATIC | P1_DECL_CONST_ORELSE |
+		    P1_DECL_BRACKET_OE)))
+		return true;
+	if (ann & P1_IS_DECL) {
+		PParseToken *prev = t - 1;
+		char c = prev->ch0;
+		return prev->kind != PPARSE_TK_PUNCT || prev->len != 1 ||
+		       !((c == ';') | (c == '{') | (c == '}') | (c == '('));
+	}
+	return false;
+}
+
 /* Freeze the remaining emission recipes and find an optional identifier while
  * the token pool is hot. */
 static bool pparse_finalize(const char *find_ident) {
@@ -8696,6 +9612,11 @@ static bool pparse_finalize(const char *find_ident) {
 	bool static_storage_initializer = false;
 	int raw_block_depth = 0;
 	uint32_t uneval_covered_until = 0;
+	/* The file-scope function body being summarized for Pass 2, and whether
+	 * it is still plain: no group defer/orelse and no token that lowers. */
+	PParseToken *body_open = NULL;
+	uint32_t body_close = 0;
+	bool plain = false;
 	for (PParseToken *t = pparse_token_pool + 1; t->kind != PPARSE_TK_EOF; t++) {
 		uint32_t ti = (uint32_t)(t - pparse_token_pool);
 		unsigned char ch = t->ch0;
@@ -8765,8 +9686,10 @@ static bool pparse_finalize(const char *find_ident) {
 			if (ch == '[') {
 				PParseBoundsPlan plan;
 				PParseToken *prev = t > pparse_token_pool + 1 ? t - 1 : NULL;
-				if (pparse_bounds_plan_subscript(t, prev, &plan))
+				if (pparse_bounds_plan_subscript(t, prev, &plan)) {
 					pparse_analysis_add(t, PPARSE_AR_BOUNDS)->as.bounds = plan;
+					plain = false;
+				}
 			} else if (ch == '*' &&
 				   pparse_bounds_deref_add_is_unverifiable(t)) {
 				if (warn_safety)
@@ -8776,13 +9699,27 @@ static bool pparse_finalize(const char *find_ident) {
 			}
 		}
 		if ((pparse_ann(t) & P1_RAW_BLOCK) && ch == '{') raw_block_depth++;
+		if (body_open) {
+			if (ti == body_close) {
+				pparse_scope_tree[(uint16_t)body_open->parse_data].is_plain = plain;
+				body_open = NULL;
+			} else if (plain && pparse_body_token_lowers(t, body_open))
+				plain = false;
+		} else if (ch == '{' && (t->flags & PPARSE_TF_OPEN) && t->pair_idx) {
+			PParseScopeInfo *si = &pparse_scope_tree[(uint16_t)t->parse_data];
+			if (si->is_func_body && !si->parent_id) {
+				body_open = t;
+				body_close = t->pair_idx;
+				plain = !(t->flags & PPARSE_TF_HAS_PRISM);
+			}
+		}
 	}
 	return found;
 }
 
 void pparse_tokenizer_teardown(bool full) {
 	PPARSE_CTX();
-	free(_pc->token_source);
+	PPARSE_FREE_SOURCE(_pc->token_source);
 	if (full) {
 		free(pparse_sos_do_frames);
 		free(pparse_sos_do_snap_buf);
@@ -8794,7 +9731,6 @@ void pparse_tokenizer_teardown(bool full) {
 			b = next;
 		}
 		_pc->main_arena.head = _pc->main_arena.current = NULL;
-		memset(pparse_keyword_cache, 0, sizeof(pparse_keyword_cache));
 		free(pparse_token_pool);
 		pparse_token_pool = NULL;
 		pparse_token_cap = 0;
@@ -8803,6 +9739,9 @@ void pparse_tokenizer_teardown(bool full) {
 		_pc->main_arena.current = _pc->main_arena.head;
 	}
 	pparse_token_count = 1;
+	_pc->names = NULL;
+	_pc->name_slots = NULL;
+	_pc->name_count = _pc->name_cap = _pc->name_slot_mask = 0;
 	_pc->input_files = NULL;
 	_pc->input_file_count = 0;
 	_pc->input_file_capacity = 0;
@@ -12503,13 +13442,9 @@ static void p1d_handle_close_brace(P1ScanState *s) {
 	s->p1d_prev = tok;
 	s->tok = pparse_next(_pc, tok);
 }
-static PRISM_HOT void p1_full_depth_prescan(PParseToken *tok) {
+static void p1_prescan_start(P1ScanState *ps, PParseToken *tok) {
 	PPARSE_CTX();
-	const bool has_orelse = pparse_feat(PPARSE_F_ORELSE);
-	const bool has_defer = pparse_feat(PPARSE_F_DEFER);
-	const bool has_flow_extensions = has_orelse | has_defer;
-	P1ScanState _ps = {0};
-	P1ScanState *ps = &_ps;
+	*ps = (P1ScanState){0};
 	ps->tok = tok;
 	ps->at_stmt_start = true;
 	ps->file_scope_stmt_start = tok;
@@ -12523,13 +13458,22 @@ static PRISM_HOT void p1_full_depth_prescan(PParseToken *tok) {
 	ps->p1d_braceless_next_sid = pparse_scope_tree_count;
 	pparse_td_scope_close = UINT32_MAX;
 	pparse_p1_has_raw_block = false;
+}
+
+/* Scans from ps->tok up to the token at pool index `stop`, or to EOF. A run
+ * may overshoot `stop` when a construct straddles it. */
+static PRISM_HOT void p1_prescan_run(P1ScanState *ps, uint32_t stop) {
+	PPARSE_CTX();
+	const bool has_orelse = pparse_feat(PPARSE_F_ORELSE);
+	const bool has_defer = pparse_feat(PPARSE_F_DEFER);
+	const bool has_flow_extensions = has_orelse | has_defer;
 
 #define CUR_SID() (ps->scope_stack[ps->scope_depth])
 #ifdef PRISM_DEBUG
 	uint64_t p1_wd_steps = 0;
 	const uint64_t p1_wd_budget = 256ull * (uint64_t)pparse_token_count + 65536ull;
 #endif
-	while (ps->tok->kind != PPARSE_TK_EOF) {
+	while (ps->tok->kind != PPARSE_TK_EOF && pparse_idx(_pc, ps->tok) < stop) {
 #ifdef PRISM_DEBUG
 		if (++p1_wd_steps > p1_wd_budget)
 			pparse_error_tok(ps->tok,
@@ -13840,6 +14784,445 @@ static unsigned pparse_context_intro(PParseToken *t) {
 	       type_ctor * PPARSE_CI_TYPE_CTOR;
 }
 
+/* ---- Pass 1 prefix snapshots ----
+ *
+ * Most translation units open with a run of system headers that the last one
+ * opened with too, and the prescan spends most of its time there. A snapshot
+ * is what the prescan leaves behind at the end of such a prefix: the typedef,
+ * bounds and function tables, function metadata, Pass 1 entries, analysis
+ * records, and the token annotations it wrote. Positions are stored as pool
+ * indexes and names as name ids, and a restored token keeps its own source
+ * offset, so a snapshot restores onto any stream whose prefix has the same
+ * tokens, spellings, file views and scopes, wherever that prefix's text lies
+ * in the source; the host keys on those. It is refused unless the prescan is at rest at file
+ * scope, and for state it does not carry: labels, defers, bounds plans, a
+ * warning, or a name that does not lie in the prefix source. */
+#define PPARSE_PREFIX_MAX_BOUNDS 32
+
+enum {
+	PPARSE_PREFIX_BOUND,
+	PPARSE_PREFIX_DIFFS,
+	PPARSE_PREFIX_TD_COUNT,
+	PPARSE_PREFIX_TD_NAMES, // ids the tables below cover
+	PPARSE_PREFIX_TD_CHAIN,
+	PPARSE_PREFIX_BA_COUNT,
+	PPARSE_PREFIX_BA_NAMES,
+	PPARSE_PREFIX_BA_CHAIN,
+	PPARSE_PREFIX_FS_NAMES,
+	PPARSE_PREFIX_FUNCS,
+	PPARSE_PREFIX_ENTRIES,
+	PPARSE_PREFIX_RECORDS,
+	PPARSE_PREFIX_HEADS,
+	PPARSE_PREFIX_PREV,
+	PPARSE_PREFIX_STMT_START,
+	PPARSE_PREFIX_RAW_BLOCK,
+	PPARSE_PREFIX_WALK_STOPS,
+	PPARSE_PREFIX_WORDS,
+};
+
+typedef struct {
+	uint32_t tok[5]; // body_open and the return-type tokens, as pool indexes
+	uint32_t entry_start, entry_count, returns_void, has_computed_goto;
+} PParsePrefixFunc;
+
+typedef struct {
+	uint32_t idx;
+	PParseToken tok;
+} PParsePrefixDiff;
+
+/* Where a prefix may end: before the first token of each system header a
+ * user file includes, and before the first token not from a system header,
+ * provided every token ahead of it came from one. File views only grow along
+ * the stream, so a view between two tokens' views was entered between them.
+ * Fills `bounds` in increasing order; a bound is never the first token. */
+static int pparse_prefix_bounds(PParseToken *tok, uint32_t *bounds) {
+	PPARSE_CTX();
+	uint32_t first = pparse_idx(_pc, tok), view = tok->file_idx;
+	int n = 0;
+	for (uint32_t i = first; pparse_token_pool[i].kind != PPARSE_TK_EOF; i++) {
+		PParseToken *t = &pparse_token_pool[i];
+		if (t->file_idx >= (uint32_t)_pc->input_file_count || t->file_idx < view) break;
+		if (!_pc->input_files[t->file_idx]->is_system) {
+			if (i > first) bounds[n++] = i;
+			break;
+		}
+		bool entered = false;
+		for (; view < t->file_idx; view++) entered |= _pc->input_files[view + 1]->is_direct_system_include;
+		if (entered && i > first && n < PPARSE_PREFIX_MAX_BOUNDS - 1) bounds[n++] = i;
+	}
+	return n;
+}
+
+static inline uint32_t pparse_prefix_ref(PParseContext *_pc, PParseToken *tok) {
+	return tok ? pparse_idx(_pc, tok) : 0;
+}
+
+static inline PParseToken *pparse_prefix_deref(PParseContext *_pc, uintptr_t idx) {
+	return idx ? &pparse_token_pool[idx] : NULL;
+}
+
+/* The ids an id-indexed array names anything under: up to its last entry. */
+static uint32_t pparse_prefix_name_span(const void *arr, uint32_t cap, size_t elem_size) {
+	while (cap && !memcmp((const char *)arr + (size_t)(cap - 1) * elem_size, "\0\0\0\0", elem_size)) cap--;
+	return cap;
+}
+
+/* Checks `n` words at `r` as an id-indexed array of values up to `max_val`. */
+static bool pparse_prefix_names_ok(PParseContext *_pc, const char *r, uint32_t n, uint32_t max_val) {
+	if (n > _pc->name_count) return false;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t v;
+		memcpy(&v, r + (size_t)i * 4, 4);
+		if (v > max_val) return false;
+	}
+	return true;
+}
+
+static void pparse_prefix_get_heads(PParseContext *_pc, const char **r, int **heads, uint32_t *cap, uint32_t n) {
+	*heads = NULL;
+	*cap = 0;
+	if (!n) return;
+	PPARSE_NAME_ARRAY_COVER(*heads, *cap, n - 1);
+	memcpy(*heads, *r, (size_t)n * 4);
+	*r += (size_t)n * 4;
+}
+
+/* Rewrites a record's token pointers as pool indexes, or back. */
+static void pparse_prefix_swizzle(PParseContext *_pc, PParseAnalysisRecord *rec, bool to_index) {
+	PParseToken **refs[2] = {&rec->as.type.end, &rec->as.type.sue_kw};
+	if (rec->kind == PPARSE_AR_DECL) refs[0] = &rec->as.decl.end, refs[1] = &rec->as.decl.var_name;
+	if (rec->kind != PPARSE_AR_TYPE && rec->kind != PPARSE_AR_DECL) return;
+	for (int i = 0; i < 2; i++)
+		*refs[i] = to_index ? (PParseToken *)(uintptr_t)pparse_prefix_ref(_pc, *refs[i])
+				    : pparse_prefix_deref(_pc, (uintptr_t)*refs[i]);
+}
+
+/* A malloc'd snapshot of the prescan in `ps`, which has just stopped at pool
+ * index `bound`. `image` is the pool as pparse_build_scopes left it, and
+ * `warnings`/`tags` the counts the prescan started from. NULL when the state
+ * cannot be carried. */
+static char *pparse_prefix_snapshot(P1ScanState *ps, uint32_t bound, const PParseToken *image,
+				    uint32_t warnings, uint32_t tags, size_t *len) {
+	PPARSE_CTX();
+	uint32_t head[PPARSE_PREFIX_WORDS] = {0}, named = 0;
+	if (ps->tok != &pparse_token_pool[bound] || ps->brace_depth || ps->scope_depth || ps->p1d_cur_func != -1 ||
+	    ps->p1d_switch_top || ps->p1d_init_brace_depth || ps->local_label_count || !ps->at_stmt_start ||
+	    ps->p1d_saw_raw || ps->p1d_saw_static || ps->p1d_ctrl_pending || ps->p1d_decl_has_attr ||
+	    ps->p1d_decl_start || ps->p1d_braceless_next_sid != pparse_scope_tree_count ||
+	    pparse_td_scope_close != UINT32_MAX || _pc->warnings != warnings || pparse_token_tag_summary != tags)
+		return NULL;
+	uint32_t diffs = 0, heads = 0;
+	for (uint32_t i = 1; i < pparse_token_count; i++)
+		if (memcmp(&pparse_token_pool[i], &image[i], sizeof(PParseToken)) != 0) {
+			if (i >= bound) return NULL;
+			diffs++;
+		}
+	for (int i = 0; i < p1_entry_count; i++)
+		if (p1_entries[i].kind == P1K_LABEL || p1_entries[i].kind == P1K_GOTO || p1_entries[i].kind == P1K_DEFER)
+			return NULL;
+	for (int i = 0; i < func_meta_count; i++)
+		if (func_meta[i].defer_name_set.buckets || func_meta[i].label_hash) return NULL;
+	PParseAnalysisRecord *records = _pc->analysis_records;
+	for (uint32_t i = 0; i < _pc->analysis_count; i++)
+		if (records[i].kind == PPARSE_AR_BOUNDS) return NULL;
+	if (_pc->analysis_index)
+		for (uint32_t i = 1; i < pparse_token_count; i++)
+			if (_pc->analysis_index[i]) {
+				if (i >= bound) return NULL;
+				heads++;
+			}
+	/* Entries past the prefix's names would point into the rest of the
+	 * stream, which a resumed file need not share. */
+	for (uint32_t i = 1; i < bound; i++)
+		if (pparse_token_pool[i].kind <= PPARSE_TK_KEYWORD) {
+			uint32_t id = pparse_token_name_id(_pc, &pparse_token_pool[i]);
+			if (id != UINT32_MAX && id >= named) named = id + 1;
+		}
+	head[PPARSE_PREFIX_BOUND] = bound;
+	head[PPARSE_PREFIX_DIFFS] = diffs;
+	head[PPARSE_PREFIX_TD_COUNT] = (uint32_t)pparse_typedef_table.count;
+	head[PPARSE_PREFIX_TD_NAMES] =
+	    pparse_prefix_name_span(pparse_typedef_table.heads, pparse_typedef_table.head_cap, sizeof(int));
+	head[PPARSE_PREFIX_TD_CHAIN] = (uint32_t)pparse_typedef_table.tl.max_chain_seen;
+	head[PPARSE_PREFIX_BA_COUNT] = (uint32_t)pparse_ba.table.count;
+	head[PPARSE_PREFIX_BA_NAMES] = pparse_prefix_name_span(pparse_ba.table.heads, pparse_ba.table.head_cap, sizeof(int));
+	head[PPARSE_PREFIX_BA_CHAIN] = (uint32_t)pparse_ba.tl.max_chain_seen;
+	head[PPARSE_PREFIX_FS_NAMES] = pparse_prefix_name_span(pparse_function_symbols, _pc->function_symbol_cap, 1);
+	if (head[PPARSE_PREFIX_TD_NAMES] > named || head[PPARSE_PREFIX_BA_NAMES] > named ||
+	    head[PPARSE_PREFIX_FS_NAMES] > named)
+		return NULL;
+	head[PPARSE_PREFIX_FUNCS] = (uint32_t)func_meta_count;
+	head[PPARSE_PREFIX_ENTRIES] = (uint32_t)p1_entry_count;
+	head[PPARSE_PREFIX_RECORDS] = _pc->analysis_count;
+	head[PPARSE_PREFIX_HEADS] = heads;
+	head[PPARSE_PREFIX_PREV] = pparse_prefix_ref(_pc, ps->p1d_prev);
+	head[PPARSE_PREFIX_STMT_START] = pparse_prefix_ref(_pc, ps->file_scope_stmt_start);
+	head[PPARSE_PREFIX_RAW_BLOCK] = pparse_p1_has_raw_block;
+	head[PPARSE_PREFIX_WALK_STOPS] = pparse_walk_stops;
+	size_t size = sizeof head + 2 * sizeof(uint64_t) + (size_t)diffs * sizeof(PParsePrefixDiff) +
+		      (size_t)head[PPARSE_PREFIX_TD_COUNT] * sizeof(PParseTypedefEntry) +
+		      (size_t)head[PPARSE_PREFIX_BA_COUNT] * sizeof(PParseBoundsArrayEntry) +
+		      ((size_t)head[PPARSE_PREFIX_TD_NAMES] + head[PPARSE_PREFIX_BA_NAMES] + head[PPARSE_PREFIX_FS_NAMES]) * 4 +
+		      (size_t)head[PPARSE_PREFIX_FUNCS] * sizeof(PParsePrefixFunc) +
+		      (size_t)head[PPARSE_PREFIX_ENTRIES] * sizeof(P1FuncEntry) +
+		      (size_t)head[PPARSE_PREFIX_RECORDS] * sizeof(PParseAnalysisRecord) + (size_t)heads * 8;
+	char *out = malloc(size), *w = out;
+	if (!out) return NULL;
+	uint64_t blooms[2] = {pparse_typedef_table.bloom, pparse_ba.table.bloom};
+	memcpy(w, head, sizeof head);
+	memcpy(w + sizeof head, blooms, sizeof blooms);
+	w += sizeof head + sizeof blooms;
+	for (uint32_t i = 1; i < bound; i++)
+		if (memcmp(&pparse_token_pool[i], &image[i], sizeof(PParseToken)) != 0) {
+			PParsePrefixDiff d = {.idx = i, .tok = pparse_token_pool[i]};
+			memcpy(w, &d, sizeof d);
+			w += sizeof d;
+		}
+	if (pparse_typedef_table.count)
+		memcpy(w, pparse_typedef_table.entries, (size_t)pparse_typedef_table.count * sizeof(PParseTypedefEntry));
+	w += (size_t)head[PPARSE_PREFIX_TD_COUNT] * sizeof(PParseTypedefEntry);
+	if (pparse_ba.table.count)
+		memcpy(w, pparse_ba.table.entries, (size_t)pparse_ba.table.count * sizeof(PParseBoundsArrayEntry));
+	w += (size_t)head[PPARSE_PREFIX_BA_COUNT] * sizeof(PParseBoundsArrayEntry);
+	if (head[PPARSE_PREFIX_TD_NAMES]) memcpy(w, pparse_typedef_table.heads, (size_t)head[PPARSE_PREFIX_TD_NAMES] * 4);
+	w += (size_t)head[PPARSE_PREFIX_TD_NAMES] * 4;
+	if (head[PPARSE_PREFIX_BA_NAMES]) memcpy(w, pparse_ba.table.heads, (size_t)head[PPARSE_PREFIX_BA_NAMES] * 4);
+	w += (size_t)head[PPARSE_PREFIX_BA_NAMES] * 4;
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_FS_NAMES]; i++) {
+		uint32_t kind = pparse_function_symbols[i];
+		memcpy(w, &kind, 4);
+		w += 4;
+	}
+	for (int i = 0; i < func_meta_count; i++) {
+		FuncMeta *fm = &func_meta[i];
+		PParsePrefixFunc f = {.tok = {pparse_prefix_ref(_pc, fm->body_open),
+					      pparse_prefix_ref(_pc, fm->ret_type_start),
+					      pparse_prefix_ref(_pc, fm->ret_type_end),
+					      pparse_prefix_ref(_pc, fm->ret_type_suffix_start),
+					      pparse_prefix_ref(_pc, fm->ret_type_suffix_end)},
+				      .entry_start = (uint32_t)fm->entry_start,
+				      .entry_count = (uint32_t)fm->entry_count,
+				      .returns_void = fm->returns_void,
+				      .has_computed_goto = fm->has_computed_goto};
+		memcpy(w, &f, sizeof f);
+		w += sizeof f;
+	}
+	if (p1_entry_count) memcpy(w, p1_entries, (size_t)p1_entry_count * sizeof(P1FuncEntry));
+	w += (size_t)head[PPARSE_PREFIX_ENTRIES] * sizeof(P1FuncEntry);
+	for (uint32_t i = 0; i < _pc->analysis_count; i++) {
+		PParseAnalysisRecord rec = records[i];
+		pparse_prefix_swizzle(_pc, &rec, true);
+		memcpy(w, &rec, sizeof rec);
+		w += sizeof rec;
+	}
+	for (uint32_t i = 1; heads && i < bound; i++)
+		if (_pc->analysis_index[i]) {
+			uint32_t pair[2] = {i, _pc->analysis_index[i]};
+			memcpy(w, pair, sizeof pair);
+			w += sizeof pair;
+		}
+	*len = size;
+	return out;
+}
+
+/* Puts a snapshot taken at pool index `bound` in place of scanning up to it,
+ * leaving `ps` where that scan would have. Returns false, having changed
+ * nothing, when the snapshot does not fit this stream. */
+static bool pparse_prefix_restore(P1ScanState *ps, const char *snap, size_t len, uint32_t bound) {
+	PPARSE_CTX();
+	uint32_t head[PPARSE_PREFIX_WORDS];
+	uint64_t blooms[2];
+	if (len < sizeof head + sizeof blooms) return false;
+	memcpy(head, snap, sizeof head);
+	memcpy(blooms, snap + sizeof head, sizeof blooms);
+	const char *r = snap + sizeof head + sizeof blooms, *diffs = r, *tds, *bas, *maps, *funcs, *ents, *recs, *heads;
+	uint32_t td_count = head[PPARSE_PREFIX_TD_COUNT], ba_count = head[PPARSE_PREFIX_BA_COUNT],
+		 nrec = head[PPARSE_PREFIX_RECORDS];
+	size_t nnames = (size_t)head[PPARSE_PREFIX_TD_NAMES] + head[PPARSE_PREFIX_BA_NAMES] +
+			head[PPARSE_PREFIX_FS_NAMES];
+	if (head[PPARSE_PREFIX_BOUND] != bound || head[PPARSE_PREFIX_PREV] >= bound ||
+	    head[PPARSE_PREFIX_STMT_START] > bound || td_count > INT32_MAX || ba_count > INT32_MAX ||
+	    head[PPARSE_PREFIX_FUNCS] > INT32_MAX || head[PPARSE_PREFIX_ENTRIES] > INT32_MAX ||
+	    nrec > INT32_MAX || head[PPARSE_PREFIX_TD_NAMES] > INT32_MAX ||
+	    head[PPARSE_PREFIX_BA_NAMES] > INT32_MAX || head[PPARSE_PREFIX_FS_NAMES] > INT32_MAX)
+		return false;
+	tds = diffs + (size_t)head[PPARSE_PREFIX_DIFFS] * sizeof(PParsePrefixDiff);
+	bas = tds + (size_t)td_count * sizeof(PParseTypedefEntry);
+	maps = bas + (size_t)ba_count * sizeof(PParseBoundsArrayEntry);
+	funcs = maps + nnames * 4;
+	ents = funcs + (size_t)head[PPARSE_PREFIX_FUNCS] * sizeof(PParsePrefixFunc);
+	recs = ents + (size_t)head[PPARSE_PREFIX_ENTRIES] * sizeof(P1FuncEntry);
+	heads = recs + (size_t)nrec * sizeof(PParseAnalysisRecord);
+	if ((size_t)(heads - snap) + (size_t)head[PPARSE_PREFIX_HEADS] * 8 != len) return false;
+
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_DIFFS]; i++) {
+		uint32_t idx;
+		memcpy(&idx, diffs + (size_t)i * sizeof(PParsePrefixDiff), sizeof idx);
+		if (!idx || idx >= bound) return false;
+	}
+	for (uint32_t i = 0; i < td_count; i++) {
+		PParseTypedefEntry e;
+		memcpy(&e, tds + (size_t)i * sizeof e, sizeof e);
+		if (e.prev_index < -1 || e.prev_index >= (int)i || e.token_index >= bound) return false;
+	}
+	for (uint32_t i = 0; i < ba_count; i++) {
+		PParseBoundsArrayEntry e;
+		memcpy(&e, bas + (size_t)i * sizeof e, sizeof e);
+		if (e.prev_index < -1 || e.prev_index >= (int)i || e.token_index >= bound ||
+		    e.static_extent_tok >= bound)
+			return false;
+	}
+	const char *m = maps;
+	if (!pparse_prefix_names_ok(_pc, m, head[PPARSE_PREFIX_TD_NAMES], td_count) ||
+	    !pparse_prefix_names_ok(_pc, m += (size_t)head[PPARSE_PREFIX_TD_NAMES] * 4, head[PPARSE_PREFIX_BA_NAMES],
+				    ba_count) ||
+	    !pparse_prefix_names_ok(_pc, m + (size_t)head[PPARSE_PREFIX_BA_NAMES] * 4, head[PPARSE_PREFIX_FS_NAMES],
+				    PPARSE_FS_AGGREGATE_RETURN))
+		return false;
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_FUNCS]; i++) {
+		PParsePrefixFunc f;
+		memcpy(&f, funcs + (size_t)i * sizeof f, sizeof f);
+		for (int j = 0; j < 5; j++)
+			if (f.tok[j] >= bound) return false;
+		if (f.entry_start > head[PPARSE_PREFIX_ENTRIES] ||
+		    f.entry_count > head[PPARSE_PREFIX_ENTRIES] - f.entry_start)
+			return false;
+	}
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_ENTRIES]; i++) {
+		P1FuncEntry e;
+		memcpy(&e, ents + (size_t)i * sizeof e, sizeof e);
+		if (e.token_index >= bound || (e.kind != P1K_DECL && e.kind != P1K_SWITCH && e.kind != P1K_CASE))
+			return false;
+	}
+	for (uint32_t i = 0; i < nrec; i++) {
+		PParseAnalysisRecord rec;
+		memcpy(&rec, recs + (size_t)i * sizeof rec, sizeof rec);
+		if (rec.next > nrec || rec.kind == PPARSE_AR_BOUNDS || rec.kind > PPARSE_AR_BOUNDS) return false;
+		if (rec.kind == PPARSE_AR_BARE_ORELSE && rec.as.token_idx >= bound) return false;
+		if (rec.kind == PPARSE_AR_TYPE && ((uintptr_t)rec.as.type.end >= bound ||
+						   (uintptr_t)rec.as.type.sue_kw >= bound ||
+						   rec.as.type.object_type_idx > bound))
+			return false;
+		if (rec.kind == PPARSE_AR_DECL &&
+		    ((uintptr_t)rec.as.decl.end >= bound || (uintptr_t)rec.as.decl.var_name >= bound))
+			return false;
+	}
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_HEADS]; i++) {
+		uint32_t pair[2];
+		memcpy(pair, heads + (size_t)i * 8, 8);
+		if (!pair[0] || pair[0] >= bound || !pair[1] || pair[1] > nrec) return false;
+	}
+
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_DIFFS]; i++) {
+		PParsePrefixDiff d;
+		memcpy(&d, diffs + (size_t)i * sizeof d, sizeof d);
+		d.tok.match_idx = pparse_token_pool[d.idx].match_idx;
+		pparse_token_pool[d.idx] = d.tok;
+	}
+	PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, pparse_typedef_table.entries, td_count,
+				pparse_typedef_table.capacity, 32, PParseTypedefEntry);
+	memcpy(pparse_typedef_table.entries, tds, (size_t)td_count * sizeof(PParseTypedefEntry));
+	pparse_typedef_table.count = (int)td_count;
+	for (uint32_t i = 0; i < td_count; i++) pparse_td_mark_bound(_pc, pparse_typedef_table.entries[i].token_index);
+	pparse_typedef_table.bloom = blooms[0];
+	PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, pparse_ba.table.entries, ba_count, pparse_ba.table.capacity, 16,
+				PParseBoundsArrayEntry);
+	memcpy(pparse_ba.table.entries, bas, (size_t)ba_count * sizeof(PParseBoundsArrayEntry));
+	pparse_ba.table.count = (int)ba_count;
+	pparse_ba.table.bloom = blooms[1];
+	pparse_prefix_get_heads(_pc, &maps, &pparse_typedef_table.heads, &pparse_typedef_table.head_cap,
+				head[PPARSE_PREFIX_TD_NAMES]);
+	pparse_prefix_get_heads(_pc, &maps, &pparse_ba.table.heads, &pparse_ba.table.head_cap,
+				head[PPARSE_PREFIX_BA_NAMES]);
+	pparse_function_symbols = NULL;
+	_pc->function_symbol_cap = 0;
+	if (head[PPARSE_PREFIX_FS_NAMES])
+		PPARSE_NAME_ARRAY_COVER(pparse_function_symbols, _pc->function_symbol_cap,
+					head[PPARSE_PREFIX_FS_NAMES] - 1);
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_FS_NAMES]; i++) {
+		uint32_t kind;
+		memcpy(&kind, maps + (size_t)i * 4, 4);
+		pparse_function_symbols[i] = (uint8_t)kind;
+	}
+	/* Timelines only index the chains; rebuilding them here answers every
+	 * lookup the way the ones built along the prefix would have. */
+	pparse_typedef_table.tl.max_chain_seen = (int)head[PPARSE_PREFIX_TD_CHAIN];
+	pparse_ba.tl.max_chain_seen = (int)head[PPARSE_PREFIX_BA_CHAIN];
+	pparse_td_build_timelines();
+	pparse_ba_build_timelines();
+	for (uint32_t i = 0; i < head[PPARSE_PREFIX_FUNCS]; i++) {
+		PParsePrefixFunc f;
+		memcpy(&f, funcs + (size_t)i * sizeof f, sizeof f);
+		PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, _pc->p1_func_meta, func_meta_count, func_meta_cap, 64,
+					FuncMeta);
+		func_meta[func_meta_count++] = (FuncMeta){.body_open = pparse_prefix_deref(_pc, f.tok[0]),
+							  .ret_type_start = pparse_prefix_deref(_pc, f.tok[1]),
+							  .ret_type_end = pparse_prefix_deref(_pc, f.tok[2]),
+							  .ret_type_suffix_start = pparse_prefix_deref(_pc, f.tok[3]),
+							  .ret_type_suffix_end = pparse_prefix_deref(_pc, f.tok[4]),
+							  .entry_start = (int)f.entry_start,
+							  .entry_count = (int)f.entry_count,
+							  .returns_void = f.returns_void,
+							  .has_computed_goto = f.has_computed_goto};
+	}
+	if (head[PPARSE_PREFIX_ENTRIES]) {
+		PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, _pc->p1_func_entries, head[PPARSE_PREFIX_ENTRIES],
+					p1_entry_cap, 64, P1FuncEntry);
+		memcpy(_pc->p1_func_entries, ents, (size_t)head[PPARSE_PREFIX_ENTRIES] * sizeof(P1FuncEntry));
+		p1_entry_count = (int)head[PPARSE_PREFIX_ENTRIES];
+	}
+	if (nrec) {
+		PParseAnalysisRecord *records = _pc->analysis_records;
+		PPARSE_ARENA_ENSURE_CAP(&_pc->main_arena, records, nrec, _pc->analysis_cap, 64, PParseAnalysisRecord);
+		_pc->analysis_records = records;
+		for (uint32_t i = 0; i < nrec; i++) {
+			memcpy(&records[i], recs + (size_t)i * sizeof *records, sizeof *records);
+			pparse_prefix_swizzle(_pc, &records[i], false);
+		}
+		_pc->analysis_count = nrec;
+		_pc->analysis_index = pparse_arena_alloc(
+		    &_pc->main_arena, (size_t)pparse_token_count * sizeof(*_pc->analysis_index));
+		for (uint32_t i = 0; i < head[PPARSE_PREFIX_HEADS]; i++) {
+			uint32_t pair[2];
+			memcpy(pair, heads + (size_t)i * 8, 8);
+			_pc->analysis_index[pair[0]] = pair[1];
+		}
+	}
+	pparse_p1_has_raw_block = head[PPARSE_PREFIX_RAW_BLOCK] != 0;
+	pparse_walk_stops |= head[PPARSE_PREFIX_WALK_STOPS];
+	ps->tok = &pparse_token_pool[bound];
+	ps->p1d_prev = pparse_prefix_deref(_pc, head[PPARSE_PREFIX_PREV]);
+	ps->file_scope_stmt_start = pparse_prefix_deref(_pc, head[PPARSE_PREFIX_STMT_START]);
+	return true;
+}
+
+/* The prescan, resumed from a prefix snapshot where the host has one and
+ * leaving one behind where it asks. */
+static void p1_full_depth_prescan(PParseToken *tok) {
+	PPARSE_CTX();
+	P1ScanState ps;
+	uint32_t bounds[PPARSE_PREFIX_MAX_BOUNDS];
+	uint32_t warnings = _pc->warnings, tags = pparse_token_tag_summary;
+	int n = pparse_prefix_bounds(tok, bounds), hit = -1, want = -1;
+	size_t len = 0;
+	const char *snap = n ? PPARSE_PREFIX_LOAD(bounds, n, &hit, &want, &len) : NULL;
+	PParseToken *image = NULL;
+	p1_prescan_start(&ps, tok);
+	if (want > hit) {
+		image = pparse_arena_alloc_uninit(&_pc->main_arena, (size_t)pparse_token_count * sizeof(PParseToken));
+		memcpy(image, pparse_token_pool, (size_t)pparse_token_count * sizeof(PParseToken));
+	}
+	_pc->p1_restored = 0;
+	if (snap && !pparse_prefix_restore(&ps, snap, len, bounds[hit])) hit = -1;
+	else if (snap) _pc->p1_restored = bounds[hit] - pparse_idx(_pc, tok);
+	if (image) {
+		p1_prescan_run(&ps, bounds[want]);
+		char *out = pparse_prefix_snapshot(&ps, bounds[want], image, warnings, tags, &len);
+		if (out) PPARSE_PREFIX_STORE(out, len);
+	}
+	p1_prescan_run(&ps, UINT32_MAX);
+}
+
 static bool pparse_analyze(PParseToken *tok) {
 	PPARSE_CTX();
 	pparse_reset();
@@ -13847,11 +15230,29 @@ static bool pparse_analyze(PParseToken *tok) {
 	 * prism_reset() on the way out, so clearing it there would leave nothing
 	 * for a caller to read after the call returns. */
 	pparse_walk_stops = 0;
+	/* Each sweep needs the one before it whole: the prescan numbers its
+	 * braceless scopes after the last brace scope, and finalize first builds
+	 * timelines from the complete tables. The CFG check reads each function's
+	 * Pass 1 entries, not tokens. */
+	uint64_t swept = (uint64_t)(pparse_token_count - pparse_idx(_pc, tok)) * sizeof(PParseToken);
+	double t0 = PPARSE_CLOCK_MS();
 	pparse_build_scopes(tok);
+	double t1 = PPARSE_CLOCK_MS();
 	p1_full_depth_prescan(tok);
+	double t2 = PPARSE_CLOCK_MS();
 	bool has_bounds_helper =
 	    pparse_finalize(pparse_feat(PPARSE_F_BOUNDS_CHECK) ? "__prism_bchk" : NULL);
+	double t3 = PPARSE_CLOCK_MS();
 	p1_verify_cfg();
+	double t4 = PPARSE_CLOCK_MS();
+	_pc->phase_ms[PPARSE_PHASE_SCOPES] = t1 - t0;
+	_pc->phase_ms[PPARSE_PHASE_PRESCAN] = t2 - t1;
+	_pc->phase_ms[PPARSE_PHASE_FINALIZE] = t3 - t2;
+	_pc->phase_ms[PPARSE_PHASE_CFG] = t4 - t3;
+	_pc->phase_bytes[PPARSE_PHASE_SCOPES] = swept;
+	_pc->phase_bytes[PPARSE_PHASE_PRESCAN] = swept - (uint64_t)_pc->p1_restored * sizeof(PParseToken);
+	_pc->phase_bytes[PPARSE_PHASE_FINALIZE] = (uint64_t)(pparse_token_count - 1) * sizeof(PParseToken);
+	_pc->phase_bytes[PPARSE_PHASE_CFG] = (uint64_t)p1_entry_count * sizeof(P1FuncEntry);
 	_pc->parses_frozen = true;
 	return has_bounds_helper;
 }
@@ -14,6 +14,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <spawn.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -34,10 +35,29 @@
 
 /* parse.c is self-contained: it includes its own headers and needs nothing
  * declared above this point. Keep it that way — it is consumed STB-style,
- * as a single file dropped into a host TU. */
+ * as a single file dropped into a host TU. The hooks it takes are how to
+ * release a source buffer (preprocessed text may be a mapped pp-cache entry),
+ * where to keep Pass 1 prefix snapshots, which scan kernels to tokenize with,
+ * and the workers that tokenize a large buffer in parts. */
 #ifndef PRISM_LIB_MODE
 #define PRISM_SINGLE_THREAD
 #endif
+#include <stdbool.h>
+#include <stdint.h>
+static void pp_buf_free(char *buf);
+static const char *p1_prefix_load(const uint32_t *bounds, int n, int *hit, int *want, size_t *len);
+static void p1_prefix_store(char *snap, size_t len);
+static int lex_jobs(size_t len);
+static bool lex_parallel(int n, size_t cap, bool (*job)(void *, int, char *, size_t), bool (*done)(void *, char **),
+			 void *arg);
+#define PPARSE_FREE_SOURCE pp_buf_free
+#define PPARSE_PREFIX_LOAD p1_prefix_load
+#define PPARSE_PREFIX_STORE p1_prefix_store
+#define PPARSE_SCAN_DEFAULT getenv("PRISM_SCAN_KERNEL")
+#define PPARSE_LEX_JOBS lex_jobs
+#define PPARSE_LEX_PARALLEL lex_parallel
+static inline double prism_now_ms(void);
+#define PPARSE_CLOCK_MS prism_now_ms
 #include "parse.c"
 
 static char **build_clean_environ(void);
@@ -67,6 +87,10 @@ static const char *prism_getenv(const char *name) {
 #endif
 #ifndef _WIN32
 #include <dirent.h> /* preprocessor-cache eviction sweep */
+#include <poll.h> /* --prism-server */
+#include <sys/file.h> /* entry index log locking */
+#include <sys/socket.h>
+#include <sys/un.h>
 #endif
 
 typedef struct {
@@ -278,6 +302,7 @@ typedef struct {
 	int dep_arg_count, dep_arg_cap;
 	int prog_arg_count, prog_arg_cap;
 	int rsp_owned_count;
+	int jobs; // -j N: worker cap for multi-source builds (0 = PRISM_JOBS, else core count)
 	CliMode mode;
 	CliAction action;
 	bool verbose;
@@ -287,6 +312,8 @@ typedef struct {
 	bool assemble_only; // -S: synthesize .s like -c synthesizes .o
 	bool passthrough;
 	bool no_link_pragma; // -fno-link-pragma: suppress #pragma link libs
+	bool integrated_cpp; // -fintegrated-cpp: preprocess without spawning cc -E
+	bool object_cache;   // -fobject-cache: reuse backend objects of unchanged -c compiles
 	/* Language from `-x` that applied to the first Prism source (GCC: -x
 	 * binds subsequent inputs until the next -x). NULL → default "c". */
 	const char *source_x_lang;
@@ -378,6 +405,11 @@ static PRISM_THREAD_LOCAL PParseToken *last_emitted = NULL;
 static PRISM_THREAD_LOCAL char out_buf[OUT_BUF_SIZE];
 static PRISM_THREAD_LOCAL int out_buf_pos = 0;
 static PRISM_THREAD_LOCAL int64_t out_total_flushed = 0;
+/* While the output cache records a translation unit, everything flushed to
+ * out_fp is copied here too. NULL once an append fails to grow it. */
+static PRISM_THREAD_LOCAL char *out_capture;
+static PRISM_THREAD_LOCAL size_t out_capture_len, out_capture_cap;
+static PRISM_THREAD_LOCAL bool out_capturing;
 static PRISM_THREAD_LOCAL bool use_linemarkers = false; // true = GCC linemarker "# N", false = C99 "#line N"
 
 typedef struct {
@@ -403,6 +435,7 @@ static PRISM_THREAD_LOCAL int ctrl_save_cap = 0;
 static PRISM_THREAD_LOCAL int current_func_idx = -1;  // Index into func_meta[] for the function being emitted
 static PRISM_THREAD_LOCAL bool is_msvc_cached;	      // cached target_is_msvc(), set in transpile_tokens
 static PRISM_THREAD_LOCAL bool prism_profile = false; // --prism-prof: emit phase timing to stderr
+static PRISM_THREAD_LOCAL bool prism_integrated_cpp = false; // -fintegrated-cpp: preprocess in-process
 /* Reparse emitted C and require a fixed point (ignoring linemarkers). */
 static PRISM_THREAD_LOCAL bool prism_verify_mode = false;
 static PRISM_THREAD_LOCAL bool prism_in_verify = false;
@@ -566,10 +599,33 @@ static bool dir_has_write_bits(const char *path) {
 	return (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) != 0;
 }
 
+static PRISM_COLD void out_capture_append(const char *s, size_t n) {
+	if (out_capture_len + n > out_capture_cap) {
+		size_t cap = out_capture_cap ? out_capture_cap : (size_t)1 << 16;
+		while (cap < out_capture_len + n) cap *= 2;
+		char *grown = realloc(out_capture, cap);
+		if (!grown) {
+			free(out_capture);
+			out_capture = NULL;
+			out_capturing = false;
+			return;
+		}
+		out_capture = grown;
+		out_capture_cap = cap;
+	}
+	memcpy(out_capture + out_capture_len, s, n);
+	out_capture_len += n;
+}
+
+static void out_write(const char *s, size_t n) {
+	fwrite(s, 1, n, out_fp);
+	out_total_flushed += (int64_t)n;
+	if (out_capturing) out_capture_append(s, n);
+}
+
 static void out_flush(void) {
 	if (out_buf_pos > 0) {
-		fwrite(out_buf, 1, out_buf_pos, out_fp);
-		out_total_flushed += out_buf_pos;
+		out_write(out_buf, (size_t)out_buf_pos);
 		out_buf_pos = 0;
 	}
 }
@@ -577,8 +633,7 @@ static void out_flush(void) {
 static PRISM_COLD void out_str_slow(const char *s, int len) {
 	if (len >= OUT_BUF_SIZE) {
 		out_flush();
-		fwrite(s, 1, len, out_fp);
-		out_total_flushed += len;
+		out_write(s, (size_t)len);
 		return;
 	}
 	out_flush();
@@ -3471,6 +3526,56 @@ static PParseToken *handle_close_brace(PParseToken *tok) {
 	return tok;
 }
 
+/* emit_tok for `tok`, then for the tokens after it, up to a brace or `stop`,
+ * that the source already spells the way emit_tok would: on the same line,
+ * with no marker or inserted newline due, and apart by nothing or by the one
+ * space emit_tok puts there. Those go out as a single copy of the source. */
+static PParseToken *emit_plain_run(PParseToken *tok, PParseToken *stop) {
+	PRISM_STATE();
+	PPARSE_CTX();
+	emit_tok(tok);
+	PParseToken *next = pparse_next(_pc, tok);
+	if (last_emitted != tok) return next;
+	const bool lines = (_pc->features & PPARSE_F_LINE_DIR) != 0;
+	const uint32_t stops = (_pc->features & PPARSE_F_FLATTEN) ? 0 : PPARSE_TF_SYS_SKIP;
+	uint32_t from = tok->match_idx + tok->len, end = from;
+	PParseToken *prev = tok;
+	for (; next != stop; prev = next, next = pparse_next(_pc, next)) {
+		uint32_t gap = next->match_idx - end;
+		if (pparse_at_bol(next) || (next->flags & stops) || next->kind == PPARSE_TK_PREP_DIR ||
+		    (next->tag & _ps->dialect_watch_tags) || (lines && next->line_no != prev->line_no))
+			break;
+		if ((next->flags & (PPARSE_TF_OPEN | PPARSE_TF_CLOSE)) && (next->ch0 == '{' || next->ch0 == '}'))
+			break;
+		if (gap == 1 ? !(next->flags & PPARSE_TF_HAS_SPACE) || _pc->token_source[end] != ' '
+			     : gap || (next->flags & PPARSE_TF_HAS_SPACE) || pparse_needs_space(prev, next))
+			break;
+		if (emit_newline_before_decl_after_stmt_boundary(prev, next)) break;
+		end = next->match_idx + next->len;
+	}
+	out_str(_pc->token_source + from, (int)(end - from));
+	last_emitted = prev;
+	return next;
+}
+
+/* A file-scope function body Pass 1 found plain (see pparse_finalize): every
+ * token is emitted as is, with only the braces kept on the scope stack that
+ * emit_tok's declaration spacing reads, and runs the source already spells
+ * right are copied whole. */
+static PParseToken *emit_plain_body(PParseToken *open) {
+	PParseToken *close = pparse_pair_known(open);
+	PParseToken *tok = handle_open_brace(open);
+	while (tok != close) {
+		if ((tok->flags & (PPARSE_TF_OPEN | PPARSE_TF_CLOSE)) && tok->ch0 == '{')
+			tok = handle_open_brace(tok);
+		else if ((tok->flags & (PPARSE_TF_OPEN | PPARSE_TF_CLOSE)) && tok->ch0 == '}')
+			tok = handle_close_brace(tok);
+		else
+			tok = emit_plain_run(tok, close);
+	}
+	return handle_close_brace(close);
+}
+
 static char **build_clean_environ(void) {
 	/* Each spawn snapshots the host environment.  Do not cache runtime-owned
 	 * pointers: a caller may replace an environment value between Prism calls. */
@@ -3608,7 +3713,8 @@ static int prism_spawn_retry(pid_t *pid, const char *file, posix_spawn_file_acti
 	return err;
 }
 
-static int spawn_command(char **argv, posix_spawn_file_actions_t *actions) {
+/* spawn_command without the wait: the child, or -1 once the failure is reported. */
+static pid_t spawn_command_start(char **argv, posix_spawn_file_actions_t *actions) {
 	char **env = build_clean_environ();
 	if (!env) return -1;
 
@@ -3619,7 +3725,12 @@ static int spawn_command(char **argv, posix_spawn_file_actions_t *actions) {
 		fprintf(stderr, "posix_spawnp: %s: %s\n", argv[0], strerror(err));
 		return -1;
 	}
-	return wait_for_child(pid);
+	return pid;
+}
+
+static int spawn_command(char **argv, posix_spawn_file_actions_t *actions) {
+	pid_t pid = spawn_command_start(argv, actions);
+	return pid < 0 ? -1 : wait_for_child(pid);
 }
 
 #ifndef _WIN32
@@ -3855,6 +3966,7 @@ static int msvc_output_flag_kind(const char *a);
 #ifndef PRISM_LIB_MODE
 static bool cli_has_cxx_passthrough(const Cli *cli);
 static const char *cxx_driver_for_cc(const char *cc);
+static int server_run(void);
 #endif
 
 static void pp_msvc_define_reserve(int needed) {
@@ -4689,7 +4801,7 @@ static const char *prism_file_input_error(const char *path) {
 }
 
 /* Preprocessed-output cache: every validation uncertainty is a miss. */
-#define PP_CACHE_MAGIC "PRISMPPC4\n"
+#define PP_CACHE_MAGIC "PRISMPPC8\n"
 
 /* Zero means unavailable; recent second-resolution files are not cached. */
 #if defined(_WIN32)
@@ -4733,15 +4845,59 @@ static bool pp_stat_id(const char *path, PPStat *o) {
 	return true;
 }
 
+/* Cache keys and payload checksums share one 128-bit hash. Four independent
+ * 64-bit lanes take 32 bytes per step (the xxHash64 round), so the multiplies
+ * overlap instead of forming one chain per byte, and a multi-MB payload hashes
+ * at memory speed. Lengths are folded in, so {"ab","c"} and {"a","bc"} cannot
+ * collide. Byte order is the host's: entries never leave the machine. */
+#define PPK_P1 0x9e3779b185ebca87ULL
+#define PPK_P2 0xc2b2ae3d27d4eb4fULL
+#define PPK_P3 0x165667b19e3779f9ULL
+
+static inline uint64_t ppk_rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t ppk_round(uint64_t acc, uint64_t v) {
+	return ppk_rotl(acc + v * PPK_P2, 31) * PPK_P1;
+}
+
+static inline uint64_t ppk_avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= PPK_P2;
+	h ^= h >> 29;
+	h *= PPK_P3;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t ppk_load64(const unsigned char *s) {
+	uint64_t v;
+	memcpy(&v, s, 8);
+	return v;
+}
+
 static void ppk_feed(PPKey *k, const void *p, size_t n) {
-	const unsigned char *s = (const unsigned char *)p;
-	for (size_t i = 0; i < n; i++) {
-		k->a = (k->a ^ s[i]) * 0x100000001b3ULL;
-		k->b = (k->b + s[i] + 1) * 0x9e3779b97f4a7c15ULL;
-		k->b ^= k->b >> 29;
+	const unsigned char *s = (const unsigned char *)p, *end = s + n;
+	uint64_t v0 = k->a + PPK_P1, v1 = k->b ^ PPK_P2, v2 = k->a ^ PPK_P3, v3 = k->b - PPK_P1;
+	for (; end - s >= 32; s += 32) {
+		v0 = ppk_round(v0, ppk_load64(s));
+		v1 = ppk_round(v1, ppk_load64(s + 8));
+		v2 = ppk_round(v2, ppk_load64(s + 16));
+		v3 = ppk_round(v3, ppk_load64(s + 24));
+	}
+	uint64_t a = ppk_rotl(v0, 1) + ppk_rotl(v1, 7) + ppk_rotl(v2, 12) + ppk_rotl(v3, 18) + (uint64_t)n;
+	uint64_t b = v0 * PPK_P3 + ppk_rotl(v1, 29) * PPK_P1 + ppk_rotl(v2, 41) * PPK_P2 + (v3 ^ (uint64_t)n * PPK_P2);
+	for (; end - s >= 8; s += 8) {
+		uint64_t w = ppk_load64(s);
+		a = ppk_rotl(a ^ ppk_round(0, w), 27) * PPK_P1 + PPK_P3;
+		b = ppk_rotl(b + w * PPK_P3, 29) * PPK_P2;
 	}
-	/* Length-feed so {"ab","c"} and {"a","bc"} cannot collide. */
-	k->a ^= n * 0xff51afd7ed558ccdULL;
+	for (; s < end; s++) {
+		a = ppk_rotl(a ^ (*s * PPK_P1), 11) * PPK_P2;
+		b = ppk_rotl(b + (*s + 1u) * PPK_P2, 17) * PPK_P3;
+	}
+	k->a = ppk_avalanche(a ^ ppk_rotl(b, 32));
+	k->b = ppk_avalanche(b + k->a);
 }
 
 static void ppk_feed_str(PPKey *k, const char *s) {
@@ -4761,6 +4917,65 @@ static void ppk_feed_stat(PPKey *k, const PPStat *id) {
 	ppk_feed(k, &id->inode, sizeof id->inode);
 }
 
+/* ---- dependency stat memo ---------------------------------------------
+ *
+ * Every TU of a multi-source invocation validates its pp-cache entry against
+ * the same system headers and search directories. Their identities are looked
+ * up once per invocation and kept here: for the CLI that is the process, for
+ * the library one call (prism_reset forgets them), since a caller may edit
+ * headers between calls. Only validation reads the memo; a store records
+ * what it stats itself. */
+typedef struct {
+	char *path;
+	PPStat id;
+	bool ok;
+} PPStatMemo;
+
+static PRISM_THREAD_LOCAL PPStatMemo *pp_stat_memo;
+static PRISM_THREAD_LOCAL uint32_t pp_stat_memo_cap, pp_stat_memo_count;
+
+static void pp_stat_memo_reset(void) {
+	for (uint32_t i = 0; i < pp_stat_memo_cap; i++) free(pp_stat_memo[i].path);
+	free(pp_stat_memo);
+	pp_stat_memo = NULL;
+	pp_stat_memo_cap = pp_stat_memo_count = 0;
+}
+
+static uint32_t pp_stat_memo_slot(const PPStatMemo *tab, uint32_t cap, const char *path) {
+	PPKey h = {0, 0};
+	ppk_feed_str(&h, path);
+	uint32_t i = (uint32_t)h.a & (cap - 1);
+	while (tab[i].path && strcmp(tab[i].path, path) != 0) i = (i + 1) & (cap - 1);
+	return i;
+}
+
+static bool pp_stat_memo_grow(void) {
+	uint32_t cap = pp_stat_memo_cap ? pp_stat_memo_cap * 2 : 512;
+	PPStatMemo *tab = calloc(cap, sizeof *tab);
+	if (!tab) return false;
+	for (uint32_t i = 0; i < pp_stat_memo_cap; i++)
+		if (pp_stat_memo[i].path) tab[pp_stat_memo_slot(tab, cap, pp_stat_memo[i].path)] = pp_stat_memo[i];
+	free(pp_stat_memo);
+	pp_stat_memo = tab;
+	pp_stat_memo_cap = cap;
+	return true;
+}
+
+/* pp_stat_id, answered from the memo after the first ask. */
+static bool pp_stat_id_memo(const char *path, PPStat *o) {
+	if (pp_stat_memo_count * 2 >= pp_stat_memo_cap && !pp_stat_memo_grow()) return pp_stat_id(path, o);
+	PPStatMemo *m = &pp_stat_memo[pp_stat_memo_slot(pp_stat_memo, pp_stat_memo_cap, path)];
+	if (!m->path) {
+		char *copy = strdup(path);
+		if (!copy) return pp_stat_id(path, o);
+		m->path = copy;
+		m->ok = pp_stat_id(path, &m->id);
+		pp_stat_memo_count++;
+	}
+	*o = m->id;
+	return m->ok;
+}
+
 static PPKey pp_payload_checksum(const char *payload, size_t len) {
 	PPKey sum = {0x6a09e667f3bcc909ULL, 0xbb67ae8584caa73bULL};
 	ppk_feed_str(&sum, "prism-pp-payload");
@@ -4786,8 +5001,9 @@ static bool pp_is_dir_sep(char c) {
 }
 
 /* Resolve `name` through PATH and fold the binary's identity into the key, so
- * upgrading or switching compilers invalidates every entry. */
-static void ppk_feed_compiler(PPKey *k, const char *name) {
+ * upgrading or switching compilers invalidates every entry. False when the
+ * binary could not be found, i.e. nothing identifying was fed. */
+static bool ppk_feed_compiler(PPKey *k, const char *name) {
 	PPStat id;
 #ifdef _WIN32
 	const char *sep_in_name = strpbrk(name, "/\\");
@@ -4795,11 +5011,12 @@ static void ppk_feed_compiler(PPKey *k, const char *name) {
 	const char *sep_in_name = strchr(name, '/');
 #endif
 	if (sep_in_name) {
-		if (pp_stat_id(name, &id)) ppk_feed_stat(k, &id);
-		return;
+		if (!pp_stat_id(name, &id)) return false;
+		ppk_feed_stat(k, &id);
+		return true;
 	}
 	const char *path = prism_getenv("PATH");
-	if (!path) return;
+	if (!path) return false;
 	size_t nlen = strlen(name);
 	for (const char *p = path; *p;) {
 		const char *sep = strchr(p, PP_PATHLIST_SEP);
@@ -4812,7 +5029,7 @@ static void ppk_feed_compiler(PPKey *k, const char *name) {
 			if (pp_stat_id(buf, &id)) {
 				ppk_feed_str(k, buf);
 				ppk_feed_stat(k, &id);
-				return;
+				return true;
 			}
 #ifdef _WIN32
 			/* PATH entries on Windows omit the extension. */
@@ -4820,13 +5037,14 @@ static void ppk_feed_compiler(PPKey *k, const char *name) {
 			if (pp_stat_id(buf, &id)) {
 				ppk_feed_str(k, buf);
 				ppk_feed_stat(k, &id);
-				return;
+				return true;
 			}
 #endif
 		}
 		if (!sep) break;
 		p = sep + 1;
 	}
+	return false;
 }
 
 /* snprintf truncation is never benign here: a clipped path can name a different
@@ -4841,23 +5059,23 @@ static bool pp_pathf(char *out, size_t cap, const char *fmt, ...) {
 	return (n >= 0) & ((size_t)n < cap);
 }
 
-/* Cache root, or NULL if it cannot be composed or created. Callers treat NULL
- * as "cache unavailable" and fall back to running the preprocessor. */
-static const char *pp_cache_dir(void) {
-	static PRISM_THREAD_LOCAL char dir[PATH_MAX];
-	static PRISM_THREAD_LOCAL int state; /* 0 unknown, 1 ready, -1 unusable */
+static void pp_index_start(const char *dir);
+
+/* 0 unknown, 1 ready, -1 unusable. A server request clears it: the root comes
+ * from the caller's environment, not the server's. */
+static PRISM_THREAD_LOCAL int pp_cache_dir_state;
+
+/* Composes the cache root's path into `dir` without touching the file
+ * system. False when it cannot be composed with room to spare. */
+static bool pp_cache_root(char *dir, size_t cap) {
 	const char *base = NULL;
 	const char *xdg = NULL;
 	const char *home = NULL;
 	bool ok = false;
-	char *s = NULL;
-
-	if (state) return state > 0 ? dir : NULL;
-	state = -1;
 
 	base = prism_getenv("PRISM_PP_CACHE_DIR");
 	if (base && *base) {
-		ok = pp_pathf(dir, sizeof dir, "%s", base);
+		ok = pp_pathf(dir, cap, "%s", base);
 	} else {
 		xdg = prism_getenv("XDG_CACHE_HOME");
 		home = prism_getenv("HOME");
@@ -4865,17 +5083,29 @@ static const char *pp_cache_dir(void) {
 		if (!home || !*home) home = prism_getenv("LOCALAPPDATA");
 #endif
 		if (xdg && *xdg)
-			ok = pp_pathf(dir, sizeof dir, "%s/prism-pp", xdg);
+			ok = pp_pathf(dir, cap, "%s/prism-pp", xdg);
 		else if (home && *home)
-			ok = pp_pathf(dir, sizeof dir, "%s/.cache/prism-pp", home);
+			ok = pp_pathf(dir, cap, "%s/.cache/prism-pp", home);
 		else
-			ok = pp_pathf(dir, sizeof dir, "%sprism-pp", get_tmp_dir());
+			ok = pp_pathf(dir, cap, "%sprism-pp", get_tmp_dir());
 	}
 	/* Leave room for "/<32 hex>.pp.<pid>.tmp" appended by callers. */
-	if (!ok || strlen(dir) + 64 >= sizeof dir) {
+	if (!ok || strlen(dir) + 64 >= cap) {
 		dir[0] = '\0';
-		return NULL;
+		return false;
 	}
+	return true;
+}
+
+/* Cache root, or NULL if it cannot be composed or created. Callers treat NULL
+ * as "cache unavailable" and fall back to running the preprocessor. */
+static const char *pp_cache_dir(void) {
+	static PRISM_THREAD_LOCAL char dir[PATH_MAX];
+	char *s = NULL;
+
+	if (pp_cache_dir_state) return pp_cache_dir_state > 0 ? dir : NULL;
+	pp_cache_dir_state = -1;
+	if (!pp_cache_root(dir, sizeof dir)) return NULL;
 	/* Parents may not exist; create each level, ignoring EEXIST. */
 	for (s = dir + 1; *s; s++) {
 		char save = *s;
@@ -4884,15 +5114,24 @@ static const char *pp_cache_dir(void) {
 		mkdir(dir, 0700);
 		*s = save;
 	}
-	mkdir(dir, 0700);
+	bool fresh = mkdir(dir, 0700) == 0;
 	{
 		struct stat st;
+		char shard[PATH_MAX];
 		if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
 			dir[0] = '\0';
 			return NULL;
 		}
+		/* Entries are sharded by their key's first byte (pp_entry_path). One
+		 * stat recognises an established layout; otherwise make every shard. */
+		if (!pp_pathf(shard, sizeof shard, "%s/ff", dir) || stat(shard, &st) != 0) {
+			for (int i = 0; i < 256; i++)
+				if (pp_pathf(shard, sizeof shard, "%s/%02x", dir, i)) mkdir(shard, 0700);
+			/* A directory made just now holds nothing the index could miss. */
+			if (fresh) pp_index_start(dir);
+		}
 	}
-	state = 1;
+	pp_cache_dir_state = 1;
 	return dir;
 }
 
@@ -5016,11 +5255,74 @@ static bool pp_argv_disables_cache(char **argv, int argc) {
 	return false;
 }
 
-static bool pp_cache_path(const PPKey *k, char *out, size_t cap) {
+/* Entry kinds, by file extension: preprocessed text, compiler-profile
+ * records, transpiled output, backend objects, chunks of preprocessed text
+ * shared between `.pp` entries, token-stream snapshots and Pass 1 prefix
+ * snapshots. The position is the kind's number in the entry index. */
+static const char *const pp_entry_exts[] = {".pp", ".ccp", ".out", ".obj", ".ppk", ".tok", ".p1s"};
+enum { PP_KIND_PP, PP_KIND_CCP, PP_KIND_OUT, PP_KIND_OBJ, PP_KIND_CHUNK, PP_KIND_TOK, PP_KIND_P1S };
+
+static int pp_entry_kind(const char *name, size_t n) {
+	for (int i = 0; i < (int)(sizeof pp_entry_exts / sizeof *pp_entry_exts); i++) {
+		size_t el = strlen(pp_entry_exts[i]);
+		if (n >= el && strcmp(name + n - el, pp_entry_exts[i]) == 0) return i;
+	}
+	return -1;
+}
+
+/* `<dir>/<first key byte>/<key><ext>`: 256 shards keep every directory small
+ * however many entries the cache holds. */
+static bool pp_entry_path(const PPKey *k, const char *ext, char *out, size_t cap) {
 	const char *dir = pp_cache_dir();
 	if (!dir) return false;
-	return pp_pathf(out, cap, "%s/%016llx%016llx.pp", dir, (unsigned long long)k->a,
-			(unsigned long long)k->b);
+	return pp_pathf(out, cap, "%s/%02x/%016llx%016llx%s", dir, (unsigned)(k->a >> 56), (unsigned long long)k->a,
+			(unsigned long long)k->b, ext);
+}
+
+static bool pp_cache_path(const PPKey *k, char *out, size_t cap) {
+	return pp_entry_path(k, ".pp", out, cap);
+}
+
+/* One record of the entry index (see pp_cache_prune). 48 bytes, no padding:
+ * records are written and read as they are. */
+#define PP_INDEX_NAME "index"
+#define PP_INDEX_MAGIC 0x5052495349445832ULL
+#define PP_INDEX_HEADER_KIND 0xffffffffu
+
+enum { PP_NOTE_GONE = -1, PP_NOTE_HIT = -2 };
+
+typedef struct {
+	uint64_t a, b;
+	int64_t size;	 // bytes on disk, or PP_NOTE_HIT / PP_NOTE_GONE
+	int64_t when;	 // seconds since the epoch
+	int64_t logical; // bytes the entry stands for, shared chunks included
+	uint32_t kind;	 // index into pp_entry_exts
+	uint32_t check;
+} PPIndexRec;
+
+static uint32_t pp_index_check(const PPIndexRec *r) {
+	PPKey h = {PP_INDEX_MAGIC, 0};
+	ppk_feed(&h, r, offsetof(PPIndexRec, check));
+	return (uint32_t)h.a;
+}
+
+static PPIndexRec pp_index_raw(uint64_t a, uint64_t b, int64_t size, int64_t when, int64_t logical, uint32_t kind) {
+	PPIndexRec r = {a, b, size, when, logical, kind, 0};
+	r.check = pp_index_check(&r);
+	return r;
+}
+
+/* A record of `k` with extension `ext`, dated now. */
+static PPIndexRec pp_index_rec(const PPKey *k, const char *ext, long long size, long long logical) {
+	int kind = pp_entry_kind(ext, strlen(ext));
+	return pp_index_raw(k->a, k->b, size, (int64_t)time(NULL), logical, kind < 0 ? PP_INDEX_HEADER_KIND : (uint32_t)kind);
+}
+
+static void pp_index_append(const PPIndexRec *r, size_t n);
+
+static void pp_index_note(const PPKey *k, const char *ext, long long size) {
+	PPIndexRec r = pp_index_rec(k, ext, size, size);
+	pp_index_append(&r, 1);
 }
 
 /* Portable atomic publish. POSIX rename replaces; Win32 needs the explicit flag. */
@@ -5033,14 +5335,488 @@ static bool pp_replace_file(const char *tmp, const char *dst) {
 }
 
 /* One process can compile the same file concurrently through the library. A
- * pid-only name makes those stores overwrite each other's temporary output. */
+ * pid-only name makes those stores overwrite each other's temporary output.
+ * The CLI registers the temporary, so a signal mid-store unlinks it; every
+ * opened temporary leaves through pp_cache_publish_temp or pp_cache_drop_temp. */
 static int pp_cache_open_temp(const char *path, char *tmp, size_t cap) {
 	if (!pp_pathf(tmp, cap, "%s.XXXXXX", path)) return -1;
+#ifdef PRISM_LIB_MODE
 	return mkstemp(tmp);
+#else
+	sigset_t mask, oldmask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, &oldmask);
+	int fd = mkstemp(tmp);
+	if (fd >= 0) signal_temps_register(tmp);
+	sigprocmask(SIG_SETMASK, &oldmask, NULL);
+	return fd;
+#endif
+}
+
+static void pp_cache_drop_temp(const char *tmp) {
+	remove(tmp);
+#ifndef PRISM_LIB_MODE
+	signal_temps_unregister(tmp);
+#endif
+}
+
+/* Moves a written temporary to `dst`, or drops it when the write failed. */
+static bool pp_cache_publish_temp(const char *tmp, const char *dst, bool ok) {
+	if (!ok || !pp_replace_file(tmp, dst)) {
+		pp_cache_drop_temp(tmp);
+		return false;
+	}
+#ifndef PRISM_LIB_MODE
+	signal_temps_unregister(tmp);
+#endif
+	return true;
 }
 
 static bool pp_file_is_time_stable(const char *path);
 
+/* A pp-cache payload starts on a page boundary and carries its own 8 bytes of
+ * NUL padding, so a hit is a private mapping of the entry, tokenized in place:
+ * nothing is copied, and the pages the tokenizer rewrites (digraphs) are the
+ * only ones that stop being shared with the page cache. A chunked entry's
+ * pieces live in several files, so pp_chunks_read copies them into one heap
+ * buffer instead. Mapped buffers are tracked here so pp_buf_free can tell
+ * them from heap ones; a parse context is per-thread, and so is the buffer it
+ * releases. */
+enum { PP_MAPPED_MAX = 8 };
+
+typedef struct {
+	char *buf;
+	size_t len;
+} PPMapped;
+
+static PRISM_THREAD_LOCAL PPMapped pp_mapped[PP_MAPPED_MAX];
+
+static void pp_buf_free(char *buf) {
+#ifndef _WIN32
+	for (int i = 0; buf && i < PP_MAPPED_MAX; i++)
+		if (pp_mapped[i].buf == buf) {
+			munmap(buf, pp_mapped[i].len);
+			pp_mapped[i] = (PPMapped){0};
+			return;
+		}
+#endif
+	free(buf);
+}
+
+/* The `len` bytes at `off` in `fd`, or NULL to fall back to reading them. */
+static char *pp_payload_map(int fd, unsigned long long off, size_t len) {
+#ifdef _WIN32
+	(void)fd, (void)off, (void)len;
+	return NULL;
+#else
+	long page = sysconf(_SC_PAGESIZE);
+	if ((page <= 0) | (len == 0) || off % (unsigned long long)page || off > (unsigned long long)LLONG_MAX)
+		return NULL;
+	for (int i = 0; i < PP_MAPPED_MAX; i++) {
+		if (pp_mapped[i].buf) continue;
+		void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)off);
+		if (m == MAP_FAILED) return NULL;
+		pp_mapped[i] = (PPMapped){m, len};
+		return m;
+	}
+	return NULL;
+#endif
+}
+
+/* Payloads above PP_LZ_MIN are stored compressed when that saves at least a
+ * quarter (PRISM_PP_CACHE_COMPRESS=0 turns it off). The codec is LZ4-style:
+ * a sequence is a token byte -- literal count in the high nibble, match
+ * length minus 4 in the low one, 15 meaning more follows in bytes of up to
+ * 255 -- then the literals and a 16-bit little-endian match offset; the last
+ * sequence is literals only. Matching is greedy on a hash of the next four
+ * bytes, and decoding is a loop of 8-byte copies, so a hit pays well under a
+ * millisecond per megabyte to read a third to a fifth of the bytes. The
+ * decoder trusts nothing: every length and offset is bounds-checked, and the
+ * payload checksum is verified on the result as before. Both sides need 8
+ * bytes of slack past their buffers for the wide copies. */
+enum { PP_LZ_MIN = 16384, PP_LZ_HASH_BITS = 14, PP_LZ_SLACK = 8 };
+
+static size_t pp_lz_bound(size_t n) {
+	return n + n / 255 + 16;
+}
+
+static bool pp_lz_enabled(void) {
+	const char *v = prism_getenv("PRISM_PP_CACHE_COMPRESS");
+	return !(v && strcmp(v, "0") == 0);
+}
+
+static uint8_t *pp_lz_len(uint8_t *op, size_t n) {
+	for (; n >= 255; n -= 255) *op++ = 255;
+	*op++ = (uint8_t)n;
+	return op;
+}
+
+static uint32_t pp_lz_load32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static void pp_lz_copy8(uint8_t *op, const uint8_t *ip, size_t n) {
+	for (uint8_t *end = op + n; op < end; op += 8, ip += 8) memcpy(op, ip, 8);
+}
+
+/* Compresses `n` bytes into `dst` (pp_lz_bound(n) bytes); returns the size. */
+static size_t pp_lz_pack(const char *src, size_t n, char *dst) {
+	const uint8_t *in = (const uint8_t *)src, *ip = in, *anchor = in, *iend = in + n;
+	uint8_t *op = (uint8_t *)dst;
+	uint32_t *table = n > 12 ? calloc((size_t)1 << PP_LZ_HASH_BITS, sizeof *table) : NULL;
+	if (table)
+		for (const uint8_t *limit = iend - 12; ip < limit;) {
+			uint32_t seq = pp_lz_load32(ip), h = (seq * 2654435761u) >> (32 - PP_LZ_HASH_BITS);
+			const uint8_t *ref = in + table[h];
+			table[h] = (uint32_t)(ip - in);
+			if (ref >= ip || ip - ref > 65535 || pp_lz_load32(ref) != seq) {
+				/* Step faster through text that keeps failing to match. */
+				ip += 1 + ((size_t)(ip - anchor) >> 6);
+				continue;
+			}
+			const uint8_t *m = ip + 4;
+			while (m < iend && *m == ref[m - ip]) m++;
+			size_t lit = (size_t)(ip - anchor), ml = (size_t)(m - ip) - 4, off = (size_t)(ip - ref);
+			uint8_t *token = op++;
+			*token = (uint8_t)((lit < 15 ? lit : 15) << 4 | (ml < 15 ? ml : 15));
+			if (lit >= 15) op = pp_lz_len(op, lit - 15);
+			memcpy(op, anchor, lit);
+			op += lit;
+			*op++ = (uint8_t)off;
+			*op++ = (uint8_t)(off >> 8);
+			if (ml >= 15) op = pp_lz_len(op, ml - 15);
+			ip = anchor = m;
+			/* Seed the table from inside the match, where the next repeat
+			 * most often starts. */
+			if (ip < limit) table[(pp_lz_load32(ip - 2) * 2654435761u) >> (32 - PP_LZ_HASH_BITS)] = (uint32_t)(ip - 2 - in);
+		}
+	size_t lit = (size_t)(iend - anchor);
+	*op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+	if (lit >= 15) op = pp_lz_len(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+	free(table);
+	return (size_t)(op - (uint8_t *)dst);
+}
+
+/* Decompresses `n` bytes into exactly `len` at `dst`. */
+static bool pp_lz_unpack(const char *src, size_t n, char *dst, size_t len) {
+	const uint8_t *ip = (const uint8_t *)src, *iend = ip + n;
+	uint8_t *op = (uint8_t *)dst, *oend = op + len;
+	for (;;) {
+		if (ip >= iend) return false;
+		unsigned t = *ip++;
+		size_t lit = t >> 4, ml = t & 15, off = 0;
+		/* Short sequences with room to spare on both sides -- nearly all of
+		 * them -- copy in fixed 16-byte moves without looking at lengths. */
+		if ((lit < 15) & (ml < 15) && iend - ip >= 18 && oend - op >= 32) {
+			memcpy(op, ip, 16);
+			op += lit;
+			ip += lit;
+			off = (size_t)ip[0] | (size_t)ip[1] << 8;
+			ip += 2;
+			if (off >= 16 && off <= (size_t)(op - (uint8_t *)dst)) {
+				memcpy(op, op - off, 16);
+				memcpy(op + 16, op - off + 16, 2);
+				op += ml + 4;
+				continue;
+			}
+			ip -= 2;
+			if (ip == iend) return op == oend;
+			goto match;
+		}
+		if (lit == 15) {
+			unsigned b = 255;
+			while (b == 255) {
+				if (ip >= iend) return false;
+				lit += b = *ip++;
+			}
+		}
+		if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return false;
+		pp_lz_copy8(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == iend) return op == oend;
+	match:
+		if (iend - ip < 2) return false;
+		off = (size_t)ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		if (ml == 15) {
+			unsigned b = 255;
+			while (b == 255) {
+				if (ip >= iend) return false;
+				ml += b = *ip++;
+			}
+		}
+		ml += 4;
+		if (off == 0 || off > (size_t)(op - (uint8_t *)dst) || ml > (size_t)(oend - op)) return false;
+		if (off >= 8)
+			pp_lz_copy8(op, op - off, ml);
+		else
+			for (size_t i = 0; i < ml; i++) op[i] = op[i - off];
+		op += ml;
+	}
+}
+
+/* Compresses `p` if it is worth it: the packed bytes (heap, caller frees) and
+ * their size in `*packed`, or NULL to store `p` as it is. */
+static char *pp_lz_maybe_pack(const char *p, size_t n, size_t *packed) {
+	char *z = n >= PP_LZ_MIN && pp_lz_enabled() ? malloc(pp_lz_bound(n)) : NULL;
+	if (z) *packed = pp_lz_pack(p, n, z);
+	if (z && *packed > n - n / 4) {
+		free(z);
+		z = NULL;
+	}
+	return z;
+}
+
+/* Reads `packed` bytes from `f` and decompresses them into exactly `n` bytes
+ * at `dst`, which has PP_LZ_SLACK bytes to spare. */
+static bool pp_lz_read(FILE *f, size_t packed, char *dst, size_t n) {
+	char *z = packed <= SIZE_MAX - PP_LZ_SLACK ? malloc(packed + PP_LZ_SLACK) : NULL;
+	bool ok = z && fread(z, 1, packed, f) == packed && pp_lz_unpack(z, packed, dst, n);
+	free(z);
+	return ok;
+}
+
+/* Most of a translation unit is usually its headers, and most headers are
+ * included by many units in the same state. So a payload is split where each
+ * header included from the main file (or the command line) is entered and
+ * left, and each such expansion is stored once, as a `.ppk` chunk addressed by
+ * its content; the entry lists its pieces, keeping the main file's own text
+ * inline. A chunked entry is reassembled into the heap on a hit instead of
+ * being mapped. Chunks are noted in the index whenever an entry using them is
+ * stored or hit, after the entry, so eviction drops an entry before the
+ * chunks it shares. */
+#define PP_CHUNK_MAGIC "PRISMPPK1\n"
+#define PP_CHUNK_LZ_MAGIC "PRISMPPKZ\n"
+enum { PP_CHUNK_MIN = 4096, PP_CHUNK_MAX_PIECES = 1024 };
+
+static PPKey pp_chunk_key(const char *p, size_t n) {
+	PPKey sum = {0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL};
+	ppk_feed_str(&sum, "prism-pp-chunk");
+	ppk_feed(&sum, p, n);
+	return sum;
+}
+
+/* The flag after a linemarker's file name: 1 entering a file, 2 returning to
+ * one, otherwise 0. */
+static int pp_marker_flag(const char *l, const char *end) {
+	if (l >= end || *l != '#') return 0;
+	l++;
+	while (l < end && ascii_hspace(*l)) l++;
+	if (l >= end || *l < '0' || *l > '9') return 0;
+	while (l < end && *l >= '0' && *l <= '9') l++;
+	while (l < end && ascii_hspace(*l)) l++;
+	if (l >= end || *l != '"') return 0;
+	for (l++; l < end && *l != '"' && *l != '\n'; l++)
+		if (*l == '\\' && l + 1 < end) l++;
+	if (l >= end || *l != '"') return 0;
+	l++;
+	while (l < end && ascii_hspace(*l)) l++;
+	if (l >= end || (*l != '1' && *l != '2')) return 0;
+	return l + 1 == end || l[1] == ' ' || l[1] == '\n' || l[1] == '\r' ? *l - '0' : 0;
+}
+
+/* Cuts `payload` where a top-level include is entered or left: cut[0] = 0,
+ * cut[n] = len. Piece i is a header's expansion when it starts with an
+ * entering marker. Returns n, or 0 when there would be too many pieces. */
+static int pp_chunk_split(const char *payload, size_t len, size_t *cut, int max) {
+	const char *end = payload + len;
+	int n = 0, depth = 0;
+	cut[0] = 0;
+	for (const char *l = payload; l < end;) {
+		const char *nl = memchr(l, '\n', (size_t)(end - l));
+		int flag = pp_marker_flag(l, nl ? nl : end);
+		if (((flag == 1 && depth == 0) || (flag == 2 && depth == 1)) && (size_t)(l - payload) != cut[n]) {
+			if (n + 1 >= max) return 0;
+			cut[++n] = (size_t)(l - payload);
+		}
+		depth += flag == 1 ? 1 : flag == 2 && depth > 0 ? -1 : 0;
+		if (!nl) break;
+		l = nl + 1;
+	}
+	cut[++n] = len;
+	return n;
+}
+
+/* Reads chunk `key` into `dst`, which it must fill exactly and which has
+ * PP_LZ_SLACK bytes to spare. */
+static bool pp_chunk_get(const PPKey *key, char *dst, size_t n) {
+	char path[PATH_MAX], magic[sizeof PP_CHUNK_MAGIC];
+	const size_t ml = sizeof magic - 1;
+	long size = 0;
+	FILE *f = pp_entry_path(key, ".ppk", path, sizeof path) ? fopen(path, "rb") : NULL;
+	if (!f) return false;
+	bool ok = fread(magic, 1, ml, f) == ml && fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= (long)ml &&
+		  fseek(f, (long)ml, SEEK_SET) == 0;
+	if (ok && memcmp(magic, PP_CHUNK_MAGIC, ml) == 0)
+		ok = (size_t)size - ml == n && fread(dst, 1, n, f) == n;
+	else
+		ok = ok && memcmp(magic, PP_CHUNK_LZ_MAGIC, ml) == 0 && pp_lz_read(f, (size_t)size - ml, dst, n);
+	fclose(f);
+	return ok;
+}
+
+/* Stores `p` as a chunk unless one with its content is already there. `note`
+ * gets the index record: a store, or a hit on the existing chunk. */
+static bool pp_chunk_put(const char *p, size_t n, PPKey *key, PPIndexRec *note) {
+	char path[PATH_MAX], tmp[PATH_MAX];
+	size_t packed = 0;
+	PPStat id;
+	*key = pp_chunk_key(p, n);
+	if (!pp_entry_path(key, ".ppk", path, sizeof path)) return false;
+	/* A store follows a miss, which may have been this chunk failing to
+	 * check out; one that is already there is only trusted if it is intact. */
+	if (pp_stat_id(path, &id)) {
+		char *have = malloc(n + PP_LZ_SLACK);
+		bool same = have && pp_chunk_get(key, have, n) && memcmp(have, p, n) == 0;
+		free(have);
+		if (same) {
+			*note = pp_index_rec(key, ".ppk", PP_NOTE_HIT, 0);
+			return true;
+		}
+	}
+	int fd = pp_cache_open_temp(path, tmp, sizeof tmp);
+	if (fd < 0) return false;
+	FILE *f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		pp_cache_drop_temp(tmp);
+		return false;
+	}
+	char *z = pp_lz_maybe_pack(p, n, &packed);
+	bool ok = fputs(z ? PP_CHUNK_LZ_MAGIC : PP_CHUNK_MAGIC, f) >= 0 && fwrite(z ? z : p, 1, z ? packed : n, f) == (z ? packed : n);
+	long size = ftell(f);
+	free(z);
+	if (fclose(f) != 0) ok = false;
+	if (!pp_cache_publish_temp(tmp, path, ok)) return false;
+	*note = pp_index_rec(key, ".ppk", size, 0);
+	return true;
+}
+
+/* Writes `payload` to `f` chunked: the `chunks` line, one line per piece and
+ * the inline text, each run compressed on its own. Returns false without
+ * writing anything when no piece is a header expansion worth sharing, and the
+ * plain layout should be used. The chunks' index records go to `notes`, and
+ * the payload bytes this file itself holds to `*stored`. */
+static bool pp_chunks_write(FILE *f, const char *payload, size_t len, PPKey sum, PPIndexRec *notes, int *nnotes,
+			    unsigned long long *stored, bool *ok) {
+	size_t *cut = malloc((PP_CHUNK_MAX_PIECES + 1) * sizeof *cut);
+	size_t *packed = calloc(PP_CHUNK_MAX_PIECES, sizeof *packed);
+	char **z = calloc(PP_CHUNK_MAX_PIECES, sizeof *z);
+	PPKey *key = malloc(PP_CHUNK_MAX_PIECES * sizeof *key);
+	int n = cut && packed && z && key ? pp_chunk_split(payload, len, cut, PP_CHUNK_MAX_PIECES) : 0;
+	int m = 0;
+	*nnotes = 0;
+	*stored = 0;
+	/* Pieces become (key, length) in place; runs of inline text merge. */
+	for (int i = 0; i < n; i++) {
+		size_t pl = cut[i + 1] - cut[i];
+		if (pl >= PP_CHUNK_MIN && pp_marker_flag(payload + cut[i], payload + cut[i + 1]) == 1 &&
+		    pp_chunk_put(payload + cut[i], pl, &key[m], &notes[*nnotes])) {
+			++*nnotes;
+			cut[m++] = pl;
+		} else if (m && !(key[m - 1].a | key[m - 1].b))
+			cut[m - 1] += pl;
+		else {
+			key[m] = (PPKey){0, 0};
+			cut[m++] = pl;
+		}
+	}
+	if (*nnotes) {
+		size_t at = 0;
+		for (int i = 0; i < m; at += cut[i++])
+			if (!(key[i].a | key[i].b)) {
+				z[i] = pp_lz_maybe_pack(payload + at, cut[i], &packed[i]);
+				*stored += z[i] ? packed[i] : cut[i];
+			}
+		*ok = fprintf(f, "chunks %llu %016llx %016llx %d %llu\n", (unsigned long long)len, (unsigned long long)sum.a,
+			      (unsigned long long)sum.b, m, *stored) > 0;
+		for (int i = 0; *ok && i < m; i++)
+			if (key[i].a | key[i].b)
+				*ok = fprintf(f, "k %016llx%016llx %zu\n", (unsigned long long)key[i].a, (unsigned long long)key[i].b,
+					      cut[i]) > 0;
+			else
+				*ok = (z[i] ? fprintf(f, "z %zu %zu\n", cut[i], packed[i]) : fprintf(f, "i %zu\n", cut[i])) > 0;
+		at = 0;
+		for (int i = 0; *ok && i < m; at += cut[i++])
+			if (z[i])
+				*ok = fwrite(z[i], 1, packed[i], f) == packed[i];
+			else if (!(key[i].a | key[i].b))
+				*ok = fwrite(payload + at, 1, cut[i], f) == cut[i];
+	}
+	for (int i = 0; z && i < m; i++) free(z[i]);
+	free(z);
+	free(packed);
+	free(cut);
+	free(key);
+	return *nnotes > 0;
+}
+
+/* Reassembles a chunked payload of `len` bytes from the `n` piece lines at
+ * `f`'s position and the inline text after them, raw or compressed. `notes`
+ * gets a hit for the entry and each chunk, to append once the payload checks
+ * out. */
+static char *pp_chunks_read(FILE *f, const PPKey *k, unsigned long long len, int n, PPIndexRec **notes,
+			    int *nnotes) {
+	char line[128];
+	char *out = NULL;
+	PPIndexRec *rec = NULL;
+	size_t pos = 0;
+	int nrec = 0;
+	struct {
+		PPKey key;
+		size_t len, packed;
+		bool shared;
+	} *piece = NULL;
+
+	if ((n < 1) | (n > PP_CHUNK_MAX_PIECES) || len > SIZE_MAX - PP_LZ_SLACK) return NULL;
+	piece = calloc((size_t)n, sizeof *piece);
+	rec = calloc((size_t)n + 1, sizeof *rec);
+	out = malloc((size_t)len + PP_LZ_SLACK);
+	if (!piece || !rec || !out) goto fail;
+	rec[nrec++] = pp_index_rec(k, ".pp", PP_NOTE_HIT, 0);
+	for (int i = 0; i < n; i++) {
+		unsigned long long a = 0, b = 0, pl = 0, zl = 0;
+		if (!fgets(line, sizeof line, f)) goto fail;
+		if (sscanf(line, "k %16llx%16llx %llu", &a, &b, &pl) == 3) {
+			piece[i].shared = true;
+			piece[i].key = (PPKey){a, b};
+			rec[nrec++] = pp_index_rec(&piece[i].key, ".ppk", PP_NOTE_HIT, 0);
+		} else if (sscanf(line, "z %llu %llu", &pl, &zl) == 2) {
+			if ((zl == 0) | (zl > SIZE_MAX - PP_LZ_SLACK)) goto fail;
+			piece[i].packed = (size_t)zl;
+		} else if (sscanf(line, "i %llu", &pl) != 1)
+			goto fail;
+		if (pl > len - pos) goto fail;
+		piece[i].len = (size_t)pl;
+		pos += (size_t)pl;
+	}
+	if (pos != len) goto fail;
+	pos = 0;
+	for (int i = 0; i < n; pos += piece[i++].len)
+		if (piece[i].shared	? !pp_chunk_get(&piece[i].key, out + pos, piece[i].len)
+		    : piece[i].packed ? !pp_lz_read(f, piece[i].packed, out + pos, piece[i].len)
+				      : fread(out + pos, 1, piece[i].len, f) != piece[i].len)
+			goto fail;
+	if (fgetc(f) != EOF) goto fail;
+	memset(out + len, 0, PP_LZ_SLACK);
+	free(piece);
+	*notes = rec;
+	*nnotes = nrec;
+	return out;
+fail:
+	free(piece);
+	free(rec);
+	free(out);
+	return NULL;
+}
+
 /* Return the cached payload if every recorded dependency is unchanged.
  *
  * All declarations precede the first `goto`: prism rejects a jump that skips an
@@ -5052,8 +5828,12 @@ static char *pp_cache_load(const PPKey *k) {
 	FILE *f = NULL;
 	PPStat file_id;
 	long ndeps = 0, ndirs = 0;
-	unsigned long long plen = 0, sum_a = 0, sum_b = 0;
+	unsigned long long plen = 0, sum_a = 0, sum_b = 0, poff = 0, stored = 0;
+	long at = 0;
 	size_t payload_len = 0;
+	static const char pad[8];
+	PPIndexRec *notes = NULL;
+	int npieces = 0, nnotes = 0;
 	long i = 0;
 
 	if (!pp_cache_path(k, path, sizeof path)) return NULL;
@@ -5077,20 +5857,21 @@ static char *pp_cache_load(const PPKey *k) {
 		p = line + off;
 		pl = strlen(p);
 		while (pl && (p[pl - 1] == '\n' || p[pl - 1] == '\r')) p[--pl] = '\0';
-		if ((pl == 0) | !pp_stat_id(p, &now)) goto done;
+		if ((pl == 0) | !pp_stat_id_memo(p, &now)) goto done;
 		{
 			/* The spelling this dependency was reached by must still resolve
 			 * to the same file. A retargeted symlink leaves the recorded
-			 * target untouched and would otherwise read as unchanged. */
-			char rawline[PATH_MAX + 128], resolved[PATH_MAX], canon[PATH_MAX];
+			 * target untouched and would otherwise read as unchanged. The
+			 * recorded path is canonical, so a spelling that resolves to it
+			 * names the file just identified; one that is that path already
+			 * (most system headers) needs no resolving at all. */
+			char rawline[PATH_MAX + 128], resolved[PATH_MAX];
 			size_t rl;
 			if (!fgets(rawline, sizeof rawline, f)) goto done;
 			rl = strlen(rawline);
 			while (rl && (rawline[rl - 1] == '\n' || rawline[rl - 1] == '\r')) rawline[--rl] = '\0';
 			if (!rl) goto done;
-			if (!realpath(rawline, resolved)) goto done;
-			if (!realpath(p, canon)) goto done;
-			if (strcmp(resolved, canon) != 0) goto done;
+			if (strcmp(rawline, p) != 0 && (!realpath(rawline, resolved) || strcmp(resolved, p) != 0)) goto done;
 		}
 		if ((now.size != rec.size) | (now.mtime_sec != rec.mtime_sec) |
 		    (now.mtime_nsec != rec.mtime_nsec) | (now.ctime_sec != rec.ctime_sec) |
@@ -5119,53 +5900,99 @@ static char *pp_cache_load(const PPKey *k) {
 		p = line + off;
 		pl = strlen(p);
 		while (pl && (p[pl - 1] == '\n' || p[pl - 1] == '\r')) p[--pl] = '\0';
-		if ((pl == 0) | !pp_stat_id(p, &now)) goto done;
+		if ((pl == 0) | !pp_stat_id_memo(p, &now)) goto done;
 		if ((now.mtime_sec != rec.mtime_sec) | (now.mtime_nsec != rec.mtime_nsec) |
 		    (now.ctime_sec != rec.ctime_sec) | (now.ctime_nsec != rec.ctime_nsec) |
 		    (now.device != rec.device) | (now.inode != rec.inode))
 			goto done;
 	}
 
-	if (!fgets(line, sizeof line, f) ||
-	    sscanf(line, "payload %llu %llx %llx", &plen, &sum_a, &sum_b) != 3)
-		goto done;
-	/* Do not allocate from an untrusted length field. Besides preventing
-	 * size_t wraparound, requiring the whole file to be at least this large
-	 * turns truncated/corrupt entries into a cheap cache miss. */
-	if (plen > SIZE_MAX - 8 || plen > (unsigned long long)file_id.size)
+	if (!fgets(line, sizeof line, f)) goto done;
+	if (sscanf(line, "chunks %llu %llx %llx %d %llu", &plen, &sum_a, &sum_b, &npieces, &stored) == 5) {
+		out = pp_chunks_read(f, k, plen, npieces, &notes, &nnotes);
+		if (!out) goto done;
+		payload_len = (size_t)plen;
+		goto check;
+	}
+	/* A compressed payload runs from here to the end of the file. */
+	if (sscanf(line, "packed %llu %llx %llx %llu", &plen, &sum_a, &sum_b, &stored) == 4) {
+		if (plen > SIZE_MAX - PP_LZ_SLACK || (at = ftell(f)) < 0 || stored != (unsigned long long)(file_id.size - at))
+			goto done;
+		payload_len = (size_t)plen;
+		out = malloc(payload_len + PP_LZ_SLACK);
+		if (!out || !pp_lz_read(f, (size_t)stored, out, payload_len)) {
+			free(out);
+			out = NULL;
+			goto done;
+		}
+		memset(out + payload_len, 0, PP_LZ_SLACK);
+		goto check;
+	}
+	if (sscanf(line, "payload %llu %llx %llx %llu", &plen, &sum_a, &sum_b, &poff) != 4) goto done;
+	/* Do not map or allocate from an untrusted length field. Besides
+	 * preventing size_t wraparound, requiring the file to end exactly where
+	 * the header says turns truncated/corrupt entries into a cheap miss. */
+	if (plen > SIZE_MAX - 8 || plen > (unsigned long long)file_id.size ||
+	    poff > (unsigned long long)file_id.size - plen || poff + plen + 8 != (unsigned long long)file_id.size ||
+	    poff < (unsigned long long)ftell(f))
 		goto done;
 	payload_len = (size_t)plen;
-	out = malloc(payload_len + 8);
-	if (!out) goto done;
-	if (fread(out, 1, payload_len, f) != payload_len) {
-		free(out);
-		out = NULL;
-		goto done;
+	out = pp_payload_map(fileno(f), poff, payload_len + 8);
+	if (!out) {
+		out = malloc(payload_len + 8);
+		if (!out) goto done;
+		if (fseek(f, (long)poff, SEEK_SET) != 0 || fread(out, 1, payload_len + 8, f) != payload_len + 8) {
+			free(out);
+			out = NULL;
+			goto done;
+		}
 	}
+check:
 	{
 		PPKey sum = pp_payload_checksum(out, payload_len);
-		if (sum.a != sum_a || sum.b != sum_b || fgetc(f) != EOF || ferror(f)) {
-			free(out);
+		if (sum.a != sum_a || sum.b != sum_b || memcmp(out + payload_len, pad, 8) != 0) {
+			pp_buf_free(out);
 			out = NULL;
 			goto done;
 		}
 	}
-	memset(out + payload_len, 0, 8);
+	if (notes)
+		pp_index_append(notes, (size_t)nnotes);
+	else
+		pp_index_note(k, ".pp", PP_NOTE_HIT);
 done:
+	free(notes);
 	fclose(f);
 	return out;
 }
 
-/* ---- eviction ---------------------------------------------------------
+/* ---- entry index and eviction -----------------------------------------
  *
- * Bounded by total size and age. Scanning on every store would cost more than
- * the cache saves, so a marker file rate-limits the sweep to once an hour. */
+ * Bounded by total size and age, evicting the least recently used entries
+ * first. What eviction needs -- each entry's size and last use -- comes from
+ * `index`, an append-only log of fixed-size records beside the shards: an
+ * entry was stored (with its size), hit, or removed. Folding the log costs no
+ * syscall per entry, which is what lets a cache of 100k entries be pruned and
+ * reported without a directory sweep. Each record is one append and carries a
+ * check word, so a record torn by a crash is skipped. The log is only a hint
+ * about the entries, never trusted for their contents: when it is missing or
+ * unreadable it is rebuilt from one scan. Pruning still runs at most once an
+ * hour, rate-limited by a marker file, and rewrites the log compactly. */
 #define PP_PRUNE_MARKER ".prune"
 
+/* One live entry, folded from the log. `seq` orders last uses. */
+typedef struct {
+	uint64_t a, b;
+	int64_t size, when, logical;
+	uint32_t kind, seq;
+} PPLive;
+
 typedef struct {
-	long long mtime, size;
-	char name[64];
-} PPEntry;
+	PPLive *v; // open-addressed by key and kind; size < 0 marks an empty or removed slot
+	uint32_t cap, seq;
+	int n;
+	long long total, logical;
+} PPIndex;
 
 static long long pp_env_ll(const char *name, long long dflt) {
 	const char *v = prism_getenv(name);
@@ -5182,63 +6009,278 @@ static long long pp_env_scaled(const char *name, long long dflt, long long scale
 	return value > LLONG_MAX / scale ? LLONG_MAX : value * scale;
 }
 
-static int pp_entry_cmp(const void *a, const void *b) {
-	long long x = ((const PPEntry *)a)->mtime, y = ((const PPEntry *)b)->mtime;
-	return (x > y) - (x < y);
+static bool pp_is_entry_name(const char *name) {
+	return pp_entry_kind(name, strlen(name)) >= 0;
 }
 
-/* Invoke `cb` for every `*.pp` entry in the cache directory. */
-static void pp_each_entry(void (*cb)(const char *dir, const char *name, void *ud), void *ud) {
+static bool pp_index_path(char *out, size_t cap) {
 	const char *dir = pp_cache_dir();
-	if (!dir) return;
-#ifdef _WIN32
-	char glob[PATH_MAX];
-	WIN32_FIND_DATAA fd;
-	HANDLE h;
-	snprintf(glob, sizeof glob, "%s\\*.pp", dir);
-	h = FindFirstFileA(glob, &fd);
-	if (h == INVALID_HANDLE_VALUE) return;
-	do {
-		if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) cb(dir, fd.cFileName, ud);
-	} while (FindNextFileA(h, &fd));
-	FindClose(h);
-#else
-	DIR *d = opendir(dir);
-	struct dirent *e;
-	if (!d) return;
-	while ((e = readdir(d)) != NULL) {
-		size_t n = strlen(e->d_name);
-		if (n > 3 && strcmp(e->d_name + n - 3, ".pp") == 0) cb(dir, e->d_name, ud);
-	}
-	closedir(d);
-#endif
+	return dir && pp_pathf(out, cap, "%s/%s", dir, PP_INDEX_NAME);
 }
 
-typedef struct {
-	PPEntry *v;
-	int n, cap;
-	long long total;
-} PPScan;
+static PPIndexRec pp_index_header(void) {
+	PPKey magic = {PP_INDEX_MAGIC, 0};
+	return pp_index_rec(&magic, "", 0, 0);
+}
 
-static void pp_collect_cb(const char *dir, const char *name, void *ud) {
-	PPScan *s = (PPScan *)ud;
-	char full[PATH_MAX];
-	PPStat id;
-	if (strlen(name) >= sizeof s->v[0].name) return;
-	if (!pp_pathf(full, sizeof full, "%s/%s", dir, name)) return;
-	if (!pp_stat_id(full, &id)) return;
-	if (s->n == s->cap) {
-		int nc = s->cap ? s->cap * 2 : 128;
-		PPEntry *nv = realloc(s->v, (size_t)nc * sizeof *nv);
+/* Starts an index for an empty cache directory: just the header, which says
+ * every entry since is accounted for. */
+static void pp_index_start(const char *dir) {
+	char path[PATH_MAX];
+	PPIndexRec r = pp_index_header();
+	FILE *f = pp_pathf(path, sizeof path, "%s/%s", dir, PP_INDEX_NAME) ? fopen(path, "wb") : NULL;
+	if (!f) return;
+	fwrite(&r, sizeof r, 1, f);
+	fclose(f);
+}
+
+/* Appends records. A stdio append of up to a buffer's worth is a single
+ * write(2) at fclose, which O_APPEND places atomically at the end. Appenders
+ * share a lock that pp_index_compact takes exclusively, so a record never
+ * lands in a log that compaction has already copied; one that waited for the
+ * lock may find the log replaced under it, and appends to the new one. */
+static void pp_index_append(const PPIndexRec *r, size_t n) {
+	char path[PATH_MAX];
+	if (!n || !pp_index_path(path, sizeof path)) return;
+	for (int tries = 0; tries < 4; tries++) {
+		FILE *f = fopen(path, "ab");
+		if (!f) return;
+#ifndef _WIN32
+		struct stat held, named;
+		if (flock(fileno(f), LOCK_SH) == 0 && fstat(fileno(f), &held) == 0 &&
+		    (stat(path, &named) != 0 || held.st_ino != named.st_ino || held.st_dev != named.st_dev)) {
+			fclose(f);
+			continue;
+		}
+#endif
+		fwrite(r, sizeof *r, n, f);
+		fclose(f);
+		return;
+	}
+}
+
+static PPLive *pp_index_slot(PPIndex *x, uint64_t a, uint64_t b, uint32_t kind) {
+	uint32_t i = (uint32_t)(a ^ (b >> 7) ^ kind) & (x->cap - 1);
+	while (x->v[i].seq && !(x->v[i].a == a && x->v[i].b == b && x->v[i].kind == kind)) i = (i + 1) & (x->cap - 1);
+	return &x->v[i];
+}
+
+static bool pp_index_init(PPIndex *x, size_t records) {
+	memset(x, 0, sizeof *x);
+	x->cap = 1024;
+	while (x->cap < records * 2 && x->cap < (1u << 30)) x->cap *= 2;
+	x->v = calloc(x->cap, sizeof *x->v);
+	return x->v != NULL;
+}
+
+/* Folds one record in. Slots stay claimed once used (seq != 0), so probing
+ * never stops early at an entry that was removed. */
+static void pp_index_apply(PPIndex *x, const PPIndexRec *r) {
+	PPLive *e = pp_index_slot(x, r->a, r->b, r->kind);
+	bool live = e->seq && e->size >= 0;
+	if (r->size == PP_NOTE_HIT && !live) return;
+	if (!e->seq) *e = (PPLive){r->a, r->b, -1, 0, 0, r->kind, 0};
+	if (live) {
+		x->n--;
+		x->total -= e->size;
+		x->logical -= e->logical;
+	}
+	if (r->size == PP_NOTE_GONE) {
+		e->size = -1;
+		e->seq = ++x->seq;
+		return;
+	}
+	if (r->size >= 0) {
+		e->size = r->size;
+		e->logical = r->logical;
+	}
+	e->when = r->when;
+	e->seq = ++x->seq;
+	x->n++;
+	x->total += e->size;
+	x->logical += e->logical;
+}
+
+/* Folds the log. False when there is none, or it does not start with the
+ * header a compaction writes: then it does not account for every entry. */
+static bool pp_index_load(PPIndex *x, long *consumed) {
+	char path[PATH_MAX];
+	if (!pp_index_path(path, sizeof path)) return false;
+	FileBytes log = read_file_bytes(path);
+	PPIndexRec r;
+	size_t n = log.size / sizeof r;
+	if (!log.data) return false;
+	if (n) memcpy(&r, log.data, sizeof r);
+	if (!n || r.kind != PP_INDEX_HEADER_KIND || r.a != PP_INDEX_MAGIC || r.check != pp_index_check(&r) ||
+	    !pp_index_init(x, n)) {
+		free(log.data);
+		return false;
+	}
+	for (size_t i = 1; i < n; i++) {
+		memcpy(&r, log.data + i * sizeof r, sizeof r);
+		if (r.check == pp_index_check(&r) && r.kind < sizeof pp_entry_exts / sizeof *pp_entry_exts &&
+		    r.size >= PP_NOTE_HIT)
+			pp_index_apply(x, &r);
+	}
+	*consumed = (long)(n * sizeof r);
+	free(log.data);
+	return true;
+}
+
+/* Invoke `cb` for every cache entry in `dir`. */
+static void pp_each_in_dir(const char *dir, void (*cb)(const char *dir, const char *name, void *ud), void *ud) {
+#ifdef _WIN32
+	char glob[PATH_MAX];
+	WIN32_FIND_DATAA fd;
+	HANDLE h;
+	snprintf(glob, sizeof glob, "%s\\*", dir);
+	h = FindFirstFileA(glob, &fd);
+	if (h == INVALID_HANDLE_VALUE) return;
+	do {
+		if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && pp_is_entry_name(fd.cFileName))
+			cb(dir, fd.cFileName, ud);
+	} while (FindNextFileA(h, &fd));
+	FindClose(h);
+#else
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	if (!d) return;
+	while ((e = readdir(d)) != NULL)
+		if (pp_is_entry_name(e->d_name)) cb(dir, e->d_name, ud);
+	closedir(d);
+#endif
+}
+
+/* Invoke `cb` for every cache entry: each shard's, and any left at the top
+ * level by the flat layout older versions used. */
+static void pp_each_entry(void (*cb)(const char *dir, const char *name, void *ud), void *ud) {
+	const char *dir = pp_cache_dir();
+	char shard[PATH_MAX];
+	if (!dir) return;
+	pp_each_in_dir(dir, cb, ud);
+	for (int i = 0; i < 256; i++)
+		if (pp_pathf(shard, sizeof shard, "%s/%02x", dir, i)) pp_each_in_dir(shard, cb, ud);
+}
+
+/* What an entry stands for: a `.pp` entry's size with its payload counted
+ * whole, uncompressed and including the chunks it uses, which are themselves
+ * counted as nothing. */
+static long long pp_entry_logical(const char *full, int kind, long long size) {
+	char line[PATH_MAX + 128];
+	unsigned long long len = 0, sa = 0, sb = 0, stored = 0;
+	int n = 0;
+	if (kind != PP_KIND_PP) return kind == PP_KIND_CHUNK ? 0 : size;
+	FILE *f = fopen(full, "rb");
+	if (!f) return size;
+	while (fgets(line, sizeof line, f) && strncmp(line, "payload ", 8) != 0)
+		if (sscanf(line, "chunks %llu %llx %llx %d %llu", &len, &sa, &sb, &n, &stored) == 5 ||
+		    sscanf(line, "packed %llu %llx %llx %llu", &len, &sa, &sb, &stored) == 4)
+			break;
+	fclose(f);
+	return size + (long long)len - (long long)stored;
+}
+
+typedef struct {
+	const char *top;
+	PPIndexRec *found;
+	size_t n, cap;
+} PPRescan;
+
+/* Entries found by a scan, oldest first by mtime. Top-level ones are from
+ * the flat layout, which nothing looks up any more: they are removed. */
+static void pp_rescan_cb(const char *dir, const char *name, void *ud) {
+	PPRescan *s = (PPRescan *)ud;
+	char full[PATH_MAX];
+	PPStat id;
+	unsigned long long a = 0, b = 0;
+	int kind = pp_entry_kind(name, strlen(name));
+	if (!pp_pathf(full, sizeof full, "%s/%s", dir, name)) return;
+	if (dir == s->top) {
+		remove(full);
+		return;
+	}
+	if (sscanf(name, "%16llx%16llx", &a, &b) != 2 || !pp_stat_id(full, &id)) return;
+	if (s->n == s->cap) {
+		size_t nc = s->cap ? s->cap * 2 : 256;
+		PPIndexRec *nv = realloc(s->found, nc * sizeof *nv);
 		if (!nv) return;
-		s->v = nv;
+		s->found = nv;
 		s->cap = nc;
 	}
-	s->v[s->n].mtime = id.mtime_sec;
-	s->v[s->n].size = id.size;
-	snprintf(s->v[s->n].name, sizeof s->v[s->n].name, "%s", name);
-	s->n++;
-	s->total += id.size;
+	s->found[s->n++] = pp_index_raw(a, b, id.size, id.mtime_sec, pp_entry_logical(full, kind, id.size), (uint32_t)kind);
+}
+
+static int pp_rec_when_cmp(const void *a, const void *b) {
+	long long x = ((const PPIndexRec *)a)->when, y = ((const PPIndexRec *)b)->when;
+	return (x > y) - (x < y);
+}
+
+static bool pp_index_rescan(PPIndex *x) {
+	PPRescan s = {pp_cache_dir(), NULL, 0, 0};
+	pp_each_entry(pp_rescan_cb, &s);
+	bool ok = pp_index_init(x, s.n);
+	if (ok) {
+		if (s.n) qsort(s.found, s.n, sizeof *s.found, pp_rec_when_cmp);
+		for (size_t i = 0; i < s.n; i++) pp_index_apply(x, &s.found[i]);
+	}
+	free(s.found);
+	return ok;
+}
+
+static int pp_live_seq_cmp(const void *a, const void *b) {
+	uint32_t x = ((const PPLive *)a)->seq, y = ((const PPLive *)b)->seq;
+	return (x > y) - (x < y);
+}
+
+/* The live entries, least recently used first. Reuses the table's storage. */
+static int pp_index_by_use(PPIndex *x) {
+	int n = 0;
+	for (uint32_t i = 0; i < x->cap; i++)
+		if (x->v[i].seq && x->v[i].size >= 0) x->v[n++] = x->v[i];
+	qsort(x->v, (size_t)n, sizeof *x->v, pp_live_seq_cmp);
+	return n;
+}
+
+/* Rewrites the log as a header plus one record per live entry, in use order.
+ * Whatever other processes appended since `consumed` bytes were folded is
+ * carried over, so their stores and hits are not lost: the old log is held
+ * locked from the copy of its tail until the new one has replaced it, and
+ * pp_index_append waits on that lock. */
+static void pp_index_compact(const PPLive *live, int n, long consumed) {
+	char path[PATH_MAX], tmp[PATH_MAX];
+	if (!pp_index_path(path, sizeof path)) return;
+	int fd = pp_cache_open_temp(path, tmp, sizeof tmp);
+	if (fd < 0) return;
+	FILE *f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		pp_cache_drop_temp(tmp);
+		return;
+	}
+	PPIndexRec r = pp_index_header();
+	bool ok = fwrite(&r, sizeof r, 1, f) == 1;
+	for (int i = 0; ok && i < n; i++) {
+		r = pp_index_raw(live[i].a, live[i].b, live[i].size, live[i].when, live[i].logical, live[i].kind);
+		ok = fwrite(&r, sizeof r, 1, f) == 1;
+	}
+	FILE *old = fopen(path, "rb");
+#ifndef _WIN32
+	if (old && flock(fileno(old), LOCK_EX) != 0) ok = false;
+#endif
+	if (old && consumed > 0) {
+		char buf[4096];
+		size_t got;
+		if (fseek(old, consumed, SEEK_SET) == 0)
+			while (ok && (got = fread(buf, 1, sizeof buf, old)) > 0) ok = fwrite(buf, 1, got, f) == got;
+	}
+	if (fclose(f) != 0) ok = false;
+#ifdef _WIN32
+	/* Windows cannot replace a file that is still open. */
+	if (old) fclose(old);
+	old = NULL;
+#endif
+	pp_cache_publish_temp(tmp, path, ok);
+	if (old) fclose(old);
 }
 
 static void pp_cache_prune(void) {
@@ -5247,10 +6289,10 @@ static void pp_cache_prune(void) {
 	long long max_bytes = pp_env_scaled("PRISM_PP_CACHE_MAX_MB", 1024, 1024 * 1024);
 	long long max_age = pp_env_scaled("PRISM_PP_CACHE_MAX_DAYS", 14, 24 * 3600);
 	long long now = (long long)time(NULL);
+	long consumed = 0;
 	PPStat mst;
-	PPScan s;
+	PPIndex x;
 	FILE *mf = NULL;
-	int i = 0;
 
 	if (!dir) return;
 	if (!pp_pathf(marker, sizeof marker, "%s/%s", dir, PP_PRUNE_MARKER)) return;
@@ -5258,32 +6300,99 @@ static void pp_cache_prune(void) {
 	mf = fopen(marker, "wb");
 	if (mf) fclose(mf);
 
-	memset(&s, 0, sizeof s);
-	pp_each_entry(pp_collect_cb, &s);
-	if (!s.v) return;
+	if (!pp_index_load(&x, &consumed) && !pp_index_rescan(&x)) return;
+	long long total = x.total;
+	int n = pp_index_by_use(&x), kept = 0;
+	/* Down to 80% of the cap, so the next store does not prune again. */
+	long long keep_bytes = total > max_bytes ? max_bytes - max_bytes / 5 : LLONG_MAX;
+	for (int i = 0; i < n; i++) {
+		PPLive *e = &x.v[i];
+		PPKey k = {e->a, e->b};
+		if ((now - e->when > max_age || total > keep_bytes) &&
+		    pp_entry_path(&k, pp_entry_exts[e->kind], full, sizeof full) && (remove(full) == 0 || errno == ENOENT)) {
+			total -= e->size;
+			continue;
+		}
+		x.v[kept++] = *e;
+	}
+	pp_index_compact(x.v, kept, consumed);
+	free(x.v);
+}
 
-	for (i = 0; i < s.n; i++) {
-		if (now - s.v[i].mtime <= max_age) continue;
-		if (!pp_pathf(full, sizeof full, "%s/%s", dir, s.v[i].name)) continue;
-		if (remove(full) == 0) {
-			s.total -= s.v[i].size;
-			s.v[i].size = -1; /* already gone */
+#ifndef _WIN32
+static bool get_self_exe_path(char *buf) {
+#if defined(__APPLE__)
+	uint32_t sz = PATH_MAX;
+	if (_NSGetExecutablePath(buf, &sz) == 0) {
+		char temp[PATH_MAX];
+		if (realpath(buf, temp)) {
+			strncpy(buf, temp, PATH_MAX - 1);
+			buf[PATH_MAX - 1] = '\0';
 		}
+		return true;
 	}
-	if (s.total > max_bytes) {
-		/* Oldest first, down to 80% of the cap so this does not run every hour. */
-		qsort(s.v, (size_t)s.n, sizeof *s.v, pp_entry_cmp);
-		long long keep_bytes = max_bytes - max_bytes / 5;
-		for (i = 0; (i < s.n) & (s.total > keep_bytes); i++) {
-			if (s.v[i].size < 0) continue;
-			if (!pp_pathf(full, sizeof full, "%s/%s", dir, s.v[i].name)) continue;
-			if (remove(full) == 0) s.total -= s.v[i].size;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+	int mib[] = {CTL_KERN, KERN_PROC, KERN_PROC_PATHNAME, -1};
+	size_t len = PATH_MAX;
+	if (sysctl(mib, 4, buf, &len, NULL, 0) == 0) return true;
+#else
+	const char *links[] = {"/proc/self/exe", "/proc/curproc/exe", "/proc/self/path/a.out"};
+	for (int i = 0; i < 3; i++) {
+		ssize_t len = readlink(links[i], buf, PATH_MAX - 1);
+		if (len > 0) {
+			buf[len] = '\0';
+			return true;
 		}
 	}
-	free(s.v);
+#endif
+	return false;
+}
+
+static ssize_t spawn_capture_stdout(char **argv, char *buf, size_t bufsize) {
+	int pipefd[2];
+	if (pipe(pipefd) != 0) return -1;
+	char **env = build_clean_environ();
+	if (!env) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+	int devnull = open("/dev/null", O_WRONLY);
+	if (devnull >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, devnull, STDERR_FILENO);
+		posix_spawn_file_actions_addclose(&actions, devnull);
+	}
+	pid_t pid;
+	int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, env);
+	free(env);
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipefd[1]);
+	if (devnull >= 0) close(devnull);
+	if (err) {
+		close(pipefd[0]);
+		buf[0] = '\0';
+		return -1;
+	}
+	size_t total = 0;
+	while (total + 1 < bufsize) {
+		ssize_t n = read(pipefd[0], buf + total, bufsize - 1 - total);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (n == 0) break;
+		total += (size_t)n;
+	}
+	close(pipefd[0]);
+	waitpid(pid, NULL, 0);
+	buf[total] = '\0';
+	return (ssize_t)total;
 }
 
-#ifndef _WIN32
 /* Same shape as spawn_capture_stdout, but the interesting output of `-E -v` is
  * on stderr; stdout (the preprocessed empty file) is discarded. */
 static ssize_t spawn_capture_stderr(char **argv, char *buf, size_t bufsize) {
@@ -5334,6 +6443,67 @@ static ssize_t spawn_capture_stderr(char **argv, char *buf, size_t bufsize) {
 
 #endif
 
+/* ---- compiler profiles ------------------------------------------------
+ *
+ * Facts prism used to learn by spawning the compiler just to ask about it:
+ * its family and version (`--version`), its include search path (`-E -v`)
+ * and its predefined macros (`-dM -E`). They depend on the binary and the
+ * flags, not on any source, so they are kept as small `.ccp` records beside
+ * the preprocessed entries, keyed by the resolved binary's identity exactly
+ * as ppk_feed_compiler keys those. Replacing or upgrading the compiler changes
+ * the key; the stale record is simply never read again and ages out. */
+#define CC_PROFILE_MAGIC "PRISMCCP1\n"
+
+static bool pp_cache_enabled(void);
+
+/* False when the compiler binary cannot be resolved: a record about a binary
+ * prism cannot identify could outlive it unnoticed. */
+static bool cc_record_key(PPKey *k, const char *what, char **argv, int argc) {
+	*k = (PPKey){0x84222325cbf29ce4ULL, 0x7f4a7c159e3779b9ULL};
+	ppk_feed_str(k, CC_PROFILE_MAGIC);
+	ppk_feed_str(k, what);
+	for (int i = 0; i < argc; i++) ppk_feed_str(k, argv[i]);
+	return ppk_feed_compiler(k, argv[0]);
+}
+
+static bool cc_record_path(const PPKey *k, char *out, size_t cap) {
+	return pp_entry_path(k, ".ccp", out, cap);
+}
+
+/* The record's body after the magic, NUL-terminated, or NULL on any miss. */
+static char *cc_record_load(const PPKey *k) {
+	char path[PATH_MAX];
+	size_t ml = sizeof CC_PROFILE_MAGIC - 1;
+	if (!pp_cache_enabled() || !cc_record_path(k, path, sizeof path)) return NULL;
+	FileBytes rec = read_file_bytes(path);
+	if (!rec.data) return NULL;
+	if (rec.size < ml || memcmp(rec.data, CC_PROFILE_MAGIC, ml) != 0 ||
+	    memchr(rec.data, '\0', rec.size)) {
+		free(rec.data);
+		return NULL;
+	}
+	memmove(rec.data, rec.data + ml, rec.size - ml + 1);
+	pp_index_note(k, ".ccp", PP_NOTE_HIT);
+	return rec.data;
+}
+
+static void cc_record_store(const PPKey *k, const char *body) {
+	char path[PATH_MAX], tmp[PATH_MAX];
+	if (!pp_cache_enabled() || !cc_record_path(k, path, sizeof path)) return;
+	int fd = pp_cache_open_temp(path, tmp, sizeof tmp);
+	if (fd < 0) return;
+	FILE *f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		pp_cache_drop_temp(tmp);
+		return;
+	}
+	bool ok = fputs(CC_PROFILE_MAGIC, f) >= 0 && fputs(body, f) >= 0;
+	long size = ftell(f);
+	if (fclose(f) != 0) ok = false;
+	if (pp_cache_publish_temp(tmp, path, ok)) pp_index_note(k, ".ccp", size);
+}
+
 /* Directories whose contents can change which file an include resolves to.
  *
  * Recording a header's identity is not enough on its own: a file appearing in a
@@ -5345,9 +6515,10 @@ static ssize_t spawn_capture_stderr(char **argv, char *buf, size_t bufsize) {
  *
  * The list comes from the backend itself (`-E -v` on an empty input prints it
  * between two fixed banners), with the same flags as the real preprocess so
- * `-I`, `-isystem` and `-nostdinc` are all reflected. Every failure path
- * returns -1, and the caller then declines to publish a header-bearing entry:
- * an entry that cannot name what it depends on must not exist. */
+ * `-I`, `-isystem` and `-nostdinc` are all reflected. The raw list is kept as
+ * a compiler-profile record; it is resolved afresh on every use. Every failure
+ * path returns -1, and the caller then declines to publish a header-bearing
+ * entry: an entry that cannot name what it depends on must not exist. */
 #ifndef _WIN32
 static int pp_search_dirs(char **argv, int argc, const char *input_file, char (*out)[PATH_MAX], int max) {
 	enum { PROBE_CAP = 1 << 16 };
@@ -5355,12 +6526,14 @@ static int pp_search_dirs(char **argv, int argc, const char *input_file, char (*
 	const char *begin = "#include <...> search starts here:";
 	const char *end = "End of search list.";
 	char *b = NULL, *e = NULL, *l = NULL;
+	char cwd[PATH_MAX];
 	int n = 0, pargc = 0;
 	ssize_t got;
+	PPKey key;
+	bool keyed = false;
 
-	buf = malloc(PROBE_CAP);
 	probe = calloc((size_t)argc + 6, sizeof *probe);
-	if (!buf || !probe) goto fail;
+	if (!probe) goto fail;
 	for (int i = 0; i < argc && argv[i]; i++) {
 		/* Drop the translation unit: the search path is a function of the
 		 * flags, and re-preprocessing the real input here would cost as much
@@ -5374,15 +6547,32 @@ static int pp_search_dirs(char **argv, int argc, const char *input_file, char (*
 	probe[pargc++] = (char *)"c";
 	probe[pargc++] = (char *)"/dev/null";
 	probe[pargc] = NULL;
-	got = spawn_capture_stderr(probe, buf, PROBE_CAP);
-	if (got <= 0) goto fail;
-	buf[got] = '\0';
-	b = strstr(buf, begin);
-	e = b ? strstr(b, end) : NULL;
-	if (!b || !e) goto fail;
-	for (l = b + strlen(begin); l < e;) {
+	/* Relative -I spellings and which listed directories exist at all are
+	 * judged from the working directory; the include environment adds more. */
+	keyed = getcwd(cwd, sizeof cwd) && cc_record_key(&key, "search-dirs", probe, pargc);
+	if (keyed) {
+		ppk_feed_str(&key, cwd);
+		for (size_t i = 0; i < sizeof pp_cache_env_keys / sizeof *pp_cache_env_keys; i++)
+			ppk_feed_str(&key, prism_getenv(pp_cache_env_keys[i]));
+		buf = cc_record_load(&key);
+	}
+	if (!buf) {
+		buf = malloc(PROBE_CAP);
+		if (!buf) goto fail;
+		got = spawn_capture_stderr(probe, buf, PROBE_CAP);
+		if (got <= 0) goto fail;
+		buf[got] = '\0';
+		b = strstr(buf, begin);
+		e = b ? strstr(b, end) : NULL;
+		if (!b || !e) goto fail;
+		b += strlen(begin);
+		*e = '\0';
+		memmove(buf, b, (size_t)(e - b) + 1);
+		if (keyed) cc_record_store(&key, buf);
+	}
+	for (l = buf; *l;) {
 		char *nl = strchr(l, '\n');
-		char *stop = (nl && nl < e) ? nl : e;
+		char *stop = nl ? nl : l + strlen(l);
 		char raw[PATH_MAX];
 		size_t len;
 		while (l < stop && (*l == ' ' || *l == '\t')) l++;
@@ -5395,7 +6585,7 @@ static int pp_search_dirs(char **argv, int argc, const char *input_file, char (*
 			/* A directory that does not resolve cannot shadow anything. */
 			if (realpath(raw, out[n])) n++;
 		}
-		if (!nl || nl >= e) break;
+		if (!nl) break;
 		l = nl + 1;
 	}
 	free(buf);
@@ -5420,6 +6610,12 @@ static void pp_cache_store(const PPKey *k, const char *input_file, const char *p
 	const char *l = NULL;
 	FILE *f = NULL;
 	bool ok = true;
+	PPKey sum = {0, 0};
+	PPIndexRec *notes = malloc(PP_CHUNK_MAX_PIECES * sizeof *notes);
+	int nnotes = 0;
+	unsigned long long stored = 0;
+	char *z = NULL;
+	size_t packed = 0;
 
 	deps = calloc(MAX_DEPS, sizeof *deps);
 	raws = calloc(MAX_DEPS, sizeof *raws);
@@ -5467,7 +6663,7 @@ static void pp_cache_store(const PPKey *k, const char *input_file, const char *p
 		f = fdopen(fd, "wb");
 		if (!f) {
 			close(fd);
-			remove(tmp);
+			pp_cache_drop_temp(tmp);
 			goto out;
 		}
 	}
@@ -5502,132 +6698,3505 @@ static void pp_cache_store(const PPKey *k, const char *input_file, const char *p
 			ok = false;
 			break;
 		}
-		ok = fprintf(f, "%lld %lld %lld %lld %lld %llu %llu %s\n", id.size, id.mtime_sec,
-			     id.mtime_nsec, id.ctime_sec, id.ctime_nsec, id.device, id.inode, deps[i]) > 0;
-		/* The spelling as the preprocessor reported it, on its own line so no
-		 * separator has to be reserved in a path. Re-resolving it on load is
-		 * what catches a symlink anywhere along the way being retargeted: the
-		 * recorded canonical file is then still there and unchanged. */
-		if (ok) ok = fprintf(f, "%s\n", raws[i] ? raws[i] : deps[i]) > 0;
+		ok = fprintf(f, "%lld %lld %lld %lld %lld %llu %llu %s\n", id.size, id.mtime_sec,
+			     id.mtime_nsec, id.ctime_sec, id.ctime_nsec, id.device, id.inode, deps[i]) > 0;
+		/* The spelling as the preprocessor reported it, on its own line so no
+		 * separator has to be reserved in a path. Re-resolving it on load is
+		 * what catches a symlink anywhere along the way being retargeted: the
+		 * recorded canonical file is then still there and unchanged. */
+		if (ok) ok = fprintf(f, "%s\n", raws[i] ? raws[i] : deps[i]) > 0;
+	}
+	if (ok) ok = fprintf(f, "dirs %d\n", nwatch) > 0;
+	for (i = 0; ok && i < nwatch; i++) {
+		PPStat id;
+		if (!pp_stat_id(watch[i], &id)) {
+			ok = false;
+			break;
+		}
+		ok = fprintf(f, "%lld %lld %lld %lld %lld %llu %llu %s\n", id.size, id.mtime_sec,
+			     id.mtime_nsec, id.ctime_sec, id.ctime_nsec, id.device, id.inode, watch[i]) > 0;
+	}
+	if (ok) sum = pp_payload_checksum(payload, len);
+	if (ok && !(notes && pp_chunks_write(f, payload, len, sum, notes, &nnotes, &stored, &ok)) &&
+	    (z = pp_lz_maybe_pack(payload, len, &packed)) != NULL) {
+		stored = packed;
+		ok = fprintf(f, "packed %llu %016llx %016llx %llu\n", (unsigned long long)len, (unsigned long long)sum.a,
+			     (unsigned long long)sum.b, stored) > 0 &&
+		     fwrite(z, 1, packed, f) == packed;
+	} else if (ok && !nnotes) {
+		stored = len;
+		/* The payload goes on the next page boundary (see pp_payload_map). */
+		long page = 4096, at = 0;
+#ifndef _WIN32
+		if (sysconf(_SC_PAGESIZE) > 0) page = sysconf(_SC_PAGESIZE);
+#endif
+		char line[96];
+		int n = snprintf(line, sizeof line, "payload %llu %016llx %016llx ", (unsigned long long)len,
+				 (unsigned long long)sum.a, (unsigned long long)sum.b);
+		at = ftell(f);
+		ok = at >= 0 && n > 0;
+		if (ok) {
+			/* Room for the offset's digits and the newline, rounded up. */
+			unsigned long long off = ((unsigned long long)at + (unsigned long long)n + 24 + (unsigned long long)page - 1) /
+						 (unsigned long long)page * (unsigned long long)page;
+			static const char pad[8];
+			ok = fprintf(f, "%s%llu\n", line, off) > 0 && (at = ftell(f)) >= 0 &&
+			     (unsigned long long)at <= off;
+			for (unsigned long long fill = ok ? off - (unsigned long long)at : 0; ok && fill; fill--)
+				ok = fputc('\0', f) != EOF;
+			ok = ok && fwrite(payload, 1, len, f) == len && fwrite(pad, 1, 8, f) == 8;
+		}
+	}
+	{
+		long size = ftell(f);
+		if (fclose(f) != 0) ok = false;
+		f = NULL;
+		if (pp_cache_publish_temp(tmp, path, ok)) {
+			PPIndexRec rec = pp_index_rec(k, ".pp", size, size + (long long)len - (long long)stored);
+			pp_index_append(&rec, 1);
+		}
+		/* Chunks written for a failed entry are still there to be evicted. */
+		pp_index_append(notes, (size_t)nnotes);
+		if (ok) pp_cache_prune();
+	}
+out:
+	/* Declined after the temporary was opened (no search path to watch). */
+	if (f) {
+		fclose(f);
+		pp_cache_drop_temp(tmp);
+	}
+	free(z);
+	free(notes);
+	for (i = 0; i < ndeps; i++) {
+		free(deps[i]);
+		if (raws) free(raws[i]);
+	}
+	free(raws);
+	free(deps);
+}
+
+static bool pp_cache_enabled(void) {
+	const char *v = prism_getenv("PRISM_NO_PP_CACHE");
+	return !(v && *v && strcmp(v, "0") != 0);
+}
+
+/* Conservatively reject volatile time macros before or after preprocessing.
+ * A short read is uncertainty, never permission to cache the partial scan. */
+static bool pp_file_is_time_stable(const char *path) {
+	struct stat st;
+	FILE *f = NULL;
+	char *b = NULL;
+	size_t got = 0;
+	bool complete = false;
+
+	if (stat(path, &st) != 0) return false;
+	/* Not off_t: that name is POSIX and MSVC only exposes it under
+	 * _CRT_DECLARE_NONSTDC_NAMES. st_size is an integer type on every target. */
+	if ((st.st_size <= 0) | ((long long)st.st_size > (long long)(64 << 20))) return false;
+	f = fopen(path, "rb");
+	if (!f) return false;
+	b = malloc((size_t)st.st_size);
+	if (!b) {
+		fclose(f);
+		return false;
+	}
+	got = fread(b, 1, (size_t)st.st_size, f);
+	complete = got == (size_t)st.st_size && !ferror(f);
+	if (fclose(f) != 0) complete = false;
+	bool ok = complete && !pp_text_has_time_macro(b, got);
+	free(b);
+	return ok;
+}
+
+/* A custom compiler command can be a wrapper that consults arbitrary state
+ * outside argv, headers, and the process environment. Default drivers remain
+ * cacheable; explicit alternatives fail closed instead of returning stale C. */
+static bool pp_cache_uses_default_compiler(void) {
+	PRISM_STATE();
+	return !_ps->extra_compiler || strcmp(_ps->extra_compiler, PRISM_DEFAULT_CC) == 0;
+}
+
+/* ---- transpiled-output cache ------------------------------------------
+ *
+ * A pp-cache hit still tokenizes, analyses and emits the whole translation
+ * unit. What is emitted is a function of the preprocessed text and of a little
+ * state beside it: the feature set, the target, the consumed defines and the
+ * source's own #defines (collect_source_defines). `.out` entries are keyed by
+ * exactly that, plus prism's own binary, so a rebuilt prism never replays what
+ * an older one emitted. */
+#define OUT_CACHE_MAGIC "PRISMOUT1\n"
+
+typedef struct {
+	PPKey key;
+	bool keyed; // a miss may be recorded under `key`
+} OutCacheProbe;
+
+static bool ppk_feed_self(PPKey *k) {
+	char self[PATH_MAX];
+	PPStat id;
+#ifdef _WIN32
+	DWORD n = GetModuleFileNameA(NULL, self, (DWORD)sizeof self);
+	if (n == 0 || n >= sizeof self) return false;
+#else
+	if (!get_self_exe_path(self)) return false;
+#endif
+	if (!pp_stat_id(self, &id)) return false;
+	ppk_feed_str(k, self);
+	ppk_feed_stat(k, &id);
+	return true;
+}
+
+static bool out_cache_key(PPKey *k, const char *input_file, const char *pp_buf, size_t len) {
+	PRISM_STATE();
+	PPARSE_CTX();
+	const char *cc = _ps->extra_compiler ? _ps->extra_compiler : PRISM_DEFAULT_CC;
+	uint8_t target[3] = {cc_is_msvc(cc), use_linemarkers, _ps->source_defines_for_pragma_only};
+	int counts[3] = {_ps->extra_compiler_flags_count, _ps->extra_define_count, _ps->source_define_count};
+	*k = (PPKey){0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL};
+	ppk_feed_str(k, OUT_CACHE_MAGIC);
+	ppk_feed_str(k, PRISM_VERSION);
+	if (!ppk_feed_self(k)) return false;
+	PPKey sum = pp_payload_checksum(pp_buf, len);
+	ppk_feed(k, &sum.a, sizeof sum.a);
+	ppk_feed(k, &sum.b, sizeof sum.b);
+	ppk_feed_str(k, input_file);
+	ppk_feed(k, &_pc->features, sizeof _pc->features);
+	ppk_feed(k, target, sizeof target);
+	ppk_feed_str(k, cc);
+	ppk_feed(k, counts, sizeof counts);
+	for (int i = 0; i < _ps->extra_compiler_flags_count; i++) ppk_feed_str(k, _ps->extra_compiler_flags[i]);
+	for (int i = 0; i < _ps->extra_define_count; i++) ppk_feed_str(k, _ps->extra_defines[i]);
+	for (int i = 0; i < _ps->source_define_count; i++) {
+		const SourceDefine *sd = &_ps->source_defines[i];
+		uint8_t post = sd->post_include;
+		ppk_feed_str(k, sd->text);
+		ppk_feed_str(k, sd->guard);
+		ppk_feed(k, &sd->guard_depth, sizeof sd->guard_depth);
+		ppk_feed(k, &post, 1);
+	}
+	return true;
+}
+
+static bool out_cache_path(const PPKey *k, const char *ext, char *out, size_t cap) {
+	return pp_entry_path(k, ext, out, cap);
+}
+
+/* An entry as read, with its payload checked and found `*off` bytes in, or
+ * NULL on any miss. Entries are `magic`, a checksummed length line, then the
+ * payload bytes. */
+static char *out_cache_read_entry(const PPKey *k, const char *magic, const char *ext, size_t *len, size_t *off) {
+	char path[PATH_MAX];
+	size_t ml = strlen(magic);
+	unsigned long long plen = 0, sum_a = 0, sum_b = 0;
+	int n = 0;
+	if (!out_cache_path(k, ext, path, sizeof path)) return NULL;
+	FileBytes e = read_file_bytes(path);
+	if (!e.data) return NULL;
+	if (e.size < ml || memcmp(e.data, magic, ml) != 0 ||
+	    sscanf(e.data + ml, "payload %llu %llx %llx%n", &plen, &sum_a, &sum_b, &n) != 3 ||
+	    e.data[ml + (size_t)n] != '\n' || plen != e.size - ml - (size_t)n - 1) {
+		free(e.data);
+		return NULL;
+	}
+	*off = ml + (size_t)n + 1;
+	PPKey sum = pp_payload_checksum(e.data + *off, (size_t)plen);
+	if (sum.a != sum_a || sum.b != sum_b) {
+		free(e.data);
+		return NULL;
+	}
+	*len = (size_t)plen;
+	pp_index_note(k, ext, PP_NOTE_HIT);
+	return e.data;
+}
+
+/* An entry's payload with 8 bytes of NUL padding, or NULL on any miss. */
+static char *out_cache_load_entry(const PPKey *k, const char *magic, const char *ext, size_t *len) {
+	size_t off = 0;
+	char *data = out_cache_read_entry(k, magic, ext, len, &off);
+	if (!data) return NULL;
+	memmove(data, data + off, *len);
+	memset(data + *len, 0, 8);
+	return data;
+}
+
+static void out_cache_store_entry(const PPKey *k, const char *magic, const char *ext, const char *text,
+				  size_t len) {
+	char path[PATH_MAX], tmp[PATH_MAX];
+	if (!out_cache_path(k, ext, path, sizeof path)) return;
+	int fd = pp_cache_open_temp(path, tmp, sizeof tmp);
+	if (fd < 0) return;
+	FILE *f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		pp_cache_drop_temp(tmp);
+		return;
+	}
+	PPKey sum = pp_payload_checksum(text, len);
+	bool ok = fputs(magic, f) >= 0 &&
+		  fprintf(f, "payload %llu %016llx %016llx\n", (unsigned long long)len,
+			  (unsigned long long)sum.a, (unsigned long long)sum.b) > 0 &&
+		  fwrite(text, 1, len, f) == len;
+	long size = ftell(f);
+	if (fclose(f) != 0) ok = false;
+	if (pp_cache_publish_temp(tmp, path, ok)) {
+		pp_index_note(k, ext, size);
+		pp_cache_prune();
+	}
+}
+
+static char *out_cache_load(const PPKey *k, size_t *len) {
+	return out_cache_load_entry(k, OUT_CACHE_MAGIC, ".out", len);
+}
+
+static void out_cache_store(const PPKey *k, const char *text, size_t len) {
+	out_cache_store_entry(k, OUT_CACHE_MAGIC, ".out", text, len);
+}
+
+/* Looks the preprocessed `pp_buf` up. A hit returns the recorded C; a miss
+ * leaves `oc` ready for transpile_tokens_recorded. --prism-verify always
+ * re-emits, since checking a replay would prove nothing. */
+static char *out_cache_begin(OutCacheProbe *oc, const char *input_file, const char *pp_buf, size_t *len) {
+	oc->keyed = false;
+	if (!pp_cache_enabled() || prism_verify_mode) return NULL;
+	if (!out_cache_key(&oc->key, input_file, pp_buf, strlen(pp_buf))) return NULL;
+	char *hit = out_cache_load(&oc->key, len);
+	if (prism_profile) fprintf(stderr, "[prism-prof] out-cache=%s\n", hit ? "hit" : "miss");
+	oc->keyed = !hit;
+	return hit;
+}
+
+/* Writes a recorded emission where transpile_tokens would have, and closes
+ * `fp` as it does. Takes ownership of `text`. */
+static bool out_cache_replay(FILE *fp, char *text, size_t len) {
+	bool ok = fwrite(text, 1, len, fp) == len && !ferror(fp);
+	if (fclose(fp) != 0) ok = false;
+	free(text);
+	return ok;
+}
+
+/* ---- token-stream cache -------------------------------------------------
+ *
+ * When the output cache misses (a new feature set, a warning that kept the
+ * emission out of it, a library call), the preprocessed text is tokenized from
+ * scratch although the pp-cache handed back the same bytes as last time.
+ * PRISM_PP_CACHE_TOKENS=1 keeps a `.tok` snapshot beside the `.pp` entry
+ * (pparse_token_snapshot) and restores it instead. Tokenization reads nothing
+ * but the text, its name and the keyword table, so that is the key, together
+ * with the struct layout the snapshot is made of. It is opt-in: a snapshot is
+ * several times the size of the text it replaces, and reading it back only
+ * wins when the cache directory is on a fast disk. */
+#define TOK_CACHE_MAGIC "PRISMTOK2\n"
+
+static bool tok_cache_enabled(void) {
+	const char *v = getenv("PRISM_PP_CACHE_TOKENS");
+	return v && *v && strcmp(v, "0") != 0 && pp_cache_enabled();
+}
+
+static bool tok_cache_key(PPKey *k, const char *input_file, const PPKey *sum) {
+	PPARSE_CTX();
+	uint32_t layout[3] = {(uint32_t)sizeof(PParseToken), (uint32_t)sizeof(PParseFile), PPARSE_SNAP_WORDS};
+	*k = (PPKey){0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL};
+	ppk_feed_str(k, TOK_CACHE_MAGIC);
+	ppk_feed_str(k, PRISM_VERSION);
+	if (!ppk_feed_self(k)) return false;
+	ppk_feed(k, layout, sizeof layout);
+	for (int i = 0; i < PPARSE_KW_SLOTS; i++) {
+		ppk_feed_str(k, pparse_keyword_table[i].name ? pparse_keyword_table[i].name : "");
+		ppk_feed(k, &pparse_keyword_table[i].value, sizeof pparse_keyword_table[i].value);
+	}
+	ppk_feed(k, &sum->a, sizeof sum->a);
+	ppk_feed(k, &sum->b, sizeof sum->b);
+	ppk_feed_str(k, input_file);
+	ppk_feed(k, &_pc->input_preprocessed, 1);
+	return true;
+}
+
+/* ---- split tokenization ----
+ *
+ * pparse_lex_split's workers. They are processes, as transpile_sources_parallel's
+ * are and for the same reasons; each is forked with the parser state as it
+ * stands, lexes its part into its own copy, and leaves the result in memory
+ * shared with the parent. A worker that fails says nothing: the parent lexes
+ * the whole buffer again, and that run reports whatever went wrong. */
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* Workers for one buffer: the build's -j when it has one source, and 1 when
+ * its sources are already transpiled in parallel. */
+static int lex_split_jobs = 1;
+static int lex_split_parts; // parts the last buffer was lexed in, for --prism-prof
+
+/* One part per PRISM_LEX_SPLIT_KB of text (default 1 MiB), up to the workers
+ * allowed. */
+static int lex_jobs(size_t len) {
+	size_t per = (size_t)pp_env_scaled("PRISM_LEX_SPLIT_KB", 1024, 1024);
+	size_t parts = len / per;
+	return parts < (size_t)lex_split_jobs ? (int)parts : lex_split_jobs;
+}
+
+static bool lex_parallel(int n, size_t cap, bool (*job)(void *, int, char *, size_t), bool (*done)(void *, char **),
+			 void *arg) {
+#ifdef _WIN32
+	(void)n, (void)cap, (void)job, (void)done, (void)arg;
+	return false;
+#else
+	char **outs = calloc((size_t)n, sizeof(*outs));
+	pid_t *pids = calloc((size_t)n, sizeof(*pids));
+	bool ok = outs && pids;
+	int started = 0;
+	for (int i = 0; ok && i < n; i++) {
+		outs[i] = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (outs[i] == MAP_FAILED) {
+			outs[i] = NULL;
+			ok = false;
+		}
+	}
+	fflush(NULL);
+	for (; ok && started < n; started++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			int null = open("/dev/null", O_WRONLY);
+			if (null >= 0) dup2(null, STDERR_FILENO);
+			_exit(job(arg, started, outs[started], cap) ? 0 : 1);
+		}
+		if (pid < 0) break;
+		pids[started] = pid;
+	}
+	ok &= started == n;
+	for (int i = 0; i < started; i++) {
+		int st = 0;
+		while (waitpid(pids[i], &st, 0) == -1 && errno == EINTR) {}
+		ok &= WIFEXITED(st) && WEXITSTATUS(st) == 0;
+	}
+	if (ok) ok = done(arg, outs);
+	if (ok) lex_split_parts = n;
+	for (int i = 0; outs && i < n; i++)
+		if (outs[i]) munmap(outs[i], cap);
+	free(outs);
+	free(pids);
+	return ok;
+#endif
+}
+
+/* pparse_tokenize_buffer, with the scan kernels it ran and its throughput
+ * under --prism-prof. */
+static PParseToken *tokenize_profiled(char *input_file, char *pp_buf) {
+	if (!prism_profile) return pparse_tokenize_buffer(input_file, pp_buf);
+	size_t len = strlen(pp_buf);
+	const char *scan = pparse_scan_kernel()->name;
+	double t0 = prism_now_ms();
+	lex_split_parts = 1;
+	PParseToken *tok = pparse_tokenize_buffer(input_file, pp_buf);
+	double ms = prism_now_ms() - t0;
+	fprintf(stderr, "[prism-prof] scan=%s tokenize=%.1fMB/s (%zu bytes, %d part%s)\n", scan,
+		ms > 0 ? len / 1e3 / ms : 0.0, len, lex_split_parts, lex_split_parts == 1 ? "" : "s");
+	return tok;
+}
+
+/* pparse_tokenize_buffer for a preprocessed `pp_buf`, through the cache. */
+static PParseToken *tokenize_cached(char *input_file, char *pp_buf) {
+	PPARSE_CTX();
+	uint32_t first = pparse_token_count, file_base = (uint32_t)_pc->input_file_count, name_base = _pc->name_count;
+	size_t len, snap_len = 0, off = 0;
+	PPKey key, sum;
+	if (!tok_cache_enabled()) return tokenize_profiled(input_file, pp_buf);
+	len = strlen(pp_buf);
+	sum = pp_payload_checksum(pp_buf, len);
+	if (!tok_cache_key(&key, input_file, &sum)) return tokenize_profiled(input_file, pp_buf);
+	char *snap = out_cache_read_entry(&key, TOK_CACHE_MAGIC, ".tok", &snap_len, &off);
+	PParseToken *tok = snap ? pparse_token_restore(snap + off, snap_len, pp_buf, len) : NULL;
+	free(snap);
+	if (prism_profile) fprintf(stderr, "[prism-prof] tok-cache=%s\n", tok ? "hit" : "miss");
+	if (tok) return tok;
+	tok = tokenize_profiled(input_file, pp_buf);
+	size_t now = strlen(_pc->token_source);
+	PPKey after = pp_payload_checksum(_pc->token_source, now);
+	snap = pparse_token_snapshot(first, file_base, name_base, now == len && after.a == sum.a && after.b == sum.b,
+				     &snap_len);
+	if (snap) out_cache_store_entry(&key, TOK_CACHE_MAGIC, ".tok", snap, snap_len);
+	free(snap);
+	return tok;
+}
+
+/* ---- Pass 1 prefix snapshots -------------------------------------------
+ *
+ * PRISM_PP_CACHE_PASS1=1 keeps the prescan's state at the end of a TU's
+ * system-header prefix (pparse_prefix_snapshot) and resumes later TUs from
+ * it: in memory for the rest of the process, which is what a multi-source
+ * run or a library caller reuses, and as a `.p1s` entry when the pp-cache is
+ * on. The key for each candidate end is everything the prescan of the prefix
+ * reads: its tokens as pparse_build_scopes left them, the source text under
+ * them, the file views and scopes they refer to, the feature set, and the
+ * struct layout the snapshot is made of. Lookup tries the longest prefix
+ * first; unless that one hit, it is what the TU stores. */
+#define P1_PREFIX_MAGIC "PRISMP1S2\n"
+#define P1_PREFIX_SLOTS 4
+
+typedef struct {
+	PPKey key;
+	char *snap;
+	size_t len;
+	uint64_t used;
+} P1PrefixSlot;
+
+static PRISM_THREAD_LOCAL P1PrefixSlot p1_prefix_slots[P1_PREFIX_SLOTS];
+static PRISM_THREAD_LOCAL uint64_t p1_prefix_clock;
+static PRISM_THREAD_LOCAL PPKey p1_prefix_pending;
+
+static bool p1_prefix_enabled(void) {
+	const char *v = getenv("PRISM_PP_CACHE_PASS1");
+	return v && *v && strcmp(v, "0") != 0;
+}
+
+static void p1_prefix_forget(void) {
+	for (int i = 0; i < P1_PREFIX_SLOTS; i++) free(p1_prefix_slots[i].snap);
+	memset(p1_prefix_slots, 0, sizeof p1_prefix_slots);
+}
+
+/* Takes ownership of `snap`, evicting the least recently used slot. */
+static P1PrefixSlot *p1_prefix_keep(const PPKey *k, char *snap, size_t len) {
+	P1PrefixSlot *slot = &p1_prefix_slots[0];
+	for (int i = 1; i < P1_PREFIX_SLOTS; i++)
+		if (p1_prefix_slots[i].used < slot->used) slot = &p1_prefix_slots[i];
+	free(slot->snap);
+	*slot = (P1PrefixSlot){*k, snap, len, ++p1_prefix_clock};
+	return slot;
+}
+
+/* Feeds what lies between two tokens, less whitespace and linemarkers: the
+ * tokens' own flags record the spacing, the file views the markers, and the
+ * markers name the main file, which a prefix must not depend on. `bol` says
+ * whether `p` starts a line. */
+static void p1_prefix_feed_gap(PPKey *k, const char *p, const char *end, bool bol) {
+	while (p < end) {
+		const char *nl = memchr(p, '\n', (size_t)(end - p));
+		const char *eol = nl ? nl : end, *q = p;
+		while (q < eol && ascii_hspace(*q)) q++;
+		bool marker = bol && q < eol && *q == '#';
+		if (marker) {
+			for (q++; q < eol && ascii_hspace(*q); q++);
+			marker = q < eol && *q >= '0' && *q <= '9';
+		}
+		for (q = p; !marker && q < eol; q++)
+			if (!ascii_hspace(*q) && *q != '\r') ppk_feed(k, q, 1);
+		if (!nl) break;
+		p = nl + 1;
+		bol = true;
+	}
+}
+
+/* Fills keys[i] for the prefix ending at bounds[i], chaining each key from
+ * the one before it. Nothing fed depends on where the prefix sits in the
+ * source or on the main file's name: tokens go in without their source
+ * offsets, followed by their spellings, and a view of the main file by a
+ * flag in place of its name. So a snapshot taken under one file resumes
+ * another that includes the same headers the same way. */
+static bool p1_prefix_keys(const uint32_t *bounds, int n, PPKey *keys) {
+	PPARSE_CTX();
+	uint32_t layout[8] = {(uint32_t)sizeof(PParseToken),	   (uint32_t)sizeof(PParseTypedefEntry),
+			      (uint32_t)sizeof(PParseBoundsArrayEntry), (uint32_t)sizeof(PParseAnalysisRecord),
+			      (uint32_t)sizeof(P1FuncEntry),	   (uint32_t)sizeof(PParsePrefixFunc),
+			      (uint32_t)sizeof(PParsePrefixDiff),	   PPARSE_PREFIX_WORDS};
+	uint32_t at = 1, src = 0, view = 0, sid = 1;
+	const char *main_name = _pc->input_files[0]->name;
+	PPKey k = {0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+	ppk_feed_str(&k, P1_PREFIX_MAGIC);
+	ppk_feed_str(&k, PRISM_VERSION);
+	if (!ppk_feed_self(&k)) return false;
+	ppk_feed(&k, layout, sizeof layout);
+	ppk_feed(&k, &_pc->features, sizeof _pc->features);
+	ppk_feed(&k, &_pc->input_preprocessed, 1);
+	for (int i = 0; i < n; i++) {
+		uint32_t b = bounds[i];
+		for (; at <= b; at++) {
+			PParseToken t = pparse_token_pool[at];
+			if (t.match_idx < src) return false;
+			p1_prefix_feed_gap(&k, _pc->token_source + src, _pc->token_source + t.match_idx,
+					   src == 0 || _pc->token_source[src - 1] == '\n');
+			if (at == b) break;
+			ppk_feed(&k, _pc->token_source + t.match_idx, t.len);
+			src = t.match_idx + t.len;
+			t.match_idx = 0;
+			ppk_feed(&k, &t, sizeof t);
+		}
+		for (; view <= pparse_token_pool[b - 1].file_idx; view++) {
+			PParseFile *f = _pc->input_files[view];
+			bool is_main = strcmp(f->name, main_name) == 0;
+			int32_t info[2] = {f->line_delta, (int32_t)(f->is_system | f->is_direct_system_include << 1 |
+								    f->skip_emit << 2 | is_main << 3)};
+			ppk_feed_str(&k, is_main ? "" : f->name);
+			ppk_feed(&k, info, sizeof info);
+		}
+		for (; sid < pparse_scope_tree_count && pparse_scope_tree[sid].open_tok_idx < b; sid++) {
+			PParseScopeInfo *si = &pparse_scope_tree[sid];
+			uint32_t info[3] = {si->open_tok_idx, si->parent_id,
+					    (uint32_t)(si->is_struct | si->is_loop << 1 | si->is_switch << 2 |
+						       si->is_func_body << 3 | si->is_stmt_expr << 4 |
+						       si->is_conditional << 5 | si->is_init << 6)};
+			ppk_feed(&k, info, sizeof info);
+		}
+		keys[i] = k;
+		ppk_feed(&keys[i], &b, sizeof b);
+		src = pparse_token_pool[b].match_idx;
+	}
+	return true;
+}
+
+static const char *p1_prefix_load(const uint32_t *bounds, int n, int *hit, int *want, size_t *len) {
+	PPKey keys[PPARSE_PREFIX_MAX_BOUNDS];
+	const char *found = NULL;
+	if (!p1_prefix_enabled() || !p1_prefix_keys(bounds, n, keys)) return NULL;
+	for (int i = n - 1; i >= 0 && !found; i--) {
+		for (int j = 0; j < P1_PREFIX_SLOTS; j++) {
+			P1PrefixSlot *slot = &p1_prefix_slots[j];
+			if (slot->snap && slot->key.a == keys[i].a && slot->key.b == keys[i].b) {
+				slot->used = ++p1_prefix_clock;
+				found = slot->snap;
+				*len = slot->len;
+				*hit = i;
+				break;
+			}
+		}
+		size_t off = 0;
+		char *data = found || !pp_cache_enabled()
+				 ? NULL
+				 : out_cache_read_entry(&keys[i], P1_PREFIX_MAGIC, ".p1s", len, &off);
+		if (data) {
+			memmove(data, data + off, *len);
+			found = p1_prefix_keep(&keys[i], data, *len)->snap;
+			*hit = i;
+		}
+	}
+	if (*hit < n - 1) {
+		*want = n - 1;
+		p1_prefix_pending = keys[n - 1];
+	}
+	if (prism_profile)
+		fprintf(stderr, "[prism-prof] p1-prefix=%s (%u of %u prefix tokens)\n", found ? "hit" : "miss",
+			found ? bounds[*hit] : 0, bounds[n - 1]);
+	return found;
+}
+
+static void p1_prefix_store(char *snap, size_t len) {
+	if (pp_cache_enabled()) out_cache_store_entry(&p1_prefix_pending, P1_PREFIX_MAGIC, ".p1s", snap, len);
+	p1_prefix_keep(&p1_prefix_pending, snap, len);
+}
+
+/* ---- object-file cache ------------------------------------------------
+ *
+ * `-fobject-cache` takes the same step for the backend compile of `-c`: the
+ * object is a function of the transpiled C, the backend argv, the compiler
+ * binary, its predefined macros and its environment, so `.obj` entries keyed
+ * by those let a rebuild skip the compiler altogether. The working directory
+ * is keyed as well, since debug info records it. A compile that printed
+ * anything is never recorded, because a hit could not repeat its diagnostics. */
+#ifndef _WIN32
+#define OBJ_CACHE_MAGIC "PRISMOBJ1\n"
+
+/* Driver variables that change what the backend runs. */
+static const char *const obj_cache_env_keys[] = {"GCC_EXEC_PREFIX", "COMPILER_PATH"};
+
+/* Digest of the predefined macros (`-dM -E` on an empty TU): two binaries
+ * with one identity can still be configured differently by specs or wrapper
+ * flags baked into the driver, and every macro they define shows up here. */
+static bool cc_macro_digest(const char *cc, PPKey *out) {
+	enum { MACRO_CAP = 1 << 20 };
+	char exe[PATH_MAX];
+	char *probe_argv[] = {exe, "-dM", "-E", "-x", "c", "/dev/null", NULL};
+	PPKey key;
+	bool keyed = false;
+	char *rec = NULL, *buf = NULL;
+	bool ok = false;
+	if (cc_is_msvc(cc)) return false;
+	snprintf(exe, sizeof exe, "%s", cc_executable(cc));
+	keyed = cc_record_key(&key, "macros", probe_argv, 6);
+	rec = keyed ? cc_record_load(&key) : NULL;
+	if (rec) {
+		unsigned long long a = 0, b = 0;
+		ok = sscanf(rec, "macros %16llx%16llx", &a, &b) == 2;
+		*out = (PPKey){a, b};
+		free(rec);
+		if (ok) return true;
+	}
+	buf = malloc(MACRO_CAP);
+	if (!buf) return false;
+	ssize_t got = spawn_capture_stdout(probe_argv, buf, MACRO_CAP);
+	ok = got > 0 && (size_t)got < MACRO_CAP - 1;
+	if (ok) {
+		*out = pp_payload_checksum(buf, strlen(buf));
+		if (keyed) {
+			char body[64];
+			snprintf(body, sizeof body, "macros %016llx%016llx\n", (unsigned long long)out->a,
+				 (unsigned long long)out->b);
+			cc_record_store(&key, body);
+		}
+	}
+	free(buf);
+	return ok;
+}
+
+/* Flags that read state argv does not describe (profiles, plugins, specs,
+ * response files) or write files beside the object that a hit would not. */
+PRISM_MAYBE_UNUSED static bool obj_cache_argv_ok(char **argv) {
+	static const char *const prefixes[] = {
+	    "-fprofile-use", "-fprofile-instr-use", "-fauto-profile", "-fplugin",	"-specs",
+	    "--specs",	     "-gsplit-dwarf",	    "--coverage",     "-ftest-coverage", "-fstack-usage",
+	    "-fcallgraph-info", "-fdump-",	    "-save-temps",    "-aux-info",	"-fopt-info",
+	    "@",
+	};
+	for (int i = 1; argv[i]; i++)
+		for (size_t j = 0; j < sizeof prefixes / sizeof *prefixes; j++)
+			if (strncmp(argv[i], prefixes[j], strlen(prefixes[j])) == 0) return false;
+	return pp_cache_enabled() && pp_cache_uses_default_compiler();
+}
+
+PRISM_MAYBE_UNUSED static bool obj_cache_key(PPKey *k, char **argv, const char *text, size_t len) {
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof cwd)) return false;
+	*k = (PPKey){0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL};
+	ppk_feed_str(k, OBJ_CACHE_MAGIC);
+	ppk_feed_str(k, cwd);
+	for (int i = 0; argv[i]; i++) ppk_feed_str(k, argv[i]);
+	if (!ppk_feed_compiler(k, argv[0])) return false;
+	PPKey macros;
+	if (!cc_macro_digest(argv[0], &macros)) return false;
+	ppk_feed(k, &macros.a, sizeof macros.a);
+	ppk_feed(k, &macros.b, sizeof macros.b);
+	for (size_t i = 0; i < sizeof pp_cache_env_keys / sizeof *pp_cache_env_keys; i++)
+		ppk_feed_str(k, prism_getenv(pp_cache_env_keys[i]));
+	for (size_t i = 0; i < sizeof obj_cache_env_keys / sizeof *obj_cache_env_keys; i++)
+		ppk_feed_str(k, prism_getenv(obj_cache_env_keys[i]));
+	PPKey sum = pp_payload_checksum(text, len);
+	ppk_feed(k, &sum.a, sizeof sum.a);
+	ppk_feed(k, &sum.b, sizeof sum.b);
+	return true;
+}
+
+/* Writes a recorded object to `out` through a temporary beside it, so a
+ * concurrent reader never sees half of one. The copy is fresh, with the mode
+ * the compiler would have created it with: a hard link would carry the
+ * entry's old mtime into make's view and share its inode with the cache. */
+static bool obj_cache_publish(const char *out, const char *obj, size_t len) {
+	char tmp[PATH_MAX];
+	int fd = pp_cache_open_temp(out, tmp, sizeof tmp);
+	if (fd < 0) return false;
+	mode_t mask = umask(0);
+	umask(mask);
+	FILE *f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		pp_cache_drop_temp(tmp);
+		return false;
+	}
+	bool ok = fchmod(fd, 0666 & ~mask) == 0 && fwrite(obj, 1, len, f) == len;
+	if (fclose(f) != 0) ok = false;
+	if (!pp_cache_publish_temp(tmp, out, ok)) return false;
+	return true;
+}
+
+/* Publishes the object recorded for `key` to `out`. False on any miss. */
+PRISM_MAYBE_UNUSED static bool obj_cache_fetch(const PPKey *key, const char *out) {
+	size_t len = 0;
+	char *obj = out_cache_load_entry(key, OBJ_CACHE_MAGIC, ".obj", &len);
+	bool hit = obj && obj_cache_publish(out, obj, len);
+	free(obj);
+	if (prism_profile) fprintf(stderr, "[prism-prof] obj-cache=%s\n", hit ? "hit" : "miss");
+	return hit;
+}
+
+#ifndef PRISM_LIB_MODE
+static bool cc_colors_diagnostics(const char *cc);
+
+/* The backend argv for a compile whose diagnostics are captured. A compiler
+ * colours only for a terminal, and the capture is a file; when prism's own
+ * stderr is a terminal, GCC and clang are asked to colour anyway. The flag
+ * goes first so one on the command line still wins, and it is not keyed:
+ * only a compile that printed nothing is recorded. NULL on allocation
+ * failure; otherwise free it (not its strings). */
+static char **obj_cache_spawn_argv(char **argv) {
+	const char *term = getenv("TERM");
+	int n = 0, at = 1;
+	while (argv[n]) n++;
+	char **v = malloc((size_t)(n + 2) * sizeof *v);
+	if (!v) return NULL;
+	v[0] = argv[0];
+	if (isatty(STDERR_FILENO) && !(term && strcmp(term, "dumb") == 0) && cc_colors_diagnostics(argv[0]))
+		v[at++] = "-fdiagnostics-color=always";
+	memcpy(v + at, argv + 1, (size_t)n * sizeof *v);
+	return v;
+}
+
+/* Relays the diagnostics captured in `err` and records the object a silent,
+ * successful compile wrote to `out`. Closes `err`. */
+static void obj_cache_finish(const PPKey *key, FILE *err, int rc, const char *out) {
+	char buf[4096];
+	size_t n, said = 0;
+	rewind(err);
+	while ((n = fread(buf, 1, sizeof buf, err)) > 0) {
+		fwrite(buf, 1, n, stderr);
+		said += n;
+	}
+	fclose(err);
+	if (rc != 0 || said) return;
+	FileBytes obj = read_file_bytes(out);
+	if (!obj.data) return;
+	out_cache_store_entry(key, OBJ_CACHE_MAGIC, ".obj", obj.data, obj.size);
+	free(obj.data);
+}
+#endif
+#endif
+
+/* `--prism-cache-clear` / `--prism-cache-info` support. */
+static void pp_clear_cb(const char *dir, const char *name, void *ud) {
+	char full[PATH_MAX];
+	long *n = (long *)ud;
+	if (!pp_pathf(full, sizeof full, "%s/%s", dir, name)) return;
+	if (remove(full) == 0) (*n)++;
+}
+
+typedef struct {
+	int n;
+	long long total, logical;
+} PPTally;
+
+static void pp_info_cb(const char *dir, const char *name, void *ud) {
+	char full[PATH_MAX];
+	PPTally *t = (PPTally *)ud;
+	PPStat id;
+	if (!pp_pathf(full, sizeof full, "%s/%s", dir, name)) return;
+	if (!pp_stat_id(full, &id)) return;
+	t->n++;
+	t->total += id.size;
+	t->logical += pp_entry_logical(full, pp_entry_kind(name, strlen(name)), id.size);
+}
+
+static int pp_cache_clear(void) {
+	char path[PATH_MAX];
+	long n = 0;
+	const char *dir = pp_cache_dir();
+	if (!dir) {
+		fprintf(stderr, "prism: preprocessor cache is unavailable\n");
+		return 1;
+	}
+	pp_each_entry(pp_clear_cb, &n);
+	if (pp_index_path(path, sizeof path)) remove(path);
+	printf("prism: cleared %ld cached preprocessor %s from %s\n", n, n == 1 ? "entry" : "entries",
+	       dir);
+	return fflush(stdout) == 0 ? 0 : 1;
+}
+
+static int pp_cache_info(void) {
+	PPTally s = {0, 0, 0};
+	PPIndex x;
+	long consumed = 0;
+	const char *dir = pp_cache_dir();
+	if (!dir) {
+		fprintf(stderr, "prism: preprocessor cache is unavailable\n");
+		return 1;
+	}
+	/* The index answers without a sweep; a scan stands in while there is none. */
+	if (pp_index_load(&x, &consumed)) {
+		s.n = x.n;
+		s.total = x.total;
+		s.logical = x.logical;
+		free(x.v);
+	} else
+		pp_each_entry(pp_info_cb, &s);
+	int wrote = printf("prism preprocessor cache\n  dir      %s\n  entries  %d\n  size     %.1f MB on disk, %.1f MB logical\n"
+			   "  limits   %lld MB / %lld days  (PRISM_PP_CACHE_MAX_MB, PRISM_PP_CACHE_MAX_DAYS)\n"
+			   "  status   %s\n",
+			   dir, s.n, s.total / (1024.0 * 1024.0), s.logical / (1024.0 * 1024.0), pp_env_ll("PRISM_PP_CACHE_MAX_MB", 1024),
+			   pp_env_ll("PRISM_PP_CACHE_MAX_DAYS", 14),
+			   pp_cache_enabled() ? "enabled" : "disabled (PRISM_NO_PP_CACHE)");
+	return wrote < 0 || fflush(stdout) != 0 ? 1 : 0;
+}
+
+/* ---- integrated preprocessor --------------------------------------------
+ *
+ * `-fintegrated-cpp` preprocesses in-process instead of spawning `cc -E`, the
+ * single most expensive step of a cold build once the transpiler itself is
+ * fast. It writes the same linemarker-annotated text GCC does, so nothing
+ * downstream can tell the difference. What only the compiler knows -- its
+ * predefined macros (`-dM -E`), its include search path (`-E -v`) and its
+ * answers to `__has_attribute`-style queries -- is asked once per compiler and
+ * flag set and kept as compiler-profile records.
+ *
+ * It declines rather than guesses. Anything it does not model (an unknown
+ * preprocessor flag, `#embed`, a malformed directive, a missing include, ...)
+ * abandons the run, and the caller spawns `cc -E` exactly as before, which is
+ * also what produces the diagnostics the user expects. */
+#ifndef _WIN32
+enum {
+	IPP_MAX_DEPTH = 200, // #include nesting, GCC's limit
+	IPP_MAX_ROUNDS = 3,  // runs allowed while discovering compiler queries
+	IPP_PROBE_CAP = 1 << 20,
+	IPP_QUERY_BITS = 31,
+	IPP_DEP_COLUMNS = 72,
+};
+
+enum { IPP_EOF, IPP_IDENT, IPP_NUM, IPP_CHAR, IPP_STR, IPP_PUNCT, IPP_OTHER, IPP_PLACEMARKER };
+
+enum {
+	IPP_TF_SPACE = 1 << 0,	  // whitespace precedes the token
+	IPP_TF_BOL = 1 << 1,	  // first token on its line
+	IPP_TF_NOEXPAND = 1 << 2, // names a macro that was disabled when it was read
+	IPP_TF_EXP = 1 << 3,	  // came out of a macro expansion
+	IPP_TF_BOUNDARY = 1 << 4, // first token after an expansion or argument edge
+	IPP_TF_SYSTEM = 1 << 5,	  // spelled in a system header
+	IPP_TF_EXTERN_C = 1 << 6, // ... one whose markers also carry flag 4
+	IPP_TF_BUILTIN = 1 << 7,  // spelled by the compiler: predefined and builtin macros
+	IPP_TF_ORIGIN = IPP_TF_SYSTEM | IPP_TF_EXTERN_C | IPP_TF_BUILTIN,
+};
+
+/* Identifiers the preprocessor itself gives meaning to. */
+enum {
+	IPP_S_NONE,
+	IPP_S_DEFINED,
+	IPP_S_HAS_INCLUDE,
+	IPP_S_HAS_INCLUDE_NEXT,
+	IPP_S_HAS_EMBED,
+	IPP_S_QUERY, // __has_attribute and friends: answered by the compiler
+	IPP_S_VA_ARGS,
+	IPP_S_VA_OPT,
+	IPP_S_PRAGMA,
+	IPP_S_FILE, // first of the builtin macros
+	IPP_S_LINE,
+	IPP_S_COUNTER,
+	IPP_S_INCLUDE_LEVEL,
+	IPP_S_BASE_FILE,
+	IPP_S_FILE_NAME,
+	IPP_S_DATE,
+	IPP_S_TIME,
+	IPP_S_TIMESTAMP,
+};
+
+enum {
+	IPP_D_UNKNOWN,
+	IPP_D_NULL,
+	IPP_D_LINEMARK,
+	IPP_D_DEFINE,
+	IPP_D_UNDEF,
+	IPP_D_INCLUDE,
+	IPP_D_INCLUDE_NEXT,
+	IPP_D_IF,
+	IPP_D_IFDEF,
+	IPP_D_IFNDEF,
+	IPP_D_ELIF,
+	IPP_D_ELIFDEF,
+	IPP_D_ELIFNDEF,
+	IPP_D_ELSE,
+	IPP_D_ENDIF,
+	IPP_D_LINE,
+	IPP_D_PRAGMA,
+	IPP_D_IDENT,
+	IPP_D_WARNING,
+};
+
+typedef struct {
+	const char *s;
+	uint32_t len;
+	uint32_t line; // presumed line; 0 inside a macro body
+	uint8_t kind, flags;
+	uint16_t param; // 1-based parameter index inside a macro body
+} IppTok;
+
+typedef struct {
+	IppTok *v;
+	uint32_t n, cap;
+} IppToks;
+
+typedef struct IppMacro {
+	IppTok *body;
+	uint32_t nbody;
+	int nparams; // -1 for object-like
+	bool variadic, has_ops, disabled;
+} IppMacro;
+
+typedef struct {
+	const char *name;
+	uint32_t len, hash;
+	IppMacro *macro;
+	uint8_t special;
+} IppSym;
+
+/* One spelled path. GCC tracks files by the path it opened them under: the
+ * guard, the dependency and the linemarkers all follow the spelling, and only
+ * `#pragma once` looks at file identity. */
+typedef struct IppSrc {
+	struct IppSrc *next, *loaded_next;
+	const char *path;
+	uint32_t hash;
+	dev_t dev;
+	ino_t ino;
+	char *buf; // spliced contents, NUL-terminated; NULL until first entered
+	uint32_t *splices, nsplices;
+	const char *guard; // multiple-include guard macro, once detected
+	uint32_t guard_len;
+	bool once, entered, dep, system;
+} IppSrc;
+
+typedef struct {
+	IppSrc *src;
+	const char *presumed; // name after #line
+	const char *p;
+	const char *sysflags; // "", " 3" or " 3 4"
+	const char *guard;
+	uint32_t guard_len;
+	uint32_t line, splice_next, cond_base, ret_line;
+	int line_delta;
+	int dir;	 // search-chain index it was found at; -1 beside its includer, -2 neither
+	int guard_state; // 0 nothing yet, 1 inside the guard #ifndef, 2 after its #endif, -1 none
+	bool bol, builtin;
+} IppFile;
+
+typedef struct {
+	bool taken, else_seen, guard;
+} IppCond;
+
+typedef struct {
+	const IppTok *toks;
+	uint32_t pos, n;
+	IppMacro *macro; // re-enabled when the context is popped; NULL for a stop run
+	uint8_t lead;	 // SPACE of the invoking name, handed to the first token
+} IppCtx;
+
+typedef struct {
+	const IppTok *toks;
+	uint32_t *start; // argument i is toks[start[i] .. start[i + 1])
+	const IppTok **exp;
+	uint32_t *nexp;
+	bool *expanded;
+	uint32_t nargs;
+	bool va_omitted;
+} IppArgs;
+
+typedef struct {
+	char *path;
+	bool system;
+} IppDir;
+
+typedef struct {
+	char *key;
+	int value;
+	bool known;
+} IppQuery;
+
+typedef struct IppPushed {
+	struct IppPushed *next;
+	const char *name;
+	uint32_t len;
+	IppMacro *macro;
+} IppPushed;
+
+typedef struct {
+	jmp_buf fail;
+	const char *why;
+	/* Configuration, fixed across runs. */
+	PParseArena cfg;
+	char **probe;
+	int nprobe;
+	char *predefs, *cmdline;
+	IppDir *dirs;
+	int ndirs, angle_start;
+	const char **forced;
+	int nforced;
+	const char *input;
+	const char *dep_file;
+	char **targets;
+	int ntargets;
+	bool deps, deps_user_only, deps_phony, working_dir, strict, trigraphs, c23, uchar;
+	IppQuery *queries;
+	int nqueries, cap_queries, unknown;
+	time_t now;
+	/* One run. */
+	PParseArena perm, scratch;
+	IppSym *syms;
+	uint32_t nsyms, cap_syms;
+	IppSrc *srcs[1024];
+	IppSrc *loaded;
+	IppFile files[IPP_MAX_DEPTH];
+	uint32_t nfiles;
+	IppCond *conds;
+	uint32_t nconds, cap_conds;
+	IppCtx *ctx;
+	uint32_t nctx, cap_ctx;
+	IppTok ahead;
+	bool has_ahead, pending_boundary, quiet;
+	int pending_call, in_if;
+	uint32_t expand_line, counter;
+	IppPushed *pushed;
+	const char **depv;
+	uint32_t ndeps, cap_deps;
+	char *out;
+	size_t out_len, out_cap;
+	uint32_t out_line;
+	bool out_bol, force_marker;
+	bool out_printed; // GCC's: the output line is begun, if only with indentation
+	bool out_system;  // the last token was spelled in a system header
+	IppTok prev;
+} Ipp;
+
+static PRISM_COLD noreturn void ipp_decline(Ipp *pp, const char *why) {
+	pp->why = why;
+	longjmp(pp->fail, 1);
+}
+
+static void ipp_arena_free(PParseArena *a) {
+	for (PParseArenaBlock *b = a->head, *next; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+	*a = (PParseArena){0};
+}
+
+static char *ipp_strndup(PParseArena *a, const char *s, size_t n) {
+	char *d = pparse_arena_alloc_uninit(a, n + 1);
+	memcpy(d, s, n);
+	d[n] = '\0';
+	return d;
+}
+
+static void ipp_toks_push(Ipp *pp, IppToks *v, const IppTok *t) {
+	PPARSE_ARENA_ENSURE_CAP(&pp->scratch, v->v, v->n, v->cap, 16, IppTok);
+	v->v[v->n++] = *t;
+}
+
+static uint32_t ipp_hash(const char *s, size_t n) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < n; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+	return h;
+}
+
+static inline bool ipp_tok_is(const IppTok *t, const char *s) {
+	return t->len == strlen(s) && memcmp(t->s, s, t->len) == 0;
+}
+
+static inline bool ipp_punct(const IppTok *t, char c) {
+	return t->kind == IPP_PUNCT && t->len == 1 && t->s[0] == c;
+}
+
+static inline bool ipp_is_hash(const IppTok *t) {
+	return t->kind == IPP_PUNCT && (ipp_punct(t, '#') || ipp_tok_is(t, "%:"));
+}
+
+static inline bool ipp_is_paste(const IppTok *t) {
+	return t->kind == IPP_PUNCT && (ipp_tok_is(t, "##") || ipp_tok_is(t, "%:%:"));
+}
+
+/* ---- symbols ---- */
+
+static IppSym *ipp_sym_find(Ipp *pp, const char *s, uint32_t n) {
+	uint32_t h = ipp_hash(s, n), mask = pp->cap_syms - 1;
+	for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+		IppSym *e = &pp->syms[i];
+		if (!e->name) return NULL;
+		if (e->hash == h && e->len == n && memcmp(e->name, s, n) == 0) return e;
+	}
+}
+
+static IppSym *ipp_sym_get(Ipp *pp, const char *s, uint32_t n) {
+	IppSym *e = pp->cap_syms ? ipp_sym_find(pp, s, n) : NULL;
+	if (e) return e;
+	if ((pp->nsyms + 1) * 2 > pp->cap_syms) {
+		uint32_t cap = pp->cap_syms ? pp->cap_syms * 2 : 4096;
+		IppSym *old = pp->syms;
+		uint32_t old_cap = pp->cap_syms;
+		pp->syms = pparse_arena_alloc(&pp->perm, cap * sizeof *pp->syms);
+		pp->cap_syms = cap;
+		for (uint32_t i = 0; i < old_cap; i++) {
+			if (!old[i].name) continue;
+			uint32_t j = old[i].hash & (cap - 1);
+			while (pp->syms[j].name) j = (j + 1) & (cap - 1);
+			pp->syms[j] = old[i];
+		}
+	}
+	uint32_t h = ipp_hash(s, n), mask = pp->cap_syms - 1, i = h & mask;
+	while (pp->syms[i].name) i = (i + 1) & mask;
+	pp->syms[i] = (IppSym){ipp_strndup(&pp->perm, s, n), n, h, NULL, IPP_S_NONE};
+	pp->nsyms++;
+	return &pp->syms[i];
+}
+
+/* ---- output ---- */
+
+static void ipp_put(Ipp *pp, const char *s, size_t n) {
+	if (pp->quiet) ipp_decline(pp, "output from predefined macros");
+	if (pp->out_len + n + 1 > pp->out_cap) {
+		size_t cap = pparse_vec_grow_cap(pp->out_cap, pp->out_len + n + 1, 1 << 16);
+		char *grown = realloc(pp->out, cap);
+		if (!grown) ipp_decline(pp, "out of memory");
+		pp->out = grown;
+		pp->out_cap = cap;
+	}
+	memcpy(pp->out + pp->out_len, s, n);
+	pp->out_len += n;
+}
+
+static void ipp_put_quoted(Ipp *pp, const char *s) {
+	for (const unsigned char *c = (const unsigned char *)s; *c; c++) {
+		char esc[8];
+		if (*c == '\\' || *c == '"') {
+			esc[0] = '\\';
+			esc[1] = (char)*c;
+			ipp_put(pp, esc, 2);
+		} else if (*c < 0x20 || *c == 0x7f) {
+			snprintf(esc, sizeof esc, "\\%03o", *c);
+			ipp_put(pp, esc, 4);
+		} else
+			ipp_put(pp, (const char *)c, 1);
+	}
+}
+
+/* `# line "name" flags`, on a line of its own. */
+static void ipp_marker(Ipp *pp, uint32_t line, const char *name, const char *kind, const char *sysflags) {
+	char num[16];
+	if (pp->out_printed) ipp_put(pp, "\n", 1);
+	ipp_put(pp, num, (size_t)snprintf(num, sizeof num, "# %u \"", line));
+	ipp_put_quoted(pp, name);
+	ipp_put(pp, "\"", 1);
+	ipp_put(pp, kind, strlen(kind));
+	ipp_put(pp, sysflags, strlen(sysflags));
+	ipp_put(pp, "\n", 1);
+	pp->out_line = line;
+	pp->out_bol = true;
+	pp->out_printed = false;
+	pp->force_marker = false;
+}
+
+/* To `line` the way GCC's maybe_print_line goes: end the line begun, then
+ * newlines if `line` is fewer than 8 ahead, else a marker. */
+static void ipp_move(Ipp *pp, uint32_t line, const char *sysflags) {
+	if (pp->out_printed) {
+		ipp_put(pp, "\n", 1);
+		pp->out_line++;
+		pp->out_bol = true;
+		pp->out_printed = false;
+	}
+	if (!pp->force_marker && line >= pp->out_line && line - pp->out_line < 8) {
+		for (; pp->out_line < line; pp->out_line++) ipp_put(pp, "\n", 1);
+		return;
+	}
+	ipp_marker(pp, line, pp->files[pp->nfiles - 1].presumed, "", sysflags);
+}
+
+static void ipp_sync(Ipp *pp, uint32_t line) {
+	if (pp->force_marker || line != pp->out_line) ipp_move(pp, line, pp->files[pp->nfiles - 1].sysflags);
+}
+
+/* A line that starts with a macro or a pragma GCC acts on: it prints nothing
+ * yet, but GCC has begun the line with its indentation. */
+static void ipp_line_change(Ipp *pp, uint32_t line) {
+	ipp_sync(pp, line);
+	pp->out_printed = true;
+}
+
+/* Whether printing `b` straight after `a` would lex differently. */
+static bool ipp_avoid_paste(const IppTok *a, const IppTok *b) {
+	if (a->kind == IPP_EOF || b->kind == IPP_EOF) return false;
+	bool aw = a->kind == IPP_IDENT || a->kind == IPP_NUM;
+	char b0 = b->s[0], alast = a->s[a->len - 1];
+	if (aw && (b->kind == IPP_IDENT || b->kind == IPP_NUM)) return true;
+	if (a->kind == IPP_NUM && (b0 == '.' || b0 == '+' || b0 == '-' || b->kind == IPP_CHAR)) return true;
+	if (a->kind == IPP_IDENT && (b->kind == IPP_STR || b->kind == IPP_CHAR)) return true;
+	if (a->kind == IPP_PUNCT && alast == '.' && b->kind == IPP_NUM) return true;
+	if (a->kind == IPP_OTHER && alast == '\\') return true;
+	if (a->kind == IPP_PUNCT && b->kind == IPP_PUNCT) {
+		if (alast == '/' && (b0 == '/' || b0 == '*')) return true;
+		if (strchr("+-*/%<>=!&|^#:.", alast) && strchr("+-*/%<>=!&|^#:.", b0)) return true;
+		if ((alast == '<' || alast == '%') && (b0 == ':' || b0 == '%' || b0 == '>')) return true;
+	}
+	return false;
+}
+
+/* A token spelled in a system header -- a macro from one used in user code
+ * included -- goes under a marker with that header's flags, and the first
+ * user token after it under a plain one, as GCC prints them. Tokens the
+ * compiler spelled itself leave the state alone. */
+static void ipp_emit(Ipp *pp, const IppTok *t) {
+	if (!(t->flags & IPP_TF_EXP)) ipp_line_change(pp, t->line);
+	else if (pp->force_marker)
+		ipp_sync(pp, pp->expand_line);
+	if (!pp->out_bol && ((t->flags & IPP_TF_SPACE) || ipp_avoid_paste(&pp->prev, t))) ipp_put(pp, " ", 1);
+	bool system = t->flags & IPP_TF_SYSTEM;
+	if (!(t->flags & IPP_TF_BUILTIN) && system != pp->out_system) {
+		ipp_move(pp, t->flags & IPP_TF_EXP ? pp->expand_line : t->line,
+			 !system ? "" : t->flags & IPP_TF_EXTERN_C ? " 3 4" : " 3");
+		pp->out_system = system;
+	}
+	ipp_put(pp, t->s, t->len);
+	pp->out_bol = false;
+	pp->out_printed = true;
+	pp->prev = *t;
+}
+
+/* ---- lexing ---- */
+
+static const char *ipp_scan_quoted(const char *q) {
+	char quote = *q++;
+	for (;; q++) {
+		if (*q == quote) return q + 1;
+		if (*q == '\n' || !*q) return NULL;
+		if (*q == '\\' && q[1] && q[1] != '\n') q++;
+	}
+}
+
+static const char *ipp_scan_punct(const char *p) {
+	char c = p[0], d = p[1];
+	switch (c) {
+	case '.': return p + (d == '.' && p[2] == '.' ? 3 : 1);
+	case '-': return p + 1 + (d == '>' || d == '-' || d == '=');
+	case '+': return p + 1 + (d == '+' || d == '=');
+	case '&': return p + 1 + (d == '&' || d == '=');
+	case '|': return p + 1 + (d == '|' || d == '=');
+	case '<':
+		if (d == '<') return p + (p[2] == '=' ? 3 : 2);
+		return p + 1 + (d == '=' || d == ':' || d == '%');
+	case '>':
+		if (d == '>') return p + (p[2] == '=' ? 3 : 2);
+		return p + 1 + (d == '=');
+	case '%':
+		if (d == ':') return p + (p[2] == '%' && p[3] == ':' ? 4 : 2);
+		return p + 1 + (d == '>' || d == '=');
+	case ':': return p + 1 + (d == '>' || d == ':');
+	case '#': return p + 1 + (d == '#');
+	case '=': case '!': case '*': case '/': case '^': return p + 1 + (d == '=');
+	default: return p + 1;
+	}
+}
+
+/* The pp-number at `p`; digit separators are a C23 spelling. */
+static const char *ipp_scan_number(const char *p, bool c23) {
+	for (;;) {
+		char c = *p;
+		if ((c == 'e' || c == 'E' || c == 'p' || c == 'P') && (p[1] == '+' || p[1] == '-'))
+			p += 2;
+		else if (c == '.' || pparse_ident_char[(unsigned char)c])
+			p++;
+		else if (c == '\'' && c23 && pparse_ident_char[(unsigned char)p[1]])
+			p++;
+		else if (c == '\\' && pparse_read_ucn((char *)p))
+			p += pparse_read_ucn((char *)p);
+		else
+			return p;
+	}
+}
+
+/* One preprocessing token at `p`, which is not whitespace. NULL for text the
+ * integrated preprocessor does not take on: raw strings and unterminated
+ * literals (GCC turns the latter into a lone-quote token with a warning). */
+static const char *ipp_scan(const char *p, uint8_t *kind, bool c23) {
+	unsigned char c = (unsigned char)*p;
+	if (PPARSE_IS_DIGIT(c) || (c == '.' && PPARSE_IS_DIGIT(p[1]))) {
+		*kind = IPP_NUM;
+		return ipp_scan_number(p, c23);
+	}
+	if (c == '"' || c == '\'') {
+		*kind = c == '"' ? IPP_STR : IPP_CHAR;
+		return ipp_scan_quoted(p);
+	}
+	if (pparse_ident_char[c] || (c == '\\' && pparse_read_ucn((char *)p))) {
+		const char *e = p;
+		for (;;) {
+			while (pparse_ident_char[(unsigned char)*e]) e++;
+			int u = pparse_read_ucn((char *)e);
+			if (!u) break;
+			e += u;
+		}
+		size_t n = (size_t)(e - p);
+		bool prefix = (n == 1 && (c == 'L' || c == 'u' || c == 'U')) || (n == 2 && c == 'u' && p[1] == '8');
+		if (prefix && (*e == '"' || *e == '\'')) {
+			*kind = *e == '"' ? IPP_STR : IPP_CHAR;
+			return ipp_scan_quoted(e);
+		}
+		if (*e == '"' && n <= 3 && p[n - 1] == 'R' &&
+		    (n == 1 || (n == 2 && (c == 'L' || c == 'u' || c == 'U')) || (n == 3 && c == 'u' && p[1] == '8')))
+			return NULL;
+		*kind = IPP_IDENT;
+		return e;
+	}
+	*kind = strchr("!%&()*+,-./:;<=>?[]^{|}~#", c) && c ? IPP_PUNCT : IPP_OTHER;
+	return *kind == IPP_PUNCT ? ipp_scan_punct(p) : p + 1;
+}
+
+static uint32_t ipp_line(IppFile *f) {
+	IppSrc *s = f->src;
+	if (s->nsplices) {
+		uint32_t off = (uint32_t)(f->p - s->buf);
+		while (f->splice_next < s->nsplices && s->splices[f->splice_next] <= off) {
+			f->line++;
+			f->splice_next++;
+		}
+	}
+	return (uint32_t)((int)f->line + f->line_delta);
+}
+
+static const char *ipp_skip_comment(Ipp *pp, IppFile *f, const char *p) {
+	for (;; p++) {
+		if (!*p) ipp_decline(pp, "unterminated comment");
+		if (*p == '\n')
+			f->line++;
+		else if (*p == '*' && p[1] == '/')
+			return p + 2;
+	}
+}
+
+/* Whitespace and comments; in line mode a newline ends the directive. */
+static void ipp_skip_ws(Ipp *pp, IppFile *f, bool line_mode, uint8_t *flags) {
+	const char *p = f->p;
+	for (;;) {
+		switch (*p) {
+		case ' ': case '\t': case '\f': case '\v': case '\r':
+			p++;
+			*flags |= IPP_TF_SPACE;
+			continue;
+		case '\n':
+			if (line_mode) break;
+			p++;
+			f->line++;
+			*flags |= IPP_TF_BOL | IPP_TF_SPACE;
+			continue;
+		case '/':
+			if (p[1] == '*') {
+				p = ipp_skip_comment(pp, f, p + 2);
+				*flags |= IPP_TF_SPACE;
+				continue;
+			}
+			if (p[1] == '/') {
+				while (*p && *p != '\n') p++;
+				*flags |= IPP_TF_SPACE;
+				continue;
+			}
+			break;
+		}
+		break;
+	}
+	f->p = p;
+}
+
+static uint8_t ipp_origin(const char *sysflags) {
+	return !sysflags[0] ? 0 : sysflags[2] ? IPP_TF_SYSTEM | IPP_TF_EXTERN_C : IPP_TF_SYSTEM;
+}
+
+static void ipp_lex_at(Ipp *pp, IppFile *f, IppTok *t, uint8_t flags) {
+	const char *p = f->p;
+	t->line = ipp_line(f);
+	t->flags = flags | (f->builtin ? IPP_TF_BUILTIN : ipp_origin(f->sysflags));
+	t->param = 0;
+	t->s = p;
+	if (!*p || *p == '\n') {
+		t->kind = IPP_EOF;
+		t->len = 0;
+		return;
+	}
+	const char *e = ipp_scan(p, &t->kind, pp->c23);
+	if (!e) ipp_decline(pp, "raw string or unterminated literal");
+	t->len = (uint32_t)(e - p);
+	f->p = e;
+}
+
+/* Next token of a directive line, or IPP_EOF at its end. */
+static void ipp_lex_line(Ipp *pp, IppFile *f, IppTok *t) {
+	uint8_t flags = 0;
+	ipp_skip_ws(pp, f, true, &flags);
+	ipp_lex_at(pp, f, t, flags);
+}
+
+/* Past the rest of a directive line and its newline. */
+static void ipp_end_line(Ipp *pp, IppFile *f) {
+	IppTok t;
+	do ipp_lex_line(pp, f, &t);
+	while (t.kind != IPP_EOF);
+	if (*f->p == '\n') {
+		f->p++;
+		f->line++;
+	}
+	f->bol = true;
+}
+
+static void ipp_line_toks(Ipp *pp, IppFile *f, IppToks *v) {
+	for (;;) {
+		IppTok t;
+		ipp_lex_line(pp, f, &t);
+		if (t.kind == IPP_EOF) break;
+		ipp_toks_push(pp, v, &t);
+	}
+	ipp_end_line(pp, f);
+}
+
+/* ---- sources ---- */
+
+static IppSrc *ipp_src_get(Ipp *pp, const char *path, const struct stat *st) {
+	uint32_t h = ipp_hash(path, strlen(path));
+	IppSrc **bucket = &pp->srcs[h & (sizeof pp->srcs / sizeof *pp->srcs - 1)];
+	for (IppSrc *s = *bucket; s; s = s->next)
+		if (s->hash == h && strcmp(s->path, path) == 0) return s;
+	IppSrc *s = pparse_arena_alloc(&pp->perm, sizeof *s);
+	s->path = ipp_strndup(&pp->perm, path, strlen(path));
+	s->hash = h;
+	s->dev = st->st_dev;
+	s->ino = st->st_ino;
+	s->next = *bucket;
+	*bucket = s;
+	return s;
+}
+
+/* Reads, splices and checks a source the first time it is entered. Splice
+ * offsets are kept so line numbers can catch up lazily, as the tokenizer's
+ * own splice table does. */
+static void ipp_src_load(Ipp *pp, IppSrc *s) {
+	if (s->buf) return;
+	FileBytes fb = read_file_bytes(s->path);
+	if (!fb.data) ipp_decline(pp, "unreadable source");
+	s->buf = fb.data;
+	s->loaded_next = pp->loaded;
+	pp->loaded = s;
+	if (memchr(fb.data, '\0', fb.size)) ipp_decline(pp, "NUL byte in source");
+	if (fb.size > UINT32_MAX / 2) ipp_decline(pp, "source too large");
+	if (pp->trigraphs) {
+		for (const char *q = fb.data; (q = strstr(q, "??")) != NULL; q++)
+			if (q[2] && strchr("=/'()!<>-", q[2])) ipp_decline(pp, "trigraphs");
+	}
+	char *r = fb.data, *w = fb.data, *end = fb.data + fb.size;
+	if (fb.size >= 3 && memcmp(r, "\xEF\xBB\xBF", 3) == 0) r += 3;
+	if (!memchr(r, '\\', (size_t)(end - r))) {
+		if (r != w) memmove(w, r, (size_t)(end - r) + 1);
+		return;
+	}
+	uint32_t cap = 0;
+	while (r < end) {
+		if (*r == '\\') {
+			const char *q = r + 1;
+			while (q < end && (*q == ' ' || *q == '\t' || *q == '\f' || *q == '\v')) q++;
+			if (q < end && *q == '\r') q++;
+			if (q < end && *q == '\n') {
+				PPARSE_ARENA_ENSURE_CAP(&pp->perm, s->splices, s->nsplices, cap, 64, uint32_t);
+				s->splices[s->nsplices++] = (uint32_t)(w - fb.data);
+				r = (char *)q + 1;
+				continue;
+			}
+		}
+		*w++ = *r++;
+	}
+	*w = '\0';
+}
+
+static void ipp_dep(Ipp *pp, IppSrc *s) {
+	if (s->dep) return;
+	s->dep = true;
+	if (!pp->deps || (pp->deps_user_only && s->system)) return;
+	PPARSE_ARENA_ENSURE_CAP(&pp->perm, pp->depv, pp->ndeps, pp->cap_deps, 64, const char *);
+	pp->depv[pp->ndeps++] = s->path;
+}
+
+/* Locates an #include the way GCC does: a quoted name beside its includer
+ * first, then the chain ([-iquote][-I][system]) from the quote or angle start;
+ * #include_next resumes after the directory the includer came from. */
+static IppSrc *ipp_find(Ipp *pp, const char *name, bool angle, bool next, int *dir, const char **sysflags) {
+	IppFile *inc = pp->nfiles ? &pp->files[pp->nfiles - 1] : NULL;
+	char path[PATH_MAX];
+	struct stat st;
+	int start = angle ? pp->angle_start : 0;
+	if (name[0] == '/') {
+		*dir = -2;
+		*sysflags = "";
+		if (stat(name, &st) != 0 || S_ISDIR(st.st_mode)) return NULL;
+		return ipp_src_get(pp, name, &st);
+	}
+	if (next && inc && inc->dir != -2)
+		start = inc->dir + 1;
+	else if (!angle && inc) {
+		const char *slash = strrchr(inc->src->path, '/');
+		int dl = slash ? (int)(slash - inc->src->path) + 1 : 0;
+		if (snprintf(path, sizeof path, "%.*s%s", dl, inc->src->path, name) < (int)sizeof path &&
+		    stat(path, &st) == 0 && !S_ISDIR(st.st_mode)) {
+			*dir = -1;
+			*sysflags = inc->sysflags;
+			IppSrc *s = ipp_src_get(pp, path, &st);
+			s->system |= inc->src->system;
+			return s;
+		}
+	}
+	for (int i = start; i < pp->ndirs; i++) {
+		const char *d = pp->dirs[i].path;
+		if (!pp_pathf(path, sizeof path, "%s%s%s", d, d[strlen(d) - 1] == '/' ? "" : "/", name)) continue;
+		if (stat(path, &st) != 0 || S_ISDIR(st.st_mode)) continue;
+		*dir = i;
+		*sysflags = pp->dirs[i].system ? " 3 4" : "";
+		IppSrc *s = ipp_src_get(pp, path, &st);
+		s->system |= pp->dirs[i].system;
+		return s;
+	}
+	return NULL;
+}
+
+static bool ipp_once_seen(Ipp *pp, const IppSrc *s) {
+	for (size_t b = 0; b < sizeof pp->srcs / sizeof *pp->srcs; b++)
+		for (IppSrc *o = pp->srcs[b]; o; o = o->next)
+			if (o->once && o->entered && o->dev == s->dev && o->ino == s->ino) return true;
+	return false;
+}
+
+static void ipp_push_file(Ipp *pp, IppSrc *s, int dir, const char *sysflags, uint32_t ret_line) {
+	if (pp->nfiles == IPP_MAX_DEPTH) ipp_decline(pp, "#include nested too deeply");
+	ipp_src_load(pp, s);
+	ipp_dep(pp, s);
+	s->entered = true;
+	pp->files[pp->nfiles++] = (IppFile){
+	    .src = s,
+	    .presumed = s->path,
+	    .p = s->buf,
+	    .sysflags = sysflags,
+	    .line = 1,
+	    .cond_base = pp->nconds,
+	    .ret_line = ret_line,
+	    .dir = dir,
+	    .bol = true,
+	};
+}
+
+/* ---- macro definitions ---- */
+
+static bool ipp_is_defined(Ipp *pp, const IppTok *name);
+
+static int ipp_find_param(const IppTok *params, int n, const IppTok *t) {
+	for (int i = 0; i < n; i++)
+		if (params[i].len == t->len && memcmp(params[i].s, t->s, t->len) == 0) return i;
+	return -1;
+}
+
+static void ipp_define(Ipp *pp, IppFile *f) {
+	IppTok name, t, params[256];
+	IppToks body = {0};
+	int np = -1;
+	bool variadic = false, has_ops = false;
+	ipp_lex_line(pp, f, &name);
+	if (name.kind != IPP_IDENT) ipp_decline(pp, "#define without a name");
+	IppSym *sym = ipp_sym_get(pp, name.s, name.len);
+	if (sym->special) ipp_decline(pp, "#define of a reserved name");
+	if (*f->p == '(') {
+		f->p++;
+		np = 0;
+		for (;;) {
+			ipp_lex_line(pp, f, &t);
+			if (ipp_punct(&t, ')') && np == 0) break;
+			if (ipp_tok_is(&t, "...")) {
+				params[np++] = (IppTok){.s = "__VA_ARGS__", .len = 11};
+				variadic = true;
+				ipp_lex_line(pp, f, &t);
+				if (!ipp_punct(&t, ')')) ipp_decline(pp, "malformed macro parameters");
+				break;
+			}
+			if (t.kind != IPP_IDENT || np == 255 || ipp_find_param(params, np, &t) >= 0 ||
+			    ipp_tok_is(&t, "__VA_ARGS__"))
+				ipp_decline(pp, "malformed macro parameters");
+			params[np++] = t;
+			ipp_lex_line(pp, f, &t);
+			if (ipp_tok_is(&t, "...")) {
+				variadic = true;
+				ipp_lex_line(pp, f, &t);
+				if (!ipp_punct(&t, ')')) ipp_decline(pp, "malformed macro parameters");
+				break;
+			}
+			if (ipp_punct(&t, ')')) break;
+			if (!ipp_punct(&t, ',')) ipp_decline(pp, "malformed macro parameters");
+		}
+	}
+	ipp_line_toks(pp, f, &body);
+	for (uint32_t i = 0; i < body.n; i++) {
+		IppTok *b = &body.v[i];
+		b->line = 0;
+		b->flags &= IPP_TF_SPACE | IPP_TF_ORIGIN;
+		if (i == 0) b->flags &= IPP_TF_ORIGIN;
+		if (ipp_is_paste(b)) {
+			if (i == 0 || i + 1 == body.n) ipp_decline(pp, "'##' at either end of a macro");
+			has_ops = true;
+		}
+		if (b->kind != IPP_IDENT || np < 0) continue;
+		int k = ipp_find_param(params, np, b);
+		if (k >= 0) {
+			b->param = (uint16_t)(k + 1);
+			has_ops = true;
+		} else if (variadic && ipp_tok_is(b, "__VA_OPT__")) {
+			/* __VA_OPT__ next to # or ## has corner cases GCC itself only
+			 * settled recently; leave those to the compiler. */
+			if (i + 1 == body.n || !ipp_punct(&b[1], '(') || (i > 0 && (ipp_is_hash(&b[-1]) || ipp_is_paste(&b[-1]))))
+				ipp_decline(pp, "__VA_OPT__ form");
+			uint32_t depth = 0, j = i + 1;
+			for (; j < body.n; j++) {
+				if (ipp_punct(&body.v[j], '(')) depth++;
+				if (ipp_punct(&body.v[j], ')') && --depth == 0) break;
+			}
+			if (j == body.n || ipp_is_paste(&body.v[i + 2]) || ipp_is_paste(&body.v[j - 1]) ||
+			    (j + 1 < body.n && ipp_is_paste(&body.v[j + 1])))
+				ipp_decline(pp, "__VA_OPT__ form");
+			has_ops = true;
+		}
+	}
+	for (uint32_t i = 0; np >= 0 && i < body.n; i++)
+		if (ipp_is_hash(&body.v[i])) {
+			if (i + 1 == body.n || !body.v[i + 1].param) ipp_decline(pp, "'#' is not followed by a parameter");
+			has_ops = true;
+		}
+	IppMacro *m = pparse_arena_alloc(&pp->perm, sizeof *m);
+	m->nparams = np;
+	m->variadic = variadic;
+	m->has_ops = has_ops;
+	m->nbody = body.n;
+	if (body.n) {
+		/* Spellings point into source buffers, which live as long as the run. */
+		m->body = pparse_arena_alloc_uninit(&pp->perm, body.n * sizeof *m->body);
+		memcpy(m->body, body.v, body.n * sizeof *m->body);
+	}
+	sym->macro = m;
+}
+
+static void ipp_undef(Ipp *pp, IppFile *f) {
+	IppTok name;
+	ipp_lex_line(pp, f, &name);
+	if (name.kind != IPP_IDENT) ipp_decline(pp, "#undef without a name");
+	IppSym *sym = ipp_sym_find(pp, name.s, name.len);
+	if (sym && sym->special) ipp_decline(pp, "#undef of a reserved name");
+	if (sym) sym->macro = NULL;
+	ipp_end_line(pp, f);
+}
+
+/* Runs text of directives alone, as the compiler's predefines and -D/-U. */
+static void ipp_run(Ipp *pp);
+
+static void ipp_run_directives(Ipp *pp, const char *text, const char *name) {
+	IppSrc *s = pparse_arena_alloc(&pp->perm, sizeof *s);
+	size_t n = strlen(text);
+	s->path = name;
+	s->buf = ipp_strndup(&pp->perm, text, n);
+	pp->files[pp->nfiles++] = (IppFile){.src = s, .presumed = name, .p = s->buf, .sysflags = "", .line = 1,
+					    .cond_base = pp->nconds, .dir = -2, .bol = true,
+					    .builtin = strcmp(name, "<built-in>") == 0};
+	pp->quiet = true;
+	ipp_run(pp);
+	pp->quiet = false;
+}
+
+/* ---- expansion ----
+ *
+ * A context stack in the manner of GCC's: each expansion pushes its
+ * replacement list and disables its macro until the list is consumed, so
+ * rescanning is just reading on. A stop run (an argument being pre-expanded,
+ * an #if line) returns IPP_EOF at its end instead of falling through to the
+ * file beneath it. */
+
+static void ipp_lex(Ipp *pp, IppTok *t);
+static bool ipp_expand(Ipp *pp, IppTok *t);
+
+static void ipp_push_ctx(Ipp *pp, const IppTok *toks, uint32_t n, IppMacro *m, uint8_t lead) {
+	PPARSE_ARENA_ENSURE_CAP(&pp->perm, pp->ctx, pp->nctx, pp->cap_ctx, 32, IppCtx);
+	pp->ctx[pp->nctx++] = (IppCtx){toks, 0, n, m, lead};
+	if (m) m->disabled = true;
+}
+
+static void ipp_next(Ipp *pp, IppTok *t) {
+	if (pp->has_ahead) {
+		*t = pp->ahead;
+		pp->has_ahead = false;
+		return;
+	}
+	while (pp->nctx) {
+		IppCtx *c = &pp->ctx[pp->nctx - 1];
+		if (c->pos == c->n) {
+			if (!c->macro) {
+				*t = (IppTok){.s = "", .kind = IPP_EOF};
+				return;
+			}
+			c->macro->disabled = false;
+			pp->nctx--;
+			pp->pending_boundary = true;
+			continue;
+		}
+		*t = c->toks[c->pos];
+		t->flags |= IPP_TF_EXP;
+		if (c->pos++ == 0 && c->macro)
+			t->flags = (uint8_t)((t->flags & ~IPP_TF_SPACE) | c->lead | IPP_TF_BOUNDARY);
+		if (pp->pending_boundary) {
+			t->flags |= IPP_TF_BOUNDARY;
+			pp->pending_boundary = false;
+		}
+		if (t->kind == IPP_IDENT && !(t->flags & IPP_TF_NOEXPAND)) {
+			IppSym *s = ipp_sym_find(pp, t->s, t->len);
+			if (s && s->macro && s->macro->disabled) t->flags |= IPP_TF_NOEXPAND;
+		}
+		return;
+	}
+	ipp_lex(pp, t);
+	if (pp->pending_boundary) {
+		t->flags |= IPP_TF_BOUNDARY;
+		pp->pending_boundary = false;
+	}
+}
+
+/* Whether any token could expand; most arguments are plain and are then used
+ * as they stand. */
+static bool ipp_needs_expansion(Ipp *pp, const IppTok *v, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++) {
+		if (v[i].kind != IPP_IDENT || (v[i].flags & IPP_TF_NOEXPAND)) continue;
+		IppSym *s = ipp_sym_find(pp, v[i].s, v[i].len);
+		if (s && (s->macro || s->special >= IPP_S_PRAGMA)) return true;
+	}
+	return false;
+}
+
+static void ipp_expand_run(Ipp *pp, const IppTok *v, uint32_t n, IppToks *out) {
+	ipp_push_ctx(pp, v, n, NULL, 0);
+	for (;;) {
+		IppTok t;
+		ipp_next(pp, &t);
+		if (t.kind == IPP_EOF) break;
+		if (t.kind == IPP_IDENT && !(t.flags & IPP_TF_NOEXPAND) && ipp_expand(pp, &t)) continue;
+		ipp_toks_push(pp, out, &t);
+	}
+	pp->nctx--;
+	pp->pending_boundary = false;
+}
+
+static void ipp_arg(Ipp *pp, IppArgs *a, uint32_t i, bool expanded, const IppTok **v, uint32_t *n) {
+	if (!expanded) {
+		*v = a->toks + a->start[i];
+		*n = a->start[i + 1] - a->start[i];
+		return;
+	}
+	if (!a->expanded[i]) {
+		const IppTok *raw = a->toks + a->start[i];
+		uint32_t nraw = a->start[i + 1] - a->start[i];
+		a->expanded[i] = true;
+		if (!ipp_needs_expansion(pp, raw, nraw)) {
+			a->exp[i] = raw;
+			a->nexp[i] = nraw;
+		} else {
+			IppToks r = {0};
+			ipp_expand_run(pp, raw, nraw, &r);
+			a->exp[i] = r.v;
+			a->nexp[i] = r.n;
+		}
+	}
+	*v = a->exp[i];
+	*n = a->nexp[i];
+}
+
+static void ipp_collect_args(Ipp *pp, IppMacro *m, IppArgs *a) {
+	IppToks all = {0};
+	uint32_t *start = NULL, nstart = 0, cap = 0;
+	int depth = 0;
+	PPARSE_ARENA_ENSURE_CAP(&pp->scratch, start, nstart, cap, 8, uint32_t);
+	start[nstart++] = 0;
+	pp->pending_call++;
+	for (;;) {
+		IppTok t;
+		ipp_next(pp, &t);
+		if (t.kind == IPP_EOF) ipp_decline(pp, "unterminated macro call");
+		if (ipp_punct(&t, '('))
+			depth++;
+		else if (ipp_punct(&t, ')')) {
+			if (!depth) break;
+			depth--;
+		} else if (ipp_punct(&t, ',') && !depth && !(m->variadic && (int)nstart == m->nparams)) {
+			PPARSE_ARENA_ENSURE_CAP(&pp->scratch, start, nstart, cap, 8, uint32_t);
+			start[nstart++] = all.n;
+			continue;
+		}
+		t.flags &= (uint8_t)~IPP_TF_BOL;
+		ipp_toks_push(pp, &all, &t);
+	}
+	pp->pending_call--;
+	uint32_t nargs = nstart;
+	if (nargs == 1 && m->nparams == 0 && all.n == 0) nargs = 0;
+	a->va_omitted = false;
+	if ((int)nargs + 1 == m->nparams && m->variadic) {
+		/* `f(x)` for `f(x, ...)`: the variable arguments are omitted. */
+		a->va_omitted = true;
+		PPARSE_ARENA_ENSURE_CAP(&pp->scratch, start, nstart, cap, 8, uint32_t);
+		start[nstart++] = all.n;
+		nargs++;
+	} else if ((int)nargs != m->nparams)
+		ipp_decline(pp, "macro argument count");
+	PPARSE_ARENA_ENSURE_CAP(&pp->scratch, start, nstart, cap, 8, uint32_t);
+	start[nstart] = all.n;
+	/* GNU mode also treats `f()` for `f(...)` as omitted, not empty. */
+	if (m->variadic && m->nparams == 1 && !pp->strict && all.n == 0) a->va_omitted = true;
+	a->toks = all.v;
+	a->start = start;
+	a->nargs = nargs;
+	a->exp = pparse_arena_alloc(&pp->scratch, (nargs + 1) * sizeof *a->exp);
+	a->nexp = pparse_arena_alloc(&pp->scratch, (nargs + 1) * sizeof *a->nexp);
+	a->expanded = pparse_arena_alloc(&pp->scratch, nargs + 1);
+}
+
+static IppTok ipp_stringify(Ipp *pp, const IppTok *v, uint32_t n) {
+	size_t cap = 3;
+	for (uint32_t i = 0; i < n; i++) cap += 2 * (size_t)v[i].len + 1;
+	char *buf = pparse_arena_alloc_uninit(&pp->scratch, cap), *w = buf;
+	*w++ = '"';
+	for (uint32_t i = 0; i < n; i++) {
+		if (i && (v[i].flags & IPP_TF_SPACE)) *w++ = ' ';
+		bool lit = v[i].kind == IPP_STR || v[i].kind == IPP_CHAR;
+		for (uint32_t k = 0; k < v[i].len; k++) {
+			char c = v[i].s[k];
+			if (lit && (c == '\\' || c == '"')) *w++ = '\\';
+			*w++ = c;
+		}
+	}
+	*w++ = '"';
+	return (IppTok){buf, (uint32_t)(w - buf), 0, IPP_STR, 0, 0};
+}
+
+/* `l ## r` into r->v's last token. Placemarkers stand in for empty
+ * arguments; a paste that does not make exactly one token declines. */
+static void ipp_paste(Ipp *pp, IppToks *r, const IppTok *rt) {
+	if (!r->n) ipp_decline(pp, "'##' with nothing on its left");
+	IppTok *l = &r->v[r->n - 1];
+	if (rt->kind == IPP_PLACEMARKER) return;
+	if (l->kind == IPP_PLACEMARKER) {
+		uint8_t sp = l->flags & IPP_TF_SPACE;
+		*l = *rt;
+		l->flags = (uint8_t)((l->flags & ~IPP_TF_SPACE) | sp);
+		l->param = 0;
+		return;
+	}
+	size_t n = (size_t)l->len + rt->len;
+	char *buf = pparse_arena_alloc_uninit(&pp->scratch, n + 4);
+	memcpy(buf, l->s, l->len);
+	memcpy(buf + l->len, rt->s, rt->len);
+	memset(buf + n, 0, 4);
+	uint8_t kind;
+	const char *e = ipp_scan(buf, &kind, pp->c23);
+	if (!e || (size_t)(e - buf) != n) ipp_decline(pp, "'##' does not form a single token");
+	l->s = buf;
+	l->len = (uint32_t)n;
+	l->kind = kind;
+	l->flags = (uint8_t)((l->flags & (IPP_TF_SPACE | IPP_TF_ORIGIN)) | IPP_TF_BOUNDARY);
+	l->param = 0;
+}
+
+static void ipp_append(Ipp *pp, IppToks *r, const IppTok *v, uint32_t n, uint8_t lead) {
+	uint32_t first = r->n;
+	for (uint32_t k = 0; k < n; k++) ipp_toks_push(pp, r, &v[k]);
+	if (n) r->v[first].flags = (uint8_t)((r->v[first].flags & ~IPP_TF_SPACE) | lead | IPP_TF_BOUNDARY);
+}
+
+/* Substitutes arguments into body[from, to). */
+static void ipp_subst(Ipp *pp, IppMacro *m, IppArgs *a, uint32_t from, uint32_t to, IppToks *r) {
+	const IppTok *b = m->body;
+	bool edge = false;
+	for (uint32_t i = from; i < to; i++) {
+		const IppTok *t = &b[i];
+		const IppTok *v;
+		uint32_t n;
+		if (m->nparams >= 0 && ipp_is_hash(t) && b[i + 1].param) {
+			ipp_arg(pp, a, b[i + 1].param - 1u, false, &v, &n);
+			IppTok s = ipp_stringify(pp, v, n);
+			/* GCC places the string at the last token it read, in the file. */
+			s.flags = (uint8_t)((t->flags & IPP_TF_SPACE) | ipp_origin(pp->files[pp->nfiles - 1].sysflags) |
+					    (edge ? IPP_TF_BOUNDARY : 0));
+			ipp_toks_push(pp, r, &s);
+			edge = false;
+			i++;
+			continue;
+		}
+		if (ipp_is_paste(t)) {
+			const IppTok *rt = &b[++i];
+			if (!rt->param) {
+				ipp_paste(pp, r, rt);
+				continue;
+			}
+			ipp_arg(pp, a, rt->param - 1u, false, &v, &n);
+			bool gnu_comma = m->variadic && rt->param == m->nparams && r->n && ipp_punct(&r->v[r->n - 1], ',');
+			if (gnu_comma) {
+				/* `, ## __VA_ARGS__`: the comma goes when the variable
+				 * arguments were omitted; otherwise nothing is pasted. */
+				if (a->va_omitted) r->n--;
+				ipp_append(pp, r, v, n, rt->flags & IPP_TF_SPACE);
+			} else if (n) {
+				ipp_paste(pp, r, &v[0]);
+				ipp_append(pp, r, v + 1, n - 1, v[1 % n].flags & IPP_TF_SPACE);
+			}
+			edge = true;
+			continue;
+		}
+		if (t->param) {
+			bool raw = i + 1 < to && ipp_is_paste(&b[i + 1]);
+			ipp_arg(pp, a, t->param - 1u, !raw, &v, &n);
+			if (!n && raw) {
+				IppTok pm = {"", 0, 0, IPP_PLACEMARKER, (uint8_t)(t->flags & IPP_TF_SPACE), 0};
+				ipp_toks_push(pp, r, &pm);
+			}
+			ipp_append(pp, r, v, n, t->flags & IPP_TF_SPACE);
+			edge = true;
+			continue;
+		}
+		if (m->variadic && t->kind == IPP_IDENT && ipp_tok_is(t, "__VA_OPT__")) {
+			uint32_t depth = 0, j = i + 1;
+			for (; j < to; j++) {
+				if (ipp_punct(&b[j], '(')) depth++;
+				if (ipp_punct(&b[j], ')') && --depth == 0) break;
+			}
+			ipp_arg(pp, a, (uint32_t)m->nparams - 1, true, &v, &n);
+			if (n) {
+				uint32_t first = r->n;
+				ipp_subst(pp, m, a, i + 2, j, r);
+				if (r->n > first)
+					r->v[first].flags = (uint8_t)((r->v[first].flags & ~IPP_TF_SPACE) | (t->flags & IPP_TF_SPACE));
+			}
+			i = j;
+			edge = true;
+			continue;
+		}
+		ipp_toks_push(pp, r, t);
+		r->v[r->n - 1].param = 0;
+		if (edge) r->v[r->n - 1].flags |= IPP_TF_BOUNDARY;
+		edge = false;
+	}
+}
+
+static void ipp_quote_into(Ipp *pp, IppTok *t, const char *s) {
+	size_t n = strlen(s);
+	char *buf = pparse_arena_alloc_uninit(&pp->scratch, 4 * n + 3), *w = buf;
+	*w++ = '"';
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '\\' || c == '"') {
+			*w++ = '\\';
+			*w++ = (char)c;
+		} else if (c == '\n') {
+			*w++ = '\\';
+			*w++ = 'n';
+		} else
+			*w++ = (char)c;
+	}
+	*w++ = '"';
+	t->s = buf;
+	t->len = (uint32_t)(w - buf);
+	t->kind = IPP_STR;
+}
+
+static void ipp_builtin(Ipp *pp, int which, IppTok *t) {
+	IppFile *f = &pp->files[pp->nfiles - 1];
+	char tmp[64];
+	struct tm tm;
+	int n = 0;
+	t->flags = (uint8_t)((t->flags & ~IPP_TF_ORIGIN) | IPP_TF_BUILTIN);
+	switch (which) {
+	case IPP_S_FILE: ipp_quote_into(pp, t, f->presumed); return;
+	case IPP_S_BASE_FILE: ipp_quote_into(pp, t, pp->input); return;
+	case IPP_S_FILE_NAME: ipp_quote_into(pp, t, path_basename(f->presumed)); return;
+	case IPP_S_LINE: n = snprintf(tmp, sizeof tmp, "%u", t->line ? t->line : pp->expand_line); break;
+	case IPP_S_COUNTER: n = snprintf(tmp, sizeof tmp, "%u", pp->counter++); break;
+	case IPP_S_INCLUDE_LEVEL: n = snprintf(tmp, sizeof tmp, "%u", pp->nfiles - 1); break;
+	case IPP_S_DATE:
+	case IPP_S_TIME:
+		/* SOURCE_DATE_EPOCH is reproducible-build time, always UTC. */
+		if (prism_getenv("SOURCE_DATE_EPOCH") ? !gmtime_r(&pp->now, &tm) : !localtime_r(&pp->now, &tm))
+			ipp_decline(pp, "clock");
+		n = (int)strftime(tmp, sizeof tmp, which == IPP_S_DATE ? "\"%b %e %Y\"" : "\"%H:%M:%S\"", &tm);
+		break;
+	case IPP_S_TIMESTAMP: {
+		struct stat st;
+		if (stat(f->src->path, &st) != 0 || !localtime_r(&st.st_mtime, &tm)) ipp_decline(pp, "file timestamp");
+		n = (int)strftime(tmp, sizeof tmp, "\"%a %b %e %H:%M:%S %Y\"", &tm);
+		break;
+	}
+	}
+	t->s = ipp_strndup(&pp->scratch, tmp, (size_t)n);
+	t->len = (uint32_t)n;
+	t->kind = which == IPP_S_DATE || which == IPP_S_TIME || which == IPP_S_TIMESTAMP ? IPP_STR : IPP_NUM;
+}
+
+static void ipp_pragma_text(Ipp *pp, const char *s, size_t n, uint32_t line);
+
+/* `_Pragma("...")` outside any expansion becomes a #pragma line, as GCC
+ * prints it. Anything the pragma would do to the preprocessor itself is left
+ * to the compiler. */
+static bool ipp_pragma_op(Ipp *pp, IppTok *t) {
+	IppTok lp, str, rp;
+	if (pp->nctx || pp->in_if || pp->pending_call || pp->quiet) ipp_decline(pp, "_Pragma inside an expansion");
+	ipp_next(pp, &lp);
+	ipp_next(pp, &str);
+	ipp_next(pp, &rp);
+	if (!ipp_punct(&lp, '(') || str.kind != IPP_STR || !ipp_punct(&rp, ')')) ipp_decline(pp, "malformed _Pragma");
+	const char *q = memchr(str.s, '"', str.len);
+	size_t n = str.len - (size_t)(q - str.s) - 2;
+	char *text = pparse_arena_alloc_uninit(&pp->scratch, n + 1), *w = text;
+	for (size_t i = 1; i <= n; i++) {
+		if (q[i] == '\\' && (q[i + 1] == '\\' || q[i + 1] == '"')) i++;
+		*w++ = q[i];
+	}
+	*w = '\0';
+	uint32_t line = t->line ? t->line : pp->expand_line;
+	ipp_line_change(pp, line);
+	ipp_pragma_text(pp, text, (size_t)(w - text), line);
+	pp->force_marker = true;
+	return true;
+}
+
+/* Expands the identifier `t` if it names a macro. True when it was consumed;
+ * false leaves `t`, possibly rewritten by a builtin, to be used as is. */
+static bool ipp_expand(Ipp *pp, IppTok *t) {
+	IppSym *s = ipp_sym_find(pp, t->s, t->len);
+	if (!s) return false;
+	if (s->special >= IPP_S_FILE) {
+		ipp_builtin(pp, s->special, t);
+		return false;
+	}
+	if (s->special == IPP_S_PRAGMA) return ipp_pragma_op(pp, t);
+	IppMacro *m = s->macro;
+	if (!m) return false;
+	if (m->disabled) {
+		t->flags |= IPP_TF_NOEXPAND;
+		return false;
+	}
+	bool top = !pp->nctx && !pp->in_if && !pp->quiet;
+	if (top && !(t->flags & IPP_TF_EXP)) pp->expand_line = t->line;
+	uint8_t lead = t->flags & IPP_TF_SPACE;
+	if (m->nparams < 0) {
+		if (top) ipp_line_change(pp, pp->expand_line);
+		if (!m->has_ops) {
+			ipp_push_ctx(pp, m->body, m->nbody, m, lead);
+			return true;
+		}
+		IppToks r = {0};
+		ipp_subst(pp, m, NULL, 0, m->nbody, &r);
+		ipp_push_ctx(pp, r.v, r.n, m, lead);
+		return true;
+	}
+	IppTok nt;
+	pp->pending_call++;
+	ipp_next(pp, &nt);
+	pp->pending_call--;
+	if (!ipp_punct(&nt, '(')) {
+		pp->ahead = nt;
+		pp->has_ahead = true;
+		return false;
+	}
+	if (top) ipp_line_change(pp, pp->expand_line);
+	IppArgs a = {0};
+	ipp_collect_args(pp, m, &a);
+	if (!m->has_ops) {
+		ipp_push_ctx(pp, m->body, m->nbody, m, lead);
+		return true;
+	}
+	IppToks r = {0};
+	ipp_subst(pp, m, &a, 0, m->nbody, &r);
+	uint32_t w = 0;
+	for (uint32_t i = 0; i < r.n; i++)
+		if (r.v[i].kind != IPP_PLACEMARKER) r.v[w++] = r.v[i];
+	ipp_push_ctx(pp, r.v, w, m, lead);
+	return true;
+}
+
+/* ---- #if ---- */
+
+typedef struct {
+	uint64_t v;
+	bool u;
+} IppVal;
+
+typedef struct {
+	Ipp *pp;
+	const IppTok *t;
+	uint32_t i, n;
+} IppEval;
+
+static IppVal ipp_eval_cond(IppEval *e, bool live);
+
+static const IppTok *ipp_eval_peek(IppEval *e) {
+	static const IppTok end = {"", 0, 0, IPP_EOF, 0, 0};
+	return e->i < e->n ? &e->t[e->i] : &end;
+}
+
+static IppVal ipp_eval_number(IppEval *e, const IppTok *t) {
+	const char *s = t->s, *end = s + t->len;
+	unsigned base = 10;
+	uint64_t v = 0;
+	bool digits = false;
+	if (s[0] == '0' && s + 1 < end && (s[1] == 'x' || s[1] == 'X')) {
+		base = 16;
+		s += 2;
+	} else if (s[0] == '0' && s + 1 < end && (s[1] == 'b' || s[1] == 'B')) {
+		base = 2;
+		s += 2;
+	} else if (s[0] == '0')
+		base = 8;
+	for (; s < end; s++) {
+		unsigned d;
+		if (*s == '\'') continue;
+		if (PPARSE_IS_DIGIT(*s))
+			d = (unsigned)(*s - '0');
+		else if (base == 16 && PPARSE_IS_XDIGIT(*s))
+			d = (unsigned)((*s | 0x20) - 'a' + 10);
+		else
+			break;
+		if (d >= base) ipp_decline(e->pp, "malformed integer in #if");
+		if (v > (UINT64_MAX - d) / base) ipp_decline(e->pp, "integer overflow in #if");
+		v = v * base + d;
+		digits = true;
+	}
+	if (!digits && base != 8) ipp_decline(e->pp, "malformed integer in #if");
+	bool u = false;
+	int ls = 0;
+	for (; s < end; s++) {
+		if ((*s == 'u' || *s == 'U') && !u)
+			u = true;
+		else if ((*s == 'l' || *s == 'L') && ls < 2)
+			ls++;
+		else
+			ipp_decline(e->pp, "non-integer in #if");
+	}
+	return (IppVal){v, u || v > INT64_MAX};
+}
+
+static IppVal ipp_eval_char(IppEval *e, const IppTok *t) {
+	const char *s = t->s;
+	bool prefixed = *s != '\'';
+	while (*s != '\'') s++;
+	s++;
+	uint64_t v;
+	if (*s == '\\') {
+		s++;
+		const char *simple = strchr("ntrabfve\\'\"?", *s);
+		if (*s && simple) {
+			static const char map[] = "\n\t\r\a\b\f\v\033\\'\"?";
+			v = (unsigned char)map[simple - "ntrabfve\\'\"?"];
+			s++;
+		} else if (*s == 'x') {
+			v = 0;
+			for (s++; PPARSE_IS_XDIGIT(*s); s++)
+				v = v * 16 + (unsigned)(PPARSE_IS_DIGIT(*s) ? *s - '0' : (*s | 0x20) - 'a' + 10);
+		} else if (*s >= '0' && *s <= '7') {
+			v = 0;
+			for (int k = 0; k < 3 && *s >= '0' && *s <= '7'; k++, s++) v = v * 8 + (unsigned)(*s - '0');
+		} else
+			ipp_decline(e->pp, "character constant in #if");
+	} else
+		v = (unsigned char)*s++;
+	if (*s != '\'' || v > 0xff || (prefixed && v > 0x7f)) ipp_decline(e->pp, "character constant in #if");
+	if (v > 0x7f && !e->pp->uchar) v = (uint64_t)(int64_t)(int8_t)v;
+	return (IppVal){v, false};
+}
+
+static IppVal ipp_eval_unary(IppEval *e, bool live) {
+	const IppTok *t = ipp_eval_peek(e);
+	e->i++;
+	if (t->kind == IPP_NUM) return ipp_eval_number(e, t);
+	if (t->kind == IPP_CHAR) return ipp_eval_char(e, t);
+	if (t->kind == IPP_IDENT) {
+		if (e->pp->c23 && (ipp_tok_is(t, "true") || ipp_tok_is(t, "false"))) ipp_decline(e->pp, "C23 boolean in #if");
+		return (IppVal){0, false};
+	}
+	if (ipp_punct(t, '(')) {
+		IppVal v = ipp_eval_cond(e, live);
+		while (ipp_punct(ipp_eval_peek(e), ',')) {
+			e->i++;
+			v = ipp_eval_cond(e, live);
+		}
+		if (!ipp_punct(ipp_eval_peek(e), ')')) ipp_decline(e->pp, "missing ')' in #if");
+		e->i++;
+		return v;
+	}
+	if (t->kind == IPP_PUNCT && t->len == 1) {
+		IppVal v;
+		switch (t->s[0]) {
+		case '+': return ipp_eval_unary(e, live);
+		case '-': v = ipp_eval_unary(e, live); v.v = 0 - v.v; return v;
+		case '~': v = ipp_eval_unary(e, live); v.v = ~v.v; return v;
+		case '!': v = ipp_eval_unary(e, live); return (IppVal){v.v == 0, false};
+		}
+	}
+	ipp_decline(e->pp, "malformed #if");
+}
+
+static int ipp_eval_prec(const IppTok *t) {
+	static const struct {
+		const char *op;
+		int prec;
+	} ops[] = {
+	    {"*", 10}, {"/", 10}, {"%", 10}, {"+", 9},	{"-", 9},  {"<<", 8}, {">>", 8}, {"<", 7},  {">", 7},
+	    {"<=", 7}, {">=", 7}, {"==", 6}, {"!=", 6}, {"&", 5},  {"^", 4},  {"|", 3},	 {"&&", 2}, {"||", 1},
+	};
+	if (t->kind != IPP_PUNCT) return 0;
+	for (size_t i = 0; i < sizeof ops / sizeof *ops; i++)
+		if (ipp_tok_is(t, ops[i].op)) return ops[i].prec;
+	return 0;
+}
+
+static IppVal ipp_eval_binary(IppEval *e, int min, bool live) {
+	IppVal l = ipp_eval_unary(e, live);
+	for (;;) {
+		const IppTok *op = ipp_eval_peek(e);
+		int prec = ipp_eval_prec(op);
+		if (!prec || prec < min) return l;
+		e->i++;
+		char c0 = op->s[0], c1 = op->len > 1 ? op->s[1] : 0;
+		if (prec <= 2) {
+			bool lv = l.v != 0;
+			IppVal r = ipp_eval_binary(e, prec + 1, live && (c0 == '&' ? lv : !lv));
+			l = (IppVal){c0 == '&' ? lv && r.v : lv || r.v, false};
+			continue;
+		}
+		IppVal r = ipp_eval_binary(e, prec + 1, live);
+		bool u = l.u || r.u;
+		int64_t sl = (int64_t)l.v, sr = (int64_t)r.v;
+		switch (prec) {
+		case 10:
+			if (c0 == '*') {
+				l = (IppVal){l.v * r.v, u};
+				break;
+			}
+			if (r.v == 0 || (!u && sl == INT64_MIN && sr == -1)) {
+				if (live) ipp_decline(e->pp, "division by zero in #if");
+				l = (IppVal){0, u};
+				break;
+			}
+			if (u)
+				l = (IppVal){c0 == '/' ? l.v / r.v : l.v % r.v, true};
+			else
+				l = (IppVal){(uint64_t)(c0 == '/' ? sl / sr : sl % sr), false};
+			break;
+		case 9: l = (IppVal){c0 == '+' ? l.v + r.v : l.v - r.v, u}; break;
+		case 8:
+			if ((!r.u && sr < 0) || r.v >= 64) {
+				if (live) ipp_decline(e->pp, "shift count in #if");
+				l = (IppVal){0, l.u};
+				break;
+			}
+			if (c0 == '<')
+				l.v <<= r.v;
+			else
+				l.v = l.u ? l.v >> r.v : (uint64_t)(sl >> r.v);
+			break;
+		case 7: {
+			bool lt = u ? l.v < r.v : sl < sr, gt = u ? l.v > r.v : sl > sr;
+			bool res = c0 == '<' ? (c1 == '=' ? !gt : lt) : (c1 == '=' ? !lt : gt);
+			l = (IppVal){res, false};
+			break;
+		}
+		case 6: l = (IppVal){(l.v == r.v) == (c0 == '='), false}; break;
+		case 5: l = (IppVal){l.v & r.v, u}; break;
+		case 4: l = (IppVal){l.v ^ r.v, u}; break;
+		case 3: l = (IppVal){l.v | r.v, u}; break;
+		}
+	}
+}
+
+static IppVal ipp_eval_cond(IppEval *e, bool live) {
+	IppVal c = ipp_eval_binary(e, 1, live);
+	if (!ipp_punct(ipp_eval_peek(e), '?')) return c;
+	e->i++;
+	IppVal a = ipp_eval_cond(e, live && c.v);
+	while (ipp_punct(ipp_eval_peek(e), ',')) {
+		e->i++;
+		a = ipp_eval_cond(e, live && c.v);
+	}
+	if (!ipp_punct(ipp_eval_peek(e), ':')) ipp_decline(e->pp, "missing ':' in #if");
+	e->i++;
+	IppVal b = ipp_eval_cond(e, live && !c.v);
+	return (IppVal){c.v ? a.v : b.v, a.u || b.u};
+}
+
+static bool ipp_is_defined(Ipp *pp, const IppTok *name);
+static int ipp_query(Ipp *pp, const char *key, bool *known);
+
+static IppTok ipp_number_tok(Ipp *pp, uint64_t v) {
+	char tmp[24];
+	int n = snprintf(tmp, sizeof tmp, "%llu", (unsigned long long)v);
+	return (IppTok){ipp_strndup(&pp->scratch, tmp, (size_t)n), (uint32_t)n, 0, IPP_NUM, 0, 0};
+}
+
+/* The header name of `__has_include(...)` or a computed #include, from
+ * tokens already read: a string, or `<` tokens `>` glued back together. */
+static bool ipp_header_name(const IppTok *v, uint32_t n, uint32_t *used, char *out, size_t cap, bool *angle) {
+	if (n && v[0].kind == IPP_STR && v[0].s[0] == '"') {
+		if (v[0].len - 2 >= cap) return false;
+		memcpy(out, v[0].s + 1, v[0].len - 2);
+		out[v[0].len - 2] = '\0';
+		*angle = false;
+		*used = 1;
+		return true;
+	}
+	if (!n || !ipp_punct(&v[0], '<')) return false;
+	size_t len = 0;
+	for (uint32_t i = 1; i < n; i++) {
+		if (ipp_punct(&v[i], '>')) {
+			out[len] = '\0';
+			*angle = true;
+			*used = i + 1;
+			return len > 0;
+		}
+		if (len + v[i].len + 2 >= cap) return false;
+		if (i > 1 && (v[i].flags & IPP_TF_SPACE)) out[len++] = ' ';
+		memcpy(out + len, v[i].s, v[i].len);
+		len += v[i].len;
+	}
+	return false;
+}
+
+/* Reads `(tokens)` raw for a builtin operand; `out` gets them balanced. */
+static void ipp_operand(Ipp *pp, IppToks *out) {
+	IppTok t;
+	int depth = 0;
+	ipp_next(pp, &t);
+	if (!ipp_punct(&t, '(')) ipp_decline(pp, "builtin without '('");
+	for (;;) {
+		ipp_next(pp, &t);
+		if (t.kind == IPP_EOF) ipp_decline(pp, "unterminated builtin operand");
+		if (ipp_punct(&t, '(')) depth++;
+		if (ipp_punct(&t, ')') && depth-- == 0) return;
+		ipp_toks_push(pp, out, &t);
+	}
+}
+
+static char *ipp_spell(Ipp *pp, const char *op, uint32_t oplen, const IppToks *v) {
+	size_t cap = oplen + 3;
+	for (uint32_t i = 0; i < v->n; i++) cap += v->v[i].len + 1;
+	char *key = pparse_arena_alloc_uninit(&pp->scratch, cap), *w = key;
+	memcpy(w, op, oplen);
+	w += oplen;
+	*w++ = '(';
+	for (uint32_t i = 0; i < v->n; i++) {
+		if (i && (v->v[i].flags & IPP_TF_SPACE)) *w++ = ' ';
+		memcpy(w, v->v[i].s, v->v[i].len);
+		w += v->v[i].len;
+	}
+	*w++ = ')';
+	*w = '\0';
+	return key;
+}
+
+/* Evaluates the rest of an #if/#elif line. */
+static bool ipp_eval(Ipp *pp, IppToks *line) {
+	IppToks r = {0};
+	pp->in_if++;
+	ipp_push_ctx(pp, line->v, line->n, NULL, 0);
+	for (;;) {
+		IppTok t;
+		ipp_next(pp, &t);
+		if (t.kind == IPP_EOF) break;
+		if (t.kind == IPP_IDENT && !(t.flags & IPP_TF_NOEXPAND)) {
+			IppSym *s = ipp_sym_find(pp, t.s, t.len);
+			int sp = s ? s->special : IPP_S_NONE;
+			if (sp == IPP_S_DEFINED) {
+				IppTok name, rp;
+				ipp_next(pp, &name);
+				bool paren = ipp_punct(&name, '(');
+				if (paren) ipp_next(pp, &name);
+				if (name.kind != IPP_IDENT) ipp_decline(pp, "malformed defined");
+				if (paren) {
+					ipp_next(pp, &rp);
+					if (!ipp_punct(&rp, ')')) ipp_decline(pp, "malformed defined");
+				}
+				t = ipp_number_tok(pp, ipp_is_defined(pp, &name));
+			} else if (sp == IPP_S_HAS_INCLUDE || sp == IPP_S_HAS_INCLUDE_NEXT) {
+				IppToks v = {0};
+				char name[PATH_MAX];
+				bool angle;
+				uint32_t used;
+				int dir;
+				const char *sysflags;
+				ipp_operand(pp, &v);
+				if (!ipp_header_name(v.v, v.n, &used, name, sizeof name, &angle) || used != v.n)
+					ipp_decline(pp, "__has_include operand");
+				t = ipp_number_tok(pp, ipp_find(pp, name, angle, sp == IPP_S_HAS_INCLUDE_NEXT, &dir, &sysflags) != NULL);
+			} else if (sp == IPP_S_QUERY) {
+				IppToks v = {0};
+				char dkey[96];
+				bool known;
+				snprintf(dkey, sizeof dkey, "defined(%.*s)", (int)t.len, t.s);
+				int defined = ipp_query(pp, dkey, &known);
+				ipp_operand(pp, &v);
+				for (uint32_t i = 0; i < v.n; i++) {
+					IppSym *o = v.v[i].kind == IPP_IDENT ? ipp_sym_find(pp, v.v[i].s, v.v[i].len) : NULL;
+					if (o && o->macro) ipp_decline(pp, "macro in a compiler query");
+				}
+				/* Where the compiler lacks the builtin, GCC reads a plain
+				 * identifier followed by `(`: an error either way. */
+				if (known && !defined) ipp_decline(pp, "query the compiler does not define");
+				t = ipp_number_tok(pp, (uint64_t)ipp_query(pp, ipp_spell(pp, t.s, t.len, &v), &known));
+			} else if (sp == IPP_S_HAS_EMBED) {
+				ipp_decline(pp, "__has_embed");
+			} else if (ipp_expand(pp, &t))
+				continue;
+		}
+		ipp_toks_push(pp, &r, &t);
+	}
+	pp->nctx--;
+	pp->in_if--;
+	pp->pending_boundary = false;
+	IppEval e = {pp, r.v, 0, r.n};
+	if (!r.n) ipp_decline(pp, "#if with no expression");
+	IppVal v = ipp_eval_cond(&e, true);
+	if (e.i != r.n) ipp_decline(pp, "malformed #if");
+	return v.v != 0;
+}
+
+/* ---- directives ---- */
+
+static int ipp_directive_kind(const char *s, size_t n) {
+	static const struct {
+		const char *name;
+		int kind;
+	} names[] = {
+	    {"define", IPP_D_DEFINE},	  {"undef", IPP_D_UNDEF},	{"include", IPP_D_INCLUDE},
+	    {"include_next", IPP_D_INCLUDE_NEXT}, {"if", IPP_D_IF},	{"ifdef", IPP_D_IFDEF},
+	    {"ifndef", IPP_D_IFNDEF},	  {"elif", IPP_D_ELIF},		{"elifdef", IPP_D_ELIFDEF},
+	    {"elifndef", IPP_D_ELIFNDEF}, {"else", IPP_D_ELSE},		{"endif", IPP_D_ENDIF},
+	    {"line", IPP_D_LINE},	  {"pragma", IPP_D_PRAGMA},	{"ident", IPP_D_IDENT},
+	    {"sccs", IPP_D_IDENT},	  {"warning", IPP_D_WARNING},
+	};
+	for (size_t i = 0; i < sizeof names / sizeof *names; i++)
+		if (strlen(names[i].name) == n && memcmp(names[i].name, s, n) == 0) return names[i].kind;
+	return IPP_D_UNKNOWN;
+}
+
+static bool ipp_is_defined(Ipp *pp, const IppTok *name) {
+	IppSym *s = ipp_sym_find(pp, name->s, name->len);
+	bool known;
+	if (!s) return false;
+	if (s->macro) return true;
+	if (s->special == IPP_S_QUERY || s->special == IPP_S_HAS_EMBED) {
+		char key[96];
+		snprintf(key, sizeof key, "defined(%.*s)", (int)name->len, name->s);
+		return ipp_query(pp, key, &known) != 0;
+	}
+	return s->special == IPP_S_HAS_INCLUDE || s->special == IPP_S_HAS_INCLUDE_NEXT ||
+	       s->special >= IPP_S_PRAGMA;
+}
+
+static const char *ipp_skip_blank(Ipp *pp, IppFile *f, const char *p) {
+	for (;;) {
+		if (*p == ' ' || *p == '\t' || *p == '\f' || *p == '\v' || *p == '\r')
+			p++;
+		else if (*p == '/' && p[1] == '*')
+			p = ipp_skip_comment(pp, f, p + 2);
+		else
+			return p;
+	}
+}
+
+/* Skips a false group line by line, looking only at directives, and stops
+ * just past the name of the #elif, #else or #endif that ends it. */
+static int ipp_skip_group(Ipp *pp, IppFile *f) {
+	int depth = 0;
+	const char *p = f->p;
+	for (;;) {
+		p = ipp_skip_blank(pp, f, p);
+		if (*p == '#' || (*p == '%' && p[1] == ':')) {
+			p = ipp_skip_blank(pp, f, p + (*p == '#' ? 1 : 2));
+			const char *name = p;
+			while (pparse_ident_char[(unsigned char)*p]) p++;
+			int k = ipp_directive_kind(name, (size_t)(p - name));
+			if (k == IPP_D_IF || k == IPP_D_IFDEF || k == IPP_D_IFNDEF)
+				depth++;
+			else if (k == IPP_D_ENDIF && depth)
+				depth--;
+			else if (!depth && (k == IPP_D_ENDIF || k == IPP_D_ELSE || k == IPP_D_ELIF ||
+					    k == IPP_D_ELIFDEF || k == IPP_D_ELIFNDEF)) {
+				f->p = p;
+				return k;
+			}
+		}
+		for (;;) {
+			char c = *p;
+			if (!c) ipp_decline(pp, "unterminated conditional");
+			if (c == '\n') {
+				p++;
+				f->line++;
+				break;
+			}
+			if (c == '/' && p[1] == '*') {
+				p = ipp_skip_comment(pp, f, p + 2);
+				continue;
+			}
+			if (c == '/' && p[1] == '/') {
+				while (*p && *p != '\n') p++;
+				continue;
+			}
+			if (c == '"' || c == '\'') {
+				/* Literals end at the line in skipped text, where an
+				 * apostrophe is as likely to be prose. */
+				for (p++; *p && *p != '\n' && *p != c; p++)
+					if (*p == '\\' && p[1] && p[1] != '\n') p++;
+				if (*p == c) p++;
+				continue;
+			}
+			p++;
+		}
+	}
+}
+
+static void ipp_close_guard(IppFile *f, const IppCond *c) {
+	if (c->guard && f->guard_state == 1) f->guard_state = 2;
+}
+
+/* Skips groups until one is taken or the conditional ends. */
+static void ipp_skip_false(Ipp *pp, IppFile *f) {
+	for (;;) {
+		int k = ipp_skip_group(pp, f);
+		IppCond *c = &pp->conds[pp->nconds - 1];
+		if (k == IPP_D_ENDIF) {
+			ipp_end_line(pp, f);
+			ipp_close_guard(f, c);
+			pp->nconds--;
+			return;
+		}
+		if (c->else_seen) ipp_decline(pp, "#elif or #else after #else");
+		if (c->guard) f->guard_state = -1;
+		if (k == IPP_D_ELSE) {
+			c->else_seen = true;
+			ipp_end_line(pp, f);
+			if (!c->taken) {
+				c->taken = true;
+				return;
+			}
+			continue;
+		}
+		if (c->taken) {
+			ipp_end_line(pp, f);
+			continue;
+		}
+		/* #elifdef is C23; older compilers skip it as unknown instead. */
+		if (k != IPP_D_ELIF) ipp_decline(pp, "#elifdef");
+		IppToks line = {0};
+		pp->expand_line = ipp_line(f);
+		ipp_line_toks(pp, f, &line);
+		if (ipp_eval(pp, &line)) {
+			c->taken = true;
+			return;
+		}
 	}
-	if (ok) ok = fprintf(f, "dirs %d\n", nwatch) > 0;
-	for (i = 0; ok && i < nwatch; i++) {
-		PPStat id;
-		if (!pp_stat_id(watch[i], &id)) {
-			ok = false;
-			break;
+}
+
+static void ipp_open_cond(Ipp *pp, IppFile *f, bool taken, bool guard) {
+	PPARSE_ARENA_ENSURE_CAP(&pp->perm, pp->conds, pp->nconds, pp->cap_conds, 64, IppCond);
+	pp->conds[pp->nconds++] = (IppCond){taken, false, guard};
+	if (guard) f->guard_state = 1;
+	if (!taken) ipp_skip_false(pp, f);
+}
+
+static void ipp_include(Ipp *pp, IppFile *f, bool next) {
+	char name[PATH_MAX];
+	bool angle = false;
+	const char *sysflags;
+	int dir;
+	uint8_t flags = 0;
+	uint32_t line = pp->expand_line;
+	if (pp->pending_call) ipp_decline(pp, "#include inside macro arguments");
+	ipp_skip_ws(pp, f, true, &flags);
+	const char *p = f->p;
+	if (*p == '"' || *p == '<') {
+		const char *close = p + 1;
+		while (*close && *close != '\n' && *close != (*p == '"' ? '"' : '>')) close++;
+		if (*close != (*p == '"' ? '"' : '>') || close == p + 1 || (size_t)(close - p) >= sizeof name)
+			ipp_decline(pp, "malformed #include");
+		angle = *p == '<';
+		memcpy(name, p + 1, (size_t)(close - p - 1));
+		name[close - p - 1] = '\0';
+		f->p = close + 1;
+		ipp_end_line(pp, f);
+	} else {
+		IppToks line = {0}, v = {0};
+		uint32_t used;
+		pp->expand_line = ipp_line(f);
+		ipp_line_toks(pp, f, &line);
+		pp->in_if++;
+		ipp_expand_run(pp, line.v, line.n, &v);
+		pp->in_if--;
+		if (!ipp_header_name(v.v, v.n, &used, name, sizeof name, &angle)) ipp_decline(pp, "computed #include");
+	}
+	IppSrc *s = ipp_find(pp, name, angle, next, &dir, &sysflags);
+	if (!s) ipp_decline(pp, "include not found");
+	/* Whatever a system header includes is a system header too. */
+	if (strlen(f->sysflags) > strlen(sysflags)) {
+		sysflags = f->sysflags;
+		s->system = true;
+	}
+	ipp_dep(pp, s);
+	if ((s->guard && ipp_sym_find(pp, s->guard, s->guard_len) && ipp_sym_find(pp, s->guard, s->guard_len)->macro) ||
+	    (s->once ? s->entered : ipp_once_seen(pp, s)))
+		return;
+	/* GCC first brings the includer up to the directive. */
+	ipp_sync(pp, line);
+	ipp_push_file(pp, s, dir, sysflags, ipp_line(f));
+	ipp_marker(pp, 1, s->path, " 1", sysflags);
+}
+
+/* `#line`, or with `marker` the `# 60 "name" flags` form, which also sets
+ * the system flags: none unless it lists them. */
+static void ipp_line_directive(Ipp *pp, IppFile *f, const IppTok *num, bool marker) {
+	IppToks v = {0};
+	char *end;
+	ipp_line_toks(pp, f, &v);
+	unsigned long line = strtoul(num->s, &end, 10);
+	if (end != num->s + num->len || !PPARSE_IS_DIGIT(num->s[0])) ipp_decline(pp, "malformed #line");
+	if (v.n) {
+		const IppTok *s = &v.v[0];
+		if (s->kind != IPP_STR || s->s[0] != '"') ipp_decline(pp, "malformed #line");
+		char *name = pparse_arena_alloc_uninit(&pp->perm, s->len), *w = name;
+		for (uint32_t i = 1; i + 1 < s->len; i++) {
+			if (s->s[i] == '\\' && i + 2 < s->len) i++;
+			*w++ = s->s[i];
+		}
+		*w = '\0';
+		f->presumed = name;
+		const char *sysflags = "";
+		for (uint32_t i = 1; i < v.n; i++) {
+			if (v.v[i].kind != IPP_NUM) ipp_decline(pp, "malformed #line");
+			if (marker && (ipp_tok_is(&v.v[i], "1") || ipp_tok_is(&v.v[i], "2")))
+				ipp_decline(pp, "linemarker entering or leaving a file");
+			if (ipp_tok_is(&v.v[i], "3"))
+				sysflags = " 3";
+			else if (ipp_tok_is(&v.v[i], "4") && sysflags[0])
+				sysflags = " 3 4";
+		}
+		if (marker) f->sysflags = sysflags;
+	}
+	ipp_line(f);
+	f->line_delta = (int)line - (int)f->line;
+	pp->force_marker = true;
+}
+
+/* Consumed pragmas change the preprocessor; the rest are printed as GCC does,
+ * tokens separated by at most one space. */
+static void ipp_pragma_text(Ipp *pp, const char *s, size_t n, uint32_t line) {
+	IppFile *f = &pp->files[pp->nfiles - 1];
+	const char *p = s, *end = s + n;
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	const char *w = p;
+	while (p < end && pparse_ident_char[(unsigned char)*p]) p++;
+	size_t wl = (size_t)(p - w);
+	if ((wl == 4 && memcmp(w, "once", 4) == 0) || (wl == 10 && memcmp(w, "push_macro", 10) == 0) ||
+	    (wl == 9 && memcmp(w, "pop_macro", 9) == 0) || (wl == 3 && memcmp(w, "GCC", 3) == 0 && p < end &&
+							      !strstr(s, "diagnostic") && !strstr(s, "visibility") &&
+							      !strstr(s, "optimize") && !strstr(s, "target") &&
+							      !strstr(s, "push_options") && !strstr(s, "pop_options") &&
+							      !strstr(s, "ivdep") && !strstr(s, "unroll")))
+		ipp_decline(pp, "pragma that acts on the preprocessor");
+	ipp_move(pp, line, f->sysflags);
+	ipp_put(pp, "#pragma ", 8);
+	ipp_put(pp, w, (size_t)(end - w));
+	ipp_put(pp, "\n", 1);
+	pp->out_line = line + 1;
+	pp->out_bol = true;
+	pp->out_printed = false;
+}
+
+static void ipp_pragma(Ipp *pp, IppFile *f, uint32_t line) {
+	IppToks v = {0};
+	if (pp->pending_call) ipp_decline(pp, "#pragma inside macro arguments");
+	ipp_line_toks(pp, f, &v);
+	const IppTok *t = v.v;
+	if (v.n == 1 && ipp_tok_is(&t[0], "once")) {
+		f->src->once = true;
+		if (!pp->quiet) ipp_line_change(pp, line);
+		return;
+	}
+	if (v.n == 4 && (ipp_tok_is(&t[0], "push_macro") || ipp_tok_is(&t[0], "pop_macro")) && ipp_punct(&t[1], '(') &&
+	    t[2].kind == IPP_STR && t[2].s[0] == '"' && ipp_punct(&t[3], ')')) {
+		const char *name = t[2].s + 1;
+		uint32_t len = t[2].len - 2;
+		IppSym *s = ipp_sym_get(pp, name, len);
+		if (s->special) ipp_decline(pp, "push_macro of a reserved name");
+		if (!pp->quiet) ipp_line_change(pp, line);
+		if (t[0].s[1] == 'u') {
+			IppPushed *e = pparse_arena_alloc(&pp->perm, sizeof *e);
+			*e = (IppPushed){pp->pushed, s->name, len, s->macro};
+			pp->pushed = e;
+			return;
 		}
-		ok = fprintf(f, "%lld %lld %lld %lld %lld %llu %llu %s\n", id.size, id.mtime_sec,
-			     id.mtime_nsec, id.ctime_sec, id.ctime_nsec, id.device, id.inode, watch[i]) > 0;
+		for (IppPushed **e = &pp->pushed; *e; e = &(*e)->next)
+			if ((*e)->len == len && memcmp((*e)->name, name, len) == 0) {
+				s->macro = (*e)->macro;
+				*e = (*e)->next;
+				break;
+			}
+		return;
 	}
-	if (ok) {
-		PPKey sum = pp_payload_checksum(payload, len);
-		ok = fprintf(f, "payload %llu %016llx %016llx\n", (unsigned long long)len,
-			     (unsigned long long)sum.a, (unsigned long long)sum.b) > 0;
+	if (v.n >= 2 && ipp_tok_is(&t[0], "GCC")) {
+		if (ipp_tok_is(&t[1], "system_header")) {
+			/* Ignored in the main file, as GCC does; elsewhere the rest of
+			 * the file is renamed into plain system-header flags. */
+			if (!pp->quiet) ipp_line_change(pp, line);
+			if (pp->nfiles > 1) {
+				f->sysflags = " 3";
+				ipp_marker(pp, line + 1, f->presumed, "", f->sysflags);
+			}
+			return;
+		}
+		if (ipp_tok_is(&t[1], "warning")) ipp_decline(pp, "#pragma GCC warning");
+		if (ipp_tok_is(&t[1], "poison") || ipp_tok_is(&t[1], "error") || ipp_tok_is(&t[1], "dependency") ||
+		    ipp_tok_is(&t[1], "push_macro") || ipp_tok_is(&t[1], "pop_macro"))
+			ipp_decline(pp, "pragma that acts on the preprocessor");
+	}
+	ipp_move(pp, line, f->sysflags);
+	ipp_put(pp, "#pragma", 7);
+	for (uint32_t i = 0; i < v.n; i++) {
+		if (!i || (t[i].flags & IPP_TF_SPACE)) ipp_put(pp, " ", 1);
+		ipp_put(pp, t[i].s, t[i].len);
+	}
+	ipp_put(pp, "\n", 1);
+	pp->out_line = line + 1;
+	pp->out_bol = true;
+	pp->out_printed = false;
+}
+
+static void ipp_directive(Ipp *pp, IppFile *f) {
+	IppTok name;
+	ipp_lex_line(pp, f, &name);
+	uint32_t line = name.line;
+	pp->expand_line = line;
+	int k = name.kind == IPP_IDENT ? ipp_directive_kind(name.s, name.len)
+		: name.kind == IPP_NUM ? IPP_D_LINEMARK
+		: name.kind == IPP_EOF ? IPP_D_NULL
+				       : IPP_D_UNKNOWN;
+	/* A guard must open the file and its #endif must close it. */
+	if (f->guard_state == 2 || (f->guard_state == 0 && k != IPP_D_IFNDEF && k != IPP_D_IF)) f->guard_state = -1;
+	switch (k) {
+	case IPP_D_NULL: ipp_end_line(pp, f); return;
+	case IPP_D_DEFINE: ipp_define(pp, f); return;
+	case IPP_D_UNDEF: ipp_undef(pp, f); return;
+	case IPP_D_INCLUDE:
+	case IPP_D_INCLUDE_NEXT: ipp_include(pp, f, k == IPP_D_INCLUDE_NEXT && pp->nfiles > 1); return;
+	case IPP_D_IFDEF:
+	case IPP_D_IFNDEF: {
+		IppTok id;
+		ipp_lex_line(pp, f, &id);
+		if (id.kind != IPP_IDENT) ipp_decline(pp, "#ifdef without a name");
+		ipp_end_line(pp, f);
+		bool guard = k == IPP_D_IFNDEF && f->guard_state == 0 && pp->nconds == f->cond_base;
+		if (guard) {
+			f->guard = id.s;
+			f->guard_len = id.len;
+		}
+		ipp_open_cond(pp, f, ipp_is_defined(pp, &id) == (k == IPP_D_IFDEF), guard);
+		return;
 	}
-	if (ok) ok = fwrite(payload, 1, len, f) == len;
-	if (fclose(f) != 0) ok = false;
-	if (!ok || !pp_replace_file(tmp, path)) remove(tmp);
-	if (ok) pp_cache_prune();
-out:
-	for (i = 0; i < ndeps; i++) {
-		free(deps[i]);
-		if (raws) free(raws[i]);
+	case IPP_D_IF: {
+		IppToks v = {0};
+		ipp_line_toks(pp, f, &v);
+		/* `#if !defined X` guards as well as #ifndef does. */
+		bool guard = f->guard_state == 0 && pp->nconds == f->cond_base && v.n >= 3 && ipp_punct(&v.v[0], '!') &&
+			     ipp_tok_is(&v.v[1], "defined") &&
+			     ((v.n == 3 && v.v[2].kind == IPP_IDENT) ||
+			      (v.n == 5 && ipp_punct(&v.v[2], '(') && v.v[3].kind == IPP_IDENT && ipp_punct(&v.v[4], ')')));
+		if (guard) {
+			const IppTok *id = &v.v[v.n == 3 ? 2 : 3];
+			f->guard = id->s;
+			f->guard_len = id->len;
+		} else if (f->guard_state == 0)
+			f->guard_state = -1;
+		ipp_open_cond(pp, f, ipp_eval(pp, &v), guard);
+		return;
+	}
+	case IPP_D_ELIF:
+	case IPP_D_ELIFDEF:
+	case IPP_D_ELIFNDEF:
+	case IPP_D_ELSE: {
+		if (pp->nconds == f->cond_base) ipp_decline(pp, "#else without #if");
+		IppCond *c = &pp->conds[pp->nconds - 1];
+		if (c->else_seen) ipp_decline(pp, "#elif or #else after #else");
+		if (c->guard) f->guard_state = -1;
+		c->else_seen = k == IPP_D_ELSE;
+		ipp_end_line(pp, f);
+		ipp_skip_false(pp, f);
+		return;
+	}
+	case IPP_D_ENDIF:
+		if (pp->nconds == f->cond_base) ipp_decline(pp, "#endif without #if");
+		ipp_close_guard(f, &pp->conds[--pp->nconds]);
+		ipp_end_line(pp, f);
+		return;
+	case IPP_D_LINE: {
+		IppTok num;
+		if (pp->pending_call) ipp_decline(pp, "#line inside macro arguments");
+		ipp_lex_line(pp, f, &num);
+		if (num.kind != IPP_NUM) ipp_decline(pp, "computed #line");
+		ipp_line_directive(pp, f, &num, false);
+		return;
+	}
+	case IPP_D_LINEMARK:
+		if (pp->pending_call) ipp_decline(pp, "#line inside macro arguments");
+		ipp_line_directive(pp, f, &name, true);
+		return;
+	case IPP_D_PRAGMA: ipp_pragma(pp, f, line); return;
+	case IPP_D_IDENT: {
+		IppToks v = {0};
+		if (pp->pending_call) ipp_decline(pp, "#ident inside macro arguments");
+		ipp_line_toks(pp, f, &v);
+		ipp_move(pp, line, f->sysflags);
+		ipp_put(pp, "#", 1);
+		ipp_put(pp, name.s, name.len);
+		for (uint32_t i = 0; i < v.n; i++) {
+			ipp_put(pp, " ", 1);
+			ipp_put(pp, v.v[i].s, v.v[i].len);
+		}
+		ipp_put(pp, "\n", 1);
+		pp->out_line = line + 1;
+		pp->out_bol = true;
+		pp->out_printed = false;
+		return;
+	}
+	/* The diagnostic belongs on stderr, with cc's wording and caret. */
+	case IPP_D_WARNING: ipp_decline(pp, "#warning");
+	default: ipp_decline(pp, "unsupported directive");
 	}
-	free(raws);
-	free(deps);
 }
 
-static bool pp_cache_enabled(void) {
-	const char *v = prism_getenv("PRISM_NO_PP_CACHE");
-	return !(v && *v && strcmp(v, "0") != 0);
+static void ipp_lex(Ipp *pp, IppTok *t) {
+	for (;;) {
+		IppFile *f = &pp->files[pp->nfiles - 1];
+		uint8_t flags = f->bol ? IPP_TF_BOL : 0;
+		ipp_skip_ws(pp, f, false, &flags);
+		ipp_lex_at(pp, f, t, flags);
+		f->bol = false;
+		if (t->kind == IPP_EOF) return;
+		if ((t->flags & IPP_TF_BOL) && ipp_is_hash(t)) {
+			ipp_directive(pp, f);
+			continue;
+		}
+		if (f->guard_state != 1) f->guard_state = -1;
+		return;
+	}
 }
 
-/* Conservatively reject volatile time macros before or after preprocessing.
- * A short read is uncertainty, never permission to cache the partial scan. */
-static bool pp_file_is_time_stable(const char *path) {
-	struct stat st;
-	FILE *f = NULL;
-	char *b = NULL;
-	size_t got = 0;
-	bool complete = false;
+/* Preprocesses the file on top of the stack to its end. */
+static void ipp_run(Ipp *pp) {
+	uint32_t floor = pp->nfiles - 1;
+	PParseArenaMark idle = pparse_arena_mark(&pp->scratch);
+	for (;;) {
+		IppTok t;
+		ipp_next(pp, &t);
+		if (t.kind == IPP_EOF) {
+			IppFile *f = &pp->files[pp->nfiles - 1];
+			if (pp->nconds != f->cond_base) ipp_decline(pp, "unterminated #if");
+			if (f->guard_state == 2) {
+				f->src->guard = f->guard;
+				f->src->guard_len = f->guard_len;
+			}
+			if (--pp->nfiles == floor) return;
+			IppFile *up = &pp->files[pp->nfiles - 1];
+			ipp_marker(pp, f->ret_line, up->presumed, " 2", up->sysflags);
+			continue;
+		}
+		if (t.kind == IPP_IDENT && !(t.flags & IPP_TF_NOEXPAND) && ipp_expand(pp, &t)) continue;
+		ipp_emit(pp, &t);
+		if (!pp->nctx && !pp->has_ahead) pparse_arena_restore(&pp->scratch, idle);
+	}
+}
 
-	if (stat(path, &st) != 0) return false;
-	/* Not off_t: that name is POSIX and MSVC only exposes it under
-	 * _CRT_DECLARE_NONSTDC_NAMES. st_size is an integer type on every target. */
-	if ((st.st_size <= 0) | ((long long)st.st_size > (long long)(64 << 20))) return false;
-	f = fopen(path, "rb");
-	if (!f) return false;
-	b = malloc((size_t)st.st_size);
-	if (!b) {
-		fclose(f);
+/* ---- compiler facts ----
+ *
+ * The search path, the predefined macros and the answers to
+ * `__has_attribute`-style queries, each asked of the compiler with the flags
+ * that change them and kept as a compiler-profile record keyed like the
+ * search-dirs one: binary identity, flags, working directory and the include
+ * environment. */
+
+static const char *const ipp_query_names[] = {
+    "__has_attribute",	 "__has_cpp_attribute", "__has_c_attribute",	    "__has_builtin", "__has_feature",
+    "__has_extension", "__has_warning",	"__has_declspec_attribute", "__is_identifier",
+};
+
+static int ipp_query(Ipp *pp, const char *key, bool *known) {
+	for (int i = 0; i < pp->nqueries; i++)
+		if (strcmp(pp->queries[i].key, key) == 0) {
+			*known = pp->queries[i].known;
+			return pp->queries[i].value;
+		}
+	/* Unknown until the compiler is asked after this run; the run goes on
+	 * with 0 and is repeated with the real answer. */
+	PPARSE_ARENA_ENSURE_CAP(&pp->cfg, pp->queries, pp->nqueries, pp->cap_queries, 16, IppQuery);
+	pp->queries[pp->nqueries++] = (IppQuery){ipp_strndup(&pp->cfg, key, strlen(key)), 0, false};
+	pp->unknown++;
+	*known = false;
+	return 0;
+}
+
+static bool ipp_fact_key(Ipp *pp, PPKey *key, const char *what, char **argv, int argc) {
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof cwd) || !cc_record_key(key, what, argv, argc)) return false;
+	ppk_feed_str(key, cwd);
+	for (size_t i = 0; i < sizeof pp_cache_env_keys / sizeof *pp_cache_env_keys; i++)
+		ppk_feed_str(key, prism_getenv(pp_cache_env_keys[i]));
+	(void)pp;
+	return true;
+}
+
+/* The probe flags plus `tail`, answered from the record or by one spawn. */
+static char *ipp_fact(Ipp *pp, const char *what, const char *const *tail, int ntail, bool from_stderr) {
+	char **argv = pparse_arena_alloc(&pp->cfg, (size_t)(pp->nprobe + ntail + 1) * sizeof *argv);
+	int argc = 0;
+	PPKey key;
+	for (int i = 0; i < pp->nprobe; i++) argv[argc++] = pp->probe[i];
+	for (int i = 0; i < ntail; i++) argv[argc++] = (char *)tail[i];
+	bool keyed = ipp_fact_key(pp, &key, what, argv, argc);
+	char *rec = keyed ? cc_record_load(&key) : NULL;
+	if (rec) {
+		char *kept = ipp_strndup(&pp->cfg, rec, strlen(rec));
+		free(rec);
+		return kept;
+	}
+	char *buf = malloc(IPP_PROBE_CAP);
+	if (!buf) ipp_decline(pp, "out of memory");
+	ssize_t got = from_stderr ? spawn_capture_stderr(argv, buf, IPP_PROBE_CAP)
+				  : spawn_capture_stdout(argv, buf, IPP_PROBE_CAP);
+	if (got <= 0 || got >= IPP_PROBE_CAP - 1) {
+		free(buf);
+		ipp_decline(pp, "compiler probe failed");
+	}
+	if (keyed) cc_record_store(&key, buf);
+	char *kept = ipp_strndup(&pp->cfg, buf, (size_t)got);
+	free(buf);
+	return kept;
+}
+
+static bool ipp_same_dir(const char *a, const char *b) {
+	struct stat sa, sb;
+	return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/* `-E -v` lists the quote-only directories, then the angle chain. The -I
+ * directories open the angle chain; everything after them is a system
+ * directory. */
+static void ipp_search_path(Ipp *pp, char **user_dirs, int nuser) {
+	static const char *const tail[] = {"-E", "-v", "-x", "c", "/dev/null"};
+	char *text = ipp_fact(pp, "ipp-search", tail, 5, true);
+	char *q = strstr(text, "#include \"...\" search starts here:");
+	char *a = q ? strstr(q, "#include <...> search starts here:") : NULL;
+	char *end = a ? strstr(a, "End of search list.") : NULL;
+	int cap = 0;
+	bool user = true;
+	if (!end) ipp_decline(pp, "unrecognised search path listing");
+	for (char *l = strchr(q, '\n'); l && l < end; l = strchr(l, '\n')) {
+		char *s = ++l;
+		if (s == a) {
+			pp->angle_start = pp->ndirs;
+			continue;
+		}
+		if (*s != ' ') continue;
+		char *nl = strchr(s, '\n');
+		size_t n = nl ? (size_t)(nl - s) : strlen(s);
+		while (n && (s[n - 1] == '\r' || s[n - 1] == ' ')) n--;
+		s++, n--;
+		if (!n) continue;
+		char *dir = ipp_strndup(&pp->cfg, s, n);
+		if (strstr(dir, "(framework directory)")) ipp_decline(pp, "framework directories");
+		bool system = false;
+		if (s > a) {
+			if (user) {
+				user = false;
+				for (int i = 0; i < nuser && !user; i++) user = ipp_same_dir(dir, user_dirs[i]);
+			}
+			system = !user;
+		}
+		PPARSE_ARENA_ENSURE_CAP(&pp->cfg, pp->dirs, pp->ndirs, cap, 16, IppDir);
+		pp->dirs[pp->ndirs++] = (IppDir){dir, system};
+	}
+}
+
+static void ipp_predefined(Ipp *pp) {
+	static const char *const tail[] = {"-dM", "-E", "-x", "c", "/dev/null"};
+	char *text = ipp_fact(pp, "ipp-macros", tail, 5, false);
+	/* Other compilers differ in details of expansion and output; only GCC is
+	 * modelled. */
+	if (strstr(text, "#define __clang__ ") || !strstr(text, "#define __GNUC__ "))
+		ipp_decline(pp, "not GCC");
+	const char *v = strstr(text, "#define __STDC_VERSION__ ");
+	pp->c23 = v && strtol(v + 25, NULL, 10) > 201710L;
+	pp->uchar = strstr(text, "#define __CHAR_UNSIGNED__ ") != NULL;
+	pp->predefs = text;
+}
+
+static void ipp_load_queries(Ipp *pp) {
+	PPKey key;
+	if (!ipp_fact_key(pp, &key, "ipp-queries", pp->probe, pp->nprobe)) return;
+	char *rec = cc_record_load(&key);
+	for (char *l = rec; l && *l;) {
+		char *nl = strchr(l, '\n'), *sp;
+		if (!nl) break;
+		*nl = '\0';
+		long value = strtol(l, &sp, 10);
+		if (*sp == ' ' && sp[1]) {
+			PPARSE_ARENA_ENSURE_CAP(&pp->cfg, pp->queries, pp->nqueries, pp->cap_queries, 16, IppQuery);
+			pp->queries[pp->nqueries++] = (IppQuery){ipp_strndup(&pp->cfg, sp + 1, strlen(sp + 1)), (int)value, true};
+		}
+		l = nl + 1;
+	}
+	free(rec);
+}
+
+/* Asks the compiler every query the last run could not answer, in one `-E`
+ * of a file that prints each answer a bit at a time. */
+static bool ipp_probe_queries(Ipp *pp) {
+	char path[PATH_MAX];
+	char **argv = pparse_arena_alloc(&pp->cfg, (size_t)(pp->nprobe + 6) * sizeof *argv);
+	char *out = NULL, *body = NULL;
+	const char *p = NULL;
+	size_t body_len = 0;
+	ssize_t got = -1;
+	int argc = 0;
+	bool ok = false;
+	PPKey key;
+	if (snprintf(path, sizeof path, "%sprism-ipp.XXXXXX.c", get_tmp_dir()) >= (int)sizeof path) return false;
+	int fd = mkstemps(path, 2);
+	if (fd < 0) return false;
+	FILE *f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		remove(path);
 		return false;
 	}
-	got = fread(b, 1, (size_t)st.st_size, f);
-	complete = got == (size_t)st.st_size && !ferror(f);
-	if (fclose(f) != 0) complete = false;
-	bool ok = complete && !pp_text_has_time_macro(b, got);
-	free(b);
+	for (int i = 0; i < pp->nqueries; i++) {
+		const char *q = pp->queries[i].key;
+		if (pp->queries[i].known) continue;
+		if (strncmp(q, "defined(", 8) == 0) {
+			fprintf(f, "#if %s\n1\n#else\n0\n#endif\n", q);
+			continue;
+		}
+		fprintf(f, "#if defined(%.*s)\n", (int)strcspn(q, "("), q);
+		for (int b = 0; b < IPP_QUERY_BITS; b++) fprintf(f, "#if ((%s) >> %d) & 1\n1\n#else\n0\n#endif\n", q, b);
+		fputs("#else\n", f);
+		for (int b = 0; b < IPP_QUERY_BITS; b++) fputs("0\n", f);
+		fputs("#endif\n", f);
+	}
+	for (int i = 0; i < pp->nprobe; i++) argv[argc++] = pp->probe[i];
+	argv[argc++] = "-E";
+	argv[argc++] = "-P";
+	argv[argc++] = "-x";
+	argv[argc++] = "c";
+	argv[argc++] = path;
+	out = fclose(f) == 0 ? malloc(IPP_PROBE_CAP) : NULL;
+	if (out) got = spawn_capture_stdout(argv, out, IPP_PROBE_CAP);
+	remove(path);
+	if (got <= 0 || got >= IPP_PROBE_CAP - 1) {
+		free(out);
+		return false;
+	}
+	p = out;
+	for (int i = 0; i < pp->nqueries; i++) {
+		IppQuery *q = &pp->queries[i];
+		int bits = strncmp(q->key, "defined(", 8) == 0 ? 1 : IPP_QUERY_BITS, value = 0;
+		if (q->known) continue;
+		for (int b = 0; b < bits; b++) {
+			while (*p == '\n' || *p == ' ') p++;
+			if (*p != '0' && *p != '1') {
+				free(out);
+				return false;
+			}
+			value |= (*p++ - '0') << b;
+		}
+		q->value = value;
+		q->known = true;
+	}
+	while (*p == '\n' || *p == ' ') p++;
+	ok = *p == '\0';
+	free(out);
+	if (ok && ipp_fact_key(pp, &key, "ipp-queries", pp->probe, pp->nprobe)) {
+		FILE *m = open_memstream(&body, &body_len);
+		if (m) {
+			for (int i = 0; i < pp->nqueries; i++) fprintf(m, "%d %s\n", pp->queries[i].value, pp->queries[i].key);
+			if (fclose(m) == 0) cc_record_store(&key, body);
+		}
+		free(body);
+	}
 	return ok;
 }
 
-/* A custom compiler command can be a wrapper that consults arbitrary state
- * outside argv, headers, and the process environment. Default drivers remain
- * cacheable; explicit alternatives fail closed instead of returning stale C. */
-static bool pp_cache_uses_default_compiler(void) {
-	PRISM_STATE();
-	return !_ps->extra_compiler || strcmp(_ps->extra_compiler, PRISM_DEFAULT_CC) == 0;
+/* ---- configuration ----
+ *
+ * The integrated preprocessor runs from the same argv `cc -E` would get, so
+ * nothing about the command line is decided twice. Flags it models are taken
+ * out; flags that only the compiler can interpret are kept for the probes;
+ * everything that changes preprocessing in a way it does not model declines. */
+
+static bool ipp_has_prefix(const char *a, const char *const *list, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		if (strncmp(a, list[i], strlen(list[i])) == 0) return true;
+	return false;
 }
 
-/* `--prism-cache-clear` / `--prism-cache-info` support. */
-static void pp_clear_cb(const char *dir, const char *name, void *ud) {
-	char full[PATH_MAX];
-	long *n = (long *)ud;
-	if (!pp_pathf(full, sizeof full, "%s/%s", dir, name)) return;
-	if (remove(full) == 0) (*n)++;
+/* Sorts the flags after `-E`; NULL when all of them are understood. */
+static const char *ipp_flags(Ipp *pp, char **argv, int first, int argc, FILE *cmd, char **user_dirs, int *nuser) {
+	static const char *const declined_exact[] = {"-C", "-CC", "-P", "-H", "-M", "-MM", "-MG", "-v",
+						     "-###", "-I-", "-A", "-trigraphs", "-remap"};
+	static const char *const declined_prefix[] = {
+	    "-d",	     "-traditional", "-imacros",   "-iprefix",		"-iwithprefix",
+	    "-Wp,",	     "-Xpreprocessor", "-specs",   "@",			"-fdirectives-only",
+	    "-fpreprocessed", "-fopenmp",    "-fopenacc", "-finput-charset",	"-fmacro-prefix-map",
+	    "-ffile-prefix-map", "-fno-dollars-in-identifiers", "-fpch-preprocess", "-fplugin",
+	};
+	static const char *const with_operand[] = {"-I",      "-iquote",   "-isystem", "-idirafter", "-isysroot",
+						   "--sysroot", "-B",	     "-imultilib", "-imultiarch", "-Xlinker",
+						   "-Xassembler", "-L"};
+	bool debug = false, working_dir = false, no_working_dir = false;
+	for (int i = first; i < argc - 1; i++) {
+		const char *a = argv[i];
+		char *op = i + 2 < argc ? argv[i + 1] : NULL;
+		bool declined = a[0] != '-';
+		for (size_t k = 0; k < sizeof declined_exact / sizeof *declined_exact; k++)
+			declined |= strcmp(a, declined_exact[k]) == 0;
+		if (declined || ipp_has_prefix(a, declined_prefix, sizeof declined_prefix / sizeof *declined_prefix))
+			return "unsupported preprocessor flag";
+		if (a[1] == 'D' || a[1] == 'U') {
+			const char *def = a[2] ? a + 2 : op;
+			if (!def) return "-D without a macro";
+			if (!a[2]) i++;
+			if (strchr(def, '\n')) return "newline in -D";
+			const char *eq = strchr(def, '=');
+			if (a[1] == 'U')
+				fprintf(cmd, "#undef %s\n", def);
+			else if (eq)
+				fprintf(cmd, "#define %.*s %s\n", (int)(eq - def), def, eq + 1);
+			else
+				fprintf(cmd, "#define %s 1\n", def);
+			continue;
+		}
+		if (strcmp(a, "-include") == 0) {
+			if (!op) return "-include without a file";
+			pp->forced[pp->nforced++] = argv[++i];
+			continue;
+		}
+		if (strcmp(a, "-MD") == 0 || strcmp(a, "-MMD") == 0) {
+			pp->deps = true;
+			pp->deps_user_only |= a[2] == 'M';
+			continue;
+		}
+		if (strcmp(a, "-MP") == 0) {
+			pp->deps_phony = true;
+			continue;
+		}
+		if (strncmp(a, "-MF", 3) == 0 || strncmp(a, "-MT", 3) == 0 || strncmp(a, "-MQ", 3) == 0) {
+			char *v = a[3] ? (char *)a + 3 : op;
+			if (!v) return "dependency flag without an operand";
+			if (!a[3]) i++;
+			if (a[2] == 'F') {
+				pp->dep_file = v;
+				continue;
+			}
+			/* The flag letter is kept: -MQ targets are quoted for make,
+			 * -MT targets are written as they are. */
+			char *t = pparse_arena_alloc_uninit(&pp->cfg, strlen(v) + 2);
+			t[0] = a[2];
+			strcpy(t + 1, v);
+			pp->targets[pp->ntargets++] = t;
+			continue;
+		}
+		if (strncmp(a, "-x", 2) == 0) {
+			const char *lang = a[2] ? a + 2 : op;
+			if (!lang || strcmp(lang, "c") != 0) return "language other than C";
+			if (!a[2]) i++;
+			continue;
+		}
+		if (strcmp(a, "-w") == 0 || (a[1] == 'W' && strncmp(a, "-Wa,", 4) != 0 && strncmp(a, "-Wl,", 4) != 0))
+			continue;
+		if (a[1] == 'g') {
+			/* -g3 keeps macro definitions in the -E output. */
+			if (a[strlen(a) - 1] == '3') return "-g3";
+			debug = strcmp(a, "-g0") != 0;
+			continue;
+		}
+		if (strcmp(a, "-fworking-directory") == 0 || strcmp(a, "-fno-working-directory") == 0) {
+			working_dir = a[2] == 'w';
+			no_working_dir = a[2] == 'n';
+			continue;
+		}
+		if (strcmp(a, "-ansi") == 0 || (strncmp(a, "-std=", 5) == 0 && (a[5] == 'c' || a[5] == 'i')))
+			pp->strict = true;
+		else if (strncmp(a, "-std=gnu", 8) == 0)
+			pp->strict = false;
+		pp->probe[pp->nprobe++] = (char *)a;
+		if (strncmp(a, "-I", 2) == 0) user_dirs[(*nuser)++] = a[2] ? (char *)a + 2 : op;
+		for (size_t k = 0; k < sizeof with_operand / sizeof *with_operand; k++) {
+			if (strcmp(a, with_operand[k]) != 0) continue;
+			if (!op) return "flag without an operand";
+			pp->probe[pp->nprobe++] = argv[++i];
+		}
+	}
+	pp->trigraphs = pp->strict;
+	pp->working_dir = !no_working_dir && (debug || working_dir);
+	return NULL;
 }
 
-static void pp_info_cb(const char *dir, const char *name, void *ud) {
-	char full[PATH_MAX];
-	PPScan *s = (PPScan *)ud;
-	PPStat id;
-	if (!pp_pathf(full, sizeof full, "%s/%s", dir, name)) return;
-	if (!pp_stat_id(full, &id)) return;
-	s->n++;
-	s->total += id.size;
+static void ipp_configure(Ipp *pp, char **argv, int argc) {
+	static const char *const declined_env[] = {"CPATH", "OBJC_INCLUDE_PATH", "DEPENDENCIES_OUTPUT",
+						   "SUNPRO_DEPENDENCIES"};
+	char *cmdline = NULL;
+	size_t cmdline_len = 0;
+	int ncc = 0, nuser = 0;
+	while (ncc < argc && strcmp(argv[ncc], "-E") != 0) ncc++;
+	if (!ncc || ncc + 1 >= argc) ipp_decline(pp, "unexpected preprocessor command");
+	if (cc_is_msvc(argv[0])) ipp_decline(pp, "MSVC");
+	for (size_t i = 0; i < sizeof declined_env / sizeof *declined_env; i++) {
+		const char *v = prism_getenv(declined_env[i]);
+		if (v && *v) ipp_decline(pp, "preprocessor environment");
+	}
+	pp->input = argv[argc - 1];
+	if (strcmp(pp->input, "-") == 0) ipp_decline(pp, "standard input");
+	pp->probe = pparse_arena_alloc(&pp->cfg, (size_t)argc * sizeof *pp->probe);
+	pp->forced = pparse_arena_alloc(&pp->cfg, (size_t)argc * sizeof *pp->forced);
+	pp->targets = pparse_arena_alloc(&pp->cfg, (size_t)argc * sizeof *pp->targets);
+	char **user_dirs = pparse_arena_alloc(&pp->cfg, (size_t)argc * sizeof *user_dirs);
+	for (int i = 0; i < ncc; i++) pp->probe[pp->nprobe++] = argv[i];
+	FILE *cmd = open_memstream(&cmdline, &cmdline_len);
+	if (!cmd) ipp_decline(pp, "out of memory");
+	const char *why = ipp_flags(pp, argv, ncc + 1, argc, cmd, user_dirs, &nuser);
+	if (fclose(cmd) != 0 && !why) why = "out of memory";
+	if (cmdline) pp->cmdline = ipp_strndup(&pp->cfg, cmdline, cmdline_len);
+	free(cmdline);
+	if (why) ipp_decline(pp, why);
+	if (pp->deps && !pp->dep_file) {
+		/* `cc -E -MD x.c` without -o writes x.d in the working directory. */
+		const char *base = path_basename(pp->input), *dot = strrchr(base, '.');
+		size_t n = dot ? (size_t)(dot - base) : strlen(base);
+		char *d = pparse_arena_alloc_uninit(&pp->cfg, n + 3);
+		memcpy(d, base, n);
+		memcpy(d + n, ".d", 3);
+		pp->dep_file = d;
+	}
+	ipp_predefined(pp);
+	ipp_search_path(pp, user_dirs, nuser);
+	ipp_load_queries(pp);
+	const char *epoch = prism_getenv("SOURCE_DATE_EPOCH");
+	pp->now = epoch && *epoch ? (time_t)strtoll(epoch, NULL, 10) : time(NULL);
+}
+
+/* ---- one run ---- */
+
+/* The macros of <stdc-predef.h> arrive with the predefined ones, but GCC read
+ * them from the header: their tokens are spelled in a system header. */
+static void ipp_predef_origin(Ipp *pp, IppSrc *s, const char *sysflags) {
+	ipp_src_load(pp, s);
+	for (const char *p = s->buf; p; p = strchr(p, '\n'), p = p ? p + 1 : NULL) {
+		p += strspn(p, " \t");
+		if (*p != '#') continue;
+		p += 1 + strspn(p + 1, " \t");
+		if (strncmp(p, "define", 6) != 0 || (p[6] != ' ' && p[6] != '\t')) continue;
+		p += 6 + strspn(p + 6, " \t");
+		const char *e = p;
+		while (pparse_ident_char[(unsigned char)*e]) e++;
+		IppSym *sym = ipp_sym_find(pp, p, (uint32_t)(e - p));
+		IppMacro *m = sym ? sym->macro : NULL;
+		for (uint32_t i = 0; m && i < m->nbody; i++)
+			if (m->body[i].flags & IPP_TF_BUILTIN)
+				m->body[i].flags = (uint8_t)((m->body[i].flags & ~IPP_TF_ORIGIN) | ipp_origin(sysflags));
+	}
 }
 
-static int pp_cache_clear(void) {
-	long n = 0;
-	const char *dir = pp_cache_dir();
-	if (!dir) {
-		fprintf(stderr, "prism: preprocessor cache is unavailable\n");
-		return 1;
+static void ipp_session(Ipp *pp) {
+	static const struct {
+		const char *name;
+		uint8_t special;
+	} specials[] = {
+	    {"defined", IPP_S_DEFINED},		 {"__has_include", IPP_S_HAS_INCLUDE},
+	    {"__has_include_next", IPP_S_HAS_INCLUDE_NEXT}, {"__has_embed", IPP_S_HAS_EMBED},
+	    {"__VA_ARGS__", IPP_S_VA_ARGS},	 {"__VA_OPT__", IPP_S_VA_OPT},
+	    {"_Pragma", IPP_S_PRAGMA},		 {"__FILE__", IPP_S_FILE},
+	    {"__LINE__", IPP_S_LINE},		 {"__COUNTER__", IPP_S_COUNTER},
+	    {"__INCLUDE_LEVEL__", IPP_S_INCLUDE_LEVEL}, {"__BASE_FILE__", IPP_S_BASE_FILE},
+	    {"__FILE_NAME__", IPP_S_FILE_NAME},
+	    /* Split so prism.c itself stays pp-cacheable (pp_text_has_time_macro). */
+	    {"__DA"
+	     "TE__",
+	     IPP_S_DATE},
+	    {"__TI"
+	     "ME__",
+	     IPP_S_TIME},
+	    {"__TIMES"
+	     "TAMP__",
+	     IPP_S_TIMESTAMP},
+	};
+	char cwd[PATH_MAX + 2];
+	struct stat st;
+	int dir;
+	const char *sysflags;
+	/* A mark taken on an empty arena would forget its first block. */
+	pparse_arena_alloc_uninit(&pp->scratch, 1);
+	pp->out_bol = true;
+	for (size_t i = 0; i < sizeof specials / sizeof *specials; i++)
+		ipp_sym_get(pp, specials[i].name, (uint32_t)strlen(specials[i].name))->special = specials[i].special;
+	for (size_t i = 0; i < sizeof ipp_query_names / sizeof *ipp_query_names; i++)
+		ipp_sym_get(pp, ipp_query_names[i], (uint32_t)strlen(ipp_query_names[i]))->special = IPP_S_QUERY;
+	ipp_run_directives(pp, pp->predefs, "<built-in>");
+	if (pp->cmdline) ipp_run_directives(pp, pp->cmdline, "<command-line>");
+
+	if (stat(pp->input, &st) != 0 || !S_ISREG(st.st_mode)) ipp_decline(pp, "input is not a regular file");
+	IppSrc *main_src = ipp_src_get(pp, pp->input, &st);
+	ipp_dep(pp, main_src);
+	ipp_marker(pp, 0, pp->input, "", "");
+	if (pp->working_dir && getcwd(cwd, PATH_MAX)) {
+		strcat(cwd, "//");
+		ipp_marker(pp, 1, cwd, "", "");
+	}
+	ipp_marker(pp, 0, "<built-in>", "", "");
+	ipp_marker(pp, 0, "<command-line>", "", "");
+	/* GCC enters <stdc-predef.h> before the first -include; its macros are
+	 * already among the predefined ones. */
+	IppSym *predef = ipp_sym_find(pp, "_STDC_PREDEF_H", 14);
+	IppSrc *s = predef && predef->macro ? ipp_find(pp, "stdc-predef.h", true, false, &dir, &sysflags) : NULL;
+	if (s) {
+		s->guard = "_STDC_PREDEF_H";
+		s->guard_len = 14;
+		ipp_dep(pp, s);
+		ipp_predef_origin(pp, s, sysflags);
+		ipp_marker(pp, 1, s->path, " 1", sysflags);
+		ipp_marker(pp, 0, "<command-line>", " 2", "");
+	}
+	for (int i = 0; i < pp->nforced; i++) {
+		const char *name = pp->forced[i];
+		char here[PATH_MAX];
+		/* -include looks in the working directory before the chain. */
+		s = NULL;
+		sysflags = "";
+		if (name[0] != '/' && pp_pathf(here, sizeof here, "./%s", name) && stat(here, &st) == 0 && !S_ISDIR(st.st_mode))
+			s = ipp_src_get(pp, here, &st);
+		if (!s) s = ipp_find(pp, name, false, false, &dir, &sysflags);
+		if (!s) ipp_decline(pp, "-include file not found");
+		ipp_push_file(pp, s, -1, sysflags, 0);
+		ipp_marker(pp, 1, s->path, " 1", sysflags);
+		ipp_run(pp);
+		ipp_marker(pp, 0, "<command-line>", " 2", "");
+	}
+	ipp_marker(pp, 1, pp->input, "", "");
+	ipp_push_file(pp, main_src, -2, "", 0);
+	ipp_run(pp);
+	if (!pp->out_bol) ipp_put(pp, "\n", 1);
+	pp->out[pp->out_len] = '\0';
+}
+
+/* Make-quoting as GCC writes it: `$` doubled, `#` escaped, and spaces escaped
+ * along with the backslashes before them. */
+static void ipp_dep_name(FILE *f, const char *name, bool quote, unsigned *col) {
+	size_t size = strlen(name);
+	while (name[0] == '.' && name[1] == '/') {
+		name += 2;
+		while (*name == '/') name++;
+		size = strlen(name);
+	}
+	if (quote)
+		for (const char *c = name; *c; c++) size += *c == '$' || *c == '#' || *c == ' ' || *c == '\t';
+	if (*col) {
+		if (*col + size > IPP_DEP_COLUMNS) {
+			fputs(" \\\n", f);
+			*col = 0;
+		}
+		(*col)++;
+		fputc(' ', f);
+	}
+	*col += (unsigned)size;
+	int slashes = 0;
+	for (const char *c = name; *c; c++) {
+		if (quote && *c == '\\')
+			slashes++;
+		else {
+			if (quote && (*c == ' ' || *c == '\t'))
+				for (size_t fill = (size_t)slashes + 1; fill--;) fputc('\\', f);
+			else if (quote && (*c == '$' || *c == '#'))
+				fputc(*c == '$' ? '$' : '\\', f);
+			slashes = 0;
+		}
+		fputc(*c, f);
 	}
-	pp_each_entry(pp_clear_cb, &n);
-	printf("prism: cleared %ld cached preprocessor %s from %s\n", n, n == 1 ? "entry" : "entries",
-	       dir);
-	return fflush(stdout) == 0 ? 0 : 1;
 }
 
-static int pp_cache_info(void) {
-	PPScan s;
-	const char *dir = pp_cache_dir();
-	if (!dir) {
-		fprintf(stderr, "prism: preprocessor cache is unavailable\n");
-		return 1;
-	}
-	memset(&s, 0, sizeof s);
-	pp_each_entry(pp_info_cb, &s);
-	int wrote = printf("prism preprocessor cache\n  dir      %s\n  entries  %d\n  size     %.1f MB\n"
-			   "  limits   %lld MB / %lld days  (PRISM_PP_CACHE_MAX_MB, PRISM_PP_CACHE_MAX_DAYS)\n"
-			   "  status   %s\n",
-			   dir, s.n, s.total / (1024.0 * 1024.0), pp_env_ll("PRISM_PP_CACHE_MAX_MB", 1024),
-			   pp_env_ll("PRISM_PP_CACHE_MAX_DAYS", 14),
-			   pp_cache_enabled() ? "enabled" : "disabled (PRISM_NO_PP_CACHE)");
-	return wrote < 0 || fflush(stdout) != 0 ? 1 : 0;
+static bool ipp_write_deps(Ipp *pp) {
+	char def[PATH_MAX];
+	unsigned col = 0;
+	if (!pp->deps) return true;
+	FILE *f = fopen(pp->dep_file, "w");
+	if (!f) return false;
+	if (!pp->ntargets) {
+		/* The default target is the object `cc -c` would write. */
+		const char *base = path_basename(pp->input), *dot = strrchr(base, '.');
+		snprintf(def, sizeof def, "%.*s.o", (int)(dot ? dot - base : (ptrdiff_t)strlen(base)), base);
+		ipp_dep_name(f, def, true, &col);
+	}
+	/* -MT targets come first, as GCC orders them. */
+	for (int pass = 0; pass < 2; pass++)
+		for (int i = 0; i < pp->ntargets; i++)
+			if ((pp->targets[i][0] == 'Q') == pass) ipp_dep_name(f, pp->targets[i] + 1, pass, &col);
+	fputc(':', f);
+	col++;
+	for (uint32_t i = 0; i < pp->ndeps; i++) ipp_dep_name(f, pp->depv[i], true, &col);
+	fputc('\n', f);
+	for (uint32_t i = 1; pp->deps_phony && i < pp->ndeps; i++) {
+		col = 0;
+		ipp_dep_name(f, pp->depv[i], true, &col);
+		fputs(":\n", f);
+	}
+	return fclose(f) == 0;
+}
+
+static void ipp_end_run(Ipp *pp) {
+	for (IppSrc *s = pp->loaded; s; s = s->loaded_next) free(s->buf);
+	ipp_arena_free(&pp->perm);
+	ipp_arena_free(&pp->scratch);
+	free(pp->out);
+	memset(&pp->perm, 0, sizeof *pp - offsetof(Ipp, perm));
+}
+
+static bool ipp_setup(Ipp *pp, char **argv, int argc) {
+	if (setjmp(pp->fail)) return false;
+	ipp_configure(pp, argv, argc);
+	return true;
+}
+
+static bool ipp_attempt(Ipp *pp) {
+	pp->unknown = 0;
+	if (setjmp(pp->fail)) return false;
+	ipp_session(pp);
+	return true;
 }
 
+/* Preprocesses the `cc -E` command `argv` in-process. Returns the output as
+ * `cc -E` would print it, or NULL with `*why` saying what was declined. */
+static char *ipp_preprocess(char **argv, int argc, const char **why) {
+	Ipp *pp = calloc(1, sizeof *pp);
+	char *out = NULL;
+	if (!pp) {
+		*why = "out of memory";
+		return NULL;
+	}
+	bool ok = ipp_setup(pp, argv, argc);
+	for (int round = 1; ok; round++) {
+		ok = ipp_attempt(pp);
+		/* A run that met new compiler queries assumed 0 for them, and may
+		 * have declined because of it: ask, and run again. */
+		if (!pp->unknown) break;
+		ipp_end_run(pp);
+		ok = round < IPP_MAX_ROUNDS && ipp_probe_queries(pp);
+		if (!ok) pp->why = "compiler queries";
+	}
+	if (ok && !ipp_write_deps(pp)) {
+		ok = false;
+		pp->why = "dependency file";
+	}
+	if (ok) {
+		out = pp->out;
+		pp->out = NULL;
+	}
+	*why = pp->why;
+	ipp_end_run(pp);
+	ipp_arena_free(&pp->cfg);
+	free(pp);
+	return out;
+}
+#endif // _WIN32
+
+/* Preprocesses `input_file` and returns its text with 8 bytes of NUL padding,
+ * or NULL. The caller owns the buffer, but it is not always heap memory: an
+ * unchunked pp-cache hit is a private mapping of the entry (pp_payload_map).
+ * Release it with pp_buf_free, never free() or realloc(), on the thread that
+ * made it, since the mapping table is per-thread. Handing it to the parse
+ * context as token_source hands that over too; the context releases it
+ * through PPARSE_FREE_SOURCE. The buffer stays inside Prism: the library
+ * API returns its output in a heap copy (PrismResult), so no mapping reaches
+ * a caller. */
 static char *preprocess_with_cc(const char *input_file) {
 	PRISM_STATE();
 	collect_source_defines(input_file);
@@ -5692,6 +10261,27 @@ static char *preprocess_with_cc(const char *input_file) {
 		}
 	}
 
+#ifndef _WIN32
+	if (prism_integrated_cpp) {
+		const char *why = NULL;
+		char *out = ipp_preprocess(argv, argc, &why);
+		if (prism_profile) fprintf(stderr, "[prism-prof] cpp=%s%s%s%s\n", out ? "integrated" : "external",
+					   out ? "" : " (", out ? "" : why ? why : "unknown", out ? "" : ")");
+		if (out) {
+			size_t len = strlen(out);
+			char *fitted = realloc(out, len + 8);
+			if (fitted) {
+				memset(fitted + len, 0, 8);
+				if (cacheable) pp_cache_store(&key, input_file, fitted, len, (char **)args, argc);
+			} else
+				free(out);
+			free(cc_dup);
+			free((void *)args);
+			return fitted;
+		}
+	}
+#endif
+
 	char *buf = NULL;
 	char *result = NULL;
 	int read_fd = -1;
@@ -6245,6 +10835,8 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 
 	int next_func_idx = 0;
 	PParseToken *pending_unreachable_tok = NULL;
+	uint32_t p2_steps = 0, p2_plain = 0;
+	const uint32_t first_idx = pparse_idx(_pc, tok);
 #undef pparse_feat
 #define pparse_feat(f) (feat & (f))
 #ifdef PRISM_DEBUG
@@ -6259,6 +10851,7 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 				  "internal: Pass 2 progress watchdog tripped "
 				  "(possible non-termination); please report");
 #endif
+		p2_steps++;
 		/* Precomputed system-include predicate avoids a per-token cold-file lookup. */
 		if (!flatten && (tok->flags & PPARSE_TF_SYS_SKIP)) {
 			if (next_func_idx < func_meta_count &&
@@ -6345,7 +10938,10 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 		if (tag & PPARSE_TT_NORETURN_FN) {
 			uint32_t ti = pparse_idx(_pc, tok);
 			if (!(pparse_token_pool[ti - 1].tag & PPARSE_TT_MEMBER)) {
-				if (has_defer && has_active_defers() && !quiet)
+				if (has_defer && has_active_defers() && !quiet) {
+					/* Counted like pparse_warn_tok's, so the output cache
+					 * does not keep a run whose replay would be silent. */
+					_pc->warnings++;
 					fprintf(
 					    stderr,
 					    "%s:%d: warning: '%.*s' referenced with active defers (defers "
@@ -6354,6 +10950,7 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 					    pparse_tok_line_no(tok),
 					    tok->len,
 					    pparse_loc(_pc, tok));
+				}
 				if (auto_unreachable && _ps->raw_block_depth == 0 &&
 				    emit_block_depth > 0 && !in_ctrl_paren() &&
 				    !(ctrl_state.pending && ctrl_state.parens_just_closed)) {
@@ -6390,6 +10987,16 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 					if (has_defer && next_func_idx < func_meta_count &&
 					    func_meta[next_func_idx].body_open == tok)
 						current_func_idx = next_func_idx++;
+					if (pparse_scope_tree[(uint16_t)tok->parse_data].is_plain && !ctrl_state.pending) {
+						PParseToken *close = pparse_pair_known(tok);
+						while (next_func_idx < func_meta_count &&
+						       func_meta[next_func_idx].body_open < close)
+							next_func_idx++;
+						p2_plain++;
+						tok = emit_plain_body(tok);
+						current_func_idx = -1;
+						continue;
+					}
 				}
 				tok = handle_open_brace(tok);
 				continue;
@@ -6443,6 +11050,26 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 	}
 #undef pparse_feat
 #define pparse_feat(f) (_pc->features & (f))
+	if (prism_profile) {
+		uint32_t total = pparse_idx(_pc, tok) - first_idx, system = 0;
+		for (uint32_t i = first_idx; i < first_idx + total; i++)
+			system += (pparse_token_pool[i].flags & PPARSE_TF_SYS_SKIP) != 0;
+		fprintf(stderr, "[prism-prof] tokens=%u names=%u system=%u pass1=%u pass2=%u plain=%u\n", total,
+			_pc->name_count, system, total - _pc->p1_restored, p2_steps, p2_plain);
+		/* Full-array sweeps: the token bytes each phase went through, over
+		 * the array's. CFG reads Pass 1 entries and is not counted. */
+		const double mb = 1024.0 * 1024.0, tb = sizeof(PParseToken);
+		double p2_bytes = (double)p2_steps * tb, swept = p2_bytes;
+		for (int i = 0; i < PPARSE_PHASE_CFG; i++) swept += (double)_pc->phase_bytes[i];
+		fprintf(stderr,
+			"[prism-prof] sweeps=%.2f scopes=%.3fms/%.1fMB prescan=%.3fms/%.1fMB "
+			"finalize=%.3fms/%.1fMB cfg=%.3fms/%.1fMB pass2=%.1fMB\n",
+			total ? swept / ((double)total * tb) : 0.0, _pc->phase_ms[PPARSE_PHASE_SCOPES],
+			_pc->phase_bytes[PPARSE_PHASE_SCOPES] / mb, _pc->phase_ms[PPARSE_PHASE_PRESCAN],
+			_pc->phase_bytes[PPARSE_PHASE_PRESCAN] / mb, _pc->phase_ms[PPARSE_PHASE_FINALIZE],
+			_pc->phase_bytes[PPARSE_PHASE_FINALIZE] / mb, _pc->phase_ms[PPARSE_PHASE_CFG],
+			_pc->phase_bytes[PPARSE_PHASE_CFG] / mb, p2_bytes / mb);
+	}
 
 	bool output_ok = out_close();
 	_pc->features = input_feat;
@@ -6451,11 +11078,31 @@ static PRISM_HOT bool transpile_tokens(PParseToken *tok, FILE *fp) {
 	return output_ok;
 }
 
-static PParseToken *preprocess_and_tokenize(char *input_file, double *pp_ms, double *tok_ms) {
+/* transpile_tokens, recording the emission when `oc` says it may be kept. A
+ * replay could not repeat warnings, so a run that printed any is not kept. */
+static bool transpile_tokens_recorded(PParseToken *tok, FILE *fp, const OutCacheProbe *oc) {
+	PPARSE_CTX();
+	uint32_t warnings = _pc->warnings;
+	out_capture_len = 0;
+	out_capturing = oc->keyed;
+	bool ok = transpile_tokens(tok, fp);
+	if (ok && out_capturing && _pc->warnings == warnings) out_cache_store(&oc->key, out_capture, out_capture_len);
+	out_capturing = false;
+	free(out_capture);
+	out_capture = NULL;
+	out_capture_cap = out_capture_len = 0;
+	return ok;
+}
+
+/* On an output-cache hit this returns NULL with the recorded C in `*hit`;
+ * otherwise the tokens, or NULL (and no hit) after reporting a failure. */
+static PParseToken *preprocess_and_tokenize(char *input_file, double *pp_ms, double *tok_ms, OutCacheProbe *oc,
+					    char **hit, size_t *hit_len) {
 	double t0 = prism_now_ms();
 	char *pp_buf = preprocess_with_cc(input_file);
 	double t1 = prism_now_ms();
 	*pp_ms = t1 - t0;
+	*hit = NULL;
 	if (!pp_buf) {
 		if (prism_spawn_refused)
 			fprintf(stderr,
@@ -6467,26 +11114,35 @@ static PParseToken *preprocess_and_tokenize(char *input_file, double *pp_ms, dou
 		return NULL;
 	}
 	double t2 = prism_now_ms();
+	*hit = out_cache_begin(oc, input_file, pp_buf, hit_len);
+	if (*hit) {
+		pp_buf_free(pp_buf);
+		free_source_defines();
+		*tok_ms = prism_now_ms() - t2;
+		return NULL;
+	}
 	/* `cc -E` (or a `.i` input) already completed translation phases 1-3. */
 	pparse_ctx->input_preprocessed = true;
-	PParseToken *tok = pparse_tokenize_buffer(input_file, pp_buf);
+	PParseToken *tok = tokenize_cached(input_file, pp_buf);
 	double t3 = prism_now_ms();
 	*tok_ms = t3 - t2;
 	return tok;
 }
 
 static int transpile_to_fp(char *input_file, FILE *fp) {
-	pparse_ensure_keyword_cache();
 	double t0 = prism_now_ms();
 	double pp_ms = 0.0, tok_ms = 0.0;
-	PParseToken *tok = preprocess_and_tokenize(input_file, &pp_ms, &tok_ms);
-	if (!tok) {
+	OutCacheProbe oc;
+	char *hit;
+	size_t hit_len = 0;
+	PParseToken *tok = preprocess_and_tokenize(input_file, &pp_ms, &tok_ms, &oc, &hit, &hit_len);
+	if (!tok && !hit) {
 		fclose(fp);
 		return 0;
 	}
 
 	double t1 = prism_now_ms();
-	int ok = transpile_tokens(tok, fp);
+	int ok = hit ? out_cache_replay(fp, hit, hit_len) : transpile_tokens_recorded(tok, fp, &oc);
 	double t2 = prism_now_ms();
 	if (prism_profile) {
 		fprintf(stderr,
@@ -6714,6 +11370,7 @@ PRISM_API void prism_reset(void) {
 	emit_scope_depth = emit_block_depth = 0;
 	_ps->aggregate_member_nest = 0;
 	system_includes_reset();
+	pp_stat_memo_reset();
 	in_defer_emit = false;
 	ctrl_reset();
 	ctrl_save_depth = 0;
@@ -6823,6 +11480,7 @@ PRISM_API void prism_thread_cleanup(void) {
 	_ps->active_membuf = NULL;
 	_ps->active_memlen = 0;
 	free_source_defines();
+	p1_prefix_forget();
 	if (!pparse_ctx) return;
 	out_buf_pos = 0;
 	system_include_list = NULL;
@@ -6989,7 +11647,6 @@ static void prism_transpile_file_into(PrismResult *result, const char *input_fil
 #endif
 
 	apply_features(features);
-	pparse_ensure_keyword_cache();
 	PParseToken *tok;
 	char *pp_buf = preprocess_with_cc((char *)input_file);
 	if (!pp_buf) {
@@ -7011,7 +11668,7 @@ static void prism_transpile_file_into(PrismResult *result, const char *input_fil
 	pparse_ctx->token_source = pp_buf;
 	/* `cc -E` (or a `.i` input) already completed translation phases 1-3. */
 	pparse_ctx->input_preprocessed = true;
-	tok = pparse_tokenize_buffer((char *)input_file, pp_buf);
+	tok = tokenize_cached((char *)input_file, pp_buf);
 
 	*result = transpile_to_result(tok);
 
@@ -7054,7 +11711,6 @@ static void prism_transpile_source_into(PrismResult *result, const char *source,
 		return;
 	}
 	apply_features(features);
-	pparse_ensure_keyword_cache();
 	PParseToken *tok;
 	char *buf;
 	size_t src_len = strlen(source);
@@ -7115,6 +11771,12 @@ static bool is_cxx_input_ext(const char *path) {
 	static const char *const exts[] = {".cpp", ".cc", ".cxx", ".C", ".mm"};
 	return has_any_ext(path, exts, sizeof(exts) / sizeof(*exts));
 }
+
+/* Passthrough inputs the backend compiles as translation units of their own. */
+static bool is_unit_input_ext(const char *path) {
+	static const char *const exts[] = {".cpp", ".cc", ".cxx", ".C", ".mm", ".m", ".s", ".S"};
+	return has_any_ext(path, exts, sizeof(exts) / sizeof(*exts));
+}
 #endif
 
 /* Args that must not be fed to `cc -E` of a Prism .c/.i unit: other TUs and
@@ -7634,6 +12296,8 @@ static bool cli_apply_feature_flag(Cli *cli, const char *name, bool on) {
 	    {"auto-static", FEATURE_OFFSET(auto_static), false},
 	    {"bounds-check", FEATURE_OFFSET(bounds_check), false},
 	    {"link-pragma", offsetof(Cli, no_link_pragma), true},
+	    {"integrated-cpp", offsetof(Cli, integrated_cpp), false},
+	    {"object-cache", offsetof(Cli, object_cache), false},
 	};
 #undef FEATURE_OFFSET
 	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
@@ -7815,6 +12479,9 @@ static Cli cli_parse(int argc, char **argv) {
 			 * translation unit involved and nothing later in argv matters. */
 			if (!strcmp(a, "--prism-cache-clear")) exit(pp_cache_clear());
 			if (!strcmp(a, "--prism-cache-info")) exit(pp_cache_info());
+#ifndef PRISM_LIB_MODE
+			if (!strcmp(a, "--prism-server")) exit(server_run());
+#endif
 			if (!strcmp(a, "--prism-verify")) {
 				cli.verify = true;
 				continue;
@@ -7838,6 +12505,23 @@ static Cli cli_parse(int argc, char **argv) {
 			cli.assemble_only = true;
 		} else if (cli_short_flag(a, 'E')) {
 			cli.passthrough = true;
+		} else if ((a[1] == 'j') & (!a[2] | ((unsigned)(a[2] - '0') < 10u))) {
+			/* -j N / -jN: consumed here; no backend driver takes -j. */
+			const char *n = a + 2;
+			if (!*n && i + 1 < argc) {
+				int rr = cli_rsp_expand_following(&argv, &queued_depth, &argc, &argv_cap,
+								      i + 1, &owned, &owned_count, &owned_cap);
+				if (rr < 0) goto rsp_fail;
+				if (i + 1 < argc) n = argv[++i];
+			}
+			char *end = NULL;
+			long jobs = strtol(n, &end, 10);
+			if (!*n || *end || jobs < 1 || jobs > 4096) {
+				fprintf(stderr, "pparse_error: -j expects a positive job count, got '%s'\n", n);
+				goto rsp_fail;
+			}
+			cli.jobs = (int)jobs;
+			continue;
 		} else if ((strcmp(a, "-M") == 0) | (strcmp(a, "-MM") == 0)) {
 			/* Like -E: preprocess-only. Must not transpile via stdin `-`
 			 * (backend would emit `-.o:` as the dep target). */
@@ -7935,7 +12619,8 @@ static void cli_free(Cli *cli) {
 
 #ifndef PRISM_LIB_MODE
 
-static int transpile_and_compile(char *input_file, char **compile_argv, bool verbose) {
+/* `obj_out`, when set, is the object a -c compile writes; see -fobject-cache. */
+static int transpile_and_compile(char *input_file, char **compile_argv, bool verbose, const char *obj_out) {
 	if (verbose) {
 		fprintf(stderr, "[prism] ");
 		for (int i = 0; compile_argv[i]; i++) fprintf(stderr, "%s ", compile_argv[i]);
@@ -7991,12 +12676,45 @@ static int transpile_and_compile(char *input_file, char **compile_argv, bool ver
 
 	double t0 = prism_now_ms();
 	double pp_ms = 0.0, tok_ms = 0.0;
-	PParseToken *tok = preprocess_and_tokenize(input_file, &pp_ms, &tok_ms);
-	if (!tok) return -1;
+	OutCacheProbe oc;
+	char *hit;
+	size_t hit_len = 0;
+	PParseToken *tok = preprocess_and_tokenize(input_file, &pp_ms, &tok_ms, &oc, &hit, &hit_len);
+	if (!tok && !hit) return -1;
+	PPKey obj_key;
+	FILE *obj_err = NULL;
+	char **spawn_argv = NULL;
+	if (obj_out && obj_cache_argv_ok(compile_argv)) {
+		/* The key needs the whole emission up front, so it is
+		 * materialized instead of streamed into the backend. */
+		if (!hit) {
+			FILE *mem = open_memstream(&hit, &hit_len);
+			if (!mem) {
+				pparse_tokenizer_teardown(false);
+				return -1;
+			}
+			if (!transpile_tokens_recorded(tok, mem, &oc)) {
+				free(hit);
+				return -1;
+			}
+		}
+		if (obj_cache_key(&obj_key, compile_argv, hit, hit_len)) {
+			if (obj_cache_fetch(&obj_key, obj_out)) {
+				free(hit);
+				return 0;
+			}
+			spawn_argv = obj_cache_spawn_argv(compile_argv);
+			obj_err = spawn_argv ? tmpfile() : NULL;
+		}
+	}
 	int pipefd[2];
 	if (pipe(pipefd) == -1) {
 		perror("pipe");
-		pparse_tokenizer_teardown(false);
+		if (obj_err) fclose(obj_err);
+		free(spawn_argv);
+		if (hit) free(hit);
+		else
+			pparse_tokenizer_teardown(false);
 		return -1;
 	}
 
@@ -8005,32 +12723,44 @@ static int transpile_and_compile(char *input_file, char **compile_argv, bool ver
 	posix_spawn_file_actions_addclose(&fa, pipefd[1]);
 	posix_spawn_file_actions_adddup2(&fa, pipefd[0], STDIN_FILENO);
 	posix_spawn_file_actions_addclose(&fa, pipefd[0]);
+	if (obj_err) {
+		posix_spawn_file_actions_adddup2(&fa, fileno(obj_err), STDERR_FILENO);
+		posix_spawn_file_actions_addclose(&fa, fileno(obj_err));
+	}
 	char **env = build_clean_environ();
 	pid_t pid;
-	int err = env ? prism_spawn_retry(&pid, compile_argv[0], &fa, compile_argv, env) : ENOMEM;
+	int err = env ? prism_spawn_retry(&pid, compile_argv[0], &fa, obj_err ? spawn_argv : compile_argv, env) : ENOMEM;
 	free(env);
+	free(spawn_argv);
 	posix_spawn_file_actions_destroy(&fa);
 	close(pipefd[0]);
 	if (err) {
 		fprintf(stderr, "posix_spawnp: %s: %s\n", compile_argv[0], strerror(err));
 		close(pipefd[1]);
-		pparse_tokenizer_teardown(false);
+		if (obj_err) fclose(obj_err);
+		if (hit) free(hit);
+		else
+			pparse_tokenizer_teardown(false);
 		return -1;
 	}
 
 	FILE *fp = fdopen(pipefd[1], "w");
 	if (!fp) {
 		close(pipefd[1]);
-		pparse_tokenizer_teardown(false);
+		if (hit) free(hit);
+		else
+			pparse_tokenizer_teardown(false);
 		waitpid(pid, NULL, 0);
+		if (obj_err) obj_cache_finish(&obj_key, obj_err, -1, obj_out);
 		return -1;
 	}
 
 	double t1 = prism_now_ms();
-	int output_ok = transpile_tokens(tok, fp);
+	int output_ok = hit ? out_cache_replay(fp, hit, hit_len) : transpile_tokens_recorded(tok, fp, &oc);
 	double t2 = prism_now_ms();
 	int rc = wait_for_child(pid);
 	double t3 = prism_now_ms();
+	if (obj_err) obj_cache_finish(&obj_key, obj_err, output_ok ? rc : -1, obj_out);
 	if (prism_profile) {
 		fprintf(stderr,
 			"[prism-prof] file=%s preprocess=%.3fms pparse_tokenize=%.3fms "
@@ -8052,34 +12782,6 @@ static noreturn void die(char *message) {
 }
 
 #ifndef _WIN32
-static bool get_self_exe_path(char *buf) {
-#if defined(__APPLE__)
-	uint32_t sz = PATH_MAX;
-	if (_NSGetExecutablePath(buf, &sz) == 0) {
-		char temp[PATH_MAX];
-		if (realpath(buf, temp)) {
-			strncpy(buf, temp, PATH_MAX - 1);
-			buf[PATH_MAX - 1] = '\0';
-		}
-		return true;
-	}
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-	int mib[] = {CTL_KERN, KERN_PROC, KERN_PROC_PATHNAME, -1};
-	size_t len = PATH_MAX;
-	if (sysctl(mib, 4, buf, &len, NULL, 0) == 0) return true;
-#else
-	const char *links[] = {"/proc/self/exe", "/proc/curproc/exe", "/proc/self/path/a.out"};
-	for (int i = 0; i < 3; i++) {
-		ssize_t len = readlink(links[i], buf, PATH_MAX - 1);
-		if (len > 0) {
-			buf[len] = '\0';
-			return true;
-		}
-	}
-#endif
-	return false;
-}
-
 static const char *get_install_path(void) {
 	const char *prefix = getenv("PREFIX");
 	if (prefix && *prefix) {
@@ -8368,7 +13070,66 @@ static char *compiler_from_env(const char *name) {
 	return cc;
 }
 
-static int capture_first_line(char **argv, char *buf);
+static int capture_all_output(char **argv, char *buf, size_t bufsize);
+
+typedef struct {
+	char kind[8];	   // "clang", "gcc", "msvc" or "other"
+	char version[256]; // first line of `--version`; empty for MSVC
+} CCProfile;
+
+/* Family and version of `cc`, from its compiler-profile record when one
+ * exists and from one `--version` spawn otherwise. The last answer is also
+ * kept in memory: a build asks about the same compiler several times. */
+static const CCProfile *cc_profile(const char *cc) {
+	static PRISM_THREAD_LOCAL CCProfile memo;
+	static PRISM_THREAD_LOCAL char memo_cc[PATH_MAX];
+	if (memo.kind[0] && strcmp(memo_cc, cc) == 0) return &memo;
+	CCProfile p = {0};
+	char exe[PATH_MAX], ver[256];
+	char *probe_argv[] = {exe, "--version", NULL};
+	PPKey key;
+	bool keyed = false;
+	char *rec = NULL;
+	snprintf(exe, sizeof exe, "%s", cc_executable(cc));
+	if (cc_is_msvc(cc)) {
+		/* cl.exe has no --version; the name already decides the family. */
+		snprintf(p.kind, sizeof p.kind, "msvc");
+	} else {
+		keyed = cc_record_key(&key, "profile", probe_argv, 2);
+		rec = keyed ? cc_record_load(&key) : NULL;
+		if (rec) {
+			char *nl = strchr(rec, '\n');
+			if (nl && !strncmp(rec, "kind ", 5) && !strncmp(nl + 1, "version ", 8)) {
+				snprintf(p.kind, sizeof p.kind, "%.*s", (int)(nl - rec - 5), rec + 5);
+				snprintf(p.version, sizeof p.version, "%s", nl + 9);
+				p.version[strcspn(p.version, "\r\n")] = '\0';
+			}
+			free(rec);
+		}
+	}
+	if (!p.kind[0]) {
+		/* Distro GCC calls itself `cc (Debian 12.2.0-14) 12.2.0`; only the
+		 * copyright line that follows names it reliably. */
+		bool probed = capture_all_output(probe_argv, ver, sizeof ver) == 0;
+		if (!probed) ver[0] = '\0';
+		snprintf(p.version, sizeof p.version, "%.*s", (int)strcspn(ver, "\r\n"), ver);
+		for (char *q = ver; *q; q++) *q = (char)tolower((unsigned char)*q);
+		snprintf(p.kind, sizeof p.kind, "%s",
+			 strstr(ver, "clang")		       ? "clang"
+			 : strstr(ver, "free software foundation") ? "gcc"
+			 : strstr(ver, "gcc")			   ? "gcc"
+								   : "other");
+		/* A failed spawn may be transient; do not make it permanent. */
+		if (keyed & probed) {
+			char body[320];
+			snprintf(body, sizeof body, "kind %s\nversion %s\n", p.kind, p.version);
+			cc_record_store(&key, body);
+		}
+	}
+	memo = p;
+	snprintf(memo_cc, sizeof memo_cc, "%s", cc);
+	return &memo;
+}
 
 static bool cc_is_clang(const char *cc) {
 #ifdef __APPLE__
@@ -8377,72 +13138,14 @@ static bool cc_is_clang(const char *cc) {
 	const char *exe = cc_executable(cc);
 	const char *base = path_basename(exe);
 	if (strncmp(base, "clang", 5) == 0) return true;
-	char ver[256];
-	char *probe_argv[] = {(char *)exe, "--version", NULL};
-	if (capture_first_line(probe_argv, ver) == 0) {
-		for (char *p = ver; *p; p++) *p = (char)tolower((unsigned char)*p);
-		if (strstr(ver, "clang")) return true;
-	}
-	return false;
-}
-
-#ifndef _WIN32
-static ssize_t spawn_capture_stdout(char **argv, char *buf, size_t bufsize) {
-	int pipefd[2];
-	if (pipe(pipefd) != 0) return -1;
-	char **env = build_clean_environ();
-	if (!env) {
-		close(pipefd[0]);
-		close(pipefd[1]);
-		return -1;
-	}
-	posix_spawn_file_actions_t actions;
-	posix_spawn_file_actions_init(&actions);
-	posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
-	posix_spawn_file_actions_addclose(&actions, pipefd[0]);
-	int devnull = open("/dev/null", O_WRONLY);
-	if (devnull >= 0) {
-		posix_spawn_file_actions_adddup2(&actions, devnull, STDERR_FILENO);
-		posix_spawn_file_actions_addclose(&actions, devnull);
-	}
-	pid_t pid;
-	int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, env);
-	free(env);
-	posix_spawn_file_actions_destroy(&actions);
-	close(pipefd[1]);
-	if (devnull >= 0) close(devnull);
-	if (err) {
-		close(pipefd[0]);
-		buf[0] = '\0';
-		return -1;
-	}
-	size_t total = 0;
-	while (total + 1 < bufsize) {
-		ssize_t n = read(pipefd[0], buf + total, bufsize - 1 - total);
-		if (n < 0) {
-			if (errno == EINTR) continue;
-			break;
-		}
-		if (n == 0) break;
-		total += (size_t)n;
-	}
-	close(pipefd[0]);
-	waitpid(pid, NULL, 0);
-	buf[total] = '\0';
-	return (ssize_t)total;
+	return strcmp(cc_profile(cc)->kind, "clang") == 0;
 }
 
-static int capture_first_line(char **argv, char *buf) {
-	ssize_t n = spawn_capture_stdout(argv, buf, 256);
-	if (n <= 0) {
-		buf[0] = '\0';
-		return -1;
-	}
-	char *nl = strchr(buf, '\n');
-	if (nl) *nl = '\0';
-	return 0;
+static bool cc_colors_diagnostics(const char *cc) {
+	return cc_is_clang(cc) || strcmp(cc_profile(cc)->kind, "gcc") == 0;
 }
 
+#ifndef _WIN32
 static int capture_all_output(char **argv, char *buf, size_t bufsize) {
 	ssize_t n = spawn_capture_stdout(argv, buf, bufsize);
 	return -(n <= 0);
@@ -8477,14 +13180,21 @@ static PRISM_COLD void print_help(void) {
 	       "local, static and file-scope array subscripts\n"
 	       "  -fno-link-pragma       Ignore #pragma link directives in source\n"
 	       "  (each -fno-X above also accepts -fX to re-enable it)\n"
+	       "  -fintegrated-cpp       Preprocess in-process instead of spawning `cc -E`\n"
+	       "                         (GCC only; anything unmodelled falls back to cc -E)\n"
+	       "  -fobject-cache         With -c, reuse the object of an unchanged compile\n"
 	       "  --prism-cc=<compiler>  Use specific compiler\n"
 	       "  --prism-verbose        Show commands\n"
 	       "  --prism-prof           Print per-phase timing breakdown\n"
+	       "  -j <N>                 Transpile/compile up to N sources at once\n"
+	       "                         (default: PRISM_JOBS, else the core count)\n"
 	       "  --prism-verify         Translation validation: re-transpile emitted C,\n"
 	       "                         require a fixed point (also: PRISM_VERIFY env)\n"
 	       "  --prism-cache-info     Show the preprocessor cache location and size\n"
 	       "  --prism-cache-clear    Delete all cached preprocessor output\n"
 	       "  --prism-emit[=<file>]  Write transpiled C to stdout, or to <file>\n"
+	       "  --prism-server         Run a compile server; other prism invocations hand\n"
+	       "                         their work to it (off: PRISM_NO_SERVER=1)\n"
 	       "  --                     Separator: remaining args are passed to the "
 	       "binary in `run` mode\n\n"
 	       "All other flags are passed through to CC.\n\n"
@@ -8549,6 +13259,7 @@ typedef struct {
 	bool compile_only;
 	bool optimize;
 	bool use_preprocessed;
+	bool drop_units; // per-unit compile: other passthrough inputs get their own
 } TempCompilePlan;
 
 static void cli_unit_output(char *out, const char *src, bool assemble_only, bool msvc) {
@@ -8647,11 +13358,20 @@ static int cc_backend_force_include_skip(const char **args, int i, int n) {
 	return 0;
 }
 
+/* cc_args[i] is a passthrough .cpp/.s/… input, not a flag or the operand of
+ * one (`-I dir.s` names a directory, not a unit). */
+static bool cli_cc_arg_is_unit(const Cli *cli, int i) {
+	const char *a = cli->cc_args[i];
+	if ((a[0] == '-') | !is_unit_input_ext(a)) return false;
+	return i == 0 || !cc_flag_takes_arg_nonnull(cli->cc_args[i - 1]);
+}
+
 static void argv_add_filtered_cc_args(const Cli *cli,
 				      const char **args,
 				      int *argc,
 				      bool skip_msvc_std,
-				      int x_flag_idx) {
+				      int x_flag_idx,
+				      bool drop_units) {
 	for (int i = 0; i < cli->cc_arg_count; i++) {
 		const char *arg = cli->cc_args[i];
 		if (i == x_flag_idx) {
@@ -8659,6 +13379,7 @@ static void argv_add_filtered_cc_args(const Cli *cli,
 			continue;
 		}
 		if (skip_msvc_std && !strncmp(arg, "/std:", 5)) continue;
+		if (drop_units && cli_cc_arg_is_unit(cli, i)) continue;
 		int fi_skip = cc_backend_force_include_skip(cli->cc_args, i, cli->cc_arg_count);
 		if (fi_skip) {
 			i += fi_skip - 1;
@@ -8747,13 +13468,13 @@ static void argv_add_cxx_stdlib(const char **args, int *argc, const char *compil
 	args[(*argc)++] = "-lstdc++";
 }
 
-static int run_temp_compile_plan(const Cli *cli, char **temps, int temp_count, const TempCompilePlan *plan) {
+static const char **temp_compile_argv(const Cli *cli, char **temps, int temp_count,
+				      const TempCompilePlan *plan, char **cc_dup) {
 	/* +2 per temp for repeated `-x c`, +4 for none/stdlib */
 	const char **args = alloc_argv(temp_count * 3 + cli->cc_arg_count +
 				      (int)strlen(plan->compiler) + 32);
 	int argc = 0;
-	char *cc_dup = NULL;
-	cc_split_into_argv(args, &argc, plan->compiler, &cc_dup);
+	cc_split_into_argv(args, &argc, plan->compiler, cc_dup);
 	if (plan->msvc) {
 		args[argc++] = "/nologo";
 		// Prism may emit typeof()/typeof_unqual() which require C23 mode on MSVC.
@@ -8780,7 +13501,7 @@ static int run_temp_compile_plan(const Cli *cli, char **temps, int temp_count, c
 		args[argc++] = "none";
 	}
 	/* Skip user's /std: flags on MSVC; /std:clatest is already present. */
-	argv_add_filtered_cc_args(cli, args, &argc, plan->msvc, -1);
+	argv_add_filtered_cc_args(cli, args, &argc, plan->msvc, -1, plan->drop_units);
 	add_warn_suppress(args, &argc, plan->clang, plan->msvc);
 	if (plan->msvc && plan->compile_only) args[argc++] = "/c";
 	argv_add_output(args, &argc, plan->output, plan->msvc, plan->compile_only);
@@ -8789,6 +13510,12 @@ static int run_temp_compile_plan(const Cli *cli, char **temps, int temp_count, c
 	if (force_c_temps & !plan->compile_only)
 		argv_add_cxx_stdlib(args, &argc, plan->compiler, plan->clang);
 	args[argc] = NULL;
+	return args;
+}
+
+static int run_temp_compile_plan(const Cli *cli, char **temps, int temp_count, const TempCompilePlan *plan) {
+	char *cc_dup = NULL;
+	const char **args = temp_compile_argv(cli, temps, temp_count, plan, &cc_dup);
 	if (cli->verbose) verbose_argv((char **)args);
 	int status = run_command((char **)args);
 	free(cc_dup);
@@ -8796,10 +13523,257 @@ static int run_temp_compile_plan(const Cli *cli, char **temps, int temp_count, c
 	return status;
 }
 
+/* A passthrough .cpp/.s/… unit under `-c`: the user's flags minus the other
+ * inputs. No `-x`, warning suppression or -fpreprocessed — it is not ours. */
+static const char **unit_compile_argv(const Cli *cli, const char *input, const TempCompilePlan *plan,
+				      char **cc_dup) {
+	const char **args = alloc_argv(cli->cc_arg_count + (int)strlen(plan->compiler) + 8);
+	int argc = 0;
+	cc_split_into_argv(args, &argc, plan->compiler, cc_dup);
+	if (plan->msvc) args[argc++] = "/nologo";
+	argv_add_filtered_cc_args(cli, args, &argc, false, -1, true);
+	if (plan->msvc) args[argc++] = "/c";
+	args[argc++] = input;
+	argv_add_output(args, &argc, plan->output, plan->msvc, true);
+	args[argc] = NULL;
+	return args;
+}
+
+static int cli_unit_input_count(const Cli *cli) {
+	int n = 0;
+	for (int i = 0; i < cli->cc_arg_count; i++) n += cli_cc_arg_is_unit(cli, i);
+	return n;
+}
+
+/* `cc -c a.c b.c x.cpp` writes a.o b.o x.o: one backend compile per unit,
+ * Prism sources first, then passthrough inputs, with up to `jobs` in flight.
+ * Children are reaped in that order, so the status returned belongs to the
+ * first failing unit no matter which child exits first, and nothing new
+ * starts after a failure — the same outcome as compiling one at a time.
+ * Argv is built right before each spawn: argv_add_output's MSVC flag lives
+ * in a static buffer. */
+static int compile_units(const Cli *cli, char **temps, const TempCompilePlan *base, int jobs) {
+	int total = cli->source_count + cli_unit_input_count(cli);
+	pid_t *pids = calloc((size_t)total, sizeof(*pids));
+	if (!pids) die("Out of memory");
+	int status = 0, started = 0, reaped = 0, next_arg = 0;
+	while (reaped < total) {
+		while ((status == 0) & (started < total) & (started - reaped < jobs)) {
+			const char *input = NULL;
+			if (started >= cli->source_count) {
+				while (!cli_cc_arg_is_unit(cli, next_arg)) next_arg++;
+				input = cli->cc_args[next_arg++];
+			}
+			char out[PATH_MAX];
+			cli_unit_output(out, input ? input : cli->sources[started], cli->assemble_only,
+					base->msvc);
+			TempCompilePlan plan = *base;
+			plan.output = out;
+			char *cc_dup = NULL;
+			const char **args = input ? unit_compile_argv(cli, input, &plan, &cc_dup)
+						  : temp_compile_argv(cli, &temps[started], 1, &plan, &cc_dup);
+			if (cli->verbose) verbose_argv((char **)args);
+			pids[started++] = spawn_command_start((char **)args, NULL);
+			free(cc_dup);
+			free((void *)args);
+		}
+		if (reaped == started) break;
+		pid_t pid = pids[reaped++];
+		int st = pid < 0 ? -1 : wait_for_child(pid);
+		if (status == 0) status = st;
+	}
+	free(pids);
+	return status;
+}
+
+/* Worker cap for multi-source builds: -j wins, then PRISM_JOBS, then the
+ * number of online cores. */
+static int cli_jobs(const Cli *cli) {
+	long long cores = 1;
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	cores = (long long)si.dwNumberOfProcessors;
+#else
+	cores = (long long)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	long long jobs = cli->jobs > 0 ? cli->jobs : pp_env_ll("PRISM_JOBS", cores);
+	return jobs < 1 ? 1 : jobs > 256 ? 256 : (int)jobs;
+}
+
+static bool transpile_source_to_temp(const Cli *cli, int i, const char *temp, int fd, bool use_lib_api) {
+	if (use_lib_api) {
+		PrismResult result = prism_transpile_file(cli->sources[i], cli->features);
+		if (result.status != PRISM_OK) {
+			fprintf(stderr,
+				"%s:%d:%d: pparse_error: %s\n",
+				cli->sources[i],
+				result.error_line,
+				result.error_col,
+				result.error_msg ? result.error_msg : "transpilation failed");
+			prism_free(&result);
+			close(fd);
+			return false;
+		}
+		FILE *f = fdopen(fd, "w");
+		if (!f) {
+			prism_free(&result);
+			close(fd);
+			return false;
+		}
+		bool wrote = fwrite(result.output, 1, result.output_len, f) == result.output_len;
+		if (fclose(f) != 0) wrote = false;
+		prism_free(&result);
+		return wrote;
+	}
+	if (cli->verbose) fprintf(stderr, "[prism] Transpiling %s -> %s\n", cli->sources[i], temp);
+	FILE *wfp = fdopen(fd, "w");
+	if (!wfp) {
+		close(fd);
+		die("Failed to open temp file");
+	}
+	if (!transpile_to_fp((char *)cli->sources[i], wfp)) return false;
+	if (prism_verify_mode & !prism_in_verify)
+		return verify_transpiled_output((char *)cli->sources[i], (char *)temp) != 0;
+	return true;
+}
+
+#ifndef _WIN32
+/* The running workers of transpile_sources_parallel, by source (0 = none).
+ * Each leads its own process group, which holds the `cc -E` it spawned, so
+ * signal_cleanup_handler passes a signal on to those groups. */
+static pid_t *volatile signal_workers;
+static volatile sig_atomic_t signal_worker_count;
+/* Set in a worker: a signal is passed on to its own process group. */
+static volatile sig_atomic_t signal_own_group;
+
+/* The CLI is built PRISM_SINGLE_THREAD and pparse_error exits, so a worker
+ * process (not a thread) is what isolates one source's parser state and its
+ * failure. Each worker's stderr lands in its own capture file; the parent
+ * replays those in source order and stops at the first failing source, so
+ * diagnostics read exactly like a serial build. */
+static bool transpile_sources_parallel(const Cli *cli, char **temps, int *fds, int jobs) {
+	int n = cli->source_count;
+	pid_t *pids = calloc((size_t)n, sizeof(*pids));
+	int *status = calloc((size_t)n, sizeof(*status));
+	FILE **logs = calloc((size_t)n, sizeof(*logs));
+	bool ok = pids && status && logs;
+	int next = 0, replayed = 0, running = 0;
+	fflush(stdout);
+	fflush(stderr);
+	signal_workers = pids;
+	signal_worker_count = pids ? n : 0;
+	while (ok && replayed < n) {
+		while (ok && (next < n) & (running < jobs)) {
+			pid_t pid = -1;
+			logs[next] = tmpfile();
+			if (logs[next]) pid = fork();
+			if (pid == 0) {
+				/* The build's temporaries are the parent's to remove; the
+				 * worker tracks only the pp-cache ones it opens. */
+				setpgid(0, 0);
+				signal_worker_count = 0;
+				signal_own_group = 1;
+				signal_temps_clear();
+				signal_temp_store(0);
+				dup2(fileno(logs[next]), STDERR_FILENO);
+				bool done = transpile_source_to_temp(cli, next, temps[next], fds[next], false);
+				fflush(stderr);
+				_exit(done ? 0 : 1);
+			}
+			if (pid < 0) {
+				/* Out of processes: drain what is running, then retry. With
+				 * nothing in flight every earlier source has been replayed, so
+				 * transpiling in-process keeps diagnostics in order. */
+				if (logs[next]) fclose(logs[next]);
+				logs[next] = NULL;
+				if (running) break;
+				ok = transpile_source_to_temp(cli, next, temps[next], fds[next], false);
+				fds[next] = -1;
+				pids[next++] = 0;
+				replayed++;
+				continue;
+			}
+			setpgid(pid, pid);
+			close(fds[next]);
+			fds[next] = -1;
+			pids[next++] = pid;
+			running++;
+		}
+		if (!ok | !running) continue;
+		int st = 0;
+		pid_t done = waitpid(-1, &st, 0);
+		if (done < 0) {
+			if (errno != EINTR) ok = false;
+			continue;
+		}
+		for (int i = replayed; i < next; i++) {
+			if (pids[i] != done) continue;
+			pids[i] = 0;
+			status[i] = st;
+			running--;
+			break;
+		}
+		while (ok && (replayed < next) && !pids[replayed]) {
+			FILE *log = logs[replayed];
+			char buf[4096];
+			size_t got;
+			rewind(log);
+			while ((got = fread(buf, 1, sizeof(buf), log)) > 0) fwrite(buf, 1, got, stderr);
+			fclose(log);
+			logs[replayed] = NULL;
+			st = status[replayed++];
+			ok = WIFEXITED(st) && WEXITSTATUS(st) == 0;
+			if (WIFSIGNALED(st))
+				fprintf(stderr, "prism: %s: worker killed by signal %d\n", cli->sources[replayed - 1],
+					WTERMSIG(st));
+		}
+	}
+	/* A later source failing never preempts an earlier one still running;
+	 * once the build is decided the remaining workers are not needed. */
+	for (int i = replayed; pids && i < next; i++) {
+		if (!pids[i]) continue;
+		kill(-pids[i], SIGTERM);
+		waitpid(pids[i], NULL, 0);
+		pids[i] = 0;
+	}
+	signal_worker_count = 0;
+	signal_workers = NULL;
+	for (int i = 0; logs && i < n; i++)
+		if (logs[i]) fclose(logs[i]);
+	if (!pids | !status | !logs) fprintf(stderr, "prism: out of memory\n");
+	free(pids);
+	free(status);
+	free(logs);
+	return ok;
+}
+#endif
+
 static char **transpile_sources_to_temps(const Cli *cli, bool use_lib_api) {
 	char **temps = calloc(cli->source_count, sizeof(char *));
 	if (!temps) die("Out of memory");
 	signal_temps_clear();
+#ifndef _WIN32
+	/* install (library API) stays serial: it builds prism itself, one TU. */
+	int jobs = use_lib_api ? 1 : cli_jobs(cli);
+	if ((jobs > 1) & (cli->source_count > 1)) {
+		int *fds = malloc(cli->source_count * sizeof(int));
+		if (!fds) die("Out of memory");
+		for (int i = 0; i < cli->source_count; i++) {
+			temps[i] = malloc(PATH_MAX);
+			if (!temps[i]) die("Out of memory");
+			fds[i] = make_temp_file_registered(temps[i], cli->sources[i]);
+			if (fds[i] < 0) die("Failed to create temp file");
+		}
+		bool ok = transpile_sources_parallel(cli, temps, fds, jobs);
+		for (int i = 0; i < cli->source_count; i++)
+			if (fds[i] >= 0) close(fds[i]);
+		free(fds);
+		if (ok) return temps;
+		cleanup_temp_range(temps, cli->source_count);
+		return NULL;
+	}
+#endif
 	for (int i = 0; i < cli->source_count; i++) {
 		/* A shorter buffer silently disables source-adjacent placement for
 		 * deeply nested paths even though the tmpdir fallback would fit. */
@@ -8807,52 +13781,9 @@ static char **transpile_sources_to_temps(const Cli *cli, bool use_lib_api) {
 		if (!temps[i]) die("Out of memory");
 		int fd = make_temp_file_registered(temps[i], cli->sources[i]);
 		if (fd < 0) die("Failed to create temp file");
-		if (use_lib_api) {
-			PrismResult result = prism_transpile_file(cli->sources[i], cli->features);
-			if (result.status != PRISM_OK) {
-				fprintf(stderr,
-					"%s:%d:%d: pparse_error: %s\n",
-					cli->sources[i],
-					result.error_line,
-					result.error_col,
-					result.error_msg ? result.error_msg : "transpilation failed");
-				prism_free(&result);
-				close(fd);
-				cleanup_temp_range(temps, i + 1);
-				return NULL;
-			}
-			FILE *f = fdopen(fd, "w");
-			if (!f) {
-				prism_free(&result);
-				close(fd);
-				cleanup_temp_range(temps, i + 1);
-				return NULL;
-			}
-			bool wrote = fwrite(result.output, 1, result.output_len, f) == result.output_len;
-			if (fclose(f) != 0) wrote = false;
-			prism_free(&result);
-			if (!wrote) {
-				cleanup_temp_range(temps, i + 1);
-				return NULL;
-			}
-		} else {
-			if (cli->verbose)
-				fprintf(stderr, "[prism] Transpiling %s -> %s\n", cli->sources[i], temps[i]);
-			FILE *wfp = fdopen(fd, "w");
-			if (!wfp) {
-				close(fd);
-				die("Failed to open temp file");
-			}
-			if (!transpile_to_fp((char *)cli->sources[i], wfp)) {
-				cleanup_temp_range(temps, i + 1);
-				return NULL;
-			}
-			if (prism_verify_mode & !prism_in_verify) {
-				if (!verify_transpiled_output((char *)cli->sources[i], temps[i])) {
-					cleanup_temp_range(temps, i + 1);
-					return NULL;
-				}
-			}
+		if (!transpile_source_to_temp(cli, i, temps[i], fd, use_lib_api)) {
+			cleanup_temp_range(temps, i + 1);
+			return NULL;
 		}
 	}
 	return temps;
@@ -9074,7 +14005,9 @@ static int compile_sources(Cli *cli) {
 			break;
 		}
 	}
-	if ((cli->source_count == 1) & !msvc & !save_temps) {
+	/* `-c a.c x.cpp` is two objects, not one pipe compile. */
+	int unit_inputs = cli->compile_only ? cli_unit_input_count(cli) : 0;
+	if ((cli->source_count == 1) & !msvc & !save_temps & !unit_inputs) {
 		/* Pipe language follows the `-x` that bound the Prism source
 		 * (GCC positional rules). Do NOT steal a later `-x c++` meant
 		 * for a passthrough .cpp — that used to compile C as C++. */
@@ -9115,7 +14048,7 @@ static int compile_sources(Cli *cli) {
 			args[argc++] = "-x";
 			args[argc++] = "none";
 		}
-		argv_add_filtered_cc_args(cli, args, &argc, false, x_flag_idx);
+		argv_add_filtered_cc_args(cli, args, &argc, false, x_flag_idx, false);
 		add_warn_suppress(args, &argc, clang, false);
 		argv_add_output(args, &argc, cli_output_path(cli, temp_exe, false), false, cli->compile_only);
 		/* Leading `-x c` makes g++ drop -lstdc++; restore when linking C++. */
@@ -9123,36 +14056,31 @@ static int compile_sources(Cli *cli) {
 			argv_add_cxx_stdlib(args, &argc, compiler, clang);
 		args[argc] = NULL;
 		if (cli->verbose) fprintf(stderr, "[prism] Transpiling %s (pipe → cc)\n", cli->sources[0]);
-		status = transpile_and_compile((char *)cli->sources[0], (char **)args, cli->verbose);
+		const char *obj_out = cli->compile_only && cli->object_cache && !need_x_none
+					  ? cli_output_path(cli, temp_exe, false)
+					  : NULL;
+		if (obj_out && !strcmp(obj_out, "-")) obj_out = NULL;
+		status = transpile_and_compile((char *)cli->sources[0], (char **)args, cli->verbose, obj_out);
 		free(cc_dup);
 		free((void *)args);
 	} else {
 		char **temps = transpile_sources_to_temps(cli, false);
 		if (!temps) die("Transpilation failed");
-		if (cli->compile_only & (cli->source_count > 1)) {
+		if (cli->compile_only & (cli->source_count + unit_inputs > 1)) {
 			if (cli->output) {
 				fprintf(stderr,
 					"pparse_error: cannot specify -o when generating multiple output files\n");
 				status = 1;
 			} else {
-				/* `cc -c a.c b.c` writes a.o b.o — not temp basenames. */
-				for (int i = 0; i < cli->source_count; i++) {
-					char out[PATH_MAX];
-					cli_unit_output(out, cli->sources[i], cli->assemble_only, msvc);
-					TempCompilePlan plan = {
-					    .compiler = compiler,
-					    .clang = clang,
-					    .msvc = msvc,
-					    .output = out,
-					    .compile_only = true,
-					    .use_preprocessed = use_linemarkers,
-					};
-					int st = run_temp_compile_plan(cli, &temps[i], 1, &plan);
-					if (st != 0) {
-						status = st;
-						break;
-					}
-				}
+				TempCompilePlan plan = {
+				    .compiler = compiler,
+				    .clang = clang,
+				    .msvc = msvc,
+				    .compile_only = true,
+				    .use_preprocessed = use_linemarkers,
+				    .drop_units = true,
+				};
+				status = compile_units(cli, temps, &plan, cli_jobs(cli));
 			}
 		} else {
 			TempCompilePlan plan = {
@@ -9213,14 +14141,380 @@ static void signal_cleanup_handler(int sig) {
 	for (int i = 0; i < n; i++)
 		if (signal_temps_ready_load(i) & (signal_temps[i][0] != '\0')) unlink(signal_temps[i]);
 	signal(sig, SIG_DFL);
+#ifndef _WIN32
+	pid_t *workers = signal_workers;
+	for (int i = 0; workers && i < signal_worker_count; i++)
+		if (workers[i] > 0) kill(-workers[i], sig);
+	if (signal_own_group) kill(0, sig);
+#endif
 	raise(sig);
 }
 
-int main(int argc, char **argv) {
-PRISM_STATE();
-#ifdef _WIN32
-	win32_utf8_argv(&argc, &argv);
+#ifndef _WIN32
+/* ---- compile server ---------------------------------------------------
+ *
+ * `prism --prism-server` listens on `server.sock` in the cache directory.
+ * Every other invocation first tries to connect there and, when something
+ * answers, hands over its argv, cwd, umask and environment together with its
+ * own stdin/stdout/stderr descriptors (SCM_RIGHTS), so output reaches the
+ * caller's terminal directly, then waits for the exit status. No answer, or a
+ * server built from another binary, means the invocation runs in-process as
+ * it always has: the caches key on the binary, so a stale server would serve
+ * entries the caller's build never wrote.
+ *
+ * Each request runs in a fork of the server. A request still exits through
+ * die()/pparse_error on failure, so it cannot share the server's address
+ * space; what it inherits instead is whatever the server warmed before it
+ * started listening: a grown token pool. Compiler probes are already
+ * persistent profile records. The cache directory is resolved again from the
+ * caller's environment. The request runs in its own process group, which gets
+ * the SIGINT or SIGTERM the caller receives. */
+#define PRISM_SERVER_MAGIC 0x50525332u /* "PRS2" */
+
+/* The header, sent with the caller's fds 0-2 attached. */
+typedef struct {
+	uint32_t magic, umask;
+	PPKey self; // server_identity of the sending binary
+} ServerHeader;
+
+static bool server_identity(PPKey *k) {
+	*k = (PPKey){0x6a09e667f3bcc908ULL, 0x3c6ef372fe94f82bULL};
+	ppk_feed_str(k, PRISM_VERSION);
+	return ppk_feed_self(k);
+}
+
+/* Composed only: a client probes for the socket on every invocation and must
+ * not create the cache directory doing so. */
+static bool server_socket_path(struct sockaddr_un *sa) {
+	char dir[PATH_MAX];
+	memset(sa, 0, sizeof *sa);
+	sa->sun_family = AF_UNIX;
+	return pp_cache_root(dir, sizeof dir) && pp_pathf(sa->sun_path, sizeof sa->sun_path, "%s/server.sock", dir);
+}
+
+static bool server_send_all(int fd, const void *p, size_t n) {
+	const char *c = (const char *)p;
+	while (n) {
+		ssize_t w = send(fd, c, n, MSG_NOSIGNAL);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return false;
+		c += w;
+		n -= (size_t)w;
+	}
+	return true;
+}
+
+static bool server_recv_all(int fd, void *p, size_t n) {
+	char *c = (char *)p;
+	while (n) {
+		ssize_t r = recv(fd, c, n, 0);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		c += r;
+		n -= (size_t)r;
+	}
+	return true;
+}
+
+/* A count, then each string as a length and its bytes. */
+static bool server_send_strs(int fd, char **v, int n) {
+	uint32_t count = (uint32_t)n;
+	if (!server_send_all(fd, &count, sizeof count)) return false;
+	for (int i = 0; i < n; i++) {
+		uint32_t len = (uint32_t)strlen(v[i]);
+		if (!server_send_all(fd, &len, sizeof len) || !server_send_all(fd, v[i], len)) return false;
+	}
+	return true;
+}
+
+/* NULL-terminated, each string its own allocation; never freed by the
+ * request child, which exits. */
+static char **server_recv_strs(int fd, int *n) {
+	uint32_t count = 0;
+	if (!server_recv_all(fd, &count, sizeof count) || count > (1u << 20)) return NULL;
+	char **v = calloc((size_t)count + 1, sizeof *v);
+	for (uint32_t i = 0; v && i < count; i++) {
+		uint32_t len = 0;
+		if (!server_recv_all(fd, &len, sizeof len) || len > (1u << 24)) return NULL;
+		v[i] = malloc((size_t)len + 1);
+		if (!v[i] || !server_recv_all(fd, v[i], len)) return NULL;
+		v[i][len] = '\0';
+	}
+	*n = (int)count;
+	return v;
+}
+
+static bool server_send_header(int fd, const ServerHeader *h) {
+	int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+	union {
+		char buf[CMSG_SPACE(sizeof fds)];
+		struct cmsghdr align;
+	} ctl;
+	struct iovec iov = {(void *)h, sizeof *h};
+	struct msghdr msg = {0};
+	memset(&ctl, 0, sizeof ctl);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof ctl.buf;
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof fds);
+	memcpy(CMSG_DATA(c), fds, sizeof fds);
+	return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof *h;
+}
+
+static bool server_recv_header(int fd, ServerHeader *h, int fds[3]) {
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct iovec iov = {h, sizeof *h};
+	struct msghdr msg = {0};
+	memset(&ctl, 0, sizeof ctl);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof ctl.buf;
+	if (recvmsg(fd, &msg, MSG_WAITALL) != (ssize_t)sizeof *h) return false;
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS ||
+	    c->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+		return false;
+	memcpy(fds, CMSG_DATA(c), 3 * sizeof(int));
+	return h->magic == PRISM_SERVER_MAGIC;
+}
+
+/* The socket lives in the per-user 0700 cache directory, but
+ * PRISM_PP_CACHE_DIR can point anywhere: server and client each deal only
+ * with their own user. */
+static bool server_peer_is_self(int fd) {
+#ifdef SO_PEERCRED
+	/* struct ucred, spelled out: <time.h> is included before _GNU_SOURCE. */
+	struct {
+		pid_t pid;
+		uid_t uid;
+		gid_t gid;
+	} cr;
+	socklen_t len = sizeof cr;
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) == 0 && cr.uid == getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+	return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static int prism_cli_main(int argc, char **argv);
+
+/* Waits for the request in `pid`, whose process group gets each signal number
+ * the caller relays on `cfd`, and SIGTERM if the caller goes away. `done` is
+ * the read end of a pipe only the request holds open, so it reads EOF once
+ * the request has exited. */
+static int server_watch(int cfd, int done, pid_t pid) {
+	struct pollfd p[2] = {{cfd, POLLIN, 0}, {done, POLLIN, 0}};
+	for (;;) {
+		if (poll(p, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (p[1].revents) break;
+		if (!p[0].revents) continue;
+		int32_t sig = 0;
+		if (!server_recv_all(cfd, &sig, sizeof sig)) {
+			kill(-pid, SIGTERM);
+			p[0].fd = -1;
+		} else if (sig == SIGINT || sig == SIGTERM) {
+			kill(-pid, sig);
+		}
+	}
+	return wait_for_child(pid);
+}
+
+/* One request: run it in a child on the caller's descriptors, then report
+ * how it exited. The child may leave through exit() anywhere, so only a
+ * parent can observe its status. A caller from another build is told so
+ * before anything runs, and runs the request itself. */
+static int server_session(int cfd, const PPKey *self) {
+	ServerHeader h = {0};
+	int fds[3] = {-1, -1, -1}, done[2] = {-1, -1};
+	int ncwd = 0, argc = 0, envc = 0;
+	char **cwd = NULL, **argv = NULL, **envp = NULL;
+	uint32_t accept = PRISM_SERVER_MAGIC;
+	if (!server_recv_header(cfd, &h, fds)) return 1;
+	if (h.self.a != self->a || h.self.b != self->b) accept = 0;
+	cwd = accept ? server_recv_strs(cfd, &ncwd) : NULL;
+	argv = cwd ? server_recv_strs(cfd, &argc) : NULL;
+	envp = argv ? server_recv_strs(cfd, &envc) : NULL;
+	if (!((ncwd == 1) & (argc > 0) && envp) || pipe(done) != 0) accept = 0;
+	int32_t status = 1;
+	if (server_send_all(cfd, &accept, sizeof accept) && accept) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(cfd);
+			close(done[0]);
+			fcntl(done[1], F_SETFD, FD_CLOEXEC);
+			setpgid(0, 0);
+			for (int i = 0; i < 3; i++) dup2(fds[i], i);
+			for (int i = 0; i < 3; i++)
+				if (fds[i] > 2) close(fds[i]);
+			if (chdir(cwd[0]) != 0) {
+				perror(cwd[0]);
+				_exit(1);
+			}
+			umask((mode_t)h.umask);
+			environ = envp;
+			pp_cache_dir_state = 0;
+			exit(prism_cli_main(argc, argv));
+		}
+		close(done[1]);
+		done[1] = -1;
+		if (pid > 0) {
+			setpgid(pid, pid);
+			status = server_watch(cfd, done[0], pid);
+		}
+		if (status < 0) status = 1;
+	}
+	for (int i = 0; i < 2; i++)
+		if (done[i] >= 0) close(done[i]);
+	for (int i = 0; i < 3; i++)
+		if (fds[i] >= 0) close(fds[i]);
+	server_send_all(cfd, &status, sizeof status);
+	close(cfd);
+	return 0;
+}
+
+static int server_run(void) {
+	struct sockaddr_un sa;
+	int lfd = -1, probe = -1;
+	if (!pp_cache_dir() || !server_socket_path(&sa)) {
+		fprintf(stderr, "prism: no usable socket path for the compile server\n");
+		return 1;
+	}
+	/* Never steal the socket from a server that still answers. */
+	probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe >= 0 && connect(probe, (struct sockaddr *)&sa, sizeof sa) == 0) {
+		fprintf(stderr, "prism: a compile server is already listening on %s\n", sa.sun_path);
+		close(probe);
+		return 1;
+	}
+	if (probe >= 0) close(probe);
+	unlink(sa.sun_path);
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	mode_t old_mask = umask(077);
+	bool bound = lfd >= 0 && bind(lfd, (struct sockaddr *)&sa, sizeof sa) == 0;
+	umask(old_mask);
+	if (!bound || listen(lfd, 64) != 0) {
+		perror("prism: compile server");
+		if (lfd >= 0) close(lfd);
+		return 1;
+	}
+	PPKey self;
+	if (!server_identity(&self)) {
+		fprintf(stderr, "prism: cannot identify this binary for the compile server\n");
+		close(lfd);
+		unlink(sa.sun_path);
+		return 1;
+	}
+	signal_temps_clear();
+	signal_temps_register(sa.sun_path);
+	pparse_token_pool_ensure(1u << 16);
+	fprintf(stderr, "prism: compile server listening on %s\n", sa.sun_path);
+	for (;;) {
+		while (waitpid(-1, NULL, WNOHANG) > 0) {}
+		int cfd = accept(lfd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno == EINTR) continue;
+			perror("prism: accept");
+			break;
+		}
+		if (!server_peer_is_self(cfd)) {
+			close(cfd);
+			continue;
+		}
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(lfd);
+			signal_temps_clear();
+			_exit(server_session(cfd, &self));
+		}
+		close(cfd);
+	}
+	close(lfd);
+	unlink(sa.sun_path);
+	return 1;
+}
+
+static volatile sig_atomic_t server_relay_fd = -1;
+
+/* Passes SIGINT/SIGTERM on to the request's process group; send(2) is
+ * async-signal-safe. */
+static void server_relay_signal(int sig) {
+	int32_t s = sig;
+	int saved = errno;
+	if (server_relay_fd >= 0) send(server_relay_fd, &s, sizeof s, MSG_NOSIGNAL);
+	errno = saved;
+}
+
+/* Hand this invocation to a running server. -1 when there is none, when it
+ * runs another build, or when the request could not be delivered whole, so
+ * the caller runs it in-process. */
+static int server_forward(int argc, char **argv) {
+	const char *off = getenv("PRISM_NO_SERVER");
+	struct sockaddr_un sa;
+	char cwd[PATH_MAX];
+	char *cwdv[1] = {cwd};
+	int envc = 0, fd = -1;
+	int32_t status = 1;
+	uint32_t accept = 0;
+	ServerHeader h = {PRISM_SERVER_MAGIC, 0, {0, 0}};
+	if ((off && *off && strcmp(off, "0") != 0) || !pp_cache_enabled()) return -1;
+	for (int i = 1; i < argc; i++)
+		if (!strcmp(argv[i], "--prism-server")) return -1;
+	if (!getcwd(cwd, sizeof cwd) || !server_socket_path(&sa)) return -1;
+	if (access(sa.sun_path, F_OK) != 0 || !server_identity(&h.self)) return -1;
+	h.umask = (uint32_t)umask(0);
+	umask((mode_t)h.umask);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	while (environ[envc]) envc++;
+	/* The socket's directory may be shared (PRISM_PP_CACHE_DIR): send the
+	 * environment and fds only to a server run by this user, and trust no
+	 * status from anyone else. */
+	if (connect(fd, (struct sockaddr *)&sa, sizeof sa) != 0 || !server_peer_is_self(fd) ||
+	    !server_send_header(fd, &h) ||
+	    !server_send_strs(fd, cwdv, 1) || !server_send_strs(fd, argv, argc) ||
+	    !server_send_strs(fd, environ, envc) || !server_recv_all(fd, &accept, sizeof accept) ||
+	    accept != PRISM_SERVER_MAGIC) {
+		close(fd);
+		return -1;
+	}
+	struct sigaction relay = {0}, old_int, old_term;
+	relay.sa_handler = server_relay_signal;
+	sigemptyset(&relay.sa_mask);
+	server_relay_fd = fd;
+	sigaction(SIGINT, &relay, &old_int);
+	sigaction(SIGTERM, &relay, &old_term);
+	if (!server_recv_all(fd, &status, sizeof status)) {
+		fprintf(stderr, "prism: compile server dropped the request\n");
+		status = 1;
+	}
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	server_relay_fd = -1;
+	close(fd);
+	return status;
+}
+#else
+static int server_run(void) {
+	fprintf(stderr, "prism: --prism-server is not supported on Windows\n");
+	return 1;
+}
 #endif
+
+static int prism_cli_main(int argc, char **argv) {
+	PRISM_STATE();
 	signal(SIGINT, signal_cleanup_handler);
 	signal(SIGTERM, signal_cleanup_handler);
 	signal(SIGPIPE,
@@ -9238,7 +14532,10 @@ PRISM_STATE();
 
 	Cli cli = cli_parse(argc, argv);
 	prism_profile = cli.profile;
+	prism_integrated_cpp = cli.integrated_cpp;
 	prism_verify_mode = cli.verify | (getenv("PRISM_VERIFY") != NULL);
+	/* A lone source has the workers to itself, for its tokenizer. */
+	lex_split_jobs = cli.source_count == 1 ? cli_jobs(&cli) : 1;
 	if (cli.action == CLI_ACT_HELP) {
 		print_help();
 		cli_free(&cli);
@@ -9342,4 +14639,16 @@ PRISM_STATE();
 	return status;
 }
 
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	win32_utf8_argv(&argc, &argv);
+#else
+	if (argc >= 2) {
+		int forwarded = server_forward(argc, argv);
+		if (forwarded >= 0) return forwarded;
+	}
+#endif
+	return prism_cli_main(argc, argv);
+}
+
 #endif // PRISM_LIB_MODE